@@ -23,6 +23,7 @@ CAxialAnalysisOptionsDlg::CAxialAnalysisOptionsDlg(MetaGraph *graph, QWidget *pa
 	setupUi(this);
 	m_radius = QString(tr(""));
 	m_choice = false;
+	m_exact_choice = false;
 	m_attribute = -1;
 	m_weighted = false;
 	m_rra = false;
@@ -35,6 +36,7 @@ CAxialAnalysisOptionsDlg::CAxialAnalysisOptionsDlg(MetaGraph *graph, QWidget *pa
 		if (mainWin)
 		{
 			m_choice = mainWin->m_options.choice;
+			m_exact_choice = mainWin->m_options.exact_choice;
 			m_local = mainWin->m_options.local;
 			m_rra = mainWin->m_options.fulloutput;
 
@@ -57,6 +59,11 @@ CAxialAnalysisOptionsDlg::CAxialAnalysisOptionsDlg(MetaGraph *graph, QWidget *pa
 	else
 		c_choice->setCheckState(Qt::Unchecked);
 	
+	if (m_exact_choice)
+		c_exact_choice->setCheckState(Qt::Checked);
+	else
+		c_exact_choice->setCheckState(Qt::Unchecked);
+	
 	if (m_local)
 		c_local->setCheckState(Qt::Checked);
 	else
@@ -159,6 +166,7 @@ void CAxialAnalysisOptionsDlg::OnOK()
 			}
 
 			mainWin->m_options.choice = m_choice;
+			mainWin->m_options.exact_choice = m_exact_choice;
 			mainWin->m_options.local = m_local;
 			mainWin->m_options.fulloutput = m_rra;
 
@@ -191,6 +199,11 @@ void CAxialAnalysisOptionsDlg::UpdateData(bool value)
 		else
 			m_choice = false;
 		
+		if (c_exact_choice->checkState())
+			m_exact_choice = true;
+		else
+			m_exact_choice = false;
+		
 		m_attribute = c_attribute_chooser->currentIndex();
 		
 		if (c_weighted->checkState())
@@ -216,6 +229,11 @@ void CAxialAnalysisOptionsDlg::UpdateData(bool value)
 		else
 			c_choice->setCheckState(Qt::Unchecked);
 		
+		if (m_exact_choice)
+			c_exact_choice->setCheckState(Qt::Checked);
+		else
+			c_exact_choice->setCheckState(Qt::Unchecked);
+		
 		c_attribute_chooser->setCurrentIndex(m_attribute);
 		if (m_weighted)
 			c_weighted->setCheckState(Qt::Checked);
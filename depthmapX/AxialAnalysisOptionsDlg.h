@@ -27,6 +27,7 @@ public:
 	void UpdateData(bool value);
 	QString	m_radius;
 	bool	m_choice;
+	bool	m_exact_choice;
 	int		m_attribute;
 	bool	m_weighted;
 	bool	m_rra;
@@ -20,9 +20,11 @@
 #include <QSettings>
 #include <QtCore/QFile>
 #include <QtGui/QFileDialog>
+#include <QtGui/QInputDialog>
 #include <QtGui/QMessageBox>
 #include <QtGui/QPushButton>
 #include <stdio.h>
+#include <time.h>
 
 #include "mainwindow.h"
 
@@ -677,10 +679,19 @@ void QGraphDoc::OnEditGrid()
    dlg.m_maxdimension = __max(r.width(), r.height());
    if (QDialog::Accepted == dlg.exec())
    {
+      int oldmap = m_meta_graph->getDisplayedPointMapRef();
       if (newmap) {
          m_meta_graph->PointMaps::addNewMap();
       }
-      m_meta_graph->setGrid( dlg.m_spacing, Point2f(0.0f, 0.0f) );
+      if (!m_meta_graph->setGrid( dlg.m_spacing, Point2f(0.0f, 0.0f) )) {
+         if (newmap) {
+            // don't leave the empty map behind:
+            m_meta_graph->PointMaps::removeMap(m_meta_graph->getDisplayedPointMapRef());
+            m_meta_graph->setDisplayedPointMapRef(oldmap);
+         }
+         QMessageBox::warning(this, tr("Warning"), tr("This grid spacing is too fine for the size of the drawing"), QMessageBox::Ok, QMessageBox::Ok);
+         return;
+      }
       m_meta_graph->m_showgrid = true;
       SetUpdateFlag(NEW_TABLE);
       SetRedrawFlag(VIEW_ALL,REDRAW_GRAPH, NEW_DATA);
@@ -1060,6 +1071,7 @@ void QGraphDoc::OnToolsTopomet()
       ((MainWindow*)m_mainFrame)->m_options.output_type = dlg.m_topological;
       ((MainWindow*)m_mainFrame)->m_options.radius = dlg.m_dradius;
       ((MainWindow*)m_mainFrame)->m_options.sel_only = dlg.m_selected_only;
+      ((MainWindow*)m_mainFrame)->m_options.exact_choice = dlg.m_exact_choice;
       if (dlg.m_topological == 0) {
          CreateWaitDialog(tr("Performing topological analysis..."));
       }
@@ -1175,34 +1187,43 @@ void QGraphDoc::OnToolsAgentRun()
    m_thread.render(this);
 }
 
-// some evo agent code... not sure if this works or not!
+// Evolving agent programs: uses the gate layer and the program set up for the agent analysis
 
 void QGraphDoc::OnEvoAgent() 
 {
-/*   if (!m_evoagent) {
-      m_evoagent = (CEvoAgent *) AfxBeginThread(RUNTIME_CLASS(CEvoAgent));
-      if (!m_evoagent) {
-         AfxMessageBox(tr("An error occurred trying to start the agent simulation module"));
-         return;
-      }
-      else {
-         CEvoAgentSetup dlg;
-         if (dlg.DoModal() == IDOK) {
-            m_evoagent->Init(this,dlg.m_evolveapply,dlg.m_filename,dlg.m_seed);
-            m_evoagent->PostThreadMessage(WM_DMP_RUN,0,0);
-         }
-         else {
-            m_evoagent->PostThreadMessage(WM_DMP_FINISHED_MESSAGE,0,0);
-            m_evoagent = NULL;
-         }
-      }
+   if (m_communicator) {
+	   QMessageBox::warning(this, tr("Warning"), tr("Please wait, another task is running"), QMessageBox::Ok, QMessageBox::Ok);
+      return;
    }
-   else {
-      // turn off pause (typically pauses after evaluation run)
-      m_evoagent->m_paused = false;
-      m_evoagent->PostThreadMessage(WM_DMP_RUN,0,0);
+
+   AgentEngine& eng = m_meta_graph->getAgentEngine();
+   if (!eng.size() || eng.m_gatelayer == -1) {
+	   QMessageBox::warning(this, tr("Warning"), tr("Please set up an agent analysis with a gate layer first"), QMessageBox::Ok, QMessageBox::Ok);
+      return;
    }
-   */
+
+   bool ok = false;
+   int generations = QInputDialog::getInt(this, tr("Evolve Agent Programs"), tr("Number of generations:"), 100, 1, GENERATIONS, 1, &ok);
+   if (!ok) {
+      return;
+   }
+
+   QString outfile = QFileDialog::getSaveFileName(
+                               0, tr("Save Best Program As"),
+                               QString(),
+                               tr("Agent program (*.txt)\nAll files (*.*)"));
+   if (outfile.isEmpty()) {
+      return;
+   }
+
+   m_communicator = new CMSCommunicator();
+   CreateWaitDialog(tr("Evolving agent programs..."));
+   m_communicator->SetFunction( CMSCommunicator::AGENTEVOLUTION );
+   m_communicator->SetOption( generations, 0 );
+   m_communicator->SetOption( int(time(NULL)), 1 );
+   m_communicator->SetString( outfile );
+
+   m_thread.render(this);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1479,7 +1500,8 @@ int QGraphDoc::OnOpenDocument(char* lpszPathName)
 
    m_opened_name = QString(lpszPathName);
 
-   int ok = m_meta_graph->read( lpszPathName );
+   // maps other than the displayed ones are read when first shown
+   int ok = m_meta_graph->read( lpszPathName, true );
    QFilePath path(m_opened_name);
 
    SetUpdateFlag(QGraphDoc::NEW_FILE,false);
@@ -1609,7 +1631,7 @@ int QGraphDoc::OnSaveDocument(QString lpszPathName, int version)
 
    modifiedFlag = true;
 
-   int ok = m_meta_graph->write( pstring(lpszPathName.toAscii()), version );
+   int ok = m_meta_graph->write( pstring(lpszPathName.toAscii()), version, false, true );
    if (ok == MetaGraph::OK) {
 	   modifiedFlag = false;
       return TRUE;
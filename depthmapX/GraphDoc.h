@@ -76,7 +76,7 @@ public:
           MAKEAXIALLINES, MAKEALLLINEMAP, MAKEFEWESTLINEMAP, MAKEDRAWING,
           MAKEUSERMAP, MAKEUSERMAPSHAPE, MAKEUSERSEGMAP, MAKEUSERSEGMAPSHAPE, MAKEGATESMAP, MAKEBOUNDARYMAP, MAKESEGMENTMAP, 
           MAKECONVEXMAP, 
-          AXIALANALYSIS, SEGMENTANALYSIS, TOPOMETANALYSIS, AGENTANALYSIS, BINDISPLAY, IMPORTEDANALYSIS };
+          AXIALANALYSIS, SEGMENTANALYSIS, TOPOMETANALYSIS, AGENTANALYSIS, AGENTEVOLUTION, BINDISPLAY, IMPORTEDANALYSIS };
 	
 public:
    void ProcPostMessage(int m, int x, int y);
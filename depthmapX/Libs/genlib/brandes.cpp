@@ -0,0 +1,150 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Shortest path counting, for exact choice (betweenness)
+
+#include <generic/brandes.h>
+
+BrandesSearch::BrandesSearch(const BrandesGraph& graph)
+{
+   m_graph = &graph;
+   int count = graph.getNodeCount();
+   m_cost = new int [count];
+   m_sigma = new double [count];
+   m_extent = new double [count];
+   m_delta = new double [count];
+   m_state = new char [count];
+   m_pred_head = new int [count];
+   for (int i = 0; i < count; i++) {
+      m_cost[i] = -1;
+      m_state[i] = 0;
+      m_pred_head[i] = -1;
+   }
+   m_queue.init(graph.m_max_cost + 1);
+}
+
+BrandesSearch::~BrandesSearch()
+{
+   delete [] m_cost;
+   delete [] m_sigma;
+   delete [] m_extent;
+   delete [] m_delta;
+   delete [] m_state;
+   delete [] m_pred_head;
+}
+
+void BrandesSearch::start()
+{
+   for (size_t i = 0; i < m_touched.size(); i++) {
+      int node = m_touched[i];
+      m_cost[node] = -1;
+      m_state[node] = 0;
+      m_pred_head[node] = -1;
+   }
+   m_touched.clear();
+   m_order.clear();
+   m_pred_node.clear();
+   m_pred_next.clear();
+   m_queue.clear();
+}
+
+void BrandesSearch::addRoot(int node)
+{
+   if (m_cost[node] == -1) {
+      m_cost[node] = 0;
+      m_sigma[node] = 1.0;
+      m_extent[node] = 0.0;
+      m_state[node] = 2;
+      m_touched.push_back(node);
+      m_queue.push(0,node);
+   }
+}
+
+void BrandesSearch::search(int cost_limit, double extent_limit)
+{
+   const BrandesGraph& graph = *m_graph;
+   while (m_queue.size()) {
+      int node = m_queue.pop();
+      int cost = m_queue.level();
+      // skip nodes already settled, or entries left behind when a shorter route was found
+      if ((m_state[node] & 1) || m_cost[node] != cost) {
+         continue;
+      }
+      m_state[node] |= 1;
+      m_order.push_back(node);
+      for (int e = graph.m_first[node]; e < graph.m_first[node+1]; e++) {
+         int to = graph.m_to[e];
+         // n.b., roots and settled nodes are never reached again
+         if (m_state[to] != 0) {
+            continue;
+         }
+         int tocost = cost + graph.m_cost[e];
+         if (cost_limit != -1 && tocost > cost_limit) {
+            continue;
+         }
+         double toextent = m_extent[node] + graph.m_extent[e];
+         if (extent_limit != -1.0 && toextent > extent_limit) {
+            continue;
+         }
+         if (m_cost[to] == -1 || tocost < m_cost[to]) {
+            if (m_cost[to] == -1) {
+               m_touched.push_back(to);
+            }
+            m_cost[to] = tocost;
+            m_sigma[to] = m_sigma[node];
+            m_extent[to] = toextent;
+            m_pred_head[to] = -1;
+            m_queue.push(graph.m_cost[e],to);
+         }
+         else if (tocost == m_cost[to]) {
+            m_sigma[to] += m_sigma[node];
+            if (toextent < m_extent[to]) {
+               m_extent[to] = toextent;
+            }
+         }
+         else {
+            continue;
+         }
+         m_pred_node.push_back(node);
+         m_pred_next.push_back(m_pred_head[to]);
+         m_pred_head[to] = int(m_pred_node.size()) - 1;
+      }
+   }
+}
+
+void BrandesSearch::accumulate(double *choice, const double *weights, int cost_limit)
+{
+   for (size_t i = 0; i < m_order.size(); i++) {
+      m_delta[m_order[i]] = 0.0;
+   }
+   // furthest first, so that each node has its full dependency before it is passed on
+   for (size_t i = m_order.size() - 1; i != paftl::npos; i--) {
+      int node = m_order[i];
+      if (m_state[node] & 2) {
+         continue;
+      }
+      if (cost_limit != -1 && m_cost[node] > cost_limit) {
+         continue;
+      }
+      double share = ((weights ? weights[node] : 1.0) + m_delta[node]) / m_sigma[node];
+      for (int p = m_pred_head[node]; p != -1; p = m_pred_next[p]) {
+         int pred = m_pred_node[p];
+         m_delta[pred] += m_sigma[pred] * share;
+      }
+      choice[node] += m_delta[node];
+   }
+}
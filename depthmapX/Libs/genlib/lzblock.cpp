@@ -0,0 +1,192 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Fast LZ77 block compression for the file sections (see lzblock.h)
+
+#include <string.h>
+#include <generic/lzblock.h>
+
+const int LZ_HASH_BITS = 16;
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+// matches stop this far short of the end, so the block always ends with literals
+const size_t LZ_END_LITERALS = 5;
+
+static inline unsigned int lzRead32(const unsigned char *p)
+{
+   unsigned int v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline unsigned int lzHash(unsigned int v)
+{
+   return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline bool lzWriteLength(unsigned char *&out, const unsigned char *end, size_t length)
+{
+   while (length >= 255) {
+      if (out == end) {
+         return false;
+      }
+      *out++ = 255;
+      length -= 255;
+   }
+   if (out == end) {
+      return false;
+   }
+   *out++ = (unsigned char) length;
+   return true;
+}
+
+// offset 0 writes the final, literal only, sequence
+static bool lzWriteSequence(unsigned char *&out, const unsigned char *end, const unsigned char *literals, size_t literal_length, size_t offset, size_t match_length)
+{
+   if (out == end) {
+      return false;
+   }
+   size_t match_code = (offset != 0) ? match_length - LZ_MIN_MATCH : 0;
+   *out++ = (unsigned char) (((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+   if (literal_length >= 15 && !lzWriteLength(out, end, literal_length - 15)) {
+      return false;
+   }
+   if (size_t(end - out) < literal_length) {
+      return false;
+   }
+   memcpy(out, literals, literal_length);
+   out += literal_length;
+   if (offset != 0) {
+      if (end - out < 2) {
+         return false;
+      }
+      *out++ = (unsigned char) (offset & 0xff);
+      *out++ = (unsigned char) (offset >> 8);
+      if (match_code >= 15 && !lzWriteLength(out, end, match_code - 15)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+size_t lzCompress(const char *src, size_t length, char *dest, size_t capacity)
+{
+   if (length <= LZ_MIN_MATCH + LZ_END_LITERALS) {
+      return 0;
+   }
+   const unsigned char *in = (const unsigned char *) src;
+   unsigned char *out = (unsigned char *) dest;
+   const unsigned char *out_end = out + capacity;
+
+   // last position each hashed four bytes were seen at
+   const size_t none = (size_t) -1;
+   size_t *table = new size_t [1 << LZ_HASH_BITS];
+   for (int i = 0; i < (1 << LZ_HASH_BITS); i++) {
+      table[i] = none;
+   }
+
+   size_t limit = length - LZ_END_LITERALS;
+   size_t anchor = 0, pos = 0;
+   bool ok = true;
+   while (ok && pos + LZ_MIN_MATCH <= limit) {
+      unsigned int seq = lzRead32(in + pos);
+      unsigned int hash = lzHash(seq);
+      size_t candidate = table[hash];
+      table[hash] = pos;
+      if (candidate != none && pos - candidate <= LZ_MAX_OFFSET && lzRead32(in + candidate) == seq) {
+         size_t match_length = LZ_MIN_MATCH;
+         while (pos + match_length < limit && in[candidate + match_length] == in[pos + match_length]) {
+            match_length++;
+         }
+         ok = lzWriteSequence(out, out_end, in + anchor, pos - anchor, pos - candidate, match_length);
+         pos += match_length;
+         anchor = pos;
+      }
+      else {
+         pos++;
+      }
+   }
+   if (ok) {
+      ok = lzWriteSequence(out, out_end, in + anchor, length - anchor, 0, 0);
+   }
+
+   delete [] table;
+
+   return ok ? size_t(out - (unsigned char *) dest) : 0;
+}
+
+static inline bool lzReadLength(const unsigned char *&in, const unsigned char *end, size_t& length)
+{
+   unsigned char b;
+   do {
+      if (in == end) {
+         return false;
+      }
+      b = *in++;
+      length += b;
+   } while (b == 255);
+   return true;
+}
+
+bool lzDecompress(const char *src, size_t srclength, char *dest, size_t destlength)
+{
+   const unsigned char *in = (const unsigned char *) src;
+   const unsigned char *in_end = in + srclength;
+   unsigned char *out = (unsigned char *) dest;
+   unsigned char *out_end = out + destlength;
+
+   while (in < in_end) {
+      unsigned char token = *in++;
+      size_t literal_length = token >> 4;
+      if (literal_length == 15 && !lzReadLength(in, in_end, literal_length)) {
+         return false;
+      }
+      if (literal_length > size_t(in_end - in) || literal_length > size_t(out_end - out)) {
+         return false;
+      }
+      memcpy(out, in, literal_length);
+      in += literal_length;
+      out += literal_length;
+      if (in == in_end) {
+         // the final sequence has no match
+         break;
+      }
+      if (in_end - in < 2) {
+         return false;
+      }
+      size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+      in += 2;
+      if (offset == 0 || offset > size_t(out - (unsigned char *) dest)) {
+         return false;
+      }
+      size_t match_length = token & 0x0f;
+      if (match_length == 15 && !lzReadLength(in, in_end, match_length)) {
+         return false;
+      }
+      match_length += LZ_MIN_MATCH;
+      if (match_length > size_t(out_end - out)) {
+         return false;
+      }
+      // byte by byte, as the match may overlap what it is making
+      const unsigned char *match = out - offset;
+      for (size_t i = 0; i < match_length; i++) {
+         out[i] = match[i];
+      }
+      out += match_length;
+   }
+   return out == out_end;
+}
@@ -21,6 +21,7 @@
 
 #include <generic/paftl.h>
 #include <generic/comm.h> // used in BSP construction
+#include <generic/parallel.h>
 #include <generic/p2dpoly.h>
 
 #ifdef _MSC_VER
@@ -146,8 +147,6 @@ Point2f gps2os(const Point2f& pt)
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-static long g_count = 0L;
-
 int bitcount(int a)
 {
    int ret = 0;
@@ -377,8 +376,6 @@ double dot(const Line& a, const Line& b) {
 
 bool intersect_line(const Line& a, const Line& b, double tolerance)
 {
-   g_count++;
-
    if ( ((a.ay() - a.by()) * (b.ax() - a.ax()) +
          (a.bx() - a.ax()) * (b.ay() - a.ay())) *
         ((a.ay() - a.by()) * (b.bx() - a.ax()) +
@@ -399,8 +396,6 @@ bool intersect_line(const Line& a, const Line& b, double tolerance)
 
 bool intersect_line_no_touch(const Line& a, const Line& b, double tolerance)
 {
-   g_count++;
-
    if ( ((a.ay() - a.by()) * (b.ax() - a.ax()) +
          (a.bx() - a.ax()) * (b.ay() - a.ay())) *
         ((a.ay() - a.by()) * (b.bx() - a.ax()) +
@@ -419,8 +414,6 @@ bool intersect_line_no_touch(const Line& a, const Line& b, double tolerance)
 // returns 0 for no intersect, 1 for touching and 2 for crossing
 int intersect_line_distinguish(const Line& a, const Line& b, double tolerance)
 {
-   g_count++;
-
    double alpha = ((a.ay() - a.by()) * (b.ax() - a.ax()) +
                    (a.bx() - a.ax()) * (b.ay() - a.ay())) *
                   ((a.ay() - a.by()) * (b.bx() - a.ax()) +
@@ -448,8 +441,6 @@ int intersect_line_distinguish(const Line& a, const Line& b, double tolerance)
 // (first point of line b is the point to be tested) -- i.e., throws if point touches polygon
 int intersect_line_b(const Line& a, const Line& b, double tolerance)
 {
-   g_count++;
-
    double alpha = ((a.ay() - a.by()) * (b.ax() - a.ax()) +
                    (a.bx() - a.ax()) * (b.ay() - a.ay()));
 
@@ -789,70 +780,73 @@ void Line::ray(short dir, const QtRegion& r)
 
 // Binary Space Partition
 
-void BSPNode::make(Communicator *communicator, comm_time_t atime, const prefvec<TaggedLine>& lines, BSPNode *par)
-{
-   m_count++;
+// The tree is built without recursion: each node to be made waits on a stack
+// with the list of its lines, as indices into a single store of lines (the split
+// fragments are added to the end of the store).  The top of the tree is built
+// breadth first until there are enough subtrees to share out between the threads,
+// then each subtree is finished with its own store.  The tree only depends on the
+// lines themselves, so it is the same however many threads make it
 
-   if (communicator)
-   {
-      if (communicator->IsCancelled()) {
-         throw Communicator::CancelledException();
-      }
-      if (qtimer( atime, 500 )) {
-         communicator->CommPostMessage( Communicator::CURRENT_RECORD, m_count );
-      }
-   }
+// splitters tried at each node, and the cost of cutting a line in two, against
+// the cost of one line more on one side than the other
+#define BSP_CANDIDATES 16
+#define BSP_SPLIT_COST 4
 
-   prefvec<TaggedLine> leftlines;
-   prefvec<TaggedLine> rightlines;
-
-   parent = par;
+// which side of line (direction v0) testline falls, as for the partition itself
+static void bspSides(const Line& line, const Point2f& v0, const Line& testline, double& a, double& b)
+{
+   Point2f v1 = testline.start()-line.start();
+   v1.normalise();
+   Point2f v2 = testline.end()-line.start();
+   v2.normalise();
+   // should use approxeq here:
+   a = testline.start() == line.start() ? 0 : det(v0,v1);
+   b = testline.end() == line.start() ? 0 : det(v0,v2);
+}
 
-   // for optimization of the tree (this reduced a six-minute gen time to a 38 second gen time)
-   size_t chosen = paftl::npos;
-   if (lines.size() > 3) {
-      size_t i;
-      Point2f midpoint;
-      for (i = 0; i < lines.size(); i++) {
-         midpoint += lines[i].line.start() + lines[i].line.end();
-      }
-      midpoint /= 2.0 * lines.size();
-      bool ver = true;
-      if (par && par->line.height() > par->line.width()) {
-         ver = false;
-      }
-      double chosendist = -1.0;
-      for (i = 0; i < lines.size(); i++) {
-         const Line& line = lines[i].line;
-         if (ver) {
-            if (line.height() > line.width() && (chosen == paftl::npos || dist(line.midpoint(),midpoint) < chosendist)) {
-               chosen = i;
-               chosendist = dist(line.midpoint(),midpoint);
+// choose the splitter for node from lines, and share the rest out to either side
+static void bspSplit(BSPNode *node, pvector<TaggedLine>& store, const pvecint& lines, pvecint& leftlines, pvecint& rightlines)
+{
+   // for optimization of the tree, a few candidates are tried against all the lines,
+   // and the one that cuts fewest lines while keeping the two sides even is chosen
+   size_t chosen = 0;
+   if (lines.size() > 1) {
+      size_t candidates = lines.size() < BSP_CANDIDATES ? lines.size() : BSP_CANDIDATES;
+      int chosencost = -1;
+      for (size_t c = 0; c < candidates; c++) {
+         size_t candidate = (c * lines.size()) / candidates;
+         const Line& line = store[lines[candidate]].line;
+         Point2f v0 = line.end() - line.start();
+         v0.normalise();
+         int leftcount = 0, rightcount = 0, splitcount = 0;
+         for (size_t i = 0; i < lines.size(); i++) {
+            if (i == candidate) {
+               continue;
             }
-         }
-         else {
-            if (line.width() > line.height() && (chosen == paftl::npos || dist(line.midpoint(),midpoint) < chosendist)) {
-               chosen = i;
-               chosendist = dist(line.midpoint(),midpoint);
+            double a, b;
+            bspSides(line,v0,store[lines[i]].line,a,b);
+            if (a >= 0 && b >= 0) {
+               leftcount++;
             }
-         }
-      }
-      // argh... and again... there weren't any hoz / ver:
-      if (chosen == paftl::npos) {
-         for (size_t i = 0; i < lines.size(); i++) {
-            if (chosen == paftl::npos || dist(lines[i].line.midpoint(),midpoint) < chosendist) {
-               chosen = i;
-               chosendist = dist(lines[i].line.midpoint(),midpoint);
+            else if (a <= 0 && b <= 0) {
+               rightcount++;
             }
+            else {
+               splitcount++;
+            }
+         }
+         int cost = BSP_SPLIT_COST * splitcount + (leftcount > rightcount ? leftcount - rightcount : rightcount - leftcount);
+         if (chosencost == -1 || cost < chosencost) {
+            chosen = candidate;
+            chosencost = cost;
          }
       }
    }
-   else {
-      chosen = pafrand() % lines.size();
-   }
 
-   line = lines[chosen].line;
-   m_tag = lines[chosen].tag;
+   // n.b., copies, as the store may grow below
+   Line line = store[lines[chosen]].line;
+   node->line = line;
+   node->m_tag = store[lines[chosen]].tag;
 
    Point2f v0 = line.end() - line.start();
    v0.normalise();
@@ -861,48 +855,137 @@ void BSPNode::make(Communicator *communicator, comm_time_t atime, const prefvec<
       if (i == chosen) {
          continue;
       }
-      const Line& testline = lines[i].line;
-      int tag = lines[i].tag;
-      Point2f v1 = testline.start()-line.start();
-      v1.normalise();
-      Point2f v2 = testline.end()-line.start();
-      v2.normalise();
-      // should use approxeq here:
-      double a = testline.start() == line.start() ? 0 : det(v0,v1);
-      double b = testline.end() == line.start() ? 0 : det(v0,v2);
+      Line testline = store[lines[i]].line;
+      int tag = store[lines[i]].tag;
+      double a, b;
+      bspSides(line,v0,testline,a,b);
       // note sure what to do if a == 0 and b == 0 (i.e., it's parallel... this test at least ensures on the line is one or the other side)
       if (a >= 0 && b >= 0) {
-         leftlines.push_back(TaggedLine(testline,tag));
+         leftlines.push_back(lines[i]);
       }
       else if (a <= 0 && b <= 0) {
-         rightlines.push_back(TaggedLine(testline,tag));
+         rightlines.push_back(lines[i]);
       }
       else {
          Point2f p = intersection_point(line,testline);
          Line x = Line(testline.start(),p);
          Line y = Line(p,testline.end());
          if (a >= 0) {
-            if (x.length() > 0.0) // should use a tolerance here too
-               leftlines.push_back(TaggedLine(x,tag));
-            if (y.length() > 0.0) // should use a tolerance here too
-               rightlines.push_back(TaggedLine(y,tag));
+            if (x.length() > 0.0) { // should use a tolerance here too
+               leftlines.push_back(store.size());
+               store.push_back(TaggedLine(x,tag));
+            }
+            if (y.length() > 0.0) { // should use a tolerance here too
+               rightlines.push_back(store.size());
+               store.push_back(TaggedLine(y,tag));
+            }
          }
          else {
-            if (x.length() > 0.0) // should use a tolerance here too
-               rightlines.push_back(TaggedLine(x,tag));
-            if (y.length() > 0.0) // should use a tolerance here too
-               leftlines.push_back(TaggedLine(y,tag));
+            if (x.length() > 0.0) { // should use a tolerance here too
+               rightlines.push_back(store.size());
+               store.push_back(TaggedLine(x,tag));
+            }
+            if (y.length() > 0.0) { // should use a tolerance here too
+               leftlines.push_back(store.size());
+               store.push_back(TaggedLine(y,tag));
+            }
          }
       }
    }
+}
 
+// make node's children (if it needs any), and queue them with their lines
+static void bspExpand(BSPNode *node, pvector<TaggedLine>& store, const pvecint& lines, pvector<BSPNode *>& nodes, prefvec<pvecint>& nodelines)
+{
+   pvecint leftlines;
+   pvecint rightlines;
+   bspSplit(node,store,lines,leftlines,rightlines);
    if (leftlines.size()) {
-      left = new BSPNode();
-      left->make(communicator,atime,leftlines,this);
+      node->left = new BSPNode();
+      node->left->parent = node;
+      nodes.push_back(node->left);
+      nodelines.push_back(leftlines);
    }
    if (rightlines.size()) {
-      right = new BSPNode();
-      right->make(communicator,atime,rightlines,this);
+      node->right = new BSPNode();
+      node->right->parent = node;
+      nodes.push_back(node->right);
+      nodelines.push_back(rightlines);
+   }
+}
+
+void BSPNode::make(Communicator *communicator, const prefvec<TaggedLine>& lines)
+{
+   ParallelComm pcomm( communicator );
+
+   pvector<TaggedLine> store;
+   pvecint rootlines;
+   for (size_t i = 0; i < lines.size(); i++) {
+      rootlines.push_back(i);
+      store.push_back(lines[i]);
+   }
+
+   // top of the tree, breadth first:
+   pvector<BSPNode *> nodes;
+   prefvec<pvecint> nodelines;
+   nodes.push_back(this);
+   nodelines.push_back(rootlines);
+   size_t next = 0;
+   size_t target = 4 * getThreadCount();
+   while (next < nodes.size() && nodes.size() - next < target) {
+      bspExpand(nodes[next],store,nodelines[next],nodes,nodelines);
+      nodelines[next].clear();
+      next++;
+      pcomm.record();
+      if (pcomm.isCancelled()) {
+         break;
+      }
+   }
+
+   // then the subtrees, depth first, each in its own store:
+   int subtree_count = int(nodes.size() - next);
+
+   #pragma omp parallel for schedule(dynamic)
+   for (int t = 0; t < subtree_count; t++) {
+      pvector<TaggedLine> substore;
+      pvector<BSPNode *> stack;
+      prefvec<pvecint> stacklines;
+      stack.push_back(nodes[next + t]);
+      stacklines.push_back(pvecint());
+      const pvecint& toplines = nodelines[next + t];
+      for (size_t i = 0; i < toplines.size(); i++) {
+         stacklines.tail().push_back(i);
+         substore.push_back(store[toplines[i]]);
+      }
+      while (stack.size() && !pcomm.isCancelled()) {
+         BSPNode *node = stack.tail();
+         pvecint nodelist = stacklines.tail();
+         stack.pop_back();
+         stacklines.pop_back();
+         bspExpand(node,substore,nodelist,stack,stacklines);
+         pcomm.record();
+      }
+   }
+
+   pcomm.throwIfCancelled();
+}
+
+BSPNode::~BSPNode()
+{
+   // delete the subtrees without recursion, so a deep tree cannot overflow the stack
+   pvector<BSPNode *> nodes;
+   if (left) nodes.push_back(left);
+   if (right) nodes.push_back(right);
+   left = NULL;
+   right = NULL;
+   while (nodes.size()) {
+      BSPNode *node = nodes.tail();
+      nodes.pop_back();
+      if (node->left) nodes.push_back(node->left);
+      if (node->right) nodes.push_back(node->right);
+      node->left = NULL;
+      node->right = NULL;
+      delete node;
    }
 }
 
@@ -53,6 +53,13 @@ unsigned int pafrand(int set) // = 0
    return (unsigned int)((g_rand[set] >> 32) & PAF_RAND_MAX);
 }
 
+unsigned int pafrand(uint64& state)
+{
+   state = g_mult * state + g_const;
+
+   return (unsigned int)((state >> 32) & PAF_RAND_MAX);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 double poisson(int x, double lambda)
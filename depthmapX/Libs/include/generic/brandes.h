@@ -0,0 +1,117 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Shortest path counting, for exact choice (betweenness)
+//
+// Choice has always been found by following one shortest path tree back from
+// each destination, so where there are several shortest routes only one of
+// them is counted, and which one depends on the order of the search.  Here,
+// as in Brandes (2001), every shortest route is counted: a search from a root
+// counts the shortest paths to each node (sigma), then the nodes are taken
+// back in reverse order, each passing its share of the routes through it on
+// to the nodes before it (the dependency, delta).
+//
+// The graph is directed and the edge costs are whole numbers (steps, or tulip
+// or metric bins), so that the search runs on a bucket queue.  An edge may also
+// have an extent (e.g., its metric length, or a step), and a search may be kept
+// within a radius of extent: the extent to a node is taken along the shortest
+// of its shortest routes, and an edge is only followed if the extent at its
+// far end is within the radius.
+
+#ifndef __BRANDES_H__
+#define __BRANDES_H__
+
+#include <generic/paftl.h>
+#include <generic/bucketqueue.h>
+
+class BrandesGraph
+{
+   friend class BrandesSearch;
+protected:
+   // edges of node i are m_first[i] to m_first[i+1] - 1
+   pvecint m_first;
+   pvecint m_to;
+   pvecint m_cost;
+   pvecdouble m_extent;
+   int m_max_cost;
+public:
+   BrandesGraph()
+   { m_first.push_back(0); m_max_cost = 0; }
+   // nodes are added in order, each followed by its edges
+   int addNode()
+   { int first = m_first.tail(); m_first.push_back(first); return int(m_first.size()) - 2; }
+   void addEdge(int to, int cost, double extent = 0.0)
+   { m_to.push_back(to); m_cost.push_back(cost); m_extent.push_back(extent); m_first.tail() += 1; if (cost > m_max_cost) m_max_cost = cost; }
+   //
+   int getNodeCount() const
+   { return int(m_first.size()) - 1; }
+};
+
+// the working space for searches on a graph: one for each thread
+
+class BrandesSearch
+{
+protected:
+   const BrandesGraph *m_graph;
+   BucketQueue<int> m_queue;
+   int *m_cost;
+   double *m_sigma;
+   double *m_extent;
+   double *m_delta;
+   char *m_state;
+   // predecessors on shortest routes, as lists linked through m_pred_next
+   int *m_pred_head;
+   pvecint m_pred_node;
+   pvecint m_pred_next;
+   // every node given a cost, and the nodes in the order they were settled
+   pvecint m_touched;
+   pvecint m_order;
+public:
+   BrandesSearch(const BrandesGraph& graph);
+   ~BrandesSearch();
+   BrandesSearch(const BrandesSearch&)
+   { throw 1; }
+   BrandesSearch& operator = (const BrandesSearch&)
+   { throw 1; }
+   // clears the last search: call before adding the roots
+   void start();
+   // a search may have more than one root (e.g., both ends of a segment)
+   void addRoot(int node);
+   // cost_limit and extent_limit -1 for no limit
+   void search(int cost_limit = -1, double extent_limit = -1.0);
+   //
+   // nodes reached (including the roots), in order of cost
+   int getReachedCount() const
+   { return int(m_order.size()); }
+   int getReached(int i) const
+   { return m_order[i]; }
+   bool isRoot(int node) const
+   { return m_state[node] == 2; }
+   // the cost is -1 for nodes not reached
+   int getCost(int node) const
+   { return m_cost[node]; }
+   // the number of shortest routes to a node (n.b., only for nodes reached)
+   double getSigma(int node) const
+   { return m_sigma[node]; }
+   //
+   // adds the dependency of each node reached other than the roots to choice[node],
+   // for the routes to destinations no more than cost_limit away (-1 for all of them),
+   // each destination counted by its weight (NULL to count each as 1)
+   void accumulate(double *choice, const double *weights = NULL, int cost_limit = -1);
+};
+
+#endif
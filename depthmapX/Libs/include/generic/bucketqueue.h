@@ -0,0 +1,112 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// A circular bucket queue, for the tulip (angular) and topo-metric searches
+//
+// An item goes into the bucket a number of steps ahead of the current one (so
+// no more than bin_count - 1 ahead), and items are taken from the current bucket
+// until it is empty, when the queue moves on round the circle, counting the steps
+// taken as it goes (level()).  The buckets are pvectors of the items themselves,
+// so nothing is allocated item by item, and clear() keeps their storage for the
+// next search.  push() uses a bucket as a stack; add() keeps it in order, as a
+// pqvector with paftl::ADD_DUPLICATE would, so that the greatest item comes off first
+
+#ifndef __BUCKETQUEUE_H__
+#define __BUCKETQUEUE_H__
+
+#include <generic/paftl.h>
+
+template <class T> class BucketQueue
+{
+protected:
+   pvector<T> *m_bins;
+   int m_bin_count;
+   int m_current;
+   int m_level;
+   int m_size;
+public:
+   BucketQueue(int bin_count = 0)
+   { m_bins = NULL; m_bin_count = 0; m_current = 0; m_level = 0; m_size = 0; init(bin_count); }
+   BucketQueue(const BucketQueue&) 
+   { throw 1; }
+   BucketQueue& operator = (const BucketQueue&)
+   { throw 1; }
+   ~BucketQueue()
+   { if (m_bins) delete [] m_bins; }
+   //
+   void init(int bin_count);
+   void clear();
+   //
+   int size() const
+   { return m_size; }
+   // the number of steps the queue has moved on since it was cleared
+   int level() const
+   { return m_level; }
+   //
+   void push(int ahead, const T& item)
+   { m_bins[(m_current + m_bin_count + ahead) % m_bin_count].push_back(item); m_size++; }
+   void add(int ahead, const T& item)
+   { m_bins[(m_current + m_bin_count + ahead) % m_bin_count].add(item, paftl::ADD_DUPLICATE); m_size++; }
+   // n.b., the queue must not be empty
+   T pop();
+};
+
+template <class T>
+void BucketQueue<T>::init(int bin_count)
+{
+   if (m_bins) {
+      delete [] m_bins;
+      m_bins = NULL;
+   }
+   m_bin_count = bin_count;
+   if (m_bin_count) {
+      m_bins = new pvector<T> [m_bin_count];
+   }
+   m_current = 0;
+   m_level = 0;
+   m_size = 0;
+}
+
+template <class T>
+void BucketQueue<T>::clear()
+{
+   if (m_size) {
+      for (int i = 0; i < m_bin_count; i++) {
+         m_bins[i].clearnofree();
+      }
+   }
+   m_current = 0;
+   m_level = 0;
+   m_size = 0;
+}
+
+template <class T>
+T BucketQueue<T>::pop()
+{
+   while (m_bins[m_current].size() == 0) {
+      m_level++;
+      m_current++;
+      if (m_current == m_bin_count) {
+         m_current = 0;
+      }
+   }
+   T item = m_bins[m_current].tail();
+   m_bins[m_current].pop_back();
+   m_size--;
+   return item;
+}
+
+#endif
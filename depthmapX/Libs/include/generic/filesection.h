@@ -0,0 +1,206 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Aligned sections of raw array data for the binary files
+//
+// Each large array is written as one section: its element count and element
+// size, padding to the next 8 byte boundary of the file, then the array just as
+// it is held in memory.  A section is read back with a single block read straight
+// into its array, with nothing parsed value by value, and since every section
+// starts on an aligned offset the data could equally be used from a mapped view
+// of the file.  The element type must be plain data (no pointers)
+//
+// A stream may also be set to compress its sections (see lzblock.h): the element
+// size then has its top bit set, and is followed by the compressed length.  Only
+// sections that actually come out smaller are stored compressed
+
+#ifndef __FILESECTION_H__
+#define __FILESECTION_H__
+
+#include <generic/paftl.h>
+#include <generic/lzblock.h>
+
+const int FILE_SECTION_ALIGNMENT = 8;
+const unsigned int FILE_SECTION_COMPRESSED = 0x80000000;
+// smaller sections are not worth compressing
+const size_t FILE_SECTION_MIN_COMPRESS = 256;
+
+// stream buffer for reading and writing whole graph files
+const int FILE_BUFFER_SIZE = 1 << 20;
+
+inline int sectionCompressionIndex()
+{
+   static int index = ios_base::xalloc();
+   return index;
+}
+
+inline void setSectionCompression(ios_base& stream, bool compress)
+{
+   stream.iword(sectionCompressionIndex()) = compress ? 1 : 0;
+}
+
+inline bool getSectionCompression(ios_base& stream)
+{
+   return stream.iword(sectionCompressionIndex()) != 0;
+}
+
+// pads the file to the next aligned offset (or, reading, steps over the padding)
+
+inline void writeAlignment(ostream& stream)
+{
+   char padding[FILE_SECTION_ALIGNMENT] = {0};
+   int offset = int(streamoff(stream.tellp()) % FILE_SECTION_ALIGNMENT);
+   if (offset != 0) {
+      stream.write( padding, FILE_SECTION_ALIGNMENT - offset );
+   }
+}
+
+inline void readAlignment(istream& stream)
+{
+   int offset = int(streamoff(stream.tellg()) % FILE_SECTION_ALIGNMENT);
+   if (offset != 0) {
+      stream.seekg( FILE_SECTION_ALIGNMENT - offset, ios::cur );
+   }
+}
+
+template <class T> ostream& writeSection(ostream& stream, const T *data, size_t count)
+{
+   // n.b., 32-bit lengths, as pmemvec read / write
+   if (count > size_t((unsigned int)-1)) {
+      throw pexception( pexception::MAX_ARRAY_EXCEEDED, count );
+   }
+   size_t bytes = sizeof(T) * count;
+   char *packed = NULL;
+   int64 packed_length = 0;
+   if (getSectionCompression(stream) && bytes >= FILE_SECTION_MIN_COMPRESS) {
+      // (no room for it to come out any bigger)
+      packed = new char [bytes];
+      packed_length = (int64) lzCompress( (const char *) data, bytes, packed, bytes - 1 );
+   }
+   unsigned int header[2];
+   header[0] = (unsigned int) count;
+   header[1] = (unsigned int) sizeof(T) | (packed_length ? FILE_SECTION_COMPRESSED : 0);
+   stream.write( (char *) header, sizeof(header) );
+   if (packed_length) {
+      stream.write( (char *) &packed_length, sizeof(packed_length) );
+   }
+   writeAlignment(stream);
+   if (packed_length) {
+      stream.write( packed, streamsize(packed_length) );
+   }
+   else if (count != 0) {
+      stream.write( (const char *) data, streamsize(bytes) );
+   }
+   if (packed) {
+      delete [] packed;
+   }
+   return stream;
+}
+
+template <class T> ostream& writeSection(ostream& stream, const pvector<T>& data)
+{
+   return writeSection( stream, data.size() ? &(data[0]) : (const T *) NULL, data.size() );
+}
+
+template <class T> istream& readSection(istream& stream, pvector<T>& data)
+{
+   unsigned int header[2];
+   stream.read( (char *) header, sizeof(header) );
+   bool compressed = (header[1] & FILE_SECTION_COMPRESSED) != 0;
+   if (stream.fail() || (header[1] & ~FILE_SECTION_COMPRESSED) != sizeof(T)) {
+      throw pexception( pexception::FILE_ERROR );
+   }
+   int64 packed_length = 0;
+   if (compressed) {
+      stream.read( (char *) &packed_length, sizeof(packed_length) );
+      if (stream.fail() || packed_length <= 0) {
+         throw pexception( pexception::FILE_ERROR );
+      }
+   }
+   readAlignment(stream);
+   data.clear();
+   if (header[0] != 0) {
+      size_t bytes = sizeof(T) * header[0];
+      data.set( size_t(header[0]) );
+      if (compressed) {
+         if (size_t(packed_length) >= bytes) {
+            throw pexception( pexception::FILE_ERROR );
+         }
+         char *packed = new char [size_t(packed_length)];
+         stream.read( packed, streamsize(packed_length) );
+         bool ok = !stream.fail() && lzDecompress( packed, size_t(packed_length), (char *) &(data[0]), bytes );
+         delete [] packed;
+         if (!ok) {
+            throw pexception( pexception::FILE_ERROR );
+         }
+      }
+      else {
+         stream.read( (char *) &(data[0]), streamsize(bytes) );
+         if (stream.fail()) {
+            throw pexception( pexception::FILE_ERROR );
+         }
+      }
+   }
+   return stream;
+}
+
+// Length prefixed blocks, so a reader can step over something it does not need yet:
+// beginBlock leaves room for the length and returns where it is, endBlock fills it in
+
+inline streampos beginBlock(ostream& stream)
+{
+   streampos start = stream.tellp();
+   int64 length = 0;
+   stream.write( (char *) &length, sizeof(length) );
+   return start;
+}
+
+inline void endBlock(ostream& stream, streampos start)
+{
+   streampos end = stream.tellp();
+   int64 length = int64(streamoff(end - start)) - int64(sizeof(int64));
+   stream.seekp( start );
+   stream.write( (char *) &length, sizeof(length) );
+   stream.seekp( end );
+}
+
+// Copies a block as it stands from one file to another (for instance, a map that has
+// not been read in, see PointMaps::writeMap), as long as it is copied to an offset
+// with the same alignment, which readSection relies on
+
+inline bool copyBlock(const pstring& filename, int64 offset, int64 length, ostream& stream)
+{
+#ifdef _WIN32
+   ifstream from( filename.c_str(), ios::binary | ios::in );
+#else
+   ifstream from( filename.c_str(), ios::in );
+#endif
+   if (from.fail()) {
+      return false;
+   }
+   from.seekg( streamoff(offset) );
+   pvector<char> buffer;
+   buffer.set(FILE_BUFFER_SIZE);
+   while (length > 0 && !from.fail()) {
+      streamsize chunk = streamsize( length < int64(FILE_BUFFER_SIZE) ? length : int64(FILE_BUFFER_SIZE) );
+      from.read( &(buffer[0]), chunk );
+      stream.write( &(buffer[0]), chunk );
+      length -= int64(chunk);
+   }
+   return !from.fail() && !stream.fail();
+}
+
+#endif
@@ -0,0 +1,39 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Fast LZ77 block compression for the file sections
+//
+// The block layout follows LZ4: a run of sequences, each a token byte (the
+// literal length in the high four bits, the match length less four in the low
+// four, 15 meaning that more length bytes follow), the literals, then a two byte
+// offset back to the match.  The last sequence is literals only.  It is made for
+// speed rather than ratio: the point grid and the packed graph have long runs
+// and repeated patterns, and compress well even so.
+
+#ifndef __LZBLOCK_H__
+#define __LZBLOCK_H__
+
+#include <stddef.h>
+
+// compresses length bytes of src into dest (with room for capacity bytes):
+// returns the compressed length, or 0 if it would not fit (so store the data as it is)
+size_t lzCompress(const char *src, size_t length, char *dest, size_t capacity);
+
+// returns false if the compressed data is damaged or does not make exactly destlength bytes
+bool lzDecompress(const char *src, size_t srclength, char *dest, size_t destlength);
+
+#endif
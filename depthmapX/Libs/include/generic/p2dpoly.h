@@ -497,18 +497,17 @@ public:
    BSPNode *parent;
    Line line;
    int m_tag;
-   int m_count;
    //
 public:
    BSPNode()
-   { left = NULL; right = NULL; parent = NULL; m_count = 0; m_tag = -1; }
-   virtual ~BSPNode()
-   { if (left) delete left; left = NULL; if (right) delete right; right = NULL; }
+   { left = NULL; right = NULL; parent = NULL; m_tag = -1; }
+   virtual ~BSPNode();
    //
    bool isLeaf() {
       return left == NULL && right == NULL;
    }
-   void make(Communicator *communicator, comm_time_t atime, const prefvec<TaggedLine>& lines, BSPNode *par);
+   // make the tree below this (root) node from the lines, cutting them where they cross
+   void make(Communicator *communicator, const prefvec<TaggedLine>& lines);
    int classify(const Point2f& p);
    const Line& getLine() const { return line; }
    const int getTag() const { return m_tag; }
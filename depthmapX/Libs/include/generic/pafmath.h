@@ -63,12 +63,19 @@ inline int round(double a)
 const unsigned int PAF_RAND_MAX = 0x0FFFFFFF;
 void pafsrand(unsigned int seed, int set = 0);
 unsigned int pafrand(int set = 0);
+// the same generator on a caller held state, for streams that must not
+// depend on what else has drawn numbers (e.g., one stream per search root)
+unsigned int pafrand(uint64& state);
 
 // a random number from 0 to 1
 inline double prandom(int set = 0)
 {
    return double(pafrand(set)) / double(PAF_RAND_MAX);
 }
+inline double prandom(uint64& state)
+{
+   return double(pafrand(state)) / double(PAF_RAND_MAX);
+}
 
 // a random number from 0 to just less than 1
 
@@ -76,6 +83,10 @@ inline double prandomr(int set = 0)
 {
    return double(pafrand(set)) / double(PAF_RAND_MAX + 1);
 }
+inline double prandomr(uint64& state)
+{
+   return double(pafrand(state)) / double(PAF_RAND_MAX + 1);
+}
 
 // note, in order to stop confusing myself I have ln defined:
 #define ln(X) log(X)
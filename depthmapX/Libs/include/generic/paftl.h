@@ -115,6 +115,30 @@ namespace paftl
 {
    enum add_t {ADD_UNIQUE, ADD_REPLACE, ADD_DUPLICATE, ADD_HERE};
    const size_t npos = size_t(-1);
+
+   // Binary search of the first length items of an ordered vector v, shared by the
+   // searchindex and lookupindex of pvector and pqvector.  probe is left at the last
+   // index looked at (which searchindex keeps as its current position), or untouched
+   // if there is nothing to search
+   template <class V, class T> size_t bisect(const V& v, size_t length, const T& item, size_t& probe)
+   {
+      if (length != 0) {
+         size_t ihere, ifloor = 0, itop = length - 1;
+         while (itop != npos && ifloor <= itop) {
+            probe = ihere = (ifloor + itop) / 2;
+            if (item == v.at(ihere)) {
+               return ihere;
+            }
+            else if (item > v.at(ihere)) {
+               ifloor = ihere + 1;
+            }
+            else {
+               itop = ihere - 1;
+            }
+         }
+      }
+      return npos;
+   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -386,8 +410,10 @@ void pmemvec<T>::grow(size_t pos)
       throw pexception( pexception::MEMORY_ALLOCATION, sizeof(T) * storage_size() );
 
    if (m_length) {
+      // (the gap at pos is left for the caller to fill)
       for (size_t i = 0; i < m_length + 1; i++)
-         new_data[i] = (i < pos) ? m_data[i] : m_data[i-1];
+         if (i != pos)
+            new_data[i] = (i < pos) ? m_data[i] : m_data[i-1];
    }
    if (m_data) {
       delete [] m_data;
@@ -490,6 +516,8 @@ public:
    size_t searchindex(const T& item) const;
    size_t searchfloorindex(const T& item) const;
    size_t searchceilindex(const T& item) const;
+   // as searchindex, but leaves the current position marker alone (so several threads may call it)
+   size_t lookupindex(const T& item) const;
    void remove(const T& item)
    { pmemvec<T>::remove_at(searchindex(item)); }
    // set operations (ordered vector)
@@ -566,22 +594,14 @@ const T& pvector<T>::search(const T& item) const
 template <class T>
 size_t pvector<T>::searchindex(const T& item) const
 {
-   if (pmemvec<T>::m_length != 0) {
-      size_t ihere, ifloor = 0, itop = pmemvec<T>::m_length - 1;
-      while (itop != paftl::npos && ifloor <= itop) {
-         m_current = ihere = (ifloor + itop) / 2;
-         if (item == at(ihere)) {
-            return m_current;
-         }
-         else if (item > at(ihere)) {
-            ifloor = ihere + 1;
-         }
-         else {
-            itop = ihere - 1;
-         }
-      }
-   }
-   return paftl::npos;
+   return paftl::bisect( *this, pmemvec<T>::m_length, item, m_current );
+}
+
+template <class T>
+size_t pvector<T>::lookupindex(const T& item) const
+{
+   size_t probe;
+   return paftl::bisect( *this, pmemvec<T>::m_length, item, probe );
 }
 
 template <class T>
@@ -1106,6 +1126,8 @@ public:
    T& search(const T& item);
    const T& search(const T& item) const;
    size_t searchindex(const T& item) const;
+   // as searchindex, but leaves the current position marker alone (so several threads may call it)
+   size_t lookupindex(const T& item) const;
    void remove(const T& item)
    { remove_at(searchindex(item)); }
    size_t add(const T& item, int type = paftl::ADD_UNIQUE);
@@ -1169,22 +1191,14 @@ const T& pqvector<T>::search(const T& item) const
 template <class T>
 size_t pqvector<T>::searchindex(const T& item) const
 {
-  if (pmemvec<T *>::size() != 0) {
-      size_t ihere, ifloor = 0, itop = pmemvec<T *>::size() - 1;
-      while (itop != paftl::npos && ifloor <= itop) {
-         m_current = ihere = (ifloor + itop) / 2;
-         if (item == prefvec<T>::at(ihere)) {
-            return m_current;
-         }
-         else if (item > prefvec<T>::at(ihere)) {
-            ifloor = ihere + 1;
-         }
-         else {
-            itop = ihere - 1;
-         }
-      }
-   }
-   return paftl::npos;
+   return paftl::bisect( (const prefvec<T>&) *this, pmemvec<T *>::size(), item, m_current );
+}
+
+template <class T>
+size_t pqvector<T>::lookupindex(const T& item) const
+{
+   size_t probe;
+   return paftl::bisect( (const prefvec<T>&) *this, pmemvec<T *>::size(), item, probe );
 }
 
 // Note: uses m_current set by searchindex
@@ -0,0 +1,117 @@
+// genlib - a component of the depthmapX - spatial network analysis platform
+// Copyright (C) 2011-2012, Tasos Varoudis
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Threading helpers for the analysis code
+//
+// Threads come from OpenMP.  Everything in here (and every omp pragma in the
+// libraries) falls back to plain serial code if the compiler is not asked for
+// OpenMP, so the analyses always build, they just run on one core.
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#include <time.h>
+#endif
+
+#include <generic/paftl.h>
+#include <generic/comm.h>
+
+// number of worker threads a parallel region will use
+inline int getThreadCount()
+{
+#ifdef _OPENMP
+   return omp_get_max_threads();
+#else
+   return 1;
+#endif
+}
+
+// wall clock seconds, for timing (only differences are meaningful)
+inline double wallTime()
+{
+#ifdef _OPENMP
+   return omp_get_wtime();
+#else
+   return double(time(NULL));
+#endif
+}
+
+// index of the calling thread within a parallel region (0 is the master)
+inline int getThreadNum()
+{
+#ifdef _OPENMP
+   return omp_get_thread_num();
+#else
+   return 0;
+#endif
+}
+
+// Progress and cancellation from inside a parallel loop
+//
+// Exceptions must not leave an omp region, and the communicator is not
+// thread safe, so: every worker counts its records here, but only the master
+// thread posts messages or looks at the cancel flag.  Once cancelled, the
+// workers should stop picking up new work (check isCancelled()), and the
+// caller throws the CancelledException after the parallel region has closed.
+
+class ParallelComm
+{
+protected:
+   Communicator *m_comm;
+   comm_time_t m_atime;
+   int m_count;
+   volatile bool m_cancelled;
+public:
+   ParallelComm(Communicator *comm, int num_records = -1)
+   {
+      m_comm = comm; m_atime = 0; m_count = 0; m_cancelled = false;
+      if (m_comm) {
+         qtimer( m_atime, 0 );
+         if (num_records != -1) {
+            m_comm->CommPostMessage( Communicator::NUM_RECORDS, num_records );
+         }
+      }
+   }
+   // call once a record has been completed (from any thread)
+   void record(int n = 1)
+   {
+#ifdef _OPENMP
+      #pragma omp atomic
+#endif
+      m_count += n;
+      if (m_comm && getThreadNum() == 0 && qtimer( m_atime, 500 )) {
+         if (m_comm->IsCancelled()) {
+            m_cancelled = true;
+         }
+         else {
+            m_comm->CommPostMessage( Communicator::CURRENT_RECORD, m_count );
+         }
+      }
+   }
+   bool isCancelled() const
+   { return m_cancelled; }
+   int getCount() const
+   { return m_count; }
+   // call from serial code, after the parallel region
+   void throwIfCancelled() const
+   { if (m_cancelled) throw Communicator::CancelledException(); }
+};
+
+#endif
@@ -22,6 +22,11 @@
 // it's slow to look for a column, since you have to find the column
 // by name, but other than that it's fairly easy
 
+// The values are stored by column: each physical column is one contiguous
+// float array in row order, and the rows are found through a sorted list of
+// their keys.  Adding a column is then a single allocation, and anything that
+// runs down a column (ranges, totals, indexing) is a straight sweep of memory
+
 // helpers... local sorting routines
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -94,7 +99,8 @@ struct OrderedIntPair
 
 ////////////////////////////////////////////////////////////////////////////////
 
-class AttributeRow : public pvector<float>
+// the state of a row other than its values (which are held by column)
+class AttributeRow
 {
    friend class AttributeTable;
 protected:
@@ -107,7 +113,6 @@ protected:
 public:
    AttributeRow()
       { m_selected = false; m_layers = 1; }
-   void init(size_t length);
    //
    // For SalaScript
    void setMark(SalaObj& mark)
@@ -212,12 +217,17 @@ inline bool operator < (const AttributeColumn& a, const AttributeColumn& b)
 inline bool operator > (const AttributeColumn& a, const AttributeColumn& b)
 { return a.m_name > b.m_name; }
 
-class AttributeTable : protected pqmap<int,AttributeRow>
+class AttributeTable
 {
+   friend class AttributeColumnWriter;
 protected:
    pstring m_name;
    pqvector<AttributeColumn> m_columns;
-   pqmap<int,AttributeRow> m_data;
+   // values, one array per physical column, each in row order:
+   prefvec<pvecfloat> m_data;
+   // row keys (sorted) and the other row state, also in row order:
+   pvecint m_keys;
+   pvector<AttributeRow> m_rows;
    // display parameters for the reference id column
    DisplayParams m_ref_display_params;
    //
@@ -236,16 +246,19 @@ public:
    int insertColumn(const pstring& name = pstring());
    void removeColumn(int col);
    int renameColumn(int col, const pstring& name = pstring());
+   // (rows are cheapest added in key order, when each is appended to the columns: one
+   // out of order moves the rows after it in every column, so use insertRows for many)
    int insertRow(int key);
+   void insertRows(const pvecint& keys);
    void removeRow(int key);
-   void removeRowids(const pvecint& list)
-      { remove_at(list); }
+   void removeRowids(const pvecint& list);
    //
    // note... retrieves from column index (which are sorted by name), not physical column
+   // (getColumnIndex and getRowid do not move the search cursors, so scripts running on several threads may call them)
    const pstring& getColumnName(int col) const
       { return col != -1 ? m_columns[col].m_name : g_ref_number_name; } 
    int getColumnIndex(const pstring& name) const
-      { size_t index = m_columns.searchindex(name); return (index == paftl::npos) ? -1 : int(index);} // note use -1 rather than paftl::npos for return value
+      { size_t index = m_columns.lookupindex(name); return (index == paftl::npos) ? -1 : int(index);} // note use -1 rather than paftl::npos for return value
    int getColumnCount() const
       { return (int) m_columns.size(); }
    int getOrInsertColumnIndex(const pstring& name)
@@ -253,56 +266,62 @@ public:
    int getOrInsertLockedColumnIndex(const pstring& name) 
       { size_t col = m_columns.searchindex(name); if (col == paftl::npos) return insertLockedColumn(name); else return (int) col; }
    bool isValidColumn(const pstring& name) const
-      { return m_columns.searchindex(name) != paftl::npos || name == g_ref_number_name; }
+      { return m_columns.lookupindex(name) != paftl::npos || name == g_ref_number_name; }
    //
    int getRowKey(int index) const
-      { return key(index); }
+      { return m_keys[index]; }
    int getRowid(const int key) const
-      { size_t i = searchindex(key); return (i == paftl::npos) ? -1 : int(i);} // note use -1 rather than paftl::npos for return value
+      { size_t i = m_keys.lookupindex(key); return (i == paftl::npos) ? -1 : int(i);} // note use -1 rather than paftl::npos for return value
    int getRowCount() const
-      { return (int) size(); }
+      { return (int) m_keys.size(); }
    int getVisibleRowCount() const
       { return m_visible_size; }
    int getMaxRowKey() const 
-      { return key(size()-1); }
+      { return m_keys.tail(); }
    // this version uses known row and col indices
    float getValue(int row, int col) const
-      { return col != -1 ? value(row).at(m_columns[col].m_physical_col) : key(row); }
+      { return col != -1 ? m_data[m_columns[col].m_physical_col][row] : m_keys[row]; }
    // this version is meant to use row key and col name
    float getValue(int row, const pstring& name) const
-      { int col = getColumnIndex(name); return col != -1 ? value(row).at(m_columns[col].m_physical_col) : key(row); }
+      { int col = getColumnIndex(name); return col != -1 ? m_data[m_columns[col].m_physical_col][row] : m_keys[row]; }
    float getNormValue(int row, int col) const
-      { return col != -1 ? m_columns[col].makeNormValue(value(row).at(m_columns[col].m_physical_col)) : (float) (double(getRowKey(row))/double(getRowKey(int(size()-1)))); }
+      { return col != -1 ? m_columns[col].makeNormValue(m_data[m_columns[col].m_physical_col][row]) : (float) (double(getRowKey(row))/double(getMaxRowKey())); }
    void setValue(int row, int col, float val)
-      { value(row).at(m_columns[col].m_physical_col) = val; m_columns[col].setValue(val); }
+      { m_data[m_columns[col].m_physical_col][row] = val; m_columns[col].setValue(val); }
    void setValue(int row, const pstring& name, float val) 
       { int col = getColumnIndex(name); if (col != -1) setValue(row,col,val); }
    void changeValue(int row, int col, float val)
-      { float& theval = value(row).at(m_columns[col].m_physical_col); m_columns[col].changeValue(theval,val); theval = val; }
+      { float& theval = m_data[m_columns[col].m_physical_col][row]; m_columns[col].changeValue(theval,val); theval = val; }
    void changeValue(int row, const pstring& name, float val) 
       { int col = getColumnIndex(name); if (col != -1) changeValue(row,col,val); }
    void changeSelValues(int col, float val) 
-      { for (size_t i = 0; i < size(); i++) { if (value(i).m_selected) changeValue((int)i,col,val);} }
+      { for (size_t i = 0; i < m_rows.size(); i++) { if (m_rows[i].m_selected) changeValue((int)i,col,val);} }
    void incrValue(int row, int col, float amount = 1.0f) 
-      { float& v = value(row).at(m_columns[col].m_physical_col); v = (v == -1.0f) ? amount : v+amount ; m_columns[col].changeValue(v-amount,v); }
+      { float& v = m_data[m_columns[col].m_physical_col][row]; v = (v == -1.0f) ? amount : v+amount ; m_columns[col].changeValue(v-amount,v); }
    void incrValue(int row, const pstring& name, float amount = 1.0f) 
       { int col = getColumnIndex(name);  if (col != -1) incrValue(row,col,amount); }
    void decrValue(int row, int col, float amount = 1.0f) 
-      { float& v = value(row).at(m_columns[col].m_physical_col); v = (v != -1.0f) ? v-amount : -1.0f; m_columns[col].changeValue(v+amount,v); }
+      { float& v = m_data[m_columns[col].m_physical_col][row]; v = (v != -1.0f) ? v-amount : -1.0f; m_columns[col].changeValue(v+amount,v); }
    void decrValue(int row, const pstring& name, float amount = 1.0f) 
       { int col = getColumnIndex(name);  if (col != -1) decrValue(row,col,amount); }
    void setColumnValue(int col, float val);
+   // add the values of the flagged rows into the column range and total, in row order,
+   // exactly as if each had been set with setValue
+   void updateColumnInfo(int col, const pvector<bool>& rows);
+   // the whole column as one array in row order (NULL if there are no rows)
+   const float *getColumnValues(int col) const
+      { const pvecfloat& data = m_data[m_columns[col].m_physical_col]; return data.size() ? &(data[0]) : NULL; }
    double getMinValue(int col) const
-      { return col != -1 ? m_columns[col].getMinValue() : key(0); }
+      { return col != -1 ? m_columns[col].getMinValue() : m_keys.head(); }
    double getMaxValue(int col) const
-      { return col != -1 ? m_columns[col].getMaxValue() : key(size()-1); }
+      { return col != -1 ? m_columns[col].getMaxValue() : m_keys.tail(); }
    double getAvgValue(int col) const
       { return col != -1 ? m_columns[col].getTotValue() / double(getRowCount()) : -1.0; }
    //
    double getVisibleMinValue(int col) const
-      { return col != -1 ? m_columns[col].getVisibleMinValue() : key(0); }
+      { return col != -1 ? m_columns[col].getVisibleMinValue() : m_keys.head(); }
    double getVisibleMaxValue(int col) const
-      { return col != -1 ? m_columns[col].getVisibleMaxValue() : key(size()-1); }
+      { return col != -1 ? m_columns[col].getVisibleMaxValue() : m_keys.tail(); }
    double getVisibleAvgValue(int col) const
       { return col != -1 ? m_columns[col].getVisibleTotValue() / double(getVisibleRowCount()) : -1.0; }
    //
@@ -324,9 +343,9 @@ public:
    //
    // For SalaScript:
    void setMark(int row, SalaObj& mark) 
-      { value(row).setMark(mark); }
+      { m_rows[row].setMark(mark); }
    const SalaObj& getMark(int row) const
-      { return value(row).getMark(); }
+      { return m_rows[row].getMark(); }
 protected:
    // Selection:
    mutable int m_sel_count;
@@ -340,7 +359,7 @@ public:
    double getSelAvg() const
    { return m_sel_value / m_sel_count; }
    bool isSelected(int index) const
-   { return value(index).m_selected; }
+   { return m_rows[index].m_selected; }
    // Display:
    mutable int m_display_column;
    mutable AttributeIndex m_display_index;
@@ -360,20 +379,21 @@ public:
    void setLayerVisible(int layer, bool show);
    //
    bool isVisible(int row) const
-      { return (m_visible_layers & (at(row).m_layers)) != 0; }
+      { return (m_visible_layers & (m_rows[row].m_layers)) != 0; }
    //
    void setDisplayColumn(int col, bool override = false) const;
    const int getDisplayColumn() const
       { return m_display_column; }
    const int getDisplayPos(int index) const
-      { return at(index).m_display_info.index; }
+      { return m_rows[index].m_display_info.index; }
    const int getDisplayColor(int row) const
-      { PafColor color; return at(row).m_selected ? PafColor(SALA_SELECTED_COLOR) : color.makeColor(at(row).m_display_info.value,m_display_params); }
+      { PafColor color; return m_rows[row].m_selected ? PafColor(SALA_SELECTED_COLOR) : color.makeColor(m_rows[row].m_display_info.value,m_display_params); }
+   // (a key with no row is shown as having no value)
    const int getDisplayColorByKey(int key) const
-      { PafColor color; return color.makeColor(search(key).m_display_info.value,m_display_params); }
+      { size_t i = m_keys.lookupindex(key); PafColor color; return color.makeColor(i != paftl::npos ? m_rows[i].m_display_info.value : -1.0f,m_display_params); }
    // this also doubles up to reset the selection total:
    void setDisplayInfo(int row, ValuePair vp) const
-      { at(row).m_display_info = vp; if (at(row).m_selected) addSelValue((double)vp.value); }
+      { m_rows[row].m_display_info = vp; if (m_rows[row].m_selected) addSelValue((double)vp.value); }
    //
    // set display params for all attributes in table
    void setDisplayParams(const DisplayParams& dp);
@@ -385,7 +405,7 @@ public:
 public:
    // misc
    void clear()  // <- totally destroy, not just clear values
-   { m_columns.clear(); pqmap<int,AttributeRow>::clear(); }
+   { m_columns.clear(); m_data.clear(); m_keys.clear(); m_rows.clear(); }
    //
    void setName(const pstring& name)
    { m_name = name; }
@@ -395,6 +415,11 @@ public:
    // read / write
    bool read( ifstream& stream, int version );
    bool write( ofstream& stream, int version );
+   // the layers alone (as at the start of the table, and in the map directory)
+   void readLayers( istream& stream );
+   void writeLayers( ostream& stream ) const;
+   const pqmap<int64,pstring>& getLayers() const
+   { return m_layers; }
    //
    bool outputHeader( ostream& stream, char delim = '\t', bool updated_only = false ) const;
    bool outputRow( int row, ostream& stream, char delim = '\t', bool updated_only = false ) const;
@@ -403,4 +428,51 @@ public:
    bool importTable(istream& stream, bool merge);
 };
 
+// What a list of maps (such as the tree view) shows of a map.  From VERSION_MAP_SUMMARY
+// it is also kept in the map directory of the file, so that a map which has not been
+// read in yet can be listed without reading it
+struct MapSummary
+{
+   pstring m_name;
+   int m_type;    // the shape map type (-1 for a point map)
+   bool m_editable;
+   int64 m_visible_layers;
+   pqmap<int64,pstring> m_layers;
+   MapSummary(const pstring& name = pstring(), int type = -1, bool editable = false)
+   { m_name = name; m_type = type; m_editable = editable; m_visible_layers = 0; }
+   int getLayerCount() const
+   { return (int) m_layers.size(); }
+   pstring getLayerName(int layer) const
+   { return m_layers.value(layer); }
+   bool isLayerVisible(int layer) const
+   { return ((m_layers.key(layer) & m_visible_layers) != 0); }
+};
+
+// Writes a column in one go: the values are put straight into the column by
+// row index, and the column range and total are only worked out on commit
+// (from the rows written, so they come out as they would through setValue).
+// Threads may share a writer as long as they write different rows, but rows
+// must not be added to or removed from the table while a writer is open.
+// A writer for column -1 (e.g., a column that was not made) ignores its values.
+// A "change" writer is for updating a column that already holds values: each value
+// replaces the old one straight away, as AttributeTable::changeValue, so it must
+// only be written from one thread
+class AttributeColumnWriter
+{
+protected:
+   AttributeTable *m_table;
+   int m_col;
+   bool m_change;
+   float *m_values;
+   pvector<bool> m_written;
+public:
+   AttributeColumnWriter(AttributeTable& table, int col, bool change = false);
+   void setValue(int row, float val)
+      { if (m_change) { m_table->changeValue(row, m_col, val); } else if (m_values) { m_values[row] = val; m_written[row] = true; } }
+   float getValue(int row) const
+      { return m_values[row]; }
+   void commit()
+      { if (m_col != -1 && !m_change) m_table->updateColumnInfo(m_col, m_written); }
+};
+
 #endif
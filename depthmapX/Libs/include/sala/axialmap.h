@@ -170,6 +170,34 @@ struct AnalysisInfo
    }
 };
 
+// AnalysisInfo split in two for searches run in parallel: the audit trail of the
+// current root, and the choice totals built up over all the roots (each thread
+// of analyseTulip keeps one of each)
+
+struct AuditInfo
+{
+   bool leaf;
+   bool choicecovered;
+   SegmentRef previous;
+   int depth;
+   AuditInfo() {
+      clearLine();
+   }
+   void clearLine() {
+      choicecovered = false; leaf = true; previous = SegmentRef(); depth = 0;
+   }
+};
+
+struct ChoiceInfo
+{
+   double choice;
+   double weighted_choice;
+   double weighted_choice2; //EFEF
+   ChoiceInfo() {
+      choice = 0.0; weighted_choice = 0.0; weighted_choice2 = 0.0;
+   }
+};
+
 class MapInfoData;
 
 class ShapeGraph : public ShapeMap
@@ -191,14 +219,14 @@ public:
    //void initAttributes();
    void makeDivisions(const prefvec<PolyConnector>& polyconnections, const pqvector<RadialLine>& radiallines, pqmap<RadialKey,pvecint>& radialdivisions, pqmap<int,pvecint>& axialdividers, Communicator *comm);
    void cutLines(const prefvec<Line>& lines, pqmap<int,pvecint>& axcuts);
-   bool integrate(Communicator *comm = NULL, const pvecint& radius = pvecint(), bool choice = false, bool local = false, bool fulloutput = false, int weighting_col = -1, bool simple_version = true);
+   bool integrate(Communicator *comm = NULL, const pvecint& radius = pvecint(), bool choice = false, bool local = false, bool fulloutput = false, int weighting_col = -1, bool simple_version = true, bool exact_choice = false);
    bool stepdepth(Communicator *comm = NULL);
    bool analyseAngular(Communicator *comm, const pvecdouble& radius);
    // extra parameters for selection_only and interactive are for parallel process extensions
-   int analyseTulip(Communicator *comm, int tulip_bins, bool choice, int radius_type, const pvecdouble& radius, int weighting_col, int weighting_col2 = -1, int routeweight_col = -1, bool selection_only = false, bool interactive = true);
+   int analyseTulip(Communicator *comm, int tulip_bins, bool choice, int radius_type, const pvecdouble& radius, int weighting_col, int weighting_col2 = -1, int routeweight_col = -1, bool selection_only = false, bool interactive = true, bool exact_choice = false);
    bool angularstepdepth(Communicator *comm);
    // the two topomet analyses can be found in topomet.cpp:
-   bool analyseTopoMet(Communicator *comm, int analysis_type, double radius, bool sel_only);
+   bool analyseTopoMet(Communicator *comm, int analysis_type, double radius, bool sel_only, bool exact_choice = false);
    bool analyseTopoMetPD(Communicator *comm, int analysis_type);
    // lineset and connectionset are filled in by segment map
    void makeNewSegMap();
@@ -242,7 +270,7 @@ public:
    bool hasAllLineMap()
    { return m_all_line_map != -1; }
    //
-   bool read( ifstream& stream, int version );
+   bool read( ifstream& stream, int version, const pstring& deferred_file = pstring() );
    bool readold( ifstream& stream, int version );
    bool write( ofstream& stream, int version, bool displayedmaponly = false );
 };
@@ -88,6 +88,8 @@ struct Connector
    enum { CONN_ALL, SEG_CONN_ALL, SEG_CONN_FW, SEG_CONN_BK };
    int count(int mode = CONN_ALL) const;
    int cursor(int mode = CONN_ALL) const;
+   // as the cursor, but for the ith connection (so it may be used from many threads at once)
+   int getConnection(int i, int mode = CONN_ALL) const;
    int direction(int mode = SEG_CONN_ALL) const;
    float weight(int mode = SEG_CONN_ALL) const;
    void first() const { m_cursor = 0; }
@@ -21,10 +21,25 @@
 // Interface: the meta graph loads and holds all sorts of arbitrary data...
 
 // Current metagraph version
-const int METAGRAPH_VERSION = 440;
+const int METAGRAPH_VERSION = 454;
 
 // Human readable(ish) metagraph version changes
 
+// 17-Oct-2026 The map directory also lists what the tree view shows of each map (see MapSummary)
+const int VERSION_MAP_SUMMARY                   = 454;
+
+// 17-Oct-2026 Map blocks start aligned, so a map not read in can be copied into a new file as it stands
+const int VERSION_ALIGNED_MAPS                  = 453;
+
+// 17-Oct-2026 Sections may be compressed
+const int VERSION_COMPRESSED_SECTIONS           = 452;
+
+// 17-Oct-2026 Maps listed by name and length, so they can be loaded on demand
+const int VERSION_MAP_DIRECTORY                 = 451;
+
+// 17-Oct-2026 Attribute columns, point grid and packed graph stored as aligned sections
+const int VERSION_ALIGNED_SECTIONS              = 450;
+
 const int VERSION_ALWAYS_RECORD_BINDISTANCES    = 440;
 
 // 17-Aug-2010 Version stamp for Depthmap 10.08.00
@@ -188,6 +203,8 @@ public:
    enum { NOT_EDITABLE = 0, EDITABLE_OFF = 1, EDITABLE_ON = 2 };
 protected:
    int m_file_version;
+   // the file any maps not yet loaded are still in:
+   pstring m_deferred_file;
    int m_state;
    void *m_lock;
 public:
@@ -508,6 +525,8 @@ public:
    AgentEngine& getAgentEngine()
    { return m_agent_engine; }
    void runAgentEngine(Communicator *comm);
+   // evolves programs from the engine's current one (the engine must have a gate layer)
+   bool runAgentEvolution(Communicator *comm, int generations, unsigned int seed, const pstring& filename);
    //
 public:
    // thru vision
@@ -530,8 +549,10 @@ public:
    // a few read-write returns:
    enum { OK, WARN_BUGGY_VERSION, WARN_CONVERTED, NOT_A_GRAPH, DAMAGED_FILE, DISK_ERROR, NEWER_VERSION, DEPRECATED_VERSION };
    // likely to use communicator if too slow...
-   int read( const pstring& filename );
-   int write( const pstring& filename, int version, bool currentlayer = false);
+   // lazy: only the displayed maps are read in full, the others as they are first used
+   int read( const pstring& filename, bool lazy = false );
+   // compress: compress the larger sections (from VERSION_COMPRESSED_SECTIONS)
+   int write( const pstring& filename, int version, bool currentlayer = false, bool compress = false );
    //
 protected:
    pqvector<AttrBody> *m_attr_conv_table;
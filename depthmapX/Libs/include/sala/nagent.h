@@ -125,6 +125,17 @@ class Agent;
 
 const int MAX_TRAILS = 50;
 
+// counts made by moving agents, by packed graph node (so a step needs no attribute
+// row lookup): the agents moving on each thread count into their own, and these are
+// added into the table at the end
+struct AgentCounts
+{
+   const pvecint *m_gates;    // the gate of each node, shared by all the threads (if counting gates)
+   pvecint m_counts;
+   pvecint m_gate_counts;
+   void init(int nodes, const pvecint *gates);
+};
+
 class AgentEngine : public prefvec<AgentSet>
 {
 public: // public for now for speed
@@ -133,6 +144,8 @@ public: // public for now for speed
 public:
    bool m_record_trails;
    int m_trail_count;
+   // the same seed gives the same run, however many threads move the agents
+   unsigned int m_seed;
 public:
    AgentEngine();
    void run(Communicator *comm, PointMap *pointmap);
@@ -179,6 +192,7 @@ struct AgentProgram
    AgentProgram();
    //
    // for evolution
+   void randomise();
    void mutate();
    friend AgentProgram crossover(const AgentProgram& prog_a, const AgentProgram& prog_b);
    // to reload later:
@@ -186,16 +200,6 @@ struct AgentProgram
    bool open(const pstring& filename);
 };
 
-struct AgentSet : public AgentProgram, public prefvec<Agent>
-{
-   pvecint m_release_locations;
-   double m_release_rate;
-   int m_lifetime;
-   AgentSet();
-   void move();
-   void init(int agent, int trail_num = -1);
-};
-
 const int POPSIZE = 500;
 // redo ASSAYs -- assaysize * assays (3 * 200 = 600 evaluations total)
 // then take mean fitness: due to large variation in fitnesses with
@@ -205,6 +209,11 @@ const int ASSAYSIZE = 25000;
 const int GENERATIONS = 10000;
 const int TIMESTEPS = 1600;
 
+// Evolution: every program in a generation is assessed at once, each on its own thread
+// with its own random stream, against the one point map (which must hold the gates in
+// g_col_gate, as for an agent engine run with a gate layer).  A program's fitness is
+// the proportion of its agents who cross into a gate within TIMESTEPS steps
+
 struct ProgramPopulation
 {
 public:
@@ -213,6 +222,14 @@ public:
    ProgramPopulation() {;}
    AgentProgram *makeChild();
    void sort();
+   // programs like prog, but with random rules
+   void init(const AgentProgram& prog);
+   void evaluate(Communicator *comm, PointMap *pointmap, uint64 seed);
+   // replaces the bottom half of the (sorted) population with children of the top half
+   void breed();
+   // the best program is saved to filename after every generation, and the times
+   // taken are written to log (if given)
+   void evolve(Communicator *comm, PointMap *pointmap, int generations, unsigned int seed, const pstring& filename, ostream *log = NULL);
 };
 
 class Agent
@@ -250,11 +267,20 @@ protected:
    // extra memory of last observed values for Gibsonian agents:
    float m_last_los[9];
    float m_curr_los[9];
+   //
+   // every agent draws from its own random stream, so it moves the same whichever thread moves it
+   uint64 m_rand;
 public:
    Agent()
-   { m_program = NULL; m_pointmap = NULL; m_output_mode = OUTPUT_NOTHING; }
+   { m_program = NULL; m_pointmap = NULL; m_output_mode = OUTPUT_NOTHING; m_rand = 0; }
+   // (this one seeds the agent's stream from the shared generator)
    Agent(AgentProgram *program, PointMap *pointmap, int output_mode = OUTPUT_NOTHING);
-   void onInit(PixelRef node, int trail_num = -1);
+   Agent(AgentProgram *program, PointMap *pointmap, int output_mode, uint64 seed);
+   // sets a pooled agent up again in place, as the constructor (its occlusion memory is
+   // emptied but keeps its buffers)
+   void reset(AgentProgram *program, PointMap *pointmap, int output_mode, uint64 seed);
+   // gates are read from counts if given (else from the attribute table)
+   void onInit(PixelRef node, int trail_num = -1, const AgentCounts *counts = NULL);
    void onClose();
    Point2f onLook(bool wholeisovist);
    Point2f onStandardLook(bool wholeisovist);
@@ -267,7 +293,8 @@ public:
    int onGibsonianRule(int rule);
    void calcLoS(int directionbin, bool curr);
    void calcLoS2(int directionbin, bool curr);
-   void onMove();
+   // counts are only made if a counts array is given
+   void onMove(AgentCounts *counts = NULL);
    void onTarget();
    void onDestination();
    void onStep();
@@ -293,14 +320,43 @@ public:
    { return *m_pointmap; }
 };
 
+// The agents of a set are held in place in one array (the pool): when an agent expires its
+// slot goes on the free list, and the next agent released is set up in that slot in place,
+// so nothing is shifted or reallocated as agents come and go (clear frees every slot, but
+// keeps the pool).  The slots in use are listed in release order
+
+struct AgentSet : public AgentProgram
+{
+   pvecint m_release_locations;
+   double m_release_rate;
+   int m_lifetime;
+protected:
+   pvector<Agent> m_agents;
+   pvecint m_live;
+   pvecint m_free;
+public:
+   AgentSet();
+   // makes an agent of this set, in a freed slot if there is one, and returns the slot
+   int add(PointMap *pointmap, int output_mode, uint64 seed);
+   // rand is the release stream: which agents start where
+   void init(int slot, uint64& rand, int trail_num = -1, const AgentCounts *counts = NULL);
+   void removeExpired();
+   void clear();
+   //
+   size_t liveCount() const
+   { return m_live.size(); }
+   Agent& live(size_t i)
+   { return m_agents[m_live[i]]; }
+};
+
 // note the add 0.5 means angles from e.g., -1/32 to 1/32 are in bin 0
 inline int binfromvec(const Point2f& p)
 { return int(32.0 * (0.5 * p.angle() / M_PI) + 0.5); }
 
 // a random angle based on a bin direction
-inline double anglefrombin2(int here)
+inline double anglefrombin2(int here, uint64& rand)
 {
-   return (2.0 * M_PI) * ((double(here)-0.5)/32.0 + prandom()/32.0);
+   return (2.0 * M_PI) * ((double(here)-0.5)/32.0 + prandom(rand)/32.0);
 }
 
 inline int binsbetween(int bin1, int bin2)
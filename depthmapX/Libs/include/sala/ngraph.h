@@ -23,6 +23,7 @@
 class PointMap;
 struct MetricPair;
 struct MetricTriple;
+struct AngularTriple;
 
 struct PixelVec
 {
@@ -41,9 +42,64 @@ struct PixelVec
    ofstream& write(ofstream& stream, const char dir, const PixelVec& context);
 };
 
+// The per search state of the points (the seen register and extent used by
+// extractUnseen, and the distance and cumulative angle of the metric and angular
+// searches), kept apart from the points (Point::m_misc, m_extent, m_dist and
+// m_cumangle) so that several searches can run at once.  Each search owns one, and
+// reset() clears it for the next search without touching the whole grid: cells are
+// only initialised once they are looked at
+
+class SearchMarks
+{
+public:
+   struct Mark {
+      unsigned int m_stamp;
+      int m_misc;
+      PixelRef m_extent;
+      float m_dist;
+      float m_cumangle;
+   };
+protected:
+   int m_rows;
+   int m_size;
+   unsigned int m_generation;
+   float m_cumangle;
+   Mark *m_marks;
+public:
+   SearchMarks()
+   { m_rows = 0; m_size = 0; m_generation = 1; m_cumangle = 0.0f; m_marks = NULL; }
+   SearchMarks(const SearchMarks&) 
+   { throw 1; }
+   SearchMarks& operator = (const SearchMarks&)
+   { throw 1; }
+   ~SearchMarks()
+   { clear(); }
+   //
+   void init(int cols, int rows);
+   void clear();
+   // cumangle is the angle cells start with (the angular search uses -1 for unset)
+   void reset(float cumangle = 0.0f)
+   { m_cumangle = cumangle;
+     if (++m_generation == 0) { for (int i = 0; i < m_size; i++) m_marks[i].m_stamp = 0; m_generation = 1; } }
+   //
+   Mark& mark(const PixelRef p)
+   { Mark& m = m_marks[p.x * m_rows + p.y];
+     if (m.m_stamp != m_generation) { m.m_stamp = m_generation; m.m_misc = 0; m.m_extent = p; m.m_dist = -1.0f; m.m_cumangle = m_cumangle; }
+     return m; }
+   int& misc(const PixelRef p)
+   { return mark(p).m_misc; }
+   PixelRef& extent(const PixelRef p)
+   { return mark(p).m_extent; }
+   float& dist(const PixelRef p)
+   { return mark(p).m_dist; }
+   float& cumangle(const PixelRef p)
+   { return mark(p).m_cumangle; }
+};
+
 class Bin
 {
    friend class Node;
+   friend class PackedGraph;
 protected:
    char m_dir;
    unsigned short m_length;
@@ -85,6 +141,8 @@ protected:
    mutable PixelRef m_curpix;
 public:
    void contents(PixelRefList& hood);
+   // adds the pixels in iterator order, but without the cursor (so it may be used from many threads at once)
+   void appendContents(PixelRefList& pixels) const;
    void first() const;
    void next() const;
    bool is_tail() const;
@@ -98,6 +156,7 @@ public:
 
 class Node
 {
+   friend class PackedGraph;
 protected:
    PixelRef m_pixel;
    Bin m_bins[32];
@@ -149,6 +208,8 @@ protected:
    mutable int m_curbin;
 public:
    void contents(PixelRefList& hood) const;
+   // adds the pixels in iterator order, but without the cursor (so it may be used from many threads at once)
+   void appendContents(PixelRefList& pixels) const;
    void first() const;
    void next() const;
    bool is_tail() const;
@@ -160,6 +221,79 @@ public:
    friend ostream& operator << (ostream& stream, const Node& node);
 };
 
+// The graph in a packed, read only form for the analyses
+//
+// Each Bin keeps its runs (PixelVecs) in an allocation of its own, so walking a large
+// graph chases a pointer per bin.  Here the runs of every bin are held in one array,
+// node after node and bin after bin, and each bin has an offset into it (so the
+// runs of bin b of node n are m_vecs[m_bin_starts[n*32+b]] up to m_bin_starts[n*32+b+1]).
+// It is copied from the nodes once the graph is made and not changed afterwards,
+// so any number of searches may read it at once.  The nodes themselves are kept,
+// as they are what is saved, edited and drawn
+//
+// For the agents, who pick a random pixel from a fan of bins at every look, each bin
+// and each run also know how many pixels come before them (in the node and in the
+// bin), so the index'th pixel of a fan is found without walking the pixels before it
+
+class PackedGraph
+{
+protected:
+   int m_rows;
+   pvecint m_node_refs;             // per grid cell (x * rows + y), -1 where there is no node
+   pvector<PixelRef> m_pixels;      // per node
+   pvecint m_bin_starts;            // per bin, plus an end marker
+   pvector<char> m_dirs;            // per bin
+   pvector<unsigned short> m_counts;// per bin
+   pvecfloat m_distances;           // per bin
+   pvector<PixelVec> m_vecs;
+   // not saved, remade from the above:
+   pvecint m_count_starts;          // per bin, the pixels in the node's bins before it
+   pvecint m_vec_starts;            // per run, the pixels in the bin's runs before it
+   void addCountStarts(int node);
+public:
+   PackedGraph()
+   { m_rows = 0; }
+   //
+   void init(int cols, int rows);
+   void addNode(const PixelRef pix, const Node& node);
+   void clear();
+   // remakes the bins of a node from its packed copy (the occlusion bins are not packed)
+   void unpackNode(int node, Node& dest) const;
+   //
+   // the arrays are saved as they are, as aligned sections (see filesection.h)
+   istream& read(istream& stream, int cols, int rows);
+   ostream& write(ostream& stream) const;
+   //
+   bool contains(const PixelRef pix) const
+   { return m_node_refs[pix.x * m_rows + pix.y] != -1; }
+   // nodes are numbered 0 to nodeCount() - 1, for searches that keep their state by node
+   int nodeCount() const
+   { return (int) m_pixels.size(); }
+   int nodeRef(const PixelRef pix) const
+   { return m_node_refs[pix.x * m_rows + pix.y]; }
+   PixelRef nodePixel(int node) const
+   { return m_pixels[node]; }
+   int binCount(const PixelRef pix, int bin) const
+   { return m_counts[m_node_refs[pix.x * m_rows + pix.y] * 32 + bin]; }
+   float binDistance(const PixelRef pix, int bin) const
+   { return m_distances[m_node_refs[pix.x * m_rows + pix.y] * 32 + bin]; }
+   // the index'th pixel met walking the bin (as Bin::first / next would)
+   PixelRef binPixel(const PixelRef pix, int bin, int index) const;
+   // the same for a fan of bins, firstbin onwards (wrapping round at 32), as an agent looks
+   int fanCount(const PixelRef pix, int firstbin, int bins) const;
+   PixelRef fanPixel(const PixelRef pix, int firstbin, int index) const;
+   //
+   void extractUnseen(const PixelRef pix, PixelRefList& pixels, SearchMarks& marks) const;
+   // bit parallel search step: ors the node's bits (words long) into the next bits of every
+   // node it can see, noting any whose next bits were empty in touched
+   void spreadBits(int node, const uint64 *bits, int words, uint64 *next, pvecint& touched) const;
+   void extractMetric(pqvector<MetricTriple>& pixels, PointMap *pointdata, const MetricTriple& curs) const;
+   // as above, but with the search state in marks, pushing onto a binary heap (see analyseMetric)
+   void extractMetric(pvector<MetricTriple>& heap, const PointMap *pointdata, const MetricTriple& curs, SearchMarks& marks) const;
+   void extractAngular(pqvector<AngularTriple>& pixels, PointMap *pointdata, const AngularTriple& curs) const;
+   void extractAngular(pvector<AngularTriple>& heap, const PointMap *pointdata, const AngularTriple& curs, SearchMarks& marks) const;
+};
+
 // Two little helpers:
 
 class PixelRefH : public PixelRef
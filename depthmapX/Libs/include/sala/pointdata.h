@@ -41,12 +41,32 @@ protected:
 
 class Bin;
 class Node;
+class PackedGraph;
 class Isovist;
 
 struct PixelVec;
 
+// The parts of a point that only a few points use (the lines through the point, which
+// are only there while the graph is made), or that are only kept for reading old files,
+// held apart from the point so that a point in the grid is as small as possible
+
+struct PointExtra
+{
+   pqmap<int,Line> m_lines;
+   AttrBody *m_attributes;        // deprecated: now PointMap has an attribute table to handle this
+   pmap<int,int> m_data_objects;  // deprecated: (first int is data layer -- presumably the KEY not the index, second int is object ref)
+   void *m_user_data;             // for user processing, set their own data on the point
+   PointExtra()
+      { m_attributes = NULL; m_user_data = NULL; }
+   ~PointExtra();
+};
+
+// the lines through a point without any
+extern const pqmap<int,Line> g_no_point_lines;
+
 class Point {
    friend class Bin;
+   friend class PackedGraph;
    friend class PointMap;
    friend class MetaGraph; // <- for file conversion routines
    friend class PafAgent;
@@ -76,20 +96,18 @@ protected:
    PixelRef m_extent;       // used to speed up graph analysis (not sure whether or not it breaks it!)
    float m_dist;            // used to speed up metric analysis
    float m_cumangle;        // cummulative angle -- used in metric analysis and angular analysis
+   // and when dynamic lines are being used, the process flag tells you which q octants to reprocess:
+   int m_processflag;
    // hmm... this is for my 3rd attempt at a quick line intersect algo:
    // every line that goes through the gridsquare -- memory intensive I know, but what can you do:
    // accuracy is imperative here!  Calculated pre-fillpoints / pre-makegraph, and (importantly) it works.
-   pqmap<int,Line> m_lines; 
-   // and when dynamic lines are being used, the process flag tells you which q octants to reprocess:
-   //
-   // Deprecated, kept for compatibility with previous versions:
-   AttrBody *m_attributes;  // deprecated: now PointMap has an attribute table to handle this
-   pmap<int,int> m_data_objects; // deprecated: (first int is data layer -- presumably the KEY not the index, second int is object ref)
-   //
-   int m_processflag;
+   // (the lines are held in the extra data, along with the deprecated attributes and data objects)
+   PointExtra *m_extra;
+   PointExtra& extra()
+      { if (!m_extra) m_extra = new PointExtra; return *m_extra; }
 public:
    Point()
-      { m_state = EMPTY; m_block = 0; m_misc = 0; m_grid_connections = 0; m_node = NULL; m_attributes = NULL; m_processflag = 0; m_merge = NoPixel; m_user_data = NULL; }
+      { m_state = EMPTY; m_block = 0; m_misc = 0; m_grid_connections = 0; m_node = NULL; m_processflag = 0; m_merge = NoPixel; m_extra = NULL; }
    Point& operator = (const Point& p) 
       { throw 1; }
    Point(const Point& p)
@@ -150,23 +168,33 @@ public:
       { return m_misc; }
    void setMisc(int misc)
       { m_misc = misc; }
-   int getDataObject( int layer ) { 
-      size_t var = m_data_objects.searchindex( layer );
+   int getDataObject( int layer ) const { 
+      if (!m_extra) 
+         return -1;
+      size_t var = m_extra->m_data_objects.searchindex( layer );
       if (var != paftl::npos) 
-         return m_data_objects.at(var);
+         return m_extra->m_data_objects.at(var);
       return -1;  // note: not paftl::npos
    }
+   const pqmap<int,Line>& getLines() const
+      { return m_extra ? m_extra->m_lines : g_no_point_lines; }
+   void addLine(int key, const Line& li)
+      { extra().m_lines.add(key,li); }
+   void clearLines();
    // note -- set merge pixel should be done only through merge pixels
    PixelRef getMergePixel() {
       return m_merge;
    }
    Node& getNode()
       { return *m_node; }
+   bool hasAttributes() const
+      { return m_extra && m_extra->m_attributes; }
    AttrBody& getAttributes()
-      { return *m_attributes; }
+      { return *(m_extra->m_attributes); }
    void setAttributes(const AttrBody& attr)
-      { if (m_attributes) delete m_attributes;
-        m_attributes = new AttrBody(attr); }
+      { if (extra().m_attributes) delete m_extra->m_attributes;
+        m_extra->m_attributes = new AttrBody(attr); }
+   void clearAttributes();
    char getGridConnections() const
       { return m_grid_connections; }
    float getBinDistance(int i);
@@ -174,14 +202,53 @@ public:
    ifstream& read(ifstream& stream, int version, int attr_count);
    ofstream& write(ofstream& stream, int version);
    //
-protected:
-   // for user processing, set their own data on the point:
-   void *m_user_data;
 public:
+   // for user processing, set their own data on the point:
    void *getUserData()
-   { return m_user_data; }
+   { return m_extra ? m_extra->m_user_data : NULL; }
    void setUserData(void *user_data)
-   { m_user_data = user_data; }
+   { extra().m_user_data = user_data; }
+};
+
+// The grid is held as square tiles of points rather than one array per column, so
+// that the points around a point are close to it in memory, and no one allocation has
+// to hold a whole column of a large grid.  Points are still found as m_points[i][j]
+
+#define POINT_TILE_SHIFT 4
+#define POINT_TILE_SIZE  (1 << POINT_TILE_SHIFT)
+#define POINT_TILE_MASK  (POINT_TILE_SIZE - 1)
+
+class PointGrid
+{
+protected:
+   Point **m_tiles;
+   int m_tile_cols;
+   int m_tile_rows;
+public:
+   class Column
+   {
+      Point **m_tiles;
+      int m_i;
+   public:
+      Column(Point **tiles, int i)
+         { m_tiles = tiles; m_i = i; }
+      Point& operator [] (int j) const
+         { return m_tiles[j >> POINT_TILE_SHIFT][((m_i & POINT_TILE_MASK) << POINT_TILE_SHIFT) + (j & POINT_TILE_MASK)]; }
+   };
+   PointGrid()
+      { m_tiles = NULL; m_tile_cols = 0; m_tile_rows = 0; }
+   PointGrid(const PointGrid& grid)
+      { throw 1; }
+   PointGrid& operator = (const PointGrid& grid)
+      { throw 1; }
+   ~PointGrid()
+      { destroy(); }
+   void create(int cols, int rows);
+   void destroy();
+   bool allocated() const
+      { return m_tiles != NULL; }
+   Column operator [] (int i) const
+      { return Column(m_tiles + (i >> POINT_TILE_SHIFT) * m_tile_rows, i); }
 };
 
 class sparkSieve2;
@@ -197,7 +264,7 @@ class PointMap : public PixelBase
    friend class MetaGraph;
 protected:
    pstring m_name;
-   Point **m_points;    // will contain the graph reference when created
+   PointGrid m_points;  // will contain the graph reference when created
    //int m_rows;
    //int m_cols;
    int m_point_count;
@@ -213,6 +280,11 @@ protected:
    pqvector<PixelRefPair> m_merge_lines;
    // The attributes table replaces AttrHeader / AttrRow data format
    AttributeTable m_attributes;
+   // packed copy of the graph used by the analyses, made on demand (see ngraph.h)
+   PackedGraph *m_packed_graph;
+   // where the map is in the file if it has not been read yet (see PointMaps::read), otherwise -1
+   int64 m_deferred_offset;
+   int64 m_deferred_length;
 public:
    PointMap(const pstring& name = pstring("VGA Map"));
    PointMap(const PointMap& pointdata);
@@ -221,6 +293,11 @@ public:
    virtual ~PointMap();
    const pstring& getName() const
    { return m_name; }
+   bool isLoaded() const
+   { return m_deferred_offset == -1; }
+   // (only a point map still being made is editable)
+   MapSummary getSummary() const
+   { return MapSummary(m_name, -1, !m_processed); }
    //
    // Quick mod - TV
 #if defined(_WIN32)
@@ -267,7 +344,14 @@ public:
    bool sparkGraph2( Communicator *comm, bool boundarygraph, double maxdist );
    bool dynamicSparkGraph2();
    bool sparkPixel2(PixelRef curs, int make, double maxdist = -1.0);
+   // thread safe version: bins and far_bin_dists are caller owned scratch space (32 of each),
+   // and the point statistics are returned rather than written into the attribute table
+   bool sparkPixel2(PixelRef curs, int make, double maxdist, pvector<PixelRef> *bins_b, float *far_bin_dists,
+                    int& neighbourhood_size, double& total_dist, double& total_dist_sqr);
    bool sieve2(sparkSieve2& sieve, pvector<PixelRef>& addlist, int q, int depth, PixelRef curs);
+   // packed copy of the graph, made on first use: clear it whenever a node is remade
+   const PackedGraph& getPackedGraph();
+   void clearPackedGraph();
    // bool makeGraph( Graph& graph, int optimization_level = 0, Communicator *comm = NULL);
    //
    bool binDisplay(Communicator *comm);
@@ -302,10 +386,7 @@ public:
    const int& pointState( const PixelRef& p ) const
       { return m_points[p.x][p.y].m_state; }
    const int pointObject( const PixelRef& p, int layer_ref ) const
-      { size_t layer_index = m_points[p.x][p.y].m_data_objects.searchindex(layer_ref);
-        if (layer_index != paftl::npos)
-           return m_points[p.x][p.y].m_data_objects.at(layer_index);
-        return -1; }
+      { return m_points[p.x][p.y].getDataObject(layer_ref); }
    // to be phased out
    bool blockedAdjacent( const PixelRef p ) const;
    //
@@ -457,6 +538,11 @@ public:
 public:
    bool read( ifstream& stream, int version );
    bool write( ofstream& stream, int version );
+protected:
+   // from VERSION_ALIGNED_SECTIONS: the points and the (packed) graph as aligned sections
+   void readPointSections( ifstream& stream );
+   void writePointSections( ofstream& stream );
+public:
    void convertAttributes( int which_attributes );
    void addGridConnections(); // adds grid connections where graph does not include them
 };
@@ -486,12 +572,39 @@ class PointMaps : public prefvec<PointMap>
 protected:
    int m_displayed_map;
    SuperSpacePixel *m_spacepix;
+   // the file the maps not yet loaded are in
+   pstring m_deferred_file;
+   int m_deferred_version;
+   // where the maps copied as they stand were put in the file last written (or -1)
+   pvector<int64> m_copied_offsets;
 public:
-   PointMaps() { m_displayed_map = -1; m_spacepix = NULL; }
+   PointMaps() { m_displayed_map = -1; m_spacepix = NULL; m_deferred_version = -1; }
    virtual ~PointMaps() {;}
    //
+   // maps left in the deferred file are read in the first time they are asked for
+   // (every accessor by index goes through at, so none hands out a map not read in):
+   PointMap& at(size_t i)
+   { loadMap(int(i)); return prefvec<PointMap>::at(i); }
+   const PointMap& at(size_t i) const
+   { const_cast<PointMaps *>(this)->loadMap(int(i)); return prefvec<PointMap>::at(i); }
+   PointMap& operator [] (size_t i)
+   { return at(i); }
+   const PointMap& operator [] (size_t i) const
+   { return at(i); }
+   PointMap& head()
+   { return at(0); }
+   const PointMap& head() const
+   { return at(0); }
+   PointMap& tail()
+   { return at(size() - 1); }
+   const PointMap& tail() const
+   { return at(size() - 1); }
+   // ...whereas the summary (for listing the maps) does not need the map read in:
+   MapSummary getMapSummary(size_t i) const
+   { return prefvec<PointMap>::at(i).getSummary(); }
+   //
    void setDisplayedPointMapRef(int i) 
-   { m_displayed_map = i; }
+   { m_displayed_map = i; if (i != -1) loadMap(i); }
    PointMap& getDisplayedPointMap()
    { return at(m_displayed_map); }
    const PointMap& getDisplayedPointMap() const
@@ -500,15 +613,22 @@ public:
    { return m_displayed_map; }
    int addNewMap(const pstring& name = pstring("VGA Map"));
    void removeMap(int i) 
-   { if (m_displayed_map >= i) m_displayed_map--; remove_at(i); }
+   { if (m_displayed_map >= i) m_displayed_map--; remove_at(i); if (m_displayed_map != -1) loadMap(m_displayed_map); }
    //
    void setSpacePixel(SuperSpacePixel *spacepix)
-   { m_spacepix = spacepix; for (size_t i = 0; i < size(); i++) at(i).setSpacePixel(spacepix); }
+   { m_spacepix = spacepix; for (size_t i = 0; i < size(); i++) prefvec<PointMap>::at(i).setSpacePixel(spacepix); }
    void redoBlockLines()   // (flags blockedlines, but also flags that you need to rebuild a bsp tree if you have one)
-   { for (size_t i = 0; i < size(); i++) { at(i).m_blockedlines = false; } }
+   { for (size_t i = 0; i < size(); i++) { prefvec<PointMap>::at(i).m_blockedlines = false; } }
    //
-   bool read( ifstream& stream, int version );
+   // with a deferred file, all but the displayed map are left in the file until loadMap
+   bool read( ifstream& stream, int version, const pstring& deferred_file = pstring() );
    bool write( ofstream& stream, int version, bool displayedmaponly = false );
+   bool loadMap(int i);
+   bool loadAllMaps();
+   // once the file is safely written, the maps copied into it are left to be loaded from it
+   void setDeferredFile( const pstring& deferred_file, int version );
+protected:
+   void writeMap( ofstream& stream, int version, int i );
 };
 
 /////////////////////////////////////////////////////////////////////////////////////
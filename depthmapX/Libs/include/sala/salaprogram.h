@@ -20,6 +20,7 @@
 #define __SALAPROGRAM_H__
 
 class AttributeTable;
+class AttributeColumnWriter;
 class PointMap;
 class ShapeMap;
 
@@ -113,6 +114,7 @@ class SalaObj
    friend class SalaProgram;
    friend class SalaCommand;
    friend class SalaArray;
+   friend class SalaCode;
 public:
    // Object types
    enum Type { S_BRACKET = 0x0000003f, S_OPEN_SQR_BRACKET = 0x0000000c,
@@ -246,6 +248,50 @@ public:
    const pstring getTypeIndefArt() const;
 };
 
+// A program compiled to a list of simple instructions, so that it can be run
+// over a whole column at once rather than walking the command tree for each row.
+// Only a single expression of numbers, attribute values, arithmetic, comparisons
+// and maths functions can be compiled; anything else is left to the interpreter.
+// Each instruction puts its result into its own register (its index in the list),
+// and is run as a tight loop over a block of rows at a time
+
+const int SALA_BLOCK_SIZE = 256;
+
+class SalaCode
+{
+public:
+   struct Instruction {
+      SalaObj::Func func; // S_FNULL for a constant, S_FVALUE for an attribute value
+      SalaObj::Type type; // type of the result: S_BOOL, S_INT or S_DOUBLE
+      int a;              // registers of the operands
+      int b;
+      int col;            // column of an attribute value (-1 for the ref number)
+      double value;       // value of a constant
+   };
+protected:
+   pvector<Instruction> m_code;
+public:
+   SalaCode() {}
+   void clear()
+   { m_code.clear(); }
+   bool empty() const
+   { return m_code.size() == 0; }
+   // note: these return the register of the result, or -1 if it cannot be compiled
+   int pushConstant(const SalaObj& obj);
+   int pushValue(int col);
+   int pushUnary(SalaObj::Func func, int a);
+   int pushBinary(SalaObj::Func func, int a, int b);
+   bool isNumber(int reg) const
+   { return (m_code[reg].type & SalaObj::S_NUMBER) != 0; }
+   bool isBool(int reg) const
+   { return m_code[reg].type == SalaObj::S_BOOL; }
+   // calculates the result for each of the rows (by rowid)
+   void evaluate(const AttributeTable& table, const int *rows, int count, double *results) const;
+protected:
+   SalaObj getConstant(int reg) const;
+   int push(SalaObj::Func func, SalaObj::Type type, int a = -1, int b = -1);
+};
+
 // Quick mod - TV
 class SalaProgram;
 
@@ -285,6 +331,8 @@ protected:
    void evaluate(SalaObj& obj, bool& ret, bool& ifhandled);
    SalaObj evaluate(int& pointer, SalaObj* &p_obj);
    SalaObj connections(SalaObj graphnode, SalaObj param); 
+   bool isReentrant(const pstring& colname) const;
+   int compile(int& pointer, SalaCode& code);
 };
 
 class SalaProgram
@@ -301,7 +349,9 @@ class SalaProgram
    // NB ! -- this can be messed with by SalaCommand!
    SalaObj m_thisobj;
    //
-   bool m_marked; // this is used to tell the program that a node has been "marked" -- all marks are cleared at the end of the execution
+   pvecint m_marked_rows; // this is used to tell the program which nodes have been "marked" -- all marks are cleared at the end of the execution
+   //
+   pstring m_source; // the program text, kept to make a copy of the program for each thread
    //
 public:
    SalaProgram(SalaObj context);
@@ -311,6 +361,11 @@ public:
    bool runupdate(int col, const pvecint& selset = pvecint());
    bool runselect(pvecint& selsetout, const pvecint& selsetin = pvecint());
    pstring getLastErrorMessage() const;
+protected:
+   void getRowids(const pvecint& selset, pvecint& rows);
+   bool isReentrant(int col);
+   size_t runrows(const pvecint& rows, AttributeColumnWriter *writer, pvector<bool> *selected);
+   bool compile(SalaCode& code);
 };
 
 inline SalaObj::SalaObj(const SalaObj& obj)
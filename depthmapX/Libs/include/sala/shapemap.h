@@ -20,6 +20,8 @@
 #ifndef __SHAPEMAP_H__
 #define __SHAPEMAP_H__
 
+#include <generic/filesection.h>
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 // each pixel has various lists of information:
@@ -173,6 +175,69 @@ struct SalaEvent
    SalaEvent(int action = SALA_NULL_EVENT, int shape_ref = -1) { m_action = action; m_shape_ref = shape_ref; }
 };
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Packed R-tree of shape bounding boxes
+//
+// Bulk loaded in one go (sort-tile-recursive), so that the nodes are stored
+// level by level in a single vector, and a node's children are a run of the
+// level below.  Unlike the pixel grid, each shape is held exactly once however
+// big it is, and a crowded area just makes the tree a little deeper.
+
+class ShapeTree
+{
+public:
+   enum { FANOUT = 16 };
+   struct Node {
+      QtRegion m_region;
+      int m_first;      // first child, or for a leaf the shape's row
+      int m_count;      // number of children, 0 for a leaf
+   };
+protected:
+   pvector<Node> m_nodes;
+   int m_leaves;
+public:
+   ShapeTree()
+   { m_leaves = 0; }
+   void clear()
+   { m_nodes.clear(); m_leaves = 0; }
+   // add the shape rows in order, then build:
+   void add(const QtRegion& region);
+   void build();
+   //
+   int size() const
+   { return m_leaves; }
+   // appends the row of every shape whose bounding box touches the region
+   void intersecting(const QtRegion& region, pvecint& rows) const;
+};
+
+// Visited set for shape queries
+//
+// Instead of a sorted list of the shapes tested so far, every query takes a
+// new stamp, and a shape counts as visited if its slot holds the current
+// stamp, so nothing needs to be emptied between queries.  Indexed by shape ref.
+
+class ShapeMarks
+{
+protected:
+   pvecint m_marks;
+   int m_stamp;
+public:
+   ShapeMarks()
+   { m_stamp = 0; }
+   // start a new query
+   void reset()
+   { if (m_stamp == 0x7fffffff) { for (size_t i = 0; i < m_marks.size(); i++) m_marks[i] = 0; m_stamp = 0; }
+     m_stamp++; }
+   bool marked(int ref) const
+   { return ref < (int)m_marks.size() && m_marks[ref] == m_stamp; }
+   // returns false if it was already marked
+   bool mark(int ref)
+   { while ((int)m_marks.size() <= ref) m_marks.push_back(0);
+     if (m_marks[ref] == m_stamp) return false;
+     m_marks[ref] = m_stamp; return true; }
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 // Quick mod - TV
 class MapInfoData;
@@ -205,6 +270,15 @@ protected:
    mutable BSPNode *m_bsp_root;
    mutable bool m_bsp_tree;
    //
+   // Scratch state for the const queries: both are written by the queries themselves,
+   // so a map must only be queried from one thread at a time (or, for region queries
+   // alone, the tree built first with getShapeTree before going parallel)
+   // bounding box tree for region queries, rebuilt when next needed after any change to the shapes
+   mutable ShapeTree m_shape_tree;
+   mutable bool m_shape_tree_valid;
+   // visited shapes for queries walking several grid cells (lineInPolyList, polyInPolyList)
+   mutable ShapeMarks m_shape_marks;
+   //
    pqmap<int,SalaShape> m_shapes;
    pqmap<int,SalaObject> m_objects;   // THIS IS UNUSED! Meant for each object to have many shapes
    //
@@ -224,6 +298,10 @@ protected:
    mutable int m_current;
    mutable bool m_invalidate;
    //
+   // where the map is in the file if it has not been read yet (see ShapeMaps::read), otherwise -1
+   int64 m_deferred_offset;
+   int64 m_deferred_length;
+   //
 public:
    ShapeMap(const pstring& name = pstring(),int type = EMPTYMAP);
    virtual ~ShapeMap();
@@ -335,6 +413,7 @@ public:
    void makeShapeConnections();
    //
    bool makeBSPtree() const;
+   const ShapeTree& getShapeTree() const;
    //
    const prefvec<Connector>& getConnections() const
    { return m_connectors; }
@@ -349,6 +428,19 @@ public:
    { return m_map_type == PESHMAP; }
    int getMapType() const
    { return m_map_type; }
+   //
+   bool isLoaded() const
+   { return m_deferred_offset == -1; }
+   int64 getDeferredOffset() const
+   { return m_deferred_offset; }
+   void setDeferredOffset(int64 offset)
+   { m_deferred_offset = offset; }
+   int64 getDeferredLength() const
+   { return m_deferred_length; }
+   void setDeferredLength(int64 length)
+   { m_deferred_length = length; }
+   // (the summary is held even by a map that has not been read in, see ShapeMaps::read)
+   MapSummary getSummary() const;
    // Attribute functionality
 protected:
    // which attribute is currently displayed:
@@ -537,8 +629,13 @@ class ShapeMaps : public /*protected*/ prefvec<T>
 {
 protected:
    size_t m_displayed_map;
+   // the file the maps not yet loaded are in
+   pstring m_deferred_file;
+   int m_deferred_version;
+   // where the maps copied as they stand were put in the file last written (or -1)
+   pvector<int64> m_copied_offsets;
 public:
-   ShapeMaps() { m_displayed_map = paftl::npos;}
+   ShapeMaps() { m_displayed_map = paftl::npos; m_deferred_version = -1; }
    virtual ~ShapeMaps() {;}
    //
    size_t addMap(const pstring& name, int type);
@@ -552,25 +649,46 @@ public:
    void setDisplayedMapRef(size_t map);
    //
    T& getDisplayedMap()
-   { return prefvec<T>::at(m_displayed_map); }
+   { return getMap(m_displayed_map); }
    const T& getDisplayedMap() const
-   { return prefvec<T>::at(m_displayed_map); }
+   { return getMap(m_displayed_map); }
    //
    size_t getDisplayedMapRef() const
    { return m_displayed_map; }
    // Getting shape maps by name and reference
    
    // Quick mod - TV
+   // (maps left in the deferred file are read in the first time they are asked for,
+   // and every accessor by index goes through getMap, so none hands out a map not read in)
    T& getMap(size_t index)
-   { return prefvec<T>::at(index); }
+   { loadMap(index); return prefvec<T>::at(index); }
    const T& getMap(size_t index) const
-   { return prefvec<T>::at(index); }
+   { const_cast<ShapeMaps<T> *>(this)->loadMap(index); return prefvec<T>::at(index); }
+   T& at(size_t index)
+   { return getMap(index); }
+   const T& at(size_t index) const
+   { return getMap(index); }
+   T& operator [] (size_t index)
+   { return getMap(index); }
+   const T& operator [] (size_t index) const
+   { return getMap(index); }
+   T& head()
+   { return getMap(0); }
+   const T& head() const
+   { return getMap(0); }
+   T& tail()
+   { return getMap(prefvec<T>::size() - 1); }
+   const T& tail() const
+   { return getMap(prefvec<T>::size() - 1); }
    const size_t getMapCount() 
    { return prefvec<T>::size(); }
    T& getLastMap()
-   { return prefvec<T>::tail(); }
+   { return tail(); }
    const T& getLastMap() const
-   { return prefvec<T>::tail(); }
+   { return tail(); }
+   // ...whereas the summary (for listing the maps) does not need the map read in:
+   MapSummary getMapSummary(size_t index) const
+   { return prefvec<T>::at(index).getSummary(); }
    //
    size_t getMapRef(const pstring& name) const;
    //
@@ -579,8 +697,16 @@ public:
    const size_t getShapeCount() const
    { return prefvec<T>::at(m_displayed_map).m_shapes.size(); }
    //
-   bool read( ifstream& stream, int version );
+   // with a deferred file, all but the displayed map are left in the file until loadMap
+   bool read( ifstream& stream, int version, const pstring& deferred_file = pstring() );
    bool write( ofstream& stream, int version, bool displayedmaponly = false );
+   bool loadMap(size_t index);
+   bool loadAllMaps();
+   // once the file is safely written, the maps copied into it are left to be loaded from it
+   void setDeferredFile( const pstring& deferred_file, int version );
+protected:
+   void writeMap( ofstream& stream, int version, size_t index );
+public:
    //
    const QtRegion& getBoundingBox() const
    { return prefvec<T>::at(m_displayed_map).getRegion(); }
@@ -618,6 +744,8 @@ void ShapeMaps<T>::removeMap(size_t map)
    prefvec<T>::remove_at(map);
    if (m_displayed_map > map || m_displayed_map >= pmemvec<T*>::size())
       m_displayed_map--; 
+   if (m_displayed_map != paftl::npos)
+      loadMap(m_displayed_map);
 }
 template <class T>
 size_t ShapeMaps<T>::getMapRef(const pstring& name) const
@@ -635,9 +763,11 @@ void ShapeMaps<T>::setDisplayedMapRef(size_t map)
    if (m_displayed_map != paftl::npos && m_displayed_map != map)
       prefvec<T>::at(m_displayed_map).clearSel();
    m_displayed_map = map;
+   if (m_displayed_map != paftl::npos)
+      loadMap(m_displayed_map);
 }
 template <class T>
-bool ShapeMaps<T>::read( ifstream& stream, int version )
+bool ShapeMaps<T>::read( ifstream& stream, int version, const pstring& deferred_file )
 {
     prefvec<T>::clear(); // empty existing data
    // n.b. -- do not change to size_t as will cause 32-bit to 64-bit conversion problems
@@ -656,15 +786,95 @@ bool ShapeMaps<T>::read( ifstream& stream, int version )
          stream.read((char *)&number,sizeof(number));
       }
    }
+   m_deferred_file = deferred_file;
+   m_deferred_version = version;
    for (size_t j = 0; j < size_t(count); j++) {
+      if (version >= VERSION_MAP_DIRECTORY) {
+         // each map is listed by name, type (and from VERSION_MAP_SUMMARY whether it is
+         // editable and its layers) and length before its data:
+         pstring name;
+         name.read(stream);
+         int type;
+         stream.read((char *) &type, sizeof(type));
+         // (only left in the file if the directory holds all of its summary)
+         bool deferred = !deferred_file.empty() && j != m_displayed_map && version >= VERSION_MAP_SUMMARY;
+         if (deferred) {
+            ShapeMaps<T>::push_back(T(name,type));
+         }
+         if (version >= VERSION_MAP_SUMMARY) {
+            // (a map read now has the same again in its own data)
+            AttributeTable layers;
+            AttributeTable& table = deferred ? prefvec<T>::tail().getAttributeTable() : layers;
+            bool editable;
+            stream.read((char *) &editable, sizeof(editable));
+            table.readLayers(stream);
+            if (deferred) {
+               prefvec<T>::tail().setEditable(editable);
+            }
+         }
+         int64 length;
+         stream.read((char *) &length, sizeof(length));
+         streampos start = stream.tellg();
+         if (version >= VERSION_ALIGNED_MAPS) {
+            readAlignment(stream);
+         }
+         if (deferred) {
+            T& map = prefvec<T>::tail();
+            map.setDeferredOffset(int64(streamoff(stream.tellg())));
+            map.setDeferredLength(length - int64(streamoff(stream.tellg() - start)));
+            stream.seekg( start + streamoff(length) );
+            continue;
+         }
+      }
       ShapeMaps<T>::push_back(T());
       prefvec<T>::tail().read(stream,version);
    }
    return true;
 }
 template <class T>
+bool ShapeMaps<T>::loadMap( size_t index )
+{
+   T& map = prefvec<T>::at(index);
+   if (map.isLoaded()) {
+      return true;
+   }
+#ifdef _WIN32
+   ifstream stream( m_deferred_file.c_str(), ios::binary | ios::in );
+#else
+   ifstream stream( m_deferred_file.c_str(), ios::in );
+#endif
+   if (stream.fail()) {
+      return false;
+   }
+   stream.seekg( streamoff(map.getDeferredOffset()) );
+   try {
+      map.read(stream,m_deferred_version);
+   }
+   catch (pexception) {
+      return false;
+   }
+   if (stream.fail()) {
+      return false;
+   }
+   map.setDeferredOffset(-1);
+   return true;
+}
+template <class T>
+bool ShapeMaps<T>::loadAllMaps()
+{
+   bool ok = true;
+   for (size_t i = 0; i < pmemvec<T*>::size(); i++) {
+      if (!loadMap(i)) {
+         ok = false;
+      }
+   }
+   return ok;
+}
+template <class T>
 bool ShapeMaps<T>::write( ofstream& stream, int version, bool displayedmaponly )
 {
+   m_copied_offsets.clear();
+   m_copied_offsets.set( -1, pmemvec<T*>::size() );
    if (!displayedmaponly) {
       // n.b. -- do not change to size_t as will cause 32-bit to 64-bit conversion problems
       unsigned int displayed_map = (unsigned int)(m_displayed_map);
@@ -674,7 +884,7 @@ bool ShapeMaps<T>::write( ofstream& stream, int version, bool displayedmaponly )
       unsigned int count = (unsigned int) pmemvec<T*>::size();
       stream.write((char *) &count, sizeof(count));
       for (size_t j = 0; j < count; j++) {
-         prefvec<T>::at(j).write(stream,version);
+         writeMap(stream,version,j);
       }
    }
    else {
@@ -686,10 +896,62 @@ bool ShapeMaps<T>::write( ofstream& stream, int version, bool displayedmaponly )
       dummy = 1;
       stream.write((char *)&dummy,sizeof(dummy));
       // write map:
-      prefvec<T>::at(m_displayed_map).write(stream,version);
+      writeMap(stream,version,m_displayed_map);
    }
    return true;
 }
+template <class T>
+void ShapeMaps<T>::writeMap( ofstream& stream, int version, size_t index )
+{
+   T& map = prefvec<T>::at(index);
+   if (version >= VERSION_MAP_DIRECTORY) {
+      pstring name = map.getName();
+      name.write(stream);
+      int type = map.getMapType();
+      stream.write((char *) &type, sizeof(type));
+      if (version >= VERSION_MAP_SUMMARY) {
+         bool editable = map.isEditable();
+         stream.write((char *) &editable, sizeof(editable));
+         map.getAttributeTable().writeLayers(stream);
+      }
+      streampos start = beginBlock(stream);
+      if (version >= VERSION_ALIGNED_MAPS) {
+         writeAlignment(stream);
+      }
+      if (!map.isLoaded() && version == m_deferred_version && version >= VERSION_ALIGNED_MAPS) {
+         // a map that has not been read in is unchanged, so it can be copied as it stands:
+         m_copied_offsets[index] = int64(streamoff(stream.tellp()));
+         if (!copyBlock(m_deferred_file, map.getDeferredOffset(), map.getDeferredLength(), stream)) {
+            stream.setstate(ios::failbit);
+         }
+      }
+      else {
+         if (!loadMap(index)) {
+            stream.setstate(ios::failbit);
+         }
+         map.write(stream,version);
+      }
+      endBlock(stream, start);
+   }
+   else {
+      if (!loadMap(index)) {
+         stream.setstate(ios::failbit);
+      }
+      map.write(stream,version);
+   }
+}
+template <class T>
+void ShapeMaps<T>::setDeferredFile( const pstring& deferred_file, int version )
+{
+   for (size_t i = 0; i < m_copied_offsets.size() && i < pmemvec<T*>::size(); i++) {
+      if (m_copied_offsets[i] != -1) {
+         prefvec<T>::at(i).setDeferredOffset(m_copied_offsets[i]);
+      }
+   }
+   m_copied_offsets.clear();
+   m_deferred_file = deferred_file;
+   m_deferred_version = version;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
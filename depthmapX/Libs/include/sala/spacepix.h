@@ -89,6 +89,9 @@ public:
 
 const PixelRef NoPixel( -1, -1 );
 
+// the most pixels a PixelRef can address along either axis
+const int PIXELREF_MAX = 32767;
+
 inline bool operator == (const PixelRef a, const PixelRef b)
 {
    return (a.x == b.x) && (a.y == b.y);
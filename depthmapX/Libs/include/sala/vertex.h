@@ -130,6 +130,8 @@ struct Options
    int cliques;
    //
    bool choice;
+   // also count every shortest route for choice (see brandes.h)
+   bool exact_choice;
    // include measures that can be derived: RA, RRA and total depth
    bool fulloutput;
    //
@@ -154,7 +156,7 @@ struct Options
    // default values
    Options() 
    { local = 0; global = 1; cliques = 0; 
-     choice = false; fulloutput = false; point_depth_selection = 0; 
+     choice = false; exact_choice = false; fulloutput = false; point_depth_selection = 0; 
      tulip_bins = 1024; 
      radius = -1; radius_type = 0; 
      output_type = OUTPUT_ISOVIST; process_in_memory = false; gates_only = false; sel_only = false; 
@@ -19,6 +19,7 @@
 #include <math.h>
 #include <float.h>
 
+#include <generic/filesection.h>
 #include <sala/mgraph.h>
 #include <sala/attributes.h>
 
@@ -32,6 +33,12 @@ int compareValuePair(const void *p1, const void *p2)
    return (v > 0.0 ? 1 : v < 0.0 ? -1 : 0);
 }
 
+static int compareKey(const void *p1, const void *p2)
+{
+   int a = *(const int *)p1, b = *(const int *)p2;
+   return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 
 AttributeTable::AttributeTable(const pstring& name)
@@ -61,15 +68,17 @@ int AttributeTable::insertColumn(const pstring& name)
    size_t index = m_columns.searchindex(AttributeColumn(name));
    if (index != paftl::npos) {
       m_columns[index].reset();
-      int phys_col = m_columns[index].m_physical_col;
-      for (size_t i = 0; i < size(); i++) {
-         at(i)[phys_col] = -1.0f;
+      pvecfloat& data = m_data[m_columns[index].m_physical_col];
+      for (size_t i = 0; i < data.size(); i++) {
+         data[i] = -1.0f;
       }
    }
    else {
       index = m_columns.add(AttributeColumn(name));
-      for (size_t i = 0; i < size(); i++) {
-         at(i).push_back(-1.0f);
+      // the new column is a single block, all nulls:
+      m_data.push_back(pvecfloat());
+      if (m_keys.size()) {
+         m_data.tail().set(-1.0f, m_keys.size());
       }
       m_columns[index].m_physical_col = m_columns.size() - 1;
    }
@@ -80,9 +89,7 @@ void AttributeTable::removeColumn(int col)
 {
    int phys_col = m_columns[col].m_physical_col;
    // remove data:
-   for (size_t i = 0; i < size(); i++) {
-      at(i).remove_at(phys_col);
-   }
+   m_data.remove_at(phys_col);
    // remove column head:
    m_columns.remove_at(col);
    // adjust other columns:
@@ -120,28 +127,126 @@ int AttributeTable::renameColumn(int col, const pstring& name)
 
 int AttributeTable::insertRow(int key)
 {
-   int index = add(key,AttributeRow());
-   value(index).init(m_columns.size());
-   return index;
+   size_t index = m_keys.add(key);
+   if (index == paftl::npos) {
+      // already exists
+      return getRowid(key);
+   }
+   m_rows.insert_at(index, AttributeRow());
+   for (size_t j = 0; j < m_data.size(); j++) {
+      m_data[j].insert_at(index, -1.0f);
+   }
+   return int(index);
+}
+
+// The keys are sorted once and merged with the rows already there, so each column is
+// rebuilt once however the keys are ordered (keys already in the table are left as they are)
+
+void AttributeTable::insertRows(const pvecint& keys)
+{
+   pvecint sorted = keys;
+   if (sorted.size()) {
+      qsort(&(sorted[0]),sorted.size(),sizeof(int),compareKey);
+   }
+   // the merged keys, and for each the row it was (or -1 for a new row):
+   pvecint merged;
+   pvecint from;
+   size_t i = 0, k = 0;
+   while (i < m_keys.size() || k < sorted.size()) {
+      if (k == sorted.size() || (i < m_keys.size() && m_keys[i] <= sorted[k])) {
+         if (k < sorted.size() && m_keys[i] == sorted[k]) {
+            k++;
+         }
+         merged.push_back(m_keys[i]);
+         from.push_back(int(i));
+         i++;
+      }
+      else {
+         if (merged.size() == 0 || merged.tail() != sorted[k]) {
+            merged.push_back(sorted[k]);
+            from.push_back(-1);
+         }
+         k++;
+      }
+   }
+   if (merged.size() == m_keys.size()) {
+      return;
+   }
+   pvector<AttributeRow> rows;
+   rows.set(merged.size());
+   for (size_t n = 0; n < merged.size(); n++) {
+      rows[n] = (from[n] != -1) ? m_rows[from[n]] : AttributeRow();
+   }
+   m_rows = rows;
+   for (size_t j = 0; j < m_data.size(); j++) {
+      pvecfloat data;
+      data.set(merged.size());
+      for (size_t n = 0; n < merged.size(); n++) {
+         data[n] = (from[n] != -1) ? m_data[j][from[n]] : -1.0f;
+      }
+      m_data[j] = data;
+   }
+   m_keys = merged;
 }
 
 void AttributeTable::removeRow(int key)
 {
-   size_t index = searchindex(key);
+   size_t index = m_keys.searchindex(key);
    if (index != paftl::npos) {
-      remove_at(index);
+      m_keys.remove_at(index);
+      m_rows.remove_at(index);
+      for (size_t j = 0; j < m_data.size(); j++) {
+         m_data[j].remove_at(index);
+      }
+   }
+}
+
+void AttributeTable::removeRowids(const pvecint& list)
+{
+   m_keys.remove_at(list);
+   m_rows.remove_at(list);
+   for (size_t j = 0; j < m_data.size(); j++) {
+      m_data[j].remove_at(list);
    }
 }
 
 void AttributeTable::setColumnValue(int col, float val)
 {
-   int phys_col = m_columns[col].m_physical_col;
-   m_columns[col].m_tot = 0.0;
+   pvecfloat& data = m_data[m_columns[col].m_physical_col];
+   size_t count = data.size();
+   for (size_t i = 0; i < count; i++) {
+      data[i] = val;
+   }
+   m_columns[col].m_tot = double(val) * double(count);
    m_columns[col].m_min = val;
    m_columns[col].m_max = val;
-   for (size_t i = 0; i < size(); i++) {
-      value(i).at(phys_col) = val;
-      m_columns[col].m_tot += val;
+}
+
+void AttributeTable::updateColumnInfo(int col, const pvector<bool>& rows)
+{
+   const pvecfloat& data = m_data[m_columns[col].m_physical_col];
+   AttributeColumn& column = m_columns[col];
+   for (size_t i = 0; i < rows.size(); i++) {
+      if (rows[i]) {
+         column.setValue(data[i]);
+      }
+   }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+AttributeColumnWriter::AttributeColumnWriter(AttributeTable& table, int col, bool change)
+{
+   m_table = &table;
+   m_col = col;
+   m_change = change && col != -1;
+   m_values = NULL;
+   if (col != -1) {
+      pvecfloat& data = table.m_data[table.m_columns[col].m_physical_col];
+      if (data.size()) {
+         m_values = &(data[0]);
+         m_written.set(false, data.size());
+      }
    }
 }
 
@@ -151,10 +256,10 @@ void AttributeTable::setColumnValue(int col, float val)
 
 bool AttributeTable::selectRowByKey(int key) const
 {
-   size_t index = searchindex(key);
+   size_t index = m_keys.searchindex(key);
    if (index != paftl::npos) {
-      if ((m_visible_layers & value(index).m_layers) != 0 && !value(index).m_selected) {
-         value(index).m_selected = true;
+      if ((m_visible_layers & m_rows[index].m_layers) != 0 && !m_rows[index].m_selected) {
+         m_rows[index].m_selected = true;
          m_sel_count++;
          addSelValue(getValue(index,m_display_column));
       }
@@ -169,8 +274,8 @@ bool AttributeTable::selectRowByKey(int key) const
 bool AttributeTable::selectRowByIndex(int index) const
 {
    if (index != -1) {
-      if ((m_visible_layers & value(index).m_layers) != 0 && !value(index).m_selected) {
-         value(index).m_selected = true;
+      if ((m_visible_layers & m_rows[index].m_layers) != 0 && !m_rows[index].m_selected) {
+         m_rows[index].m_selected = true;
          m_sel_count++;
          addSelValue(getValue(index,m_display_column));
       }
@@ -186,8 +291,8 @@ void AttributeTable::deselectAll() const
 {
    m_sel_count = 0;
    m_sel_value = 0.0;
-   for (size_t i = 0; i < size(); i++) {
-      value(i).m_selected = false;
+   for (size_t i = 0; i < m_rows.size(); i++) {
+      m_rows[i].m_selected = false;
    }
 }
 
@@ -271,9 +376,9 @@ bool AttributeTable::selectionToLayer(const pstring& name)
    m_layers.add(newlayer,name);
 
    // convert everything in the selection to the new layer
-   for (size_t i = 0; i < size(); i++) {
+   for (size_t i = 0; i < m_rows.size(); i++) {
       if (isVisible(i) && isSelected(i)) {
-         at(i).m_layers |= newlayer;
+         m_rows[i].m_layers |= newlayer;
       }
    }
 
@@ -301,39 +406,88 @@ void AttributeTable::setDisplayColumn(int col, bool override) const
 
 //////////////////////////////////////////////////////////////////////////////////////
 
+void AttributeTable::readLayers( istream& stream )
+{
+   m_layers.clear();
+   stream.read((char *)&m_available_layers,sizeof(int64));
+   stream.read((char *)&m_visible_layers,sizeof(int64));
+   int count;
+   stream.read((char *)&count,sizeof(int));
+   for (int i = 0; i < count; i++) {
+      int64 key;
+      pstring value;
+      stream.read((char *)&key,sizeof(key));
+      value.read(stream);
+      m_layers.add(key,value);
+   }
+}
+
+void AttributeTable::writeLayers( ostream& stream ) const
+{
+   stream.write((char *)&m_available_layers,sizeof(int64));
+   stream.write((char *)&m_visible_layers,sizeof(int64));
+   int count = m_layers.size();
+   stream.write((char *)&count,sizeof(int));
+   for (size_t i = 0; i < m_layers.size(); i++) {
+      int64 key = m_layers.key(i);
+      stream.write((char *)&key,sizeof(key));
+      pstring value = m_layers.value(i);
+      value.write(stream);
+   }
+}
+
 bool AttributeTable::read( ifstream& stream, int version )
 {
    if (version >= VERSION_MAP_LAYERS) {
-      m_layers.clear();
-      stream.read((char *)&m_available_layers,sizeof(int64));
-      stream.read((char *)&m_visible_layers,sizeof(int64));
-      int count;
-      stream.read((char *)&count,sizeof(int));
-      for (int i = 0; i < count; i++) {
-         int64 key;
-         pstring value;
-         stream.read((char *)&key,sizeof(key));
-         value.read(stream);
-         m_layers.add(key,value);
-      }
+      readLayers(stream);
    }
    int colcount;
    stream.read((char *)&colcount, sizeof(colcount));
    for (int j = 0; j < colcount; j++) {
       m_columns.push_back(AttributeColumn());
       m_columns.tail().read(stream, version);
-      // this may need a bit of reordering, as the reader can chop up names:
-      m_columns.sort();
+      m_data.push_back(pvecfloat());
    }
+   // this may need a bit of reordering, as the reader can chop up names:
+   m_columns.sort();
    int rowcount, rowkey;
    stream.read((char *)&rowcount, sizeof(rowcount));
-   for (int i = 0; i < rowcount; i++) {
-      stream.read((char *)&rowkey, sizeof(rowkey));
-      int index = add(rowkey,AttributeRow());
-      if (version >= VERSION_MAP_LAYERS) {
-         stream.read((char *)&(value(index).m_layers),sizeof(int64));
+   if (version >= VERSION_ALIGNED_SECTIONS) {
+      // keys, layers and then each column as a block
+      readSection(stream, m_keys);
+      pvector<int64> layers;
+      readSection(stream, layers);
+      if (int(m_keys.size()) != rowcount || int(layers.size()) != rowcount) {
+         throw pexception( pexception::FILE_ERROR );
+      }
+      m_rows.clear();
+      if (rowcount) {
+         m_rows.set(rowcount);
+         for (int i = 0; i < rowcount; i++) {
+            m_rows[i].m_layers = layers[i];
+         }
+      }
+      for (int j = 0; j < colcount; j++) {
+         readSection(stream, m_data[j]);
+         if (int(m_data[j].size()) != rowcount) {
+            throw pexception( pexception::FILE_ERROR );
+         }
+      }
+   }
+   else {
+      // rows are stored whole in the file, so each is split out into the columns
+      pvecfloat rowdata;
+      for (int i = 0; i < rowcount; i++) {
+         stream.read((char *)&rowkey, sizeof(rowkey));
+         int index = insertRow(rowkey);
+         if (version >= VERSION_MAP_LAYERS) {
+            stream.read((char *)&(m_rows[index].m_layers),sizeof(int64));
+         }
+         rowdata.read(stream);
+         for (size_t j = 0; j < rowdata.size() && j < m_data.size(); j++) {
+            m_data[j][index] = rowdata[j];
+         }
       }
-      value(index).read(stream);
    }
    if (version >= VERSION_GATE_MAPS) {
       // ref column display params
@@ -345,30 +499,44 @@ bool AttributeTable::read( ifstream& stream, int version )
 bool AttributeTable::write( ofstream& stream, int version )
 {
    if (version >= VERSION_MAP_LAYERS) {
-      stream.write((char *)&m_available_layers,sizeof(int64));
-      stream.write((char *)&m_visible_layers,sizeof(int64));
-      int count = m_layers.size();
-      stream.write((char *)&count,sizeof(int));
-      for (size_t i = 0; i < m_layers.size(); i++) {
-         int64 key = m_layers.key(i);
-         stream.write((char *)&key,sizeof(key));
-         m_layers.value(i).write(stream);
-      }
+      writeLayers(stream);
    }
    int colcount = m_columns.size();
    stream.write((char *)&colcount, sizeof(colcount));
    for (int j = 0; j < colcount; j++) {
       m_columns[j].write(stream,version);
    }
-   int rowcount = size(), rowkey;
+   int rowcount = m_keys.size(), rowkey;
    stream.write((char *)&rowcount, sizeof(rowcount));
-   for (int i = 0; i < rowcount; i++) {
-      rowkey = key(i);
-      stream.write((char *)&rowkey, sizeof(rowkey));
-      if (version >= VERSION_MAP_LAYERS) {
-         stream.write((char *)&(value(i).m_layers),sizeof(int64));
+   if (version >= VERSION_ALIGNED_SECTIONS) {
+      // keys, layers and then each column as a block
+      writeSection(stream, m_keys);
+      pvector<int64> layers;
+      for (int i = 0; i < rowcount; i++) {
+         layers.push_back(m_rows[i].m_layers);
+      }
+      writeSection(stream, layers);
+      for (int j = 0; j < colcount; j++) {
+         writeSection(stream, m_data[j]);
+      }
+   }
+   else {
+      // gathered back into whole rows for the file
+      pvecfloat rowdata;
+      if (m_data.size()) {
+         rowdata.set(m_data.size());
+      }
+      for (int i = 0; i < rowcount; i++) {
+         rowkey = m_keys[i];
+         stream.write((char *)&rowkey, sizeof(rowkey));
+         if (version >= VERSION_MAP_LAYERS) {
+            stream.write((char *)&(m_rows[i].m_layers),sizeof(int64));
+         }
+         for (size_t j = 0; j < m_data.size(); j++) {
+            rowdata[j] = m_data[j][i];
+         }
+         rowdata.write(stream);
       }
-      value(i).write(stream);
    }
    // ref column display params
    stream.write((char *)&m_display_params,sizeof(m_display_params));
@@ -393,7 +561,7 @@ bool AttributeTable::outputRow( int row, ostream& stream, char delim, bool updat
 
    for (size_t i = 0; i < m_columns.size(); i++) {
       if (!updated_only || m_columns[i].m_updated) {
-         stream << delim << value(row).at(m_columns[i].m_physical_col);
+         stream << delim << m_data[m_columns[i].m_physical_col][row];
       }
    }
    stream << endl;
@@ -492,24 +660,6 @@ bool AttributeTable::importTable(istream& stream, bool merge)
 
 ////////////////////////////////////////////////////////////////////////
 
-void AttributeRow::init(size_t length)
-{
-   if (m_data) {
-      delete [] m_data;
-      m_data = NULL;
-   }
-   while (length >= storage_size())
-      m_shift++;
-   m_data = new float [storage_size()];
-   m_length = length;
-
-   for (size_t i = 0; i < m_length; i++) {
-      at(i) = -1.0;
-   }
-}
-
-////////////////////////////////////////////////////////////////////////
-
 void AttributeColumn::reset()
 {
    m_min = -1.0;
@@ -613,11 +763,13 @@ int AttributeIndex::makeIndex(const AttributeTable& table, int col, bool setdisp
    int viscount = 0;
    // n.b., attributes, axial lines and line refs must match
    size_t i;
+   // the column is swept straight from its array
+   const float *values = (col != -1) ? table.getColumnValues(col) : NULL;
    for (i = 0; i < rowcount; i++)
    {
       at(i).index = i;
       if (col != -1) {
-         at(i).value = double(table.getValue(i,col));
+         at(i).value = double(values[i]);
          if (at(i).value != -1) {
             if (min == -1.0f || at(i).value < min) {
                min = (double) at(i).value;
@@ -23,6 +23,9 @@
 #include <time.h>
 #include <generic/paftl.h>
 #include <generic/comm.h>  // For communicator
+#include <generic/parallel.h>
+#include <generic/bucketqueue.h>
+#include <generic/brandes.h>
 
 #include <sala/mgraph.h> // purely for the version info --- as phased out should replace
 #include <sala/axialmap.h>
@@ -1824,11 +1827,11 @@ int ShapeGraphs::convertAxialToSegment(Communicator *comm, const pstring& name,
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 
-bool ShapeGraphs::read( ifstream& stream, int version )
+bool ShapeGraphs::read( ifstream& stream, int version, const pstring& deferred_file )
 {
    // base class read
    if (version >= VERSION_AXIAL_SHAPES) {
-      ShapeMaps<ShapeGraph>::read(stream,version);
+      ShapeMaps<ShapeGraph>::read(stream,version,deferred_file);
    }
    else {
       readold(stream,version);
@@ -2166,23 +2169,30 @@ void ShapeGraph::cutLines(const prefvec<Line>& lines, pqmap<int,pvecint>& axcuts
 
 typedef pvector<IntPair> IntPairVector;
 
+// the values for one root at one radius, held until all the roots are done
+struct IntegrationResult
+{
+   int node_count;
+   int total_depth;
+   int depth;
+   double total_weight;
+   double w_total_depth;
+   double entropy;
+   double rel_entropy;
+   double intensity;
+   double harmonic;
+   IntegrationResult() {
+      node_count = 0; total_depth = 0; depth = 0; total_weight = 0.0; w_total_depth = 0.0;
+      entropy = 0.0; rel_entropy = 0.0; intensity = 0.0; harmonic = 0.0;
+   }
+};
+
 // n.b., translate radius list before entry
-bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool choice, bool local, bool fulloutput, int weighting_col, bool simple_version)
+bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool choice, bool local, bool fulloutput, int weighting_col, bool simple_version, bool exact_choice)
 {
    // note, from 10.0, Depthmap no longer includes *self* connections on axial lines
    // self connections are stripped out on loading graph files, as well as no longer made
 
-   // Quick mod - TV
-#if defined(_WIN32)
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, m_connectors.size() );
-   }
-
    // note: radius must be sorted lowest to highest, but if -1 occurs ("radius n") it needs to be last...
    // ...to ensure no mess ups, we'll re-sort here:
    bool radius_n = false;
@@ -2228,6 +2238,18 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
             m_attributes.insertColumn(nw_choice_col_text.c_str());
          }
       }
+      if (exact_choice) {
+         pstring x_choice_col_text = pstring("Choice [Exact]") + radius_text;
+         m_attributes.insertColumn(x_choice_col_text.c_str());
+         pstring nx_choice_col_text = pstring("Choice [Exact][Norm]") + radius_text;
+         m_attributes.insertColumn(nx_choice_col_text.c_str());
+         if (weighting_col != -1) {
+            pstring wx_choice_col_text = pstring("Choice [Exact][") + weighting_col_text + pstring(" Wgt]") + radius_text;
+            m_attributes.insertColumn(wx_choice_col_text.c_str());
+            pstring nwx_choice_col_text = pstring("Choice [Exact][") + weighting_col_text + pstring(" Wgt][Norm]") + radius_text;
+            m_attributes.insertColumn(nwx_choice_col_text.c_str());
+         }
+      }
 
 // dX simple version test // TV
 //#define _COMPILE_dX_SIMPLE_VERSION
@@ -2306,6 +2328,7 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
    // then look up all the columns... eek:
    pvecint choice_col, n_choice_col, w_choice_col, nw_choice_col, entropy_col, integ_dv_col, integ_pv_col, integ_tk_col, intensity_col,
            depth_col, count_col, rel_entropy_col, penn_norm_col, w_depth_col, total_weight_col, ra_col, rra_col, td_col, harmonic_col;
+   pvecint x_choice_col, nx_choice_col, wx_choice_col, nwx_choice_col;
    for (r = 0; r < radius.size(); r++) {
       pstring radius_text;
       if (radius[r] != -1) {
@@ -2323,6 +2346,18 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
             nw_choice_col.push_back(m_attributes.getColumnIndex(nw_choice_col_text.c_str()));
          }
       }
+      if (exact_choice) {
+         pstring x_choice_col_text = pstring("Choice [Exact]") + radius_text;
+         x_choice_col.push_back(m_attributes.getColumnIndex(x_choice_col_text.c_str()));
+         pstring nx_choice_col_text = pstring("Choice [Exact][Norm]") + radius_text;
+         nx_choice_col.push_back(m_attributes.getColumnIndex(nx_choice_col_text.c_str()));
+         if (weighting_col != -1) {
+            pstring wx_choice_col_text = pstring("Choice [Exact][") + weighting_col_text + pstring(" Wgt]") + radius_text;
+            wx_choice_col.push_back(m_attributes.getColumnIndex(wx_choice_col_text.c_str()));
+            pstring nwx_choice_col_text = pstring("Choice [Exact][") + weighting_col_text + pstring(" Wgt][Norm]") + radius_text;
+            nwx_choice_col.push_back(m_attributes.getColumnIndex(nwx_choice_col_text.c_str()));
+         }
+      }
 #ifndef _COMPILE_dX_SIMPLE_VERSION
       if(!simple_version) {
           pstring entropy_col_text = pstring("Entropy") + radius_text;
@@ -2381,7 +2416,7 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
          td_col.push_back(m_attributes.getColumnIndex(td_col_text.c_str()));
       }
    }
-   int control_col, controllability_col;
+   int control_col = -1, controllability_col = -1;
    if (local) {
 #ifndef _COMPILE_dX_SIMPLE_VERSION
        if(!simple_version) {
@@ -2391,141 +2426,248 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
 #endif
    }
 
-   // for choice
-   AnalysisInfo **audittrail;
-   if (choice) {
-      audittrail = new AnalysisInfo *[m_connectors.size()];
-      for (size_t i = 0; i < m_connectors.size(); i++) {
-         audittrail[i] = new AnalysisInfo [radius.size()];
-      }
+   // The roots are shared out between the threads.  Each thread has its own covered
+   // register (put back after each root for just the lines it reached), found lists and
+   // previous lines, and its own choice totals, which are added together once all the
+   // roots are done.  The values for each root are held until then too.  For choice,
+   // the line taken next from the current depth is picked at random as ever, but from a
+   // random number stream seeded by the root, so the routes no longer depend on which
+   // thread takes which root, or on how many runs have gone before
+   int line_count = m_connectors.size();
+   int radius_count = radius.size();
+   pvector<IntegrationResult> results;
+   results.set( IntegrationResult(), line_count * radius_count );
+   pvecdouble controls, controllabilities;
+   if (local) {
+      controls.set( -1.0, line_count );
+      controllabilities.set( -1.0, line_count );
+   }
+
+   int thread_count = getThreadCount();
+   ChoiceInfo **thread_choices = new ChoiceInfo *[thread_count];
+   for (int t = 0; t < thread_count; t++) {
+      thread_choices[t] = NULL;
    }
 
+   ParallelComm pcomm( comm, exact_choice ? line_count * 2 : line_count );
+
    // n.b., for this operation we assume continuous line referencing from zero (this is silly?)
    // has already failed due to this!  when intro hand drawn fewest line (where user may have deleted)
    // it's going to get worse...
 
-   bool *covered = new bool [m_connectors.size()];
-   for (size_t i = 0; i < m_connectors.size(); i++) {
-      for (size_t j = 0; j < m_connectors.size(); j++) {
+   #pragma omp parallel
+   {
+      bool *covered = new bool [line_count];
+      for (int j = 0; j < line_count; j++) {
          covered[j] = false;
       }
+      pvecint reached;
+      pflipper<IntPairVector> foundlist;
+      pvecint depthcounts;
+
+      // for choice: the previous line (the 0th member of the audittrail in the serial version)
+      // and the choice totals (choices[line * radius_count + r])
+      int *previouslines = NULL;
+      ChoiceInfo *choices = NULL;
       if (choice) {
-         for (size_t k = 0; k < m_connectors.size(); k++) {
-            audittrail[k][0].previous.ref = -1; // note, 0th member used as radius doesn't matter
-            // note, choice columns are not cleared, but cummulative over all shortest path pairs
-         }
+         previouslines = new int [line_count];
+         choices = new ChoiceInfo [line_count * radius_count];
+         thread_choices[getThreadNum()] = choices;
       }
 
-      if (local) {
-         double control = 0.0;
-         pvecint& connections = m_connectors[i].m_connections;
-         pvecint totalneighbourhood;
-         for (size_t j = 0; j < connections.size(); j++) {
-            // n.b., as of Depthmap 10.0, connections[j] and i cannot coexist
-            // if (connections[j] != i) {
-               totalneighbourhood.add(connections[j]); // <- note add does nothing if member already exists
-               int intersect_size = 0, retro_size = 0;
-               pvecint retconnectors = m_connectors[connections[j]].m_connections;
-               for (size_t k = 0; k < retconnectors.size(); k++) {
-                  //if (connections[j] != retconnectors[k]) {
-                     retro_size++;
-                     /*
-                     // used for clustering coeff, but clustering coeff next to useless
-                     if (connections.searchindex(retconnectors[k]) != paftl::npos) {
-                        intersect_size++;
-                     }
-                     */
-                     totalneighbourhood.add(retconnectors[k]); // <- note add does nothing if member already exists
-                  //}
-               }
-               control += 1.0 / double(retro_size);
-            //}
-         }
+      #pragma omp for schedule(static, 16)
+      for (int i = 0; i < line_count; i++) {
 
-#ifndef _COMPILE_dX_SIMPLE_VERSION
-         if(!simple_version) {
-             if (connections.size() > 0) {
-                 m_attributes.setValue(i, control_col, float(control) );
-                 m_attributes.setValue(i, controllability_col, float( double(connections.size()) / double(totalneighbourhood.size()-1)) );
-             }
-             else {
-                 m_attributes.setValue(i, control_col, -1 );
-                 m_attributes.setValue(i, controllability_col, -1 );
-             }
+         if (pcomm.isCancelled()) {
+            continue;
          }
-#endif
-      }
 
-      pvecint depthcounts;
-      depthcounts.push_back(0);
-      Connector& thisline = m_connectors[i];
-      pflipper<IntPairVector> foundlist;
-      foundlist.a().push_back(IntPair(i,-1));
-      covered[i] = true;
-      int total_depth = 0, depth = 1, node_count = 1, pos = -1, previous = -1; // node_count includes this 1
-      double weight = 0.0, rootweight = 0.0, total_weight = 0.0, w_total_depth = 0.0;
-      if (weighting_col != -1) {
-         rootweight = weights[i];
-         // include this line in total weights (as per nodecount)
-         total_weight += rootweight;
-      }
-      register int index = -1;
-      for (size_t r = 0; r < radius.size(); r++) {
-         while (foundlist.a().size()) {
-            if (!choice) {
-               index = foundlist.a().tail().a;
+         if (local) {
+            double control = 0.0;
+            pvecint& connections = m_connectors[i].m_connections;
+            pvecint totalneighbourhood;
+            for (size_t j = 0; j < connections.size(); j++) {
+               // n.b., as of Depthmap 10.0, connections[j] and i cannot coexist
+               // if (connections[j] != i) {
+                  totalneighbourhood.add(connections[j]); // <- note add does nothing if member already exists
+                  int retro_size = 0;
+                  pvecint& retconnectors = m_connectors[connections[j]].m_connections;
+                  for (size_t k = 0; k < retconnectors.size(); k++) {
+                     //if (connections[j] != retconnectors[k]) {
+                        retro_size++;
+                        /*
+                        // used for clustering coeff, but clustering coeff next to useless
+                        if (connections.searchindex(retconnectors[k]) != paftl::npos) {
+                           intersect_size++;
+                        }
+                        */
+                        totalneighbourhood.add(retconnectors[k]); // <- note add does nothing if member already exists
+                     //}
+                  }
+                  control += 1.0 / double(retro_size);
+               //}
             }
-            else {
-               pos = pafrand() % foundlist.a().size();
-               index = foundlist.a().at(pos).a;
-               previous = foundlist.a().at(pos).b;
-               audittrail[index][0].previous.ref = previous; // note 0th member used here: can be used individually different radius previous
+            if (connections.size() > 0) {
+               controls[i] = control;
+               controllabilities[i] = double(connections.size()) / double(totalneighbourhood.size()-1);
             }
-            Connector& line = m_connectors[index];
-            double control = 0;
-            for (size_t k = 0; k < line.m_connections.size(); k++) {
-               if (!covered[line.m_connections[k]]) {
-                  covered[line.m_connections[k]] = true;
-                  foundlist.b().push_back(IntPair(line.m_connections[k],index));
-                  if (weighting_col != -1) {
-                     // the weight is taken from the discovered node:
-                     weight = weights[line.m_connections[k]];
-                     total_weight += weight;
-                     w_total_depth += depth * weight;
-                  }
-                  if (choice && previous != -1) {
-                     // both directional paths are now recorded for choice
-                     // (coincidentally fixes choice problem which was completely wrong)
-                     int here = index; // note: start counting from index as actually looking ahead here
-                     while (here != i) { // not i means not the current root for the path
-                        audittrail[here][r].choice += 1;
-                        audittrail[here][r].weighted_choice += weight * rootweight;
-                        here = audittrail[here][0].previous.ref; // <- note, just using 0th position: radius for the previous doesn't matter in this analysis
-                     }
+         }
+
+         uint64 seed = i;
+         reached.clear();
+         depthcounts.clear();
+         depthcounts.push_back(0);
+         foundlist.a().clear();
+         foundlist.b().clear();
+         foundlist.a().push_back(IntPair(i,-1));
+         covered[i] = true;
+         reached.push_back(i);
+         int total_depth = 0, depth = 1, node_count = 1, pos = -1, previous = -1; // node_count includes this 1
+         double weight = 0.0, rootweight = 0.0, total_weight = 0.0, w_total_depth = 0.0;
+         if (weighting_col != -1) {
+            rootweight = weights[i];
+            // include this line in total weights (as per nodecount)
+            total_weight += rootweight;
+         }
+         register int index = -1;
+         for (int r = 0; r < radius_count; r++) {
+            while (foundlist.a().size()) {
+               if (!choice) {
+                  index = foundlist.a().tail().a;
+               }
+               else {
+                  pos = pafrand(seed) % foundlist.a().size();
+                  index = foundlist.a().at(pos).a;
+                  previous = foundlist.a().at(pos).b;
+                  previouslines[index] = previous;
+               }
+               Connector& line = m_connectors[index];
+               for (size_t k = 0; k < line.m_connections.size(); k++) {
+                  if (!covered[line.m_connections[k]]) {
+                     covered[line.m_connections[k]] = true;
+                     reached.push_back(line.m_connections[k]);
+                     foundlist.b().push_back(IntPair(line.m_connections[k],index));
                      if (weighting_col != -1) {
-                        // in weighted choice, root node and current node receive values:
-                        audittrail[i][r].weighted_choice += (weight * rootweight) * 0.5;
-                        audittrail[line.m_connections[k]][r].weighted_choice += (weight * rootweight) * 0.5;
+                        // the weight is taken from the discovered node:
+                        weight = weights[line.m_connections[k]];
+                        total_weight += weight;
+                        w_total_depth += depth * weight;
                      }
+                     if (choice && previous != -1) {
+                        // both directional paths are now recorded for choice
+                        // (coincidentally fixes choice problem which was completely wrong)
+                        int here = index; // note: start counting from index as actually looking ahead here
+                        while (here != i) { // not i means not the current root for the path
+                           choices[here * radius_count + r].choice += 1;
+                           choices[here * radius_count + r].weighted_choice += weight * rootweight;
+                           here = previouslines[here]; // <- note, radius for the previous doesn't matter in this analysis
+                        }
+                        if (weighting_col != -1) {
+                           // in weighted choice, root node and current node receive values:
+                           choices[i * radius_count + r].weighted_choice += (weight * rootweight) * 0.5;
+                           choices[line.m_connections[k] * radius_count + r].weighted_choice += (weight * rootweight) * 0.5;
+                        }
+                     }
+                     total_depth += depth;
+                     node_count++;
+                     depthcounts.tail() += 1;
+                  }
+               }
+               if (!choice) 
+                  foundlist.a().pop_back();
+               else
+                  foundlist.a().remove_at(pos);
+               if (!foundlist.a().size()) {
+                  foundlist.flip();
+                  depth++;
+                  depthcounts.push_back(0);
+                  if (radius[r] != -1 && depth > radius[r]) {
+                     break;
                   }
-                  total_depth += depth;
-                  node_count++;
-                  depthcounts.tail() += 1;
                }
             }
-            if (!choice) 
-               foundlist.a().pop_back();
-            else
-               foundlist.a().remove_at(pos);
-            if (!foundlist.a().size()) {
-               foundlist.flip();
-               depth++;
-               depthcounts.push_back(0);
-               if (radius[r] != -1 && depth > radius[r]) {
-                  break;
+            // the values for this node:
+            IntegrationResult& result = results[i * radius_count + r];
+            result.node_count = node_count;
+            result.total_depth = total_depth;
+            result.depth = depth;
+            result.total_weight = total_weight;
+            result.w_total_depth = w_total_depth;
+            // node count > 1 to avoid divide by zero (was > 2)
+            if (node_count > 1 && !simple_version) {
+               // note -- node_count includes this one -- mean depth as per p.108 Social Logic of Space
+               double mean_depth = double(total_depth) / double(node_count - 1);
+               double entropy = 0.0, intensity = 0.0, rel_entropy = 0.0, factorial = 1.0, harmonic = 0.0;
+               for (size_t k = 0; k < depthcounts.size(); k++) {
+                  if (depthcounts[k] != 0) {
+                     // some debate over whether or not this should be node count - 1
+                     // (i.e., including or not including the node itself)
+                     double prob = double(depthcounts[k]) / double(node_count);
+                     entropy -= prob * log2( prob );
+                     // Formula from Turner 2001, "Depthmap"
+                     factorial *= double(k + 1);
+                     double q = (pow( mean_depth, double(k) ) / double(factorial)) * exp(-mean_depth);
+                     rel_entropy += (double) prob * log2( prob / q );
+                     //
+                     harmonic += 1.0 / double(depthcounts[k]);
+                  }
+               }
+               harmonic = double(depthcounts.size()) / harmonic;
+               if (total_depth > node_count) {
+                  intensity = node_count * entropy / (total_depth - node_count);
                }
+               else {
+                  intensity = -1;
+               }
+               result.entropy = entropy;
+               result.rel_entropy = rel_entropy;
+               result.intensity = intensity;
+               result.harmonic = harmonic;
             }
          }
+
+         // put the covered register back for the next root
+         for (size_t j = 0; j < reached.size(); j++) {
+            covered[reached[j]] = false;
+         }
+
+         pcomm.record();
+      }
+
+      delete [] covered;
+      if (previouslines) {
+         delete [] previouslines;
+      }
+   }
+
+   if (pcomm.isCancelled()) {
+      for (int t = 0; t < thread_count; t++) {
+         if (thread_choices[t]) {
+            delete [] thread_choices[t];
+         }
+      }
+      delete [] thread_choices;
+      pcomm.throwIfCancelled();
+   }
+
+   for (int i = 0; i < line_count; i++) {
+
+      if (local) {
+#ifndef _COMPILE_dX_SIMPLE_VERSION
+         if(!simple_version) {
+             m_attributes.setValue(i, control_col, float(controls[i]) );
+             m_attributes.setValue(i, controllability_col, float(controllabilities[i]) );
+         }
+#endif
+      }
+
+      for (int r = 0; r < radius_count; r++) {
+         const IntegrationResult& result = results[i * radius_count + r];
+         int node_count = result.node_count;
+         int total_depth = result.total_depth;
+         int depth = result.depth;
+         double total_weight = result.total_weight;
+         double w_total_depth = result.w_total_depth;
          // set the attributes for this node:
          m_attributes.setValue(i,count_col[r],float(node_count));
          if (weighting_col != -1) {
@@ -2613,32 +2755,10 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
 
 #ifndef _COMPILE_dX_SIMPLE_VERSION
             if(!simple_version) {
-                double entropy = 0.0, intensity = 0.0, rel_entropy = 0.0, factorial = 1.0, harmonic = 0.0;
-                for (size_t k = 0; k < depthcounts.size(); k++) {
-                    if (depthcounts[k] != 0) {
-                        // some debate over whether or not this should be node count - 1
-                        // (i.e., including or not including the node itself)
-                        double prob = double(depthcounts[k]) / double(node_count);
-                        entropy -= prob * log2( prob );
-                        // Formula from Turner 2001, "Depthmap"
-                        factorial *= double(k + 1);
-                        double q = (pow( mean_depth, double(k) ) / double(factorial)) * exp(-mean_depth);
-                        rel_entropy += (double) prob * log2( prob / q );
-                        //
-                        harmonic += 1.0 / double(depthcounts[k]);
-                    }
-                }
-                harmonic = double(depthcounts.size()) / harmonic;
-                if (total_depth > node_count) {
-                    intensity = node_count * entropy / (total_depth - node_count);
-                }
-                else {
-                    intensity = -1;
-                }
-                m_attributes.setValue(i,entropy_col[r],float(entropy));
-                m_attributes.setValue(i,rel_entropy_col[r],float(rel_entropy));
-                m_attributes.setValue(i,intensity_col[r],float(intensity));
-                m_attributes.setValue(i,harmonic_col[r],float(harmonic));
+                m_attributes.setValue(i,entropy_col[r],float(result.entropy));
+                m_attributes.setValue(i,rel_entropy_col[r],float(result.rel_entropy));
+                m_attributes.setValue(i,intensity_col[r],float(result.intensity));
+                m_attributes.setValue(i,harmonic_col[r],float(result.harmonic));
             }
 #endif
          }
@@ -2656,26 +2776,25 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
             }
 #endif
          }
-
-      }
-      //
-      if (comm) {
-         if (qtimer( atime, 500 )) {
-            if (comm->IsCancelled()) {
-               delete [] covered;
-               throw Communicator::CancelledException();
-            }
-            comm->CommPostMessage( Communicator::CURRENT_RECORD, i );
-         }         
       }
    }
-   delete [] covered;
+
    if (choice) {
-      for (size_t i = 0; i < m_connectors.size(); i++) {
+      // add up the choice totals of each thread (in thread order)
+      ChoiceInfo *audittrail = new ChoiceInfo [line_count * radius_count];
+      for (int t = 0; t < thread_count; t++) {
+         if (thread_choices[t]) {
+            for (int j = 0; j < line_count * radius_count; j++) {
+               audittrail[j].choice += thread_choices[t][j].choice;
+               audittrail[j].weighted_choice += thread_choices[t][j].weighted_choice;
+            }
+         }
+      }
+      for (int i = 0; i < line_count; i++) {
          double total_choice = 0.0, w_total_choice = 0.0;
-         for (size_t r = 0; r < radius.size(); r++) {
-            total_choice += audittrail[i][r].choice;
-            w_total_choice += audittrail[i][r].weighted_choice;
+         for (int r = 0; r < radius_count; r++) {
+            total_choice += audittrail[i * radius_count + r].choice;
+            w_total_choice += audittrail[i * radius_count + r].weighted_choice;
             // n.b., normalise choice according to (n-1)(n-2)/2 (maximum possible through routes)
             double node_count = m_attributes.getValue(i,count_col[r]);
             double total_weight;
@@ -2700,11 +2819,142 @@ bool ShapeGraph::integrate(Communicator *comm, const pvecint& radius_list, bool
             }
          }
       }
-      for (size_t i = 0; i < m_connectors.size(); i++) {
-         delete [] audittrail[i];
-      }
       delete [] audittrail;
    }
+   for (int t = 0; t < thread_count; t++) {
+      if (thread_choices[t]) {
+         delete [] thread_choices[t];
+      }
+   }
+   delete [] thread_choices;
+
+   if (exact_choice) {
+      // Exact choice counts every shortest route between each pair of lines, rather than
+      // one at random (see brandes.h).  As the radius is in steps, one search out to the
+      // largest radius serves them all, each radius taking just the routes within it.
+      // Each thread has its own totals, set out as [(r * 2 + w) * line_count + line],
+      // w = 0 for choice and 1 for weighted choice, added together in thread order
+      BrandesGraph graph;
+      for (int i = 0; i < line_count; i++) {
+         graph.addNode();
+         pvecint& connections = m_connectors[i].m_connections;
+         for (size_t j = 0; j < connections.size(); j++) {
+            graph.addEdge(connections[j], 1);
+         }
+      }
+      // (radius n, if there, is last)
+      int cost_limit = radius.tail();
+
+      double **thread_exact = new double *[thread_count];
+      for (int t = 0; t < thread_count; t++) {
+         thread_exact[t] = NULL;
+      }
+
+      #pragma omp parallel
+      {
+         BrandesSearch search(graph);
+         double *exact = new double [radius_count * 2 * line_count];
+         for (int j = 0; j < radius_count * 2 * line_count; j++) {
+            exact[j] = 0.0;
+         }
+         thread_exact[getThreadNum()] = exact;
+         double *pairweights = NULL;
+         if (weighting_col != -1) {
+            pairweights = new double [line_count];
+         }
+
+         #pragma omp for schedule(static, 16)
+         for (int i = 0; i < line_count; i++) {
+
+            if (pcomm.isCancelled()) {
+               continue;
+            }
+
+            search.start();
+            search.addRoot(i);
+            search.search(cost_limit);
+
+            if (weighting_col != -1) {
+               // the weight of a route is the weight of the line it goes to times the root's
+               for (int n = 0; n < search.getReachedCount(); n++) {
+                  int j = search.getReached(n);
+                  pairweights[j] = weights[j] * weights[i];
+               }
+            }
+            for (int r = 0; r < radius_count; r++) {
+               search.accumulate(exact + (r * 2) * line_count, NULL, radius[r]);
+               if (weighting_col != -1) {
+                  double *w_exact = exact + (r * 2 + 1) * line_count;
+                  search.accumulate(w_exact, pairweights, radius[r]);
+                  // as for choice, the start and end lines of each route through another line are given half its weight each
+                  for (int n = 0; n < search.getReachedCount(); n++) {
+                     int j = search.getReached(n);
+                     int cost = search.getCost(j);
+                     if (cost > 1 && (radius[r] == -1 || cost <= radius[r])) {
+                        w_exact[i] += pairweights[j] * 0.5;
+                        w_exact[j] += pairweights[j] * 0.5;
+                     }
+                  }
+               }
+            }
+
+            pcomm.record();
+         }
+
+         if (pairweights) {
+            delete [] pairweights;
+         }
+      }
+
+      if (!pcomm.isCancelled()) {
+         double *exact = new double [radius_count * 2 * line_count];
+         for (int j = 0; j < radius_count * 2 * line_count; j++) {
+            exact[j] = 0.0;
+            for (int t = 0; t < thread_count; t++) {
+               if (thread_exact[t]) {
+                  exact[j] += thread_exact[t][j];
+               }
+            }
+         }
+         for (int i = 0; i < line_count; i++) {
+            for (int r = 0; r < radius_count; r++) {
+               double total_choice = exact[(r * 2) * line_count + i];
+               double w_total_choice = exact[(r * 2 + 1) * line_count + i];
+               // n.b., normalise choice according to (n-1)(n-2)/2 (maximum possible through routes)
+               double node_count = m_attributes.getValue(i,count_col[r]);
+               double total_weight;
+               if (weighting_col != -1) {
+                   total_weight = m_attributes.getValue(i,total_weight_col[r]);
+               }
+               if (node_count > 2) {
+                  m_attributes.setValue(i,x_choice_col[r],float(total_choice));
+                  m_attributes.setValue(i,nx_choice_col[r],float(2.0*total_choice/((node_count-1)*(node_count-2))));
+                  if (weighting_col != -1) {
+                     m_attributes.setValue(i,wx_choice_col[r],float(w_total_choice));
+                     m_attributes.setValue(i,nwx_choice_col[r],float(2.0*w_total_choice/(total_weight*total_weight)));
+                  }
+               }
+               else {
+                  m_attributes.setValue(i,x_choice_col[r],-1);
+                  m_attributes.setValue(i,nx_choice_col[r],-1);
+                  if (weighting_col != -1) {
+                     m_attributes.setValue(i,wx_choice_col[r],-1);
+                     m_attributes.setValue(i,nwx_choice_col[r],-1);
+                  }
+               }
+            }
+         }
+         delete [] exact;
+      }
+      for (int t = 0; t < thread_count; t++) {
+         if (thread_exact[t]) {
+            delete [] thread_exact[t];
+         }
+      }
+      delete [] thread_exact;
+
+      pcomm.throwIfCancelled();
+   }
 
    m_displayed_attribute = -1; // <- override if it's already showing
    setDisplayedAttribute(integ_dv_col.tail());
@@ -3413,7 +3663,7 @@ bool ShapeGraph::analyseAngular(Communicator *comm, const pvecdouble& radius_lis
 }
 
 // extra parameters for selection_only and interactive are for parallel process extensions
-int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, int radius_type, const pvecdouble& radius_list, int weighting_col, int weighting_col2, int routeweight_col, bool selection_only, bool interactive)
+int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, int radius_type, const pvecdouble& radius_list, int weighting_col, int weighting_col2, int routeweight_col, bool selection_only, bool interactive, bool exact_choice)
 {
    int processed_rows = 0;
 
@@ -3421,18 +3671,6 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
       return processed_rows;
    }
 
-   // Quick mod - TV
-#if defined(_WIN32)
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif
-
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, (selection_only ? m_selection_set.size() : m_connectors.size()) );
-   }
-
    // note: radius must be sorted lowest to highest, but if -1 occurs ("radius n") it needs to be last...
    // ...to ensure no mess ups, we'll re-sort here:
    bool radius_n = false;
@@ -3582,6 +3820,32 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
 			}
 		}
    }
+   // exact choice (see brandes.h), entered and looked up together:
+   pvecint x_choice_col, wx_choice_col;
+   if (exact_choice) {
+      pstring x_choice_text = tulip_text + pstring(" Choice [Exact]");
+      if (routeweight_col != -1) {
+         x_choice_text = x_choice_text + pstring("[Route weight by ") + routeweight_col_text + pstring("]");
+      }
+      for (r = 0; r < radius_unconverted.size(); r++) {
+         pstring radius_text = makeRadiusText(radius_type, radius_unconverted[r]);
+         pstring x_choice_col_text = x_choice_text + radius_text;
+         m_attributes.insertColumn(x_choice_col_text.c_str());
+         if (weighting_col != -1) {
+            pstring wx_choice_col_text = x_choice_text + pstring("[") + weighting_col_text + pstring(" Wgt]") + radius_text;
+            m_attributes.insertColumn(wx_choice_col_text.c_str());
+         }
+      }
+      for (r = 0; r < radius_unconverted.size(); r++) {
+         pstring radius_text = makeRadiusText(radius_type, radius_unconverted[r]);
+         pstring x_choice_col_text = x_choice_text + radius_text;
+         x_choice_col.push_back(m_attributes.getColumnIndex(x_choice_col_text.c_str()));
+         if (weighting_col != -1) {
+            pstring wx_choice_col_text = x_choice_text + pstring("[") + weighting_col_text + pstring(" Wgt]") + radius_text;
+            wx_choice_col.push_back(m_attributes.getColumnIndex(wx_choice_col_text.c_str()));
+         }
+      }
+   }
    pvecint choice_col, w_choice_col, w_choice_col2, count_col, integ_col, w_integ_col, td_col, w_td_col, total_weight_col;
    // then look them up! eek....
    for (r = 0; r < radius_unconverted.size(); r++) {
@@ -3664,20 +3928,6 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
    tulip_bins /= 2;  // <- actually use semicircle of tulip bins
    tulip_bins += 1;
 
-   pqvector<SegmentData> *bins = new pqvector<SegmentData>[tulip_bins];
-
-   AnalysisInfo ***audittrail;
-   unsigned int **uncovered;
-   audittrail = new AnalysisInfo **[m_connectors.size()];
-   uncovered = new unsigned int *[m_connectors.size()];
-   for (size_t i = 0; i < m_connectors.size(); i++) {
-      audittrail[i] = new AnalysisInfo *[radius_unconverted.size()];
-      for (size_t j = 0; j < radius_unconverted.size(); j++) {
-         audittrail[i][j] = new AnalysisInfo[2];
-      }
-      uncovered[i] = new unsigned int [2];
-
-   }
    pvecdouble radius;
    for (r = 0; r < radius_unconverted.size(); r++) {
       if (radius_type == Options::RADIUS_ANGULAR && radius_unconverted[r] != -1) {
@@ -3702,8 +3952,9 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
       radiusmask |= (1 << i);
    }
 
+   // the roots, in the order their results go into the table
+   pvecint roots;
    for (size_t rowid = 0; rowid < m_connectors.size(); rowid++) {
-
       if (selection_only) {
          // could use m_selection_set.searchindex(rowid) to find 
          // if this row is selected as m_selection_set is ordered for axial and segment maps, etc
@@ -3712,245 +3963,324 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
             continue;
          }
       }
+      roots.push_back(rowid);
+   }
+   int root_count = roots.size();
+
+   ParallelComm pcomm( comm, exact_choice ? root_count * 2 : root_count );
+
+   // The roots are shared out between the threads.  Each thread has its own tulip
+   // bins, audit trail and coverage, which are put back after each root for just the
+   // segments that root's search reached, and its own choice totals, which are
+   // added together once all the roots are done.  The totals for each root are held
+   // until then too.  Roots are dealt out in fixed chunks, so that the choice
+   // totals are added in the same order from run to run
+   int segment_count = m_connectors.size();
+   int results_size = 4 * radiussize;  // node count, total depth, total weight, total weighted depth
+   pvecdouble results;
+   results.set( 0.0, root_count * results_size );
+   pvector<char> processed;
+   processed.set( 0, root_count );
 
-      for (int k = 0; k < tulip_bins; k++) {
-         bins[k].clear();
+   int thread_count = getThreadCount();
+   ChoiceInfo **thread_choices = new ChoiceInfo *[thread_count];
+   for (int i = 0; i < thread_count; i++) {
+      thread_choices[i] = NULL;
+   }
+
+   #pragma omp parallel
+   {
+      BucketQueue<SegmentData> bins(tulip_bins);
+
+      // audittrail[(ref * radiussize + rbin) * 2 + dir], and uncovered[ref * 2 + dir]
+      AuditInfo *audittrail = new AuditInfo [segment_count * radiussize * 2];
+      unsigned int *uncovered = new unsigned int [segment_count * 2];
+      for (int i = 0; i < segment_count * 2; i++) {
+         uncovered[i] = radiusmask;
       }
-      for (size_t j = 0; j < m_connectors.size(); j++) {
-         for (int dir = 0; dir < 2; dir++) {
-            for (int k = 0; k < radiussize; k++) {
-               audittrail[j][k][dir].clearLine();
-            }
-            uncovered[j][dir] = radiusmask;
-         }
+      ChoiceInfo *choices = NULL;
+      if (choice) {
+         choices = new ChoiceInfo [segment_count * radiussize * 2];
+         thread_choices[getThreadNum()] = choices;
       }
+      // the segments reached from the current root
+      pvecint reached;
 
-      double rootseglength = m_attributes.getValue(rowid,length_col);
-      double rootweight = (weighting_col != -1) ? weights[rowid] : 0.0;
-		//EFEF
-		double rootweight2 = (weighting_col2 != -1) ? weights2[rowid] : 0.0;
-		//EFEF
+      #pragma omp for schedule(static, 16)
+      for (int i = 0; i < root_count; i++) {
 
-      // setup: direction 0 (both ways), segment i, previous -1, segdepth (step depth) 0, metricdepth 0.5 * rootseglength, bin 0
-      bins[0].add(SegmentData(0,rowid,SegmentRef(),0,0.5*rootseglength,radiusmask));
-      // this version below is only designed to be used temporarily --
-      // could be on an option?
-      //bins[0].push_back(SegmentData(0,rowid,SegmentRef(),0,0.0,radiusmask));
-      Connector& thisline = m_connectors[rowid];
-      pvecint node_count;
-      double weight = 0.0;
-      int depthlevel = 0;
-      int opencount = 1;
-      int currentbin = 0;
-      while (opencount) {
-         while (!bins[currentbin].size()) {
-            depthlevel++;
-            currentbin++;
-            if (currentbin == tulip_bins) {
-               currentbin = 0;
-            }
+         if (pcomm.isCancelled()) {
+            continue;
          }
-         SegmentData lineindex = bins[currentbin].tail();
-         bins[currentbin].pop_back();
-         //
-         opencount--;
-
-         int ref = lineindex.ref;
-         int dir = (lineindex.dir == 1) ? 0 : 1;
-         int coverage = lineindex.coverage & uncovered[ref][dir];
-         if (coverage != 0) {
-            register int rbin = 0;
-            int rbinbase;
-            if (lineindex.previous.ref != -1) {
-               uncovered[ref][dir] &= ~coverage;
-               while (((coverage >> rbin) & 0x1) == 0)
-                  rbin++;
-               rbinbase = rbin;
-               while (rbin < radiussize) {
-                  if (((coverage >> rbin) & 0x1) == 1) {
-                     audittrail[ref][rbin][dir].depth = depthlevel;
-                     audittrail[ref][rbin][dir].previous = lineindex.previous;
-                     audittrail[lineindex.previous.ref][rbin][(lineindex.previous.dir == 1) ? 0 : 1].leaf = false;
+
+         int rowid = roots[i];
+
+         bins.clear();
+         reached.clear();
+
+         double rootseglength = m_attributes.getValue(rowid,length_col);
+         double rootweight = (weighting_col != -1) ? weights[rowid] : 0.0;
+         // (the second weighting is also by the root weight, see choiceweight2 below)
+
+         // setup: direction 0 (both ways), segment i, previous -1, segdepth (step depth) 0, metricdepth 0.5 * rootseglength, bin 0
+         bins.add(0,SegmentData(0,rowid,SegmentRef(),0,0.5*rootseglength,radiusmask));
+         // this version below is only designed to be used temporarily --
+         // could be on an option?
+         //bins.push(0,SegmentData(0,rowid,SegmentRef(),0,0.0,radiusmask));
+         while (bins.size()) {
+            SegmentData lineindex = bins.pop();
+            int depthlevel = bins.level();
+
+            int ref = lineindex.ref;
+            int dir = (lineindex.dir == 1) ? 0 : 1;
+            int coverage = lineindex.coverage & uncovered[ref * 2 + dir];
+            if (coverage != 0) {
+               if (uncovered[ref * 2] == (unsigned int) radiusmask && uncovered[ref * 2 + 1] == (unsigned int) radiusmask) {
+                  reached.push_back(ref);
+               }
+               register int rbin = 0;
+               int rbinbase;
+               if (lineindex.previous.ref != -1) {
+                  uncovered[ref * 2 + dir] &= ~coverage;
+                  while (((coverage >> rbin) & 0x1) == 0)
+                     rbin++;
+                  rbinbase = rbin;
+                  while (rbin < radiussize) {
+                     if (((coverage >> rbin) & 0x1) == 1) {
+                        audittrail[(ref * radiussize + rbin) * 2 + dir].depth = depthlevel;
+                        audittrail[(ref * radiussize + rbin) * 2 + dir].previous = lineindex.previous;
+                        audittrail[(lineindex.previous.ref * radiussize + rbin) * 2 + ((lineindex.previous.dir == 1) ? 0 : 1)].leaf = false;
+                     }
+                     rbin++;
                   }
-                  rbin++;
                }
-            }
-            else {
-               rbinbase = 0;
-               uncovered[ref][0] &= ~coverage;
-               uncovered[ref][1] &= ~coverage;
-            }
-            Connector& line = m_connectors[ref];
-            float seglength;
-            register int extradepth;
-            if (lineindex.dir != -1) {
-               for (size_t k = 0; k < line.m_forward_segconns.size(); k++) {
-                  rbin = rbinbase;
-                  SegmentRef conn = line.m_forward_segconns.key(k);
-                  if ((uncovered[conn.ref][(conn.dir == 1 ? 0 : 1)] & coverage) != 0) {
-							//EF routeweight*
-							if (routeweight_col != -1) {  //EF here we do the weighting of the angular cost by the weight of the next segment
-													//note that the content of the routeweights array is scaled between 0 and 1 and is reversed 
-													// such that: = 1.0-(m_attributes.getValue(i, routeweight_col)/max_value)
-								extradepth = (int) floor(line.m_forward_segconns.value(k) * tulip_bins * 0.5 * routeweights[conn.ref]);					 
-							}
-							//*EF routeweight
-							else {
-								extradepth = (int) floor(line.m_forward_segconns.value(k) * tulip_bins * 0.5);
-							}
-							seglength = lengths[conn.ref];
-                     switch (radius_type) {
-                     case Options::RADIUS_ANGULAR:
-                        while (rbin != radiussize && radius[rbin] != -1 && depthlevel+extradepth > (int) radius[rbin]) {
-                           rbin++;
+               else {
+                  rbinbase = 0;
+                  uncovered[ref * 2] &= ~coverage;
+                  uncovered[ref * 2 + 1] &= ~coverage;
+               }
+               Connector& line = m_connectors[ref];
+               float seglength;
+               register int extradepth;
+               if (lineindex.dir != -1) {
+                  for (size_t k = 0; k < line.m_forward_segconns.size(); k++) {
+                     rbin = rbinbase;
+                     SegmentRef conn = line.m_forward_segconns.key(k);
+                     if ((uncovered[conn.ref * 2 + (conn.dir == 1 ? 0 : 1)] & coverage) != 0) {
+                        //EF routeweight*
+                        if (routeweight_col != -1) {  //EF here we do the weighting of the angular cost by the weight of the next segment
+                                                //note that the content of the routeweights array is scaled between 0 and 1 and is reversed 
+                                                // such that: = 1.0-(m_attributes.getValue(i, routeweight_col)/max_value)
+                           extradepth = (int) floor(line.m_forward_segconns.value(k) * tulip_bins * 0.5 * routeweights[conn.ref]);
                         }
-                        break;
-                     case Options::RADIUS_METRIC:
-                        while (rbin != radiussize && radius[rbin] != -1 && lineindex.metricdepth+seglength*0.5 > radius[rbin]) {
-                           rbin++;
+                        //*EF routeweight
+                        else {
+                           extradepth = (int) floor(line.m_forward_segconns.value(k) * tulip_bins * 0.5);
                         }
-                        break;
-                     case Options::RADIUS_STEPS: 
-                        if (rbin != radiussize && radius[rbin] != -1 && lineindex.segdepth >= (int) radius[rbin]) {
-                           rbin++;
+                        seglength = lengths[conn.ref];
+                        switch (radius_type) {
+                        case Options::RADIUS_ANGULAR:
+                           while (rbin != radiussize && radius[rbin] != -1 && depthlevel+extradepth > (int) radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        case Options::RADIUS_METRIC:
+                           while (rbin != radiussize && radius[rbin] != -1 && lineindex.metricdepth+seglength*0.5 > radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        case Options::RADIUS_STEPS: 
+                           if (rbin != radiussize && radius[rbin] != -1 && lineindex.segdepth >= (int) radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        }
+                        if ((coverage >> rbin) != 0) {
+                           bins.add(extradepth,
+                              SegmentData(conn,SegmentRef(1,lineindex.ref),lineindex.segdepth+1,lineindex.metricdepth+seglength,(coverage >> rbin) << rbin));
                         }
-                        break;
-                     }
-                     if ((coverage >> rbin) != 0) {
-                        bins[(currentbin + tulip_bins + extradepth) % tulip_bins].add(
-                           SegmentData(conn,SegmentRef(1,lineindex.ref),lineindex.segdepth+1,lineindex.metricdepth+seglength,(coverage >> rbin) << rbin), paftl::ADD_DUPLICATE);
-                        opencount++;
                      }
                   }
                }
-            }
-            if (lineindex.dir != 1) {
-               for (size_t k = 0; k < line.m_back_segconns.size(); k++) {
-                  rbin = rbinbase;
-                  SegmentRef conn = line.m_back_segconns.key(k);
-                  if ((uncovered[conn.ref][(conn.dir == 1 ? 0 : 1)] & coverage) != 0) {
-							//EF routeweight*
-							if (routeweight_col != -1) {  //EF here we do the weighting of the angular cost by the weight of the next segment
-													//note that the content of the routeweights array is scaled between 0 and 1 and is reversed 
-													// such that: = 1.0-(m_attributes.getValue(i, routeweight_col)/max_value)
-								extradepth = (int) floor(line.m_back_segconns.value(k) * tulip_bins * 0.5 * routeweights[conn.ref]);					 
-							}
-							//*EF routeweight
-							else {
-								extradepth = (int) floor(line.m_back_segconns.value(k) * tulip_bins * 0.5);
-							}
-                     seglength = lengths[conn.ref];
-                     switch (radius_type) {
-                     case Options::RADIUS_ANGULAR:
-                        while (rbin != radiussize && radius[rbin] != -1 && depthlevel+extradepth > (int) radius[rbin]) {
-                           rbin++;
+               if (lineindex.dir != 1) {
+                  for (size_t k = 0; k < line.m_back_segconns.size(); k++) {
+                     rbin = rbinbase;
+                     SegmentRef conn = line.m_back_segconns.key(k);
+                     if ((uncovered[conn.ref * 2 + (conn.dir == 1 ? 0 : 1)] & coverage) != 0) {
+                        //EF routeweight*
+                        if (routeweight_col != -1) {  //EF here we do the weighting of the angular cost by the weight of the next segment
+                                                //note that the content of the routeweights array is scaled between 0 and 1 and is reversed 
+                                                // such that: = 1.0-(m_attributes.getValue(i, routeweight_col)/max_value)
+                           extradepth = (int) floor(line.m_back_segconns.value(k) * tulip_bins * 0.5 * routeweights[conn.ref]);
                         }
-                        break;
-                     case Options::RADIUS_METRIC:
-                        while (rbin != radiussize && radius[rbin] != -1 && lineindex.metricdepth+seglength*0.5 > radius[rbin]) {
-                           rbin++;
+                        //*EF routeweight
+                        else {
+                           extradepth = (int) floor(line.m_back_segconns.value(k) * tulip_bins * 0.5);
                         }
-                        break;
-                     case Options::RADIUS_STEPS: 
-                        if (rbin != radiussize && radius[rbin] != -1 && lineindex.segdepth >= (int) radius[rbin]) {
-                           rbin++;
+                        seglength = lengths[conn.ref];
+                        switch (radius_type) {
+                        case Options::RADIUS_ANGULAR:
+                           while (rbin != radiussize && radius[rbin] != -1 && depthlevel+extradepth > (int) radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        case Options::RADIUS_METRIC:
+                           while (rbin != radiussize && radius[rbin] != -1 && lineindex.metricdepth+seglength*0.5 > radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        case Options::RADIUS_STEPS: 
+                           if (rbin != radiussize && radius[rbin] != -1 && lineindex.segdepth >= (int) radius[rbin]) {
+                              rbin++;
+                           }
+                           break;
+                        }
+                        if ((coverage >> rbin) != 0) {
+                           bins.add(extradepth,
+                              SegmentData(conn,SegmentRef(-1,lineindex.ref),lineindex.segdepth+1,lineindex.metricdepth+seglength,(coverage >> rbin) << rbin));
                         }
-                        break;
-                     }
-                     if ((coverage >> rbin) != 0) {
-                        bins[(currentbin + tulip_bins + extradepth) % tulip_bins].add(
-                           SegmentData(conn,SegmentRef(-1,lineindex.ref),lineindex.segdepth+1,lineindex.metricdepth+seglength,(coverage >> rbin) << rbin), paftl::ADD_DUPLICATE);
-                        opencount++;
                      }
                   }
                }
             }
          }
-      }
-      // set the attributes for this node:
-      for (int k = 0; k < radiussize; k++) {
-         // note, curs_total_depth must use double as mantissa can get too long for int in large systems
-         double curs_node_count = 0.0, curs_total_depth = 0.0;
-         double curs_total_weight = 0.0, curs_total_weighted_depth = 0.0;
-         size_t j;
-         for (j = 0; j < m_connectors.size(); j++) {
-            // find dir according 
-            bool m0 = ((uncovered[j][0] >> k) & 0x1) == 0;
-            bool m1 = ((uncovered[j][1] >> k) & 0x1) == 0;
-            if ((m0 | m1) != 0) {
-               int dir;
-               if (m0 & m1) {
-                  // dir is the one with the lowest depth:
-                  if (audittrail[j][k][0].depth < audittrail[j][k][1].depth)
-                     dir = 0;
-                  else
-                     dir = 1;
-               }
-               else {
-                  // dir is simply the one that's filled in:
-                  dir = m0 ? 0 : 1;
-               }
-               curs_node_count++;
-               curs_total_depth += audittrail[j][k][dir].depth;
-               curs_total_weight += weights[j];
-               curs_total_weighted_depth += audittrail[j][k][dir].depth * weights[j];
-               //
-               if (choice && audittrail[j][k][dir].leaf) {
-                  // note, graph may be directed (e.g., for one way streets), so both ways must be included from now on:
-                  SegmentRef here = SegmentRef(dir == 0 ? 1 : -1,j);
-                  if (here.ref != rowid) {
-                     int choicecount = 0;
-                     double choiceweight = 0.0;
-							//EFEF*
-							double choiceweight2 = 0.0;
-							//*EFEF
-                     while (here.ref != rowid) { // not rowid means not the current root for the path
-                        int heredir = (here.dir == 1) ? 0 : 1;
-                        // each node has the existing choicecount and choiceweight from previously encountered nodes added to it
-                        audittrail[here.ref][k][heredir].choice += choicecount;
-                        // nb, weighted values calculated anyway to save time on 'if'
-                        audittrail[here.ref][k][heredir].weighted_choice += choiceweight;
+
+         // the totals are taken over the reached segments in order, as they were over all of them
+         reached.sort();
+
+         // set the attributes for this node:
+         for (int k = 0; k < radiussize; k++) {
+            // note, curs_total_depth must use double as mantissa can get too long for int in large systems
+            double curs_node_count = 0.0, curs_total_depth = 0.0;
+            double curs_total_weight = 0.0, curs_total_weighted_depth = 0.0;
+            for (size_t n = 0; n < reached.size(); n++) {
+               int j = reached[n];
+               // find dir according 
+               bool m0 = ((uncovered[j * 2] >> k) & 0x1) == 0;
+               bool m1 = ((uncovered[j * 2 + 1] >> k) & 0x1) == 0;
+               if ((m0 | m1) != 0) {
+                  int dir;
+                  if (m0 & m1) {
+                     // dir is the one with the lowest depth:
+                     if (audittrail[(j * radiussize + k) * 2].depth < audittrail[(j * radiussize + k) * 2 + 1].depth)
+                        dir = 0;
+                     else
+                        dir = 1;
+                  }
+                  else {
+                     // dir is simply the one that's filled in:
+                     dir = m0 ? 0 : 1;
+                  }
+                  AuditInfo& info = audittrail[(j * radiussize + k) * 2 + dir];
+                  curs_node_count++;
+                  curs_total_depth += info.depth;
+                  curs_total_weight += weights[j];
+                  curs_total_weighted_depth += info.depth * weights[j];
+                  //
+                  if (choice && info.leaf) {
+                     // note, graph may be directed (e.g., for one way streets), so both ways must be included from now on:
+                     SegmentRef here = SegmentRef(dir == 0 ? 1 : -1,j);
+                     if (here.ref != rowid) {
+                        int choicecount = 0;
+                        double choiceweight = 0.0;
                         //EFEF*
-								audittrail[here.ref][k][heredir].weighted_choice2 += choiceweight2;
-								//*EFEF
-								// if the node hasn't been encountered before, the choicecount and choiceweight is 
-                        // incremented for all remaining nodes to be encountered on the backwards route from it
-                        if (!audittrail[here.ref][k][heredir].choicecovered) {
-                           // this node has not been encountered before: this adds the choicecount and weight for this
-                           // node, and flags it as visited
-                           choicecount++;
-                           choiceweight += weights[here.ref] * rootweight;
-									//EFEF*
-									choiceweight2 += weights2[here.ref] * rootweight;//rootweight!
-									//*EFEF
-
-                           audittrail[here.ref][k][heredir].choicecovered = true;
-                           // note, for weighted choice, the start and end points have choice added to them:
-                           if (weighting_col != -1) {
-                              audittrail[here.ref][k][heredir].weighted_choice += (weights[here.ref] * rootweight) / 2.0;
-										//EFEF*
-										if (weighting_col2 != -1) {
-											audittrail[here.ref][k][heredir].weighted_choice2 += (weights2[here.ref] * rootweight) / 2.0;  //rootweight!
-										}
-										//*EFEF
-									}
+                        double choiceweight2 = 0.0;
+                        //*EFEF
+                        while (here.ref != rowid) { // not rowid means not the current root for the path
+                           int heredir = (here.dir == 1) ? 0 : 1;
+                           int index = (here.ref * radiussize + k) * 2 + heredir;
+                           // each node has the existing choicecount and choiceweight from previously encountered nodes added to it
+                           choices[index].choice += choicecount;
+                           // nb, weighted values calculated anyway to save time on 'if'
+                           choices[index].weighted_choice += choiceweight;
+                           //EFEF*
+                           choices[index].weighted_choice2 += choiceweight2;
+                           //*EFEF
+                           // if the node hasn't been encountered before, the choicecount and choiceweight is 
+                           // incremented for all remaining nodes to be encountered on the backwards route from it
+                           if (!audittrail[index].choicecovered) {
+                              // this node has not been encountered before: this adds the choicecount and weight for this
+                              // node, and flags it as visited
+                              choicecount++;
+                              choiceweight += weights[here.ref] * rootweight;
+                              //EFEF*
+                              choiceweight2 += weights2[here.ref] * rootweight;//rootweight!
+                              //*EFEF
+
+                              audittrail[index].choicecovered = true;
+                              // note, for weighted choice, the start and end points have choice added to them:
+                              if (weighting_col != -1) {
+                                 choices[index].weighted_choice += (weights[here.ref] * rootweight) / 2.0;
+                                 //EFEF*
+                                 if (weighting_col2 != -1) {
+                                    choices[index].weighted_choice2 += (weights2[here.ref] * rootweight) / 2.0;  //rootweight!
+                                 }
+                                 //*EFEF
+                              }
+                           }
+                           here = audittrail[index].previous;
+                        }
+                        // note, for weighted choice, the start and end points have choice added to them:
+                        // (this is the summed weight for all starting nodes encountered in this path)
+                        if (weighting_col != -1) {
+                           int index = (here.ref * radiussize + k) * 2 + ((here.dir == 1) ? 0 : 1);
+                           choices[index].weighted_choice += choiceweight / 2.0;
+                           //EFEF*
+                           if (weighting_col2 != -1) {
+                              choices[index].weighted_choice2 += choiceweight2 / 2.0;
+                           }
+                           //*EFEF
                         }
-                        here = audittrail[here.ref][k][heredir].previous;
                      }
-                     // note, for weighted choice, the start and end points have choice added to them:
-                     // (this is the summed weight for all starting nodes encountered in this path)
-                     if (weighting_col != -1) {
-                        audittrail[here.ref][k][(here.dir == 1) ? 0 : 1].weighted_choice += choiceweight / 2.0;
-								//EFEF*
-								if (weighting_col2 != -1) {
-									audittrail[here.ref][k][(here.dir == 1) ? 0 : 1].weighted_choice2 += choiceweight2 / 2.0;
-								}
-								//*EFEF
-							}
                   }
                }
             }
+            double *result = &(results[i * results_size + k * 4]);
+            result[0] = curs_node_count;
+            result[1] = curs_total_depth;
+            result[2] = curs_total_weight;
+            result[3] = curs_total_weighted_depth;
+         }
+
+         // put the audit trail back for the next root
+         for (size_t n = 0; n < reached.size(); n++) {
+            int j = reached[n];
+            for (int k = 0; k < radiussize * 2; k++) {
+               audittrail[j * radiussize * 2 + k].clearLine();
+            }
+            uncovered[j * 2] = radiusmask;
+            uncovered[j * 2 + 1] = radiusmask;
+         }
+
+         processed[i] = 1;
+         pcomm.record();
+      }
+
+      delete [] audittrail;
+      delete [] uncovered;
+   }
+
+   // interactive is usual Depthmap: throw an exception if cancelled
+   // in non-interactive mode, retain what's been processed already
+   if (pcomm.isCancelled() && interactive) {
+      for (int i = 0; i < thread_count; i++) {
+         if (thread_choices[i]) {
+            delete [] thread_choices[i];
          }
+      }
+      delete [] thread_choices;
+      pcomm.throwIfCancelled();
+   }
+
+   for (int i = 0; i < root_count; i++) {
+      if (!processed[i]) {
+         continue;
+      }
+      int rowid = roots[i];
+      for (int k = 0; k < radiussize; k++) {
+         const double *result = &(results[i * results_size + k * 4]);
+         double curs_node_count = result[0], curs_total_depth = result[1];
+         double curs_total_weight = result[2], curs_total_weighted_depth = result[3];
          double total_depth_conv = curs_total_depth / ((tulip_bins - 1.0f) * 0.5f);
          double total_weighted_depth_conv = curs_total_weighted_depth / ((tulip_bins - 1.0f) * 0.5f);
          //
@@ -3986,42 +4316,29 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
       }
       //
       processed_rows++;
-      //
-      if (comm) {
-         if (qtimer( atime, 500 )) {
-            if (comm->IsCancelled()) {
-   				// interactive is usual Depthmap: throw an exception if cancelled
-	   			if (interactive) {
-                  for (size_t i = 0; i < m_connectors.size(); i++) {
-                     for (size_t j = 0; j < size_t(radiussize); j++) {
-                        delete [] audittrail[i][j];
-                     }
-                     delete [] audittrail [i];
-                     delete [] uncovered [i];
-                  }
-                  delete [] audittrail;
-                  delete [] uncovered;
-                  delete [] bins;
-                  throw Communicator::CancelledException();
-               }
-               else {
-                  // in non-interactive mode, retain what's been processed already
-                  break;
-               }
-            }
-            comm->CommPostMessage( Communicator::CURRENT_RECORD, rowid );
-         }         
-      }
    }
+
    if (choice) {
+      // add up the choice totals of each thread (in thread order)
+      ChoiceInfo *audittrail = new ChoiceInfo [segment_count * radiussize * 2];
+      for (int t = 0; t < thread_count; t++) {
+         if (thread_choices[t]) {
+            for (int i = 0; i < segment_count * radiussize * 2; i++) {
+               audittrail[i].choice += thread_choices[t][i].choice;
+               audittrail[i].weighted_choice += thread_choices[t][i].weighted_choice;
+               audittrail[i].weighted_choice2 += thread_choices[t][i].weighted_choice2;
+            }
+         }
+      }
       for (size_t rowid = 0; rowid < m_connectors.size(); rowid++) {
          for (size_t r = 0; r < radius.size(); r++) {
+            const ChoiceInfo *info = audittrail + (rowid * radiussize + r) * 2;
             // according to Eva's correction, total choice and total weighted choice
             // should already have been accumulated by radius at this stage
-            double total_choice = audittrail[rowid][r][0].choice + audittrail[rowid][r][1].choice;
-            double total_weighted_choice = audittrail[rowid][r][0].weighted_choice + audittrail[rowid][r][1].weighted_choice;
+            double total_choice = info[0].choice + info[1].choice;
+            double total_weighted_choice = info[0].weighted_choice + info[1].weighted_choice;
             //EFEF*
-				double total_weighted_choice2 = audittrail[rowid][r][0].weighted_choice2 + audittrail[rowid][r][1].weighted_choice2;
+				double total_weighted_choice2 = info[0].weighted_choice2 + info[1].weighted_choice2;
 				//*EFEF
 			
 				// normalised choice now excluded for two reasons:
@@ -4043,17 +4360,163 @@ int ShapeGraph::analyseTulip(Communicator *comm, int tulip_bins, bool choice, in
 				}
          }
       }
+      delete [] audittrail;
    }
-   for (size_t i = 0; i < m_connectors.size(); i++) {
-      for (int j = 0; j < radiussize; j++) {
-         delete [] audittrail[i][j];
+   for (int i = 0; i < thread_count; i++) {
+      if (thread_choices[i]) {
+         delete [] thread_choices[i];
+      }
+   }
+   delete [] thread_choices;
+
+   if (exact_choice) {
+      // Exact choice counts every shortest route between each pair of segments, rather than
+      // the one the search happens to find (see brandes.h).  The nodes of the graph are the
+      // segments entered in each direction, node (ref * 2 + dir) as for the audit trail,
+      // with the tulip bins as costs.  An angular radius is on the cost itself, so one search
+      // out to the largest serves them all, but metric and step radii need a search each.
+      // Each thread has its own totals, set out as [(r * 2 + w) * node_count + node],
+      // w = 0 for choice and 1 for weighted choice, added together in thread order
+      BrandesGraph graph;
+      for (int i = 0; i < segment_count; i++) {
+         for (int dir = 0; dir < 2; dir++) {
+            graph.addNode();
+            Connector& line = m_connectors[i];
+            pmap<SegmentRef,float>& segconns = (dir == 0) ? line.m_forward_segconns : line.m_back_segconns;
+            for (size_t k = 0; k < segconns.size(); k++) {
+               SegmentRef conn = segconns.key(k);
+               int extradepth;
+               if (routeweight_col != -1) {
+                  extradepth = (int) floor(segconns.value(k) * tulip_bins * 0.5 * routeweights[conn.ref]);
+               }
+               else {
+                  extradepth = (int) floor(segconns.value(k) * tulip_bins * 0.5);
+               }
+               double extent = 0.0;
+               if (radius_type == Options::RADIUS_METRIC) {
+                  // from the middle of one segment to the middle of the next
+                  extent = (lengths[i] + lengths[conn.ref]) * 0.5;
+               }
+               else if (radius_type == Options::RADIUS_STEPS) {
+                  extent = 1.0;
+               }
+               graph.addEdge(conn.ref * 2 + ((conn.dir == 1) ? 0 : 1), extradepth, extent);
+            }
+         }
+      }
+      int node_count = segment_count * 2;
+
+      double **thread_exact = new double *[thread_count];
+      for (int i = 0; i < thread_count; i++) {
+         thread_exact[i] = NULL;
+      }
+
+      #pragma omp parallel
+      {
+         BrandesSearch search(graph);
+         double *exact = new double [radiussize * 2 * node_count];
+         for (int j = 0; j < radiussize * 2 * node_count; j++) {
+            exact[j] = 0.0;
+         }
+         thread_exact[getThreadNum()] = exact;
+         // each segment is one destination, shared between its two ends if both are as near
+         double *destinations = new double [node_count];
+         double *pairweights = new double [node_count];
+
+         #pragma omp for schedule(static, 16)
+         for (int i = 0; i < root_count; i++) {
+
+            if (pcomm.isCancelled()) {
+               continue;
+            }
+
+            int rowid = roots[i];
+            double rootweight = (weighting_col != -1) ? weights[rowid] : 0.0;
+
+            for (int k = 0; k < radiussize; k++) {
+               if (k == 0 || radius_type != Options::RADIUS_ANGULAR) {
+                  search.start();
+                  search.addRoot(rowid * 2);
+                  search.addRoot(rowid * 2 + 1);
+                  if (radius_type == Options::RADIUS_ANGULAR) {
+                     search.search((int) radius.tail());
+                  }
+                  else {
+                     search.search(-1, radius[k]);
+                  }
+                  for (int n = 0; n < search.getReachedCount(); n++) {
+                     int node = search.getReached(n);
+                     int other = node ^ 1;
+                     double share = 1.0;
+                     if (search.isRoot(node)) {
+                        share = 0.0;
+                     }
+                     else if (search.getCost(other) != -1 && search.getCost(other) < search.getCost(node)) {
+                        share = 0.0;
+                     }
+                     else if (search.getCost(other) == search.getCost(node)) {
+                        share = search.getSigma(node) / (search.getSigma(node) + search.getSigma(other));
+                     }
+                     destinations[node] = share;
+                     pairweights[node] = share * weights[node / 2] * rootweight;
+                  }
+               }
+               int cost_limit = (radius_type == Options::RADIUS_ANGULAR) ? (int) radius[k] : -1;
+               search.accumulate(exact + (k * 2) * node_count, destinations, cost_limit);
+               if (weighting_col != -1) {
+                  double *w_exact = exact + (k * 2 + 1) * node_count;
+                  search.accumulate(w_exact, pairweights, cost_limit);
+                  // as for choice, the start and end segments of each route are given half its weight each
+                  for (int n = 0; n < search.getReachedCount(); n++) {
+                     int node = search.getReached(n);
+                     if (cost_limit == -1 || search.getCost(node) <= cost_limit) {
+                        w_exact[rowid * 2] += pairweights[node] * 0.5;
+                        w_exact[node] += pairweights[node] * 0.5;
+                     }
+                  }
+               }
+            }
+
+            pcomm.record();
+         }
+
+         delete [] destinations;
+         delete [] pairweights;
+      }
+
+      if (!pcomm.isCancelled() || !interactive) {
+         double *exact = new double [radiussize * 2 * node_count];
+         for (int j = 0; j < radiussize * 2 * node_count; j++) {
+            exact[j] = 0.0;
+            for (int t = 0; t < thread_count; t++) {
+               if (thread_exact[t]) {
+                  exact[j] += thread_exact[t][j];
+               }
+            }
+         }
+         for (int rowid = 0; rowid < segment_count; rowid++) {
+            for (int k = 0; k < radiussize; k++) {
+               const double *info = exact + (k * 2) * node_count + rowid * 2;
+               m_attributes.setValue(rowid,x_choice_col[k],float(info[0] + info[1]));
+               if (weighting_col != -1) {
+                  const double *w_info = exact + (k * 2 + 1) * node_count + rowid * 2;
+                  m_attributes.setValue(rowid,wx_choice_col[k],float(w_info[0] + w_info[1]));
+               }
+            }
+         }
+         delete [] exact;
+      }
+      for (int i = 0; i < thread_count; i++) {
+         if (thread_exact[i]) {
+            delete [] thread_exact[i];
+         }
+      }
+      delete [] thread_exact;
+
+      if (interactive) {
+         pcomm.throwIfCancelled();
       }
-      delete [] audittrail [i];
-      delete [] uncovered [i];
    }
-   delete [] audittrail;
-   delete [] uncovered;
-   delete [] bins;
 
    m_displayed_attribute = -2; // <- override if it's already showing
    if (choice) {
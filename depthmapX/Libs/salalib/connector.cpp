@@ -88,37 +88,43 @@ int Connector::cursor(int mode) const
 {
    int cur = -1;
    if (m_cursor != -1) {
-      switch (mode) {
-      case CONN_ALL:
-         if (m_cursor < (int)m_connections.size()) {
-            cur = m_connections[m_cursor];
-         }
-         break;
-      case SEG_CONN_ALL:
-         if (m_cursor < (int)m_back_segconns.size()) {
-            cur = m_back_segconns.key(m_cursor).ref;
-         }
-         else if (m_cursor - m_back_segconns.size() < m_forward_segconns.size()) {
-            cur = m_forward_segconns.key(m_cursor - m_back_segconns.size()).ref;
-         }
-         break;
-      case SEG_CONN_FW:
-         if (m_cursor < (int)m_forward_segconns.size()) {
-            cur = m_forward_segconns.key(m_cursor).ref;
-         }
-         break;
-      case SEG_CONN_BK:
-         if (m_cursor < (int)m_back_segconns.size()) {
-            cur = m_back_segconns.key(m_cursor).ref;
-         }
-         break;
-      }
+      cur = getConnection(m_cursor, mode);
    }
    if (cur == -1) {
       m_cursor = -1;
    }
    return cur;
 }
+int Connector::getConnection(int i, int mode) const
+{
+   int cur = -1;
+   switch (mode) {
+   case CONN_ALL:
+      if (i < (int)m_connections.size()) {
+         cur = m_connections[i];
+      }
+      break;
+   case SEG_CONN_ALL:
+      if (i < (int)m_back_segconns.size()) {
+         cur = m_back_segconns.key(i).ref;
+      }
+      else if (i - m_back_segconns.size() < m_forward_segconns.size()) {
+         cur = m_forward_segconns.key(i - m_back_segconns.size()).ref;
+      }
+      break;
+   case SEG_CONN_FW:
+      if (i < (int)m_forward_segconns.size()) {
+         cur = m_forward_segconns.key(i).ref;
+      }
+      break;
+   case SEG_CONN_BK:
+      if (i < (int)m_back_segconns.size()) {
+         cur = m_back_segconns.key(i).ref;
+      }
+      break;
+   }
+   return cur;
+}
 int Connector::direction(int mode) const
 {
    int direction = 0;
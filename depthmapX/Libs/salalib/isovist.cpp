@@ -250,7 +250,7 @@ void Isovist::addBlock(const Line& li, int tag, double startangle, double endang
    }
 }
 
-void Isovist::setData(AttributeTable& table, int row, bool simple_version)
+void Isovist::getData(IsovistData& data)
 {
    // the area / centre of gravity calculation is a duplicate of the SalaPolygon version,
    // included here for general information about the isovist
@@ -288,58 +288,80 @@ void Isovist::setData(AttributeTable& table, int row, bool simple_version)
    driftvec.normalise();
    double driftang = driftvec.angle();
    //
-   int col = table.getOrInsertColumnIndex("Isovist Area");
-   if (col == -1) {
-      col = table.insertColumn("Isovist Area");
-   }
-   table.setValue(row,col,(float)area);
+   data.area = area;
+   data.compactness = 4.0 * M_PI * area / (m_perimeter*m_perimeter);
+   data.drift_angle = 180.0*driftang/M_PI;
+   data.drift_magnitude = driftmag;
+   data.min_radial = m_min_radial;
+   data.max_radial = m_max_radial;
+   data.occlusivity = m_occluded_perimeter;
+   data.perimeter = m_perimeter;
+}
 
+// column names, in the order setData has always added them
 
+static const char *g_isovist_columns[] = {
+   "Isovist Area",
+   "Isovist Compactness",
+   "Isovist Drift Angle",
+   "Isovist Drift Magnitude",
+   "Isovist Min Radial",
+   "Isovist Max Radial",
+   "Isovist Occlusivity",
+   "Isovist Perimeter"
+};
+
+static double isovistValue(const IsovistData& data, int which)
+{
+   switch (which) {
+   case 0: return data.area;
+   case 1: return data.compactness;
+   case 2: return data.drift_angle;
+   case 3: return data.drift_magnitude;
+   case 4: return data.min_radial;
+   case 5: return data.max_radial;
+   case 6: return data.occlusivity;
+   default: return data.perimeter;
+   }
+}
 
+static int isovistColumnCount(bool simple_version)
+{
    // dX simple version test // TV
 //#define _COMPILE_dX_SIMPLE_VERSION
 #ifndef _COMPILE_dX_SIMPLE_VERSION
    if(!simple_version) {
-       col = table.getColumnIndex("Isovist Compactness");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Compactness");
-       }
-       table.setValue(row,col, (float)(4.0 * M_PI * area / (m_perimeter*m_perimeter)));
-
-       col = table.getColumnIndex("Isovist Drift Angle");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Drift Angle");
-       }
-       table.setValue(row,col,(float)(180.0*driftang/M_PI));
-
-       col = table.getColumnIndex("Isovist Drift Magnitude");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Drift Magnitude");
-       }
-       table.setValue(row,col,(float)driftmag);
-       col = table.getColumnIndex("Isovist Min Radial");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Min Radial");
-       }
-       table.setValue(row,col,(float)m_min_radial);
-       col = table.getColumnIndex("Isovist Max Radial");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Max Radial");
-       }
-       table.setValue(row,col,(float)m_max_radial);
-
-       col = table.getColumnIndex("Isovist Occlusivity");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Occlusivity");
-       }
-       table.setValue(row,col,(float)m_occluded_perimeter);
-
-       col = table.getColumnIndex("Isovist Perimeter");
-       if (col == -1) {
-           col = table.insertColumn("Isovist Perimeter");
-       }
-       table.setValue(row,col,(float)m_perimeter);
+      return 8;
    }
 #endif
+   return 1;
+}
 
+void Isovist::setData(AttributeTable& table, int row, bool simple_version)
+{
+   IsovistData data;
+   getData(data);
+
+   int count = isovistColumnCount(simple_version);
+   for (int i = 0; i < count; i++) {
+      int col = table.getOrInsertColumnIndex(g_isovist_columns[i]);
+      table.setValue(row,col,(float)isovistValue(data,i));
+   }
+}
+
+void Isovist::setData(AttributeTable& table, const pvecint& rows, const pvector<IsovistData>& data, bool simple_version)
+{
+   // add all the columns before looking any of them up, as inserting a column can move the others
+   int count = isovistColumnCount(simple_version);
+   int i;
+   for (i = 0; i < count; i++) {
+      table.getOrInsertColumnIndex(g_isovist_columns[i]);
+   }
+   for (i = 0; i < count; i++) {
+      AttributeColumnWriter writer( table, table.getColumnIndex(g_isovist_columns[i]) );
+      for (size_t j = 0; j < rows.size(); j++) {
+         writer.setValue(rows[j],(float)isovistValue(data[j],i));
+      }
+      writer.commit();
+   }
 }
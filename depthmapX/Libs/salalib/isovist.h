@@ -49,6 +49,21 @@ inline bool operator < (const IsoSeg& b1, const IsoSeg& b2)
 
 class AttributeTable;
 
+// the measures setData records for an isovist, held so that a whole batch of
+// isovists can be made before any of them are written to the table
+
+struct IsovistData
+{
+   double area;
+   double compactness;
+   double drift_angle;
+   double drift_magnitude;
+   double min_radial;
+   double max_radial;
+   double occlusivity;
+   double perimeter;
+};
+
 struct PointDist {
    Point2f m_point;
    double m_dist;
@@ -78,7 +93,10 @@ public:
    void make(BSPNode *here);
    void drawnode(const Line& li, int tag);
    void addBlock(const Line& li, int tag, double startangle, double endangle);
+   void getData(IsovistData& data);
    void setData(AttributeTable& table, int row, bool simple_version);
+   // write a batch of measures, data[i] to rows[i], one column at a time
+   static void setData(AttributeTable& table, const pvecint& rows, const pvector<IsovistData>& data, bool simple_version);
    //
    int getClosestLine(BSPNode *root, const Point2f& p);
 };
@@ -25,6 +25,7 @@
 #include <generic/p2dpoly.h>
 #include <generic/dxfp.h>
 #include <generic/comm.h>
+#include <generic/filesection.h>
 
 #include "isovist.h"
 #include "ntfp.h"
@@ -228,10 +229,17 @@ void MetaGraph::copyPointMap(const PointMap& meta)
 
 bool MetaGraph::setGrid( double spacing, const Point2f& offset )
 {
+   int oldstate = m_state;
    m_state &= ~POINTMAPS;
 
    getDisplayedPointMap().setSpacePixel( (SuperSpacePixel *) this );
-   getDisplayedPointMap().setGrid( spacing, offset );
+   bool ok = getDisplayedPointMap().setGrid( spacing, offset );
+
+   if (!ok) {
+      // too fine a grid for the drawing, the map is left as it was
+      m_state = oldstate;
+      return false;
+   }
 
    m_state |= POINTMAPS;
 
@@ -515,6 +523,7 @@ int MetaGraph::makeIsovist(Communicator *communicator, const Point2f& p, double
          m_state |= DATAMAPS;
          retvar = 2;
       }
+      m_data_maps.loadMap(shapelayer);
       ShapeMap& map = m_data_maps.getMap(shapelayer);
       // false: closed polygon, true: isovist
       int polyref = map.makePolyShape(iso.getPolygon(),false);  
@@ -581,6 +590,7 @@ int MetaGraph::makeIsovistPath(Communicator *communicator, double fov, bool simp
                   isovistmapref = m_data_maps.addMap("Isovists",ShapeMap::DATAMAP);
                   retvar = 2;
                }
+               m_data_maps.loadMap(isovistmapref);
                isovists = &(m_data_maps.getMap(isovistmapref));
                first = false;
             }
@@ -685,17 +695,10 @@ bool MetaGraph::makeBSPtree(Communicator *communicator)
       }
       m_bsp_root = new BSPNode();
 
-      // Quick mod - TV
-#if defined(_WIN32)      
-      __time64_t atime = 0;
-#else
-      time_t atime = 0;
-#endif      
       communicator->CommPostMessage( Communicator::NUM_RECORDS, partitionlines.size() );
-      qtimer( atime, 0 );
 
       try {
-         m_bsp_root->make(communicator,atime,partitionlines,NULL);
+         m_bsp_root->make(communicator,partitionlines);
          m_bsp_tree = true;
       } 
       catch (Communicator::CancelledException) {
@@ -1262,7 +1265,7 @@ bool MetaGraph::analyseAxial( Communicator *communicator, Options options, bool
       for (size_t i = 0; i < options.radius_list.size(); i++) {
          radius.push_back( (int) options.radius_list[i] );
       }
-      retvar = m_shape_graphs.getDisplayedMap().integrate( communicator, radius, options.choice, options.local, options.fulloutput, options.weighted_measure_col, simple_version );
+      retvar = m_shape_graphs.getDisplayedMap().integrate( communicator, radius, options.choice, options.local, options.fulloutput, options.weighted_measure_col, simple_version, options.exact_choice );
    } 
    catch (Communicator::CancelledException) {
       retvar = false;
@@ -1285,7 +1288,7 @@ bool MetaGraph::analyseSegments( Communicator *communicator, Options options ) /
       }
       else {
          retvar = m_shape_graphs.getDisplayedMap().analyseTulip(communicator, options.tulip_bins, options.choice, 
-                                                                 options.radius_type, options.radius_list, options.weighted_measure_col);
+                                                                 options.radius_type, options.radius_list, options.weighted_measure_col, -1, -1, false, true, options.exact_choice);
       }
    } 
    catch (Communicator::CancelledException) {
@@ -1305,7 +1308,7 @@ bool MetaGraph::analyseTopoMet( Communicator *communicator, Options options ) //
 
    try {
       // note: "output_type" reused for analysis type (either 0 = topological or 1 = metric)
-      retvar = m_shape_graphs.getDisplayedMap().analyseTopoMet(communicator, options.output_type, options.radius, options.sel_only);
+      retvar = m_shape_graphs.getDisplayedMap().analyseTopoMet(communicator, options.output_type, options.radius, options.sel_only, options.exact_choice);
    } 
    catch (Communicator::CancelledException) {
       retvar = false;
@@ -2357,6 +2360,52 @@ void MetaGraph::runAgentEngine(Communicator *comm)
    }
 }
 
+// Evolution of agent programs against the agent engine's gate layer: the engine's current
+// program is the template, and the programs evolved from it are rated by how many of their
+// agents reach a gate (see ProgramPopulation::evaluate).  The best program so far is saved
+// to filename after each generation, with a log of the generations alongside it
+
+bool MetaGraph::runAgentEvolution(Communicator *comm, int generations, unsigned int seed, const pstring& filename)
+{
+   if (m_agent_engine.m_gatelayer == -1 || !m_agent_engine.size()) {
+      return false;
+   }
+
+   AttributeTable& table = getDisplayedPointMap().getAttributeTable();
+
+   // switch the reference numbers from the gates layer to the vga layer
+   int colgates = table.insertColumn(g_col_gate);
+   pushValuesToLayer(VIEWDATA,m_agent_engine.m_gatelayer,
+                     VIEWVGA,getDisplayedPointMapRef(),
+                     -1,colgates,PUSH_FUNC_TOT);
+
+   // the evolved rules are Gibsonian ones:
+   AgentProgram prog = m_agent_engine.tail();
+   prog.m_sel_type = AgentProgram::SEL_LENGTH;
+
+   // (a population is too large for the stack)
+   ProgramPopulation *population = new ProgramPopulation;
+   population->init(prog);
+
+   pstring logname = filename + pstring(".log");
+   ofstream log( logname.c_str() );
+   log << "Seed: " << seed << endl;
+
+   bool retvar = true;
+   try {
+      population->evolve( comm, &(getDisplayedPointMap()), generations, seed, filename, &log );
+   }
+   catch (Communicator::CancelledException) {
+      retvar = false;
+   }
+   delete population;
+
+   // and delete the temporary column:
+   table.removeColumn(table.getColumnIndex(g_col_gate));
+
+   return retvar;
+}
+
 // Thru vision
 
 bool MetaGraph::analyseThruVision(Communicator *comm, int gatelayer)
@@ -2586,12 +2635,21 @@ AttributeTable& MetaGraph::getAttributeTable(int type, int layer)
    }
    switch (type & VIEWFRONT) {
    case VIEWVGA:
+      if (layer != -1) {
+         PointMaps::loadMap(layer);
+      }
       tab = (layer == -1) ? &(getDisplayedPointMap().getAttributeTable()) : &(PointMaps::at(layer).getAttributeTable());
       break;
    case VIEWAXIAL:
+      if (layer != -1) {
+         m_shape_graphs.loadMap(layer);
+      }
       tab = (layer == -1) ? &(m_shape_graphs.getDisplayedMap().getAttributeTable()) : &(m_shape_graphs.getMap(layer).getAttributeTable());
       break;
    case VIEWDATA:
+      if (layer != -1) {
+         m_data_maps.loadMap(layer);
+      }
       tab = (layer == -1) ? &(m_data_maps.getDisplayedMap().getAttributeTable()) : &(m_data_maps.getMap(layer).getAttributeTable());
       break;
    }
@@ -2709,7 +2767,7 @@ void MetaGraph::unloadGraphAgent()
 
 ///////////////////////////////////////////////////////////////////////////////
 
-int MetaGraph::read( const pstring& filename )
+int MetaGraph::read( const pstring& filename, bool lazy )
 {
    m_state = 0;   // <- clear the state out
 
@@ -2724,10 +2782,16 @@ int MetaGraph::read( const pstring& filename )
       return NOT_A_GRAPH;
    }
 
+   // a large buffer, as the maps are read in many small pieces
+   // (n.b., must be declared before the stream, so it outlasts it)
+   pvector<char> buffer;
+   buffer.set(FILE_BUFFER_SIZE);
+   ifstream stream;
+   stream.rdbuf()->pubsetbuf( &(buffer[0]), FILE_BUFFER_SIZE );
 #ifdef _WIN32
-   ifstream stream( filename.c_str(), ios::binary | ios::in );
+   stream.open( filename.c_str(), ios::binary | ios::in );
 #else
-   ifstream stream( filename.c_str(), ios::in );
+   stream.open( filename.c_str(), ios::in );
 #endif
 
    char header[3];
@@ -2748,6 +2812,10 @@ int MetaGraph::read( const pstring& filename )
       return DEPRECATED_VERSION; // trial version no longer supported
    }
 
+   // maps left in the file are read from here as they are needed:
+   pstring deferred_file = lazy ? filename : pstring();
+   m_deferred_file = deferred_file;
+
    // have to use temporary state here as redraw attempt may come too early:
    int temp_state = 0;
    if (version >= VERSION_STATE_RECORDED) {
@@ -2843,7 +2911,7 @@ int MetaGraph::read( const pstring& filename )
          setDisplayedPointMapRef(0);
       }
       else {
-         PointMaps::read( stream, version );
+         PointMaps::read( stream, version, deferred_file );
       }
       PointMaps::setSpacePixel( (SuperSpacePixel *) this );
       temp_state |= POINTMAPS;
@@ -2900,7 +2968,7 @@ int MetaGraph::read( const pstring& filename )
       }
    }
    if (type == 'x') {
-      m_shape_graphs.read( stream, version );
+      m_shape_graphs.read( stream, version, deferred_file );
       temp_state |= SHAPEGRAPHS;
       /*
       // THIS CODE IS NO LONGER REQUIRED AS AXIAL MAPS *ARE* SHAPE MAPS -- can just be switched to shape map layer
@@ -2927,7 +2995,7 @@ int MetaGraph::read( const pstring& filename )
       }
    }
    if (type == 's') {
-      m_data_maps.read( stream, version );
+      m_data_maps.read( stream, version, deferred_file );
       temp_state |= DATAMAPS;
       if (!stream.eof()) {
          stream.read( &type, 1 );         
@@ -2964,9 +3032,29 @@ int MetaGraph::read( const pstring& filename )
    return OK;
 }
 
-int MetaGraph::write( const pstring& filename, int version, bool currentlayer )
+int MetaGraph::write( const pstring& filename, int version, bool currentlayer, bool compress )
 {
+   // a large buffer, as the maps are written in many small pieces
+   // (n.b., must be declared before the stream, so it outlasts it)
+   pvector<char> buffer;
+   buffer.set(FILE_BUFFER_SIZE);
    ofstream stream;
+   stream.rdbuf()->pubsetbuf( &(buffer[0]), FILE_BUFFER_SIZE );
+   setSectionCompression( stream, compress && version >= VERSION_COMPRESSED_SECTIONS );
+
+   // maps not yet loaded are copied across from the file they are in (or read from it
+   // as they are written), so when saving over that file the new one is written alongside
+   // and moved into place afterwards.  A current layer is only the displayed map, so
+   // saving one over the file needs the others read first:
+   bool overwrite = !m_deferred_file.empty() && filename == m_deferred_file;
+   if (overwrite && currentlayer) {
+      if (!PointMaps::loadAllMaps() || !m_shape_graphs.loadAllMaps() || !m_data_maps.loadAllMaps()) {
+         return DISK_ERROR;
+      }
+      m_deferred_file = pstring();
+      overwrite = false;
+   }
+   pstring writefile = overwrite ? filename + pstring(".tmp") : filename;
 
    int oldstate = m_state;
    m_state = 0;   // <- temporarily clear out state, avoids any potential read / write errors
@@ -2974,7 +3062,7 @@ int MetaGraph::write( const pstring& filename, int version, bool currentlayer )
    char type;
 
    // As of MetaGraph version 70 the disk caching has been removed
-   stream.open( filename.c_str(), ios::binary | ios::out | ios::trunc );
+   stream.open( writefile.c_str(), ios::binary | ios::out | ios::trunc );
    if (stream.fail()) {
       if (stream.rdbuf()->is_open()) {
          stream.close();
@@ -3056,6 +3144,29 @@ int MetaGraph::write( const pstring& filename, int version, bool currentlayer )
    stream.close();
 
    m_state = oldstate;
+
+   if (stream.fail()) {
+      if (overwrite) {
+         ::remove( writefile.c_str() );
+      }
+      return DISK_ERROR;
+   }
+   if (overwrite) {
+#ifdef _WIN32
+      ::remove( filename.c_str() );
+#endif
+      if (::rename( writefile.c_str(), filename.c_str() ) != 0) {
+         return DISK_ERROR;
+      }
+   }
+   if (!currentlayer) {
+      // the maps copied across are now left in the new file until they are needed:
+      PointMaps::setDeferredFile( filename, version );
+      m_shape_graphs.setDeferredFile( filename, version );
+      m_data_maps.setDeferredFile( filename, version );
+      m_deferred_file = filename;
+   }
+
    return OK;
 }
 
@@ -19,6 +19,7 @@
 // a simple agent demonstration for Salad (now within depthmapX)
 #include <generic/paftl.h>
 #include <generic/comm.h>
+#include <generic/parallel.h>
 
 #include <sala/mgraph.h>
 #include <sala/nagent.h>
@@ -40,6 +41,23 @@ static int rankselect(int popsize)
    return 0;   // <- this shouldn't happen
 }
 
+// the first entry whose (cumulative) weight is over chosen, found by bisection
+static size_t weightedChoice(const pvector<wpair>& weightmap, double chosen)
+{
+   size_t lo = 0;
+   size_t hi = weightmap.size() - 1;
+   while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (chosen < weightmap[mid].weight) {
+         hi = mid;
+      }
+      else {
+         lo = mid + 1;
+      }
+   }
+   return lo;
+}
+
 // note: this is tested and right: higher fitness, lower rank (so population[0] is best)
 int progcompare(const void *a, const void *b )
 {
@@ -57,6 +75,37 @@ int progcompare(const void *a, const void *b )
 
 pvecpoint g_trails[MAX_TRAILS];
 
+// the n'th of many random streams drawn from one seed (the golden ratio step keeps
+// the streams of neighbouring n apart)
+static uint64 streamSeed(uint64 seed, uint64 n)
+{
+   return seed + n * ((uint64(0x9E3779B9) << 32) + 0x7F4A7C15);
+}
+
+// the gate of each node of the graph, or -1 where it is in none
+static void nodeGates(AttributeTable& table, const PackedGraph& graph, pvecint& gates)
+{
+   int gatecol = table.getColumnIndex(g_col_gate);
+   gates.clear();
+   for (int n = 0; n < graph.nodeCount(); n++) {
+      int row = table.getRowid(graph.nodePixel(n));
+      gates.push_back((row != -1 && gatecol != -1) ? (int)table.getValue(row, gatecol) : -1);
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+void AgentCounts::init(int nodes, const pvecint *gates)
+{
+   m_gates = gates;
+   m_counts.clear();
+   m_gate_counts.clear();
+   for (int i = 0; i < nodes; i++) {
+      m_counts.push_back(0);
+      m_gate_counts.push_back(0);
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 // run one agent engine only
@@ -67,6 +116,7 @@ AgentEngine::AgentEngine()
    m_gatelayer = -1;
    m_record_trails = false;
    m_trail_count = MAX_TRAILS;
+   m_seed = 0;
 }
 
 void AgentEngine::run(Communicator *comm, PointMap *pointmap)
@@ -85,11 +135,20 @@ void AgentEngine::run(Communicator *comm, PointMap *pointmap)
    AttributeTable& table = pointmap->getAttributeTable();
    int displaycol = table.insertColumn(g_col_total_counts);
 
+   // the agents look through the packed form of the graph
+   const PackedGraph& graph = pointmap->getPackedGraph();
+
    int output_mode = Agent::OUTPUT_COUNTS;
    if (m_gatelayer != -1) {
       output_mode |= Agent::OUTPUT_GATE_COUNTS;
    }
 
+   // the gate each node is in, read from the table once rather than at every step
+   pvecint node_gates;
+   if (output_mode & Agent::OUTPUT_GATE_COUNTS) {
+      nodeGates(table, graph, node_gates);
+   }
+
    // remove any agent trails that are left from a previous run
    for (int k = 0; k < MAX_TRAILS; k++) {
       g_trails[k].clear();
@@ -111,18 +170,27 @@ void AgentEngine::run(Communicator *comm, PointMap *pointmap)
       at(j).clear();
    }
 
+   // agents are released from one stream, and each agent released is given its own stream
+   // (seeded by its release number), so nothing depends on the order the agents move in
+   uint64 release_rand = m_seed;
+   uint64 released = 0;
+
+   prefvec<AgentCounts> thread_counts;
+   for (int t = 0; t < getThreadCount(); t++) {
+      thread_counts.push_back(AgentCounts());
+      thread_counts.tail().init(graph.nodeCount(), &node_gates);
+   }
+   pvector<Agent *> agents;
+
    for (int i = 0; i < m_timesteps; i++) {
 
       size_t j;
       for (j = 0; j < size(); j++) {
-         int q = invcumpoisson(prandomr(),at(j).m_release_rate);
-         int length = at(j).size();
-         int k;
-         for (k = 0; k < q; k++) {
-            at(j).push_back(Agent(&(at(j)),pointmap,output_mode));
-         }
-         for (k = 0; k < q; k++) {
-            at(j).init(length+k,trail_num);
+         int q = invcumpoisson(prandomr(release_rand),at(j).m_release_rate);
+         for (int k = 0; k < q; k++) {
+            released++;
+            int slot = at(j).add(pointmap,output_mode,streamSeed(m_seed,released));
+            at(j).init(slot,release_rand,trail_num);
             if (trail_num != -1) {
                trail_num++;
                // after trail count, stop recording:
@@ -133,8 +201,27 @@ void AgentEngine::run(Communicator *comm, PointMap *pointmap)
          }
       }
 
+      // the agents do not see each other, so they may all take their step at once
+      agents.clear();
       for (j = 0; j < size(); j++) {
-         at(j).move();
+         for (size_t k = 0; k < at(j).liveCount(); k++) {
+            agents.push_back(&(at(j).live(k)));
+         }
+      }
+      int agent_count = (int) agents.size();
+
+      #pragma omp parallel
+      {
+         AgentCounts *counts = &(thread_counts[getThreadNum()]);
+
+         #pragma omp for schedule(dynamic,64)
+         for (int a = 0; a < agent_count; a++) {
+            agents[a]->onMove(counts);
+         }
+      }
+
+      for (j = 0; j < size(); j++) {
+         at(j).removeExpired();
       }
 
       if (comm) {
@@ -147,6 +234,29 @@ void AgentEngine::run(Communicator *comm, PointMap *pointmap)
       }
    }
 
+   // add the counts made on each thread into the table
+   int gatecountcol = (output_mode & Agent::OUTPUT_GATE_COUNTS) ? table.getColumnIndex(g_col_gate_counts) : -1;
+   for (int n = 0; n < graph.nodeCount(); n++) {
+      int count = 0, gate_count = 0;
+      for (size_t t = 0; t < thread_counts.size(); t++) {
+         count += thread_counts[t].m_counts[n];
+         gate_count += thread_counts[t].m_gate_counts[n];
+      }
+      if (!count && !gate_count) {
+         continue;
+      }
+      int row = table.getRowid(graph.nodePixel(n));
+      if (row == -1) {
+         continue;
+      }
+      if (count) {
+         table.incrValue(row, displaycol, float(count));
+      }
+      if (gate_count && gatecountcol != -1) {
+         table.incrValue(row, gatecountcol, float(gate_count));
+      }
+   }
+
    // output agent trails to file:
    if (m_record_trails) {
       // just dump in local file...
@@ -174,30 +284,63 @@ AgentSet::AgentSet()
    m_lifetime = 1000;
 }
 
-void AgentSet::init(int agent, int trail_num)
+int AgentSet::add(PointMap *pointmap, int output_mode, uint64 seed)
+{
+   int slot;
+   if (m_free.size()) {
+      slot = m_free.tail();
+      m_free.pop_back();
+      m_agents[slot].reset(this, pointmap, output_mode, seed);
+   }
+   else {
+      slot = (int) m_agents.size();
+      m_agents.push_back(Agent(this, pointmap, output_mode, seed));
+   }
+   m_live.push_back(slot);
+   return slot;
+}
+
+void AgentSet::init(int slot, uint64& rand, int trail_num, const AgentCounts *counts)
 {
    if (m_release_locations.size()) {
-      int which = pafrand() % m_release_locations.size();
-      at(agent).onInit( m_release_locations[which], trail_num );
+      int which = pafrand(rand) % m_release_locations.size();
+      m_agents[slot].onInit( m_release_locations[which], trail_num, counts );
    }
    else {
-      const PointMap& map = at(agent).getPointMap();
+      const PointMap& map = m_agents[slot].getPointMap();
       PixelRef pix;
       do {
-         pix = map.pickPixel(prandom());
+         pix = map.pickPixel(prandom(rand));
       } while (!map.getPoint(pix).filled());
-      at(agent).onInit(pix, trail_num);
+      m_agents[slot].onInit(pix, trail_num, counts);
    }
 }
 
-void AgentSet::move()
+void AgentSet::removeExpired()
 {
-   // go through backwards so remove does not affect later agents
-   for (size_t i = size() - 1; i != paftl::npos; i--) {
-      at(i).onMove();
-      if (at(i).getFrame() >= m_lifetime) {
-         remove_at(i);
+   // one pass, keeping the release order of the agents left
+   size_t kept = 0;
+   for (size_t i = 0; i < m_live.size(); i++) {
+      int slot = m_live[i];
+      if (m_agents[slot].getFrame() >= m_lifetime) {
+         m_free.push_back(slot);
       }
+      else {
+         m_live[kept++] = slot;
+      }
+   }
+   while (m_live.size() > kept) {
+      m_live.pop_back();
+   }
+}
+
+void AgentSet::clear()
+{
+   // (lowest slots last, so they are reused first)
+   m_live.clearnofree();
+   m_free.clearnofree();
+   for (size_t i = m_agents.size(); i > 0; i--) {
+      m_free.push_back(int(i - 1));
    }
 }
 
@@ -221,6 +364,107 @@ void ProgramPopulation::sort()
    qsort(m_population,POPSIZE,sizeof(AgentProgram),progcompare);
 }
 
+void ProgramPopulation::init(const AgentProgram& prog)
+{
+   for (int i = 0; i < POPSIZE; i++) {
+      m_population[i] = prog;
+      m_population[i].randomise();
+   }
+}
+
+void ProgramPopulation::evaluate(Communicator *comm, PointMap *pointmap, uint64 seed)
+{
+   const PackedGraph& graph = pointmap->getPackedGraph();
+   pvecint node_gates;
+   nodeGates(pointmap->getAttributeTable(), graph, node_gates);
+
+   // each assay releases this many agents together, to walk TIMESTEPS steps
+   int assay_agents = ASSAYSIZE / TIMESTEPS;
+
+   ParallelComm pcomm( comm, POPSIZE );
+
+   #pragma omp parallel
+   {
+      AgentCounts counts;
+      counts.init(graph.nodeCount(), &node_gates);
+
+      #pragma omp for schedule(dynamic)
+      for (int p = 0; p < POPSIZE; p++) {
+         if (pcomm.isCancelled()) {
+            continue;
+         }
+         // the program's own stream, from which its agents' streams are drawn in turn
+         uint64 rand = streamSeed(seed, p + 1);
+         AgentSet set;
+         (AgentProgram&) set = m_population[p];
+         int encountered = 0;
+         for (int i = 0; i < ASSAYS; i++) {
+            set.clear();
+            for (int k = 0; k < assay_agents; k++) {
+               uint64 agent_seed = (uint64(pafrand(rand)) << 32) + pafrand(rand);
+               int slot = set.add(pointmap, Agent::OUTPUT_GATE_COUNTS, agent_seed);
+               set.init(slot, rand, -1, &counts);
+            }
+            for (int t = 0; t < TIMESTEPS; t++) {
+               for (size_t k = 0; k < set.liveCount(); k++) {
+                  set.live(k).onMove(&counts);
+               }
+            }
+            for (size_t k = 0; k < set.liveCount(); k++) {
+               if (set.live(k).gateEncountered()) {
+                  encountered++;
+               }
+            }
+         }
+         m_population[p].m_fitness = double(encountered) / double(ASSAYS * assay_agents);
+
+         pcomm.record();
+      }
+   }
+
+   pcomm.throwIfCancelled();
+}
+
+void ProgramPopulation::breed()
+{
+   for (int i = POPSIZE / 2; i < POPSIZE; i++) {
+      int a = rankselect(POPSIZE / 2);
+      int b = rankselect(POPSIZE / 2);
+      while (a == b)
+         b = rankselect(POPSIZE / 2);
+      m_population[i] = crossover(m_population[a],m_population[b]);
+      m_population[i].mutate();
+   }
+}
+
+void ProgramPopulation::evolve(Communicator *comm, PointMap *pointmap, int generations, unsigned int seed, const pstring& filename, ostream *log)
+{
+   // breeding uses the shared generator, so that is seeded too
+   pafsrand(seed);
+
+   for (int g = 0; g < generations; g++) {
+      double start = wallTime();
+
+      evaluate(comm, pointmap, streamSeed(seed, uint64(g) << 32));
+      sort();
+      m_population[0].save(filename);
+
+      if (log) {
+         double mean = 0.0;
+         for (int i = 0; i < POPSIZE; i++) {
+            mean += m_population[i].m_fitness;
+         }
+         mean /= double(POPSIZE);
+         *log << "Generation " << g << ": best " << m_population[0].m_fitness << ", mean " << mean
+              << ", " << (wallTime() - start) << " seconds" << endl;
+      }
+
+      if (g < generations - 1) {
+         breed();
+      }
+   }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 AgentProgram::AgentProgram()
@@ -232,6 +476,29 @@ AgentProgram::AgentProgram()
    m_los_sqrd = false;
 }
 
+// random rules to evolve from (the rest of the program is left as it is)
+void AgentProgram::randomise()
+{
+   // rule order relies on putting rules into slots:
+   for (int i = 0; i < 4; i++) {
+      m_rule_order[i] = -1;
+   }
+   for (int j = 0; j < 4; j++) {
+      int choice = pafrand() % (4 - j);
+      for (int k = 0; k < choice + 1; k++) {
+         if (m_rule_order[k] != -1) {
+            choice++;
+         }
+      }
+      m_rule_order[choice] = j;
+   }
+   for (int i = 0; i < 4; i++) {
+      m_rule_threshold[i] = float(prandom() * 100.0);
+      m_rule_probability[i] = float(prandom());
+   }
+   m_fitness = 0.0;
+}
+
 /*
 AgentProgram::AgentProgram()
 {
@@ -327,7 +594,8 @@ void AgentProgram::mutate()
 
 AgentProgram crossover(const AgentProgram& prog_a, const AgentProgram& prog_b)
 {
-   AgentProgram child;
+   // what is not crossed over below (sel type, bins, steps) is kept from the first parent
+   AgentProgram child = prog_a;
    // either one sel type or the other:
   /*
    if (pafrand() % 2) {
@@ -588,13 +856,39 @@ Agent::Agent(AgentProgram *program, PointMap *pointmap, int output_mode)
    m_pointmap = pointmap;
    m_output_mode = output_mode;
    m_trail_num = -1;
+   m_rand = (uint64(pafrand()) << 32) + pafrand();
 }
 
-void Agent::onInit(PixelRef node, int trail_num)
+Agent::Agent(AgentProgram *program, PointMap *pointmap, int output_mode, uint64 seed)
+{
+   m_program = program;
+   m_pointmap = pointmap;
+   m_output_mode = output_mode;
+   m_trail_num = -1;
+   m_rand = seed;
+}
+
+void Agent::reset(AgentProgram *program, PointMap *pointmap, int output_mode, uint64 seed)
+{
+   m_program = program;
+   m_pointmap = pointmap;
+   m_output_mode = output_mode;
+   m_trail_num = -1;
+   m_rand = seed;
+   m_occ_memory.a().clearnofree();
+   m_occ_memory.b().clearnofree();
+}
+
+void Agent::onInit(PixelRef node, int trail_num, const AgentCounts *counts)
 {
    m_node = node;
    m_loc = m_pointmap->depixelate(m_node);
-   if (m_output_mode & OUTPUT_GATE_COUNTS) {
+   if ((m_output_mode & OUTPUT_GATE_COUNTS) && counts) {
+      // (the table's searches are not safe to share between threads, so use the node gates)
+      int index = m_pointmap->getPackedGraph().nodeRef(m_node);
+      m_gate = (index != -1) ? (*counts->m_gates)[index] : -1;
+   }
+   else if (m_output_mode & OUTPUT_GATE_COUNTS) {
       int index = m_pointmap->getAttributeTable().getRowid(m_node);
       m_gate = (index != -1) ? (int)m_pointmap->getAttributeTable().getValue(index,g_col_gate) : -1;
    }
@@ -621,7 +915,7 @@ void Agent::onInit(PixelRef node, int trail_num)
    m_target_pix = NoPixel;
 }
 
-void Agent::onMove()
+void Agent::onMove(AgentCounts *counts)
 {
    m_at_target = false;
    m_frame++;
@@ -635,7 +929,7 @@ void Agent::onMove()
       onTarget();
       m_vector = onLook(false);
    }
-   else if (prandomr() < (1.0 / m_program->m_steps) && !m_target_lock) { // note, on average, will change 1 in steps
+   else if (prandomr(m_rand) < (1.0 / m_program->m_steps) && !m_target_lock) { // note, on average, will change 1 in steps
       m_step = 0;
       m_vector = onLook(false);
       /*
@@ -655,18 +949,18 @@ void Agent::onMove()
    // now step...
    PixelRef lastnode = m_node;
    onStep();
-   if (m_node != lastnode && m_output_mode != OUTPUT_NOTHING) {
-      int index = m_pointmap->getAttributeTable().getRowid(m_node);
+   if (m_node != lastnode && m_output_mode != OUTPUT_NOTHING && counts) {
+      int index = m_pointmap->getPackedGraph().nodeRef(m_node);
       if (index != -1) {
          if (m_output_mode & OUTPUT_COUNTS) {
-            m_pointmap->getAttributeTable().incrValue(index, g_col_total_counts);
+            counts->m_counts[index]++;
          }
          if (m_output_mode & OUTPUT_GATE_COUNTS) {
-            int obj = (int)m_pointmap->getAttributeTable().getValue(index, g_col_gate);
+            int obj = (*counts->m_gates)[index];
             if (m_gate != obj) {
                m_gate = obj;
                if (m_gate != -1) {
-                  m_pointmap->getAttributeTable().incrValue(index, g_col_gate_counts);
+                  counts->m_gate_counts[index]++;
                   // actually crossed into a new gate:
                   m_gate_encountered = true;
                }
@@ -731,7 +1025,7 @@ bool Agent::diagonalStep()
    int nextnode2 = m_pointmap->pixelate(nextloc2,false);
 
    bool good = false;
-   if (pafrand() % 2 == 0) {
+   if (pafrand(m_rand) % 2 == 0) {
       if (goodStep(nextnode1)) {
          m_node = nextnode1;
          m_loc = nextloc1;
@@ -824,15 +1118,13 @@ Point2f Agent::onStandardLook(bool wholeisovist)
       vbin = 16;
    }
    int directionbin = 32 + binfromvec(m_vector) - vbin;
-   int choices = 0;
    // reset for getting list, check in range:
    vbin = vbin * 2 + 1;
    if (vbin > 32) {
       vbin = 32;
    }
-   for (int i = 0; i < vbin; i++) {
-      choices += m_pointmap->getPoint(m_node).getNode().bincount( (directionbin + i) % 32 );
-   }
+   const PackedGraph& graph = m_pointmap->getPackedGraph();
+   int choices = graph.fanCount( m_node, directionbin % 32, vbin );
    if (choices == 0) {
       if (!wholeisovist) {
          return onStandardLook(true);
@@ -845,18 +1137,8 @@ Point2f Agent::onStandardLook(bool wholeisovist)
       }
    }
    else {
-      int chosen = pafrand() % choices;
-      Node& node = m_pointmap->getPoint(m_node).getNode();
-      for (; chosen >= node.bincount( directionbin % 32 ); directionbin++) {
-         chosen -= node.bincount( directionbin % 32 );
-      }
-      Bin& bin = node.bin(directionbin % 32);
-      bin.first();
-      tarpixelate = bin.cursor();
-      for (; chosen > 0; chosen--) {
-         bin.next();
-         tarpixelate = bin.cursor();
-      }
+      int chosen = pafrand(m_rand) % choices;
+      tarpixelate = graph.fanPixel( m_node, directionbin % 32, chosen );
    }
 
    m_target_pix = tarpixelate;
@@ -876,48 +1158,40 @@ Point2f Agent::onWeightedLook(bool wholeisovist)
    if (vbin = -1) {
       vbin = 16;
    }
-   int aheadbin = binfromvec(m_vector);
-   int directionbin = 32 + binfromvec(m_vector) - vbin;
-   prefvec<wpair> weightmap;
-   double weight = 0.0;
+   int aheadbin = binfromvec(m_vector) % 32;
+   int directionbin = (32 + binfromvec(m_vector) - vbin) % 32;
    // reset for getting list, check in range:
    vbin = vbin * 2 + 1;
    if (vbin > 32) {
       vbin = 32;
    }
-   for (int i = 0; i < vbin; i++) {
-      Bin& bin = m_pointmap->getPoint(m_node).getNode().bin((directionbin + i) % 32);
-      bin.first();
-      
-      // Quick mod - TV
-#if defined(_WIN32)      
-      int node = bin.is_tail() ? -1 : bin.cursor();
-#else
-      int node = bin.is_tail() ? -1 : bin.cursor().x;
-#endif      
-      while (node != -1) {
-         weight += ((directionbin + i) % 32 == aheadbin) ? 5.0 : 1.0;
-         weightmap.push_back(wpair(weight,node));
-         bin.next();
-	 // Quick mod - TV
-#if defined(_WIN32)	          
-         node = bin.is_tail() ? -1 : bin.cursor();
-#else
-         node = bin.is_tail() ? -1 : bin.cursor().x;
-#endif         
-      }
-   }
-   if (weightmap.size() == 0) {
+   // every pixel in the fan has a weight of one, except those in the bin straight ahead,
+   // which have five: so the fan is taken as the pixels before, in and after that bin
+   const PackedGraph& graph = m_pointmap->getPackedGraph();
+   int ahead = (aheadbin - directionbin + 32) % 32;
+   int choices = graph.fanCount( m_node, directionbin, vbin );
+   int before = graph.fanCount( m_node, directionbin, ahead < vbin ? ahead : vbin );
+   int in_ahead = ahead < vbin ? graph.binCount( m_node, aheadbin ) : 0;
+   double weight = double(choices) + 4.0 * in_ahead;
+   if (choices == 0) {
       return onWeightedLook(true);
    }
    else {
-      double chosen = prandomr() * weight;
-      for (size_t i = 0; i < weightmap.size(); i++) {
-         if (chosen < weightmap[i].weight) {
-            tarpixelate = weightmap[i].node;
-            break;
-         }
+      double chosen = prandomr(m_rand) * weight;
+      int index;
+      if (chosen < before) {
+         index = int(chosen);
+      }
+      else if (chosen < before + 5.0 * in_ahead) {
+         index = before + int((chosen - before) / 5.0);
       }
+      else {
+         index = before + in_ahead + int(chosen - before - 5.0 * in_ahead);
+      }
+      if (index >= choices) {
+         index = choices - 1;
+      }
+      tarpixelate = graph.fanPixel( m_node, directionbin, index );
    }
 
    m_target_pix = tarpixelate;
@@ -968,7 +1242,7 @@ Point2f Agent::onOcclusionLook(bool wholeisovist, int looktype)
          }
       }
       else {
-         size_t chosen = pafrand() % choices;
+         size_t chosen = pafrand(m_rand) % choices;
          for (; chosen >= node.m_occlusion_bins[ directionbin % 32 ].size(); directionbin++) {
             chosen -= node.m_occlusion_bins[ directionbin % 32 ].size();
          }
@@ -983,7 +1257,7 @@ Point2f Agent::onOcclusionLook(bool wholeisovist, int looktype)
       else if (looktype == AgentProgram::SEL_OCC_BIN60) {
          subset = 5;
       }
-      prefvec<wpair> weightmap;
+      pvector<wpair> weightmap;
       double weight = 0.0;
       Node& node = m_pointmap->getPoint(m_node).getNode();
       for (int i = 0; i < vbin; i += subset) {
@@ -1037,13 +1311,8 @@ Point2f Agent::onOcclusionLook(bool wholeisovist, int looktype)
          }
       }
       else {
-         double chosen = prandomr() * weight;
-         for (size_t i = 0; i < weightmap.size(); i++) {
-            if (chosen < weightmap[i].weight) {
-               tarpixelate = weightmap[i].node;
-               break;
-            }
-         }
+         double chosen = prandomr(m_rand) * weight;
+         tarpixelate = weightmap[weightedChoice(weightmap, chosen)].node;
       }
    }
 
@@ -1070,7 +1339,7 @@ Point2f Agent::onLoSLook(bool wholeisovist, int look_type)
       vbin = 16;
    }
    int directionbin = 32 + binfromvec(m_vector) - vbin;
-   prefvec<wpair> weightmap;
+   pvector<wpair> weightmap;
    double weight = 0.0;
    // reset for getting list, check in range:
    vbin = vbin * 2 + 1;
@@ -1079,7 +1348,7 @@ Point2f Agent::onLoSLook(bool wholeisovist, int look_type)
    }
    for (int i = 0; i < vbin; i++) {
       double los = (look_type == AgentProgram::SEL_LOS) ?
-         m_pointmap->getPoint(m_node).getNode().bindistance( (directionbin + i) % 32 ) :
+         m_pointmap->getPackedGraph().binDistance( m_node, (directionbin + i) % 32 ) :
          m_pointmap->getPoint(m_node).getNode().occdistance( (directionbin + i) % 32 );
       if (m_program->m_los_sqrd) {
          los *= los;
@@ -1101,16 +1370,11 @@ Point2f Agent::onLoSLook(bool wholeisovist, int look_type)
       }
    }
    else {
-      double chosen = prandomr() * weight;
-      for (size_t i = 0; i < weightmap.size(); i++) {
-         if (chosen < weightmap[i].weight) {
-            targetbin = weightmap[i].node;
-            break;
-         }
-      }
+      double chosen = prandomr(m_rand) * weight;
+      targetbin = weightmap[weightedChoice(weightmap, chosen)].node;
    }
 
-   float angle = (float)anglefrombin2(targetbin);
+   float angle = (float)anglefrombin2(targetbin, m_rand);
 
    return Point2f( cosf(angle), sinf(angle) );
 }
@@ -1127,7 +1391,7 @@ Point2f Agent::onDirectedLoSLook(bool wholeisovist, int look_type)
       vbin = 16;
    }
    int directionbin = 32 + binfromvec(vec2) - vbin;
-   prefvec<wpair> weightmap;
+   pvector<wpair> weightmap;
    double weight = 0.0;
    // reset for getting list, check in range:
    vbin = vbin * 2 + 1;
@@ -1136,7 +1400,7 @@ Point2f Agent::onDirectedLoSLook(bool wholeisovist, int look_type)
    }
    for (int i = 0; i < vbin; i++) {
       double los = (look_type == AgentProgram::SEL_LOS) ?
-         m_pointmap->getPoint(m_node).getNode().bindistance( (directionbin + i) % 32 ) :
+         m_pointmap->getPackedGraph().binDistance( m_node, (directionbin + i) % 32 ) :
          m_pointmap->getPoint(m_node).getNode().occdistance( (directionbin + i) % 32 );
       if (m_program->m_los_sqrd) {
          los *= los;
@@ -1155,16 +1419,11 @@ Point2f Agent::onDirectedLoSLook(bool wholeisovist, int look_type)
       }
    }
    else {
-      double chosen = prandomr() * weight;
-      for (size_t i = 0; i < weightmap.size(); i++) {
-         if (chosen < weightmap[i].weight) {
-            targetbin = weightmap[i].node;
-            break;
-         }
-      }
+      double chosen = prandomr(m_rand) * weight;
+      targetbin = weightmap[weightedChoice(weightmap, chosen)].node;
    }
 
-   float angle = (float)anglefrombin2(targetbin);
+   float angle = (float)anglefrombin2(targetbin, m_rand);
 
    return Point2f( cosf(angle), sinf(angle) );
 }
@@ -1195,7 +1454,7 @@ Point2f Agent::onGibsonianLook(bool wholeisovist)
    float angle = 0.0;
 
    if (rule_choice != -1) {
-      angle = (float)anglefrombin2((binfromvec(m_vector) + (2 * rule_choice + 1) * dir + 32) % 32);
+      angle = (float)anglefrombin2((binfromvec(m_vector) + (2 * rule_choice + 1) * dir + 32) % 32, m_rand);
    }
 
    // if no rule selection made, carry on in current direction
@@ -1246,15 +1505,15 @@ int Agent::onGibsonianRule(int rule)
       break;
    }
    int dir = 0;
-   if (option == 0x01 && m_program->m_rule_probability[0] > prandomr()) {
+   if (option == 0x01 && m_program->m_rule_probability[0] > prandomr(m_rand)) {
       dir = -1;
    }
-   else if (option == 0x10 && m_program->m_rule_probability[0] > prandomr()) {
+   else if (option == 0x10 && m_program->m_rule_probability[0] > prandomr(m_rand)) {
       dir = +1;
    }
-   else if (option == 0x11 && m_program->m_rule_probability[0] > prandomr() * prandomr()) {
+   else if (option == 0x11 && m_program->m_rule_probability[0] > prandomr(m_rand) * prandomr(m_rand)) {
       // note, use random * random event as there are two ways to do this
-      dir = (rand() % 2) ? -1 : +1;
+      dir = (pafrand(m_rand) % 2) ? -1 : +1;
    }
    return dir;
 }
@@ -1272,7 +1531,7 @@ Point2f Agent::onGibsonianLook2(bool wholeisovist)
    // first action: adjust to longest line of sight
    if (m_curr_los[3] > m_curr_los[0]) {
       maxbin = -m_program->m_vahead;
-      if (m_curr_los[4] > m_curr_los[0] && (pafrand() % 2)) {
+      if (m_curr_los[4] > m_curr_los[0] && (pafrand(m_rand) % 2)) {
          maxbin = m_program->m_vahead;
       }
    }
@@ -1288,14 +1547,14 @@ Point2f Agent::onGibsonianLook2(bool wholeisovist)
    if ((m_curr_los[2]-m_last_los[2])/m_curr_los[2] > m_program->m_feeler_threshold) {
       dir |= 0x10;
    }
-   if (dir == 0x01 && m_program->m_feeler_probability > prandomr()) {
+   if (dir == 0x01 && m_program->m_feeler_probability > prandomr(m_rand)) {
       maxbin = -m_program->m_vbin;
    }
-   else if (dir == 0x10 && m_program->m_feeler_probability > prandomr()) {
+   else if (dir == 0x10 && m_program->m_feeler_probability > prandomr(m_rand)) {
       maxbin = m_program->m_vbin;
    }
-   else if (dir == 0x11 && m_program->m_feeler_probability > prandomr() * prandomr()) {
-      maxbin = (pafrand() % 2) ? m_program->m_vbin : -m_program->m_vbin;
+   else if (dir == 0x11 && m_program->m_feeler_probability > prandomr(m_rand) * prandomr(m_rand)) {
+      maxbin = (pafrand(m_rand) % 2) ? m_program->m_vbin : -m_program->m_vbin;
    }
    // third action: detect heading for dead-end
    if (maxbin == 0 && (m_curr_los[0] / m_pointmap->getSpacing() < m_program->m_ahead_threshold)) {
@@ -1308,7 +1567,7 @@ Point2f Agent::onGibsonianLook2(bool wholeisovist)
    }
 
    int bin = binfromvec(m_vector) + maxbin;
-   float angle = (float)anglefrombin2(bin);
+   float angle = (float)anglefrombin2(bin, m_rand);
 
    return (maxbin == 0) ? m_vector : Point2f( cosf(angle), sinf(angle) );
 }
@@ -1322,17 +1581,17 @@ void Agent::calcLoS(int directionbin, bool curr)
    else {
       los = m_last_los;
    }
-   Node& node = m_pointmap->getPoint(m_node).getNode();
+   const PackedGraph& graph = m_pointmap->getPackedGraph();
    // ahead
-   los[0] = node.bindistance( directionbin % 32 );
+   los[0] = graph.binDistance( m_node, directionbin % 32 );
    // directions:
    int count = 1;
    for (int i = 1; i <= 7; i += 2) {
-      los[count] = node.bindistance((directionbin - i + 32) % 32);
+      los[count] = graph.binDistance( m_node, (directionbin - i + 32) % 32);
       count++;
    }
    for (int j = 1; j <= 7; j += 2) {
-      los[count] = node.bindistance((directionbin + j)  % 32);
+      los[count] = graph.binDistance( m_node, (directionbin + j)  % 32);
       count++;
    }
 }
@@ -1346,13 +1605,13 @@ void Agent::calcLoS2(int directionbin, bool curr)
    else {
       los = m_last_los;
    }
-   Node& node = m_pointmap->getPoint(m_node).getNode();
+   const PackedGraph& graph = m_pointmap->getPackedGraph();
    // ahead
-   los[0] = node.bindistance(directionbin % 32);
+   los[0] = graph.binDistance( m_node, directionbin % 32);
    // directions:
-   los[1] = node.bindistance( (directionbin - m_program->m_vbin + 32) % 32);
-   los[2] = node.bindistance( (directionbin + m_program->m_vbin) % 32);
+   los[1] = graph.binDistance( m_node, (directionbin - m_program->m_vbin + 32) % 32);
+   los[2] = graph.binDistance( m_node, (directionbin + m_program->m_vbin) % 32);
    //
-   los[3] = node.bindistance( (directionbin - m_program->m_vahead + 32) % 32);
-   los[4] = node.bindistance( (directionbin + m_program->m_vahead) % 32);
+   los[3] = graph.binDistance( m_node, (directionbin - m_program->m_vahead + 32) % 32);
+   los[4] = graph.binDistance( m_node, (directionbin + m_program->m_vahead) % 32);
 }
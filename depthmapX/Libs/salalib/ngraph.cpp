@@ -18,11 +18,38 @@
 
 // ngraph.cpp
 
+#include <generic/filesection.h>
 #include <sala/mgraph.h>
 #include <sala/spacepix.h>
 #include <sala/pointdata.h>
 #include <sala/ngraph.h>
 
+#include <algorithm>
+#include <functional>
+
+void SearchMarks::init(int cols, int rows)
+{
+   clear();
+   m_rows = rows;
+   m_size = cols * rows;
+   m_generation = 1;
+   m_marks = new Mark [m_size];
+   for (int i = 0; i < m_size; i++) {
+      m_marks[i].m_stamp = 0;
+   }
+}
+
+void SearchMarks::clear()
+{
+   if (m_marks) {
+      delete [] m_marks;
+      m_marks = NULL;
+   }
+   m_size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
 void Node::make(const PixelRef pix, PixelRefList *bins, float *bin_far_dists, int q_octants)
 {
    m_pixel = pix;
@@ -191,6 +218,13 @@ void Node::contents(PixelRefList& hood) const
    }
 }
 
+void Node::appendContents(PixelRefList& pixels) const
+{
+   for (int i = 0; i < 32; i++) {
+      m_bins[i].appendContents(pixels);
+   }
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 
 ifstream& Node::read(ifstream& stream, int version)
@@ -405,6 +439,16 @@ void Bin::contents(PixelRefList& hood)
    }
 }
 
+void Bin::appendContents(PixelRefList& pixels) const
+{
+   for (int i = 0; i < m_length; i++) {
+      PixelRef pix = m_pixel_vecs[i].m_start;
+      do {
+         pixels.push_back(pix);
+      } while (pix.move(m_dir).col(m_dir) <= m_pixel_vecs[i].end().col(m_dir));
+   }
+}
+
 void Bin::first() const
 {
    m_curvec = 0;
@@ -638,3 +682,361 @@ ofstream& PixelVec::write(ofstream& stream, const char dir, const PixelVec& cont
 
    return stream;
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+void PackedGraph::init(int cols, int rows)
+{
+   clear();
+   m_rows = rows;
+   m_node_refs.set(-1, cols * rows);
+   m_bin_starts.push_back(0);
+}
+
+void PackedGraph::clear()
+{
+   m_rows = 0;
+   m_node_refs.clear();
+   m_pixels.clear();
+   m_bin_starts.clear();
+   m_dirs.clear();
+   m_counts.clear();
+   m_distances.clear();
+   m_vecs.clear();
+   m_count_starts.clear();
+   m_vec_starts.clear();
+}
+
+// nodes may be added in any order, but each only once
+void PackedGraph::addNode(const PixelRef pix, const Node& node)
+{
+   m_node_refs[pix.x * m_rows + pix.y] = int(m_pixels.size());
+   m_pixels.push_back(pix);
+   for (int i = 0; i < 32; i++) {
+      const Bin& bin = node.m_bins[i];
+      for (int j = 0; j < bin.m_length; j++) {
+         m_vecs.push_back(bin.m_pixel_vecs[j]);
+      }
+      m_bin_starts.push_back(int(m_vecs.size()));
+      m_dirs.push_back(bin.m_dir);
+      m_counts.push_back(bin.m_node_count);
+      m_distances.push_back(bin.m_distance);
+   }
+   addCountStarts(nodeCount() - 1);
+}
+
+// nodes must be added in order (their runs are appended to m_vec_starts)
+void PackedGraph::addCountStarts(int node)
+{
+   int count = 0;
+   for (int i = 0; i < 32; i++) {
+      int b = node * 32 + i;
+      m_count_starts.push_back(count);
+      count += m_counts[b];
+      char dir = m_dirs[b];
+      int vec_count = 0;
+      for (int j = m_bin_starts[b]; j < m_bin_starts[b+1]; j++) {
+         m_vec_starts.push_back(vec_count);
+         vec_count += m_vecs[j].end().col(dir) - m_vecs[j].start().col(dir) + 1;
+      }
+   }
+}
+
+void PackedGraph::unpackNode(int node, Node& dest) const
+{
+   for (int i = 0; i < 32; i++) {
+      int b = node * 32 + i;
+      Bin& bin = dest.m_bins[i];
+      if (bin.m_pixel_vecs) {
+         delete [] bin.m_pixel_vecs;
+         bin.m_pixel_vecs = NULL;
+      }
+      bin.m_dir = m_dirs[b];
+      bin.m_node_count = m_counts[b];
+      bin.m_distance = m_distances[b];
+      bin.m_length = (unsigned short) (m_bin_starts[b+1] - m_bin_starts[b]);
+      if (bin.m_length) {
+         bin.m_pixel_vecs = new PixelVec [bin.m_length];
+         for (int j = 0; j < bin.m_length; j++) {
+            bin.m_pixel_vecs[j] = m_vecs[m_bin_starts[b] + j];
+         }
+      }
+   }
+}
+
+istream& PackedGraph::read(istream& stream, int cols, int rows)
+{
+   clear();
+   stream.read( (char *) &m_rows, sizeof(m_rows) );
+   readSection(stream, m_node_refs);
+   readSection(stream, m_pixels);
+   readSection(stream, m_bin_starts);
+   readSection(stream, m_dirs);
+   readSection(stream, m_counts);
+   readSection(stream, m_distances);
+   readSection(stream, m_vecs);
+   // check the arrays agree with each other before anything walks them
+   size_t bins = m_pixels.size() * 32;
+   if (m_rows != rows || int(m_node_refs.size()) != cols * rows || m_bin_starts.size() != bins + 1 || m_dirs.size() != bins || m_counts.size() != bins || 
+       m_distances.size() != bins || m_bin_starts.tail() != int(m_vecs.size())) {
+      throw pexception( pexception::FILE_ERROR );
+   }
+   for (int i = 0; i < nodeCount(); i++) {
+      addCountStarts(i);
+   }
+   return stream;
+}
+
+ostream& PackedGraph::write(ostream& stream) const
+{
+   stream.write( (char *) &m_rows, sizeof(m_rows) );
+   writeSection(stream, m_node_refs);
+   writeSection(stream, m_pixels);
+   writeSection(stream, m_bin_starts);
+   writeSection(stream, m_dirs);
+   writeSection(stream, m_counts);
+   writeSection(stream, m_distances);
+   writeSection(stream, m_vecs);
+   return stream;
+}
+
+PixelRef PackedGraph::binPixel(const PixelRef pix, int bin, int index) const
+{
+   int b = m_node_refs[pix.x * m_rows + pix.y] * 32 + bin;
+   int lo = m_bin_starts[b];
+   int hi = m_bin_starts[b+1];
+   if (index < 0 || lo == hi) {
+      return NoPixel;
+   }
+   // the last run that starts at or before index
+   while (hi - lo > 1) {
+      int mid = (lo + hi) / 2;
+      if (m_vec_starts[mid] <= index) {
+         lo = mid;
+      }
+      else {
+         hi = mid;
+      }
+   }
+   char dir = m_dirs[b];
+   const PixelVec& vec = m_vecs[lo];
+   index -= m_vec_starts[lo];
+   if (index > vec.end().col(dir) - vec.start().col(dir)) {
+      return NoPixel;
+   }
+   // a run is a straight line, so step along it in one go (as index moves would)
+   PixelRef here = vec.start();
+   switch (dir) {
+      case PixelRef::POSDIAGONAL: here.x += index; here.y += index; break;
+      case PixelRef::NEGDIAGONAL: here.x += index; here.y -= index; break;
+      case PixelRef::HORIZONTAL: here.x += index; break;
+      case PixelRef::VERTICAL: here.y += index; break;
+      case PixelRef::NEGHORIZONTAL: here.x -= index; break;
+      case PixelRef::NEGVERTICAL: here.y -= index; break;
+   }
+   return here;
+}
+
+int PackedGraph::fanCount(const PixelRef pix, int firstbin, int bins) const
+{
+   int b = m_node_refs[pix.x * m_rows + pix.y] * 32;
+   int total = m_count_starts[b + 31] + m_counts[b + 31];
+   int start = m_count_starts[b + firstbin];
+   int endbin = firstbin + bins;
+   if (endbin <= 32) {
+      return (endbin == 32 ? total : m_count_starts[b + endbin]) - start;
+   }
+   // wraps round past bin 31
+   return (total - start) + m_count_starts[b + endbin - 32];
+}
+
+PixelRef PackedGraph::fanPixel(const PixelRef pix, int firstbin, int index) const
+{
+   int b = m_node_refs[pix.x * m_rows + pix.y] * 32;
+   int total = m_count_starts[b + 31] + m_counts[b + 31];
+   // where the pixel is counting from the start of bin 0 (index must be less than the fan count)
+   int pos = m_count_starts[b + firstbin] + index;
+   if (pos >= total) {
+      pos -= total;
+   }
+   // the last bin that starts at or before pos (which cannot be empty)
+   int lo = 0;
+   int hi = 32;
+   while (hi - lo > 1) {
+      int mid = (lo + hi) / 2;
+      if (m_count_starts[b + mid] <= pos) {
+         lo = mid;
+      }
+      else {
+         hi = mid;
+      }
+   }
+   return binPixel(pix, lo, pos - m_count_starts[b + lo]);
+}
+
+// These follow the Node / Bin versions exactly (see above), but walk the packed runs:
+
+void PackedGraph::extractUnseen(const PixelRef pix, PixelRefList& pixels, SearchMarks& marks) const
+{
+   int node = m_node_refs[pix.x * m_rows + pix.y];
+   for (int b = node * 32; b < node * 32 + 32; b++) {
+      char dir = m_dirs[b];
+      int binmark = 1 << (b - node * 32);
+      for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+         const PixelVec& vec = m_vecs[i];
+         for (PixelRef here = vec.start(); here.col(dir) <= vec.end().col(dir); ) {
+            SearchMarks::Mark& mark = marks.mark(here);
+            if (mark.m_misc == 0) {
+               pixels.push_back(here);
+               mark.m_misc |= binmark;
+            }
+            if (!(dir & PixelRef::DIAGONAL)) {
+               if (mark.m_extent.col(dir) >= vec.end().col(dir))
+                  break;
+               mark.m_extent.col(dir) = vec.end().col(dir);
+            }
+            here.move(dir);
+         }
+      }
+   }
+}
+
+void PackedGraph::spreadBits(int node, const uint64 *bits, int words, uint64 *next, pvecint& touched) const
+{
+   for (int b = node * 32; b < node * 32 + 32; b++) {
+      char dir = m_dirs[b];
+      for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+         const PixelVec& vec = m_vecs[i];
+         for (PixelRef pix = vec.start(); pix.col(dir) <= vec.end().col(dir); pix.move(dir)) {
+            int ref = m_node_refs[pix.x * m_rows + pix.y];
+            if (ref == -1) {
+               continue;
+            }
+            uint64 *here = next + ref * words;
+            uint64 any = 0;
+            for (int w = 0; w < words; w++) {
+               any |= here[w];
+               here[w] |= bits[w];
+            }
+            if (!any) {
+               touched.push_back(ref);
+            }
+         }
+      }
+   }
+}
+
+void PackedGraph::extractMetric(pqvector<MetricTriple>& pixels, PointMap *pointdata, const MetricTriple& curs) const
+{
+   if (curs.dist == 0.0f || pointdata->getPoint(curs.pixel).blocked() || pointdata->blockedAdjacent(curs.pixel)) { 
+      int node = m_node_refs[curs.pixel.x * m_rows + curs.pixel.y];
+      for (int b = node * 32; b < node * 32 + 32; b++) {
+         char dir = m_dirs[b];
+         for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+            const PixelVec& vec = m_vecs[i];
+            for (PixelRef pix = vec.start(); pix.col(dir) <= vec.end().col(dir); ) {
+               Point& pt = pointdata->getPoint(pix);
+               if (pt.m_misc == 0 && 
+                  (pt.m_dist == -1.0 || (curs.dist + dist(pix,curs.pixel) < pt.m_dist))) {
+                  pt.m_dist = curs.dist + (float) dist(pix,curs.pixel);
+                  // n.b. dmap v4.06r now sets angle in range 0 to 4 (1 = 90 degrees)
+                  pt.m_cumangle = pointdata->getPoint(curs.pixel).m_cumangle + (curs.lastpixel == NoPixel ? 0.0f : (float) (angle(pix,curs.pixel,curs.lastpixel) / (M_PI * 0.5)));
+                  pixels.add(MetricTriple(pt.m_dist, pix, curs.pixel));
+               }
+               pix.move(dir);
+            }
+         }
+      }
+   }
+}
+
+// n.b., the heap holds each (dist, pixel) once, as the pqvector does: a pixel whose
+// distance comes out the same again (in float) takes the new angle, but is not pushed twice
+
+void PackedGraph::extractMetric(pvector<MetricTriple>& heap, const PointMap *pointdata, const MetricTriple& curs, SearchMarks& marks) const
+{
+   if (curs.dist == 0.0f || pointdata->getPoint(curs.pixel).blocked() || pointdata->blockedAdjacent(curs.pixel)) { 
+      float curs_cumangle = marks.cumangle(curs.pixel);
+      int node = m_node_refs[curs.pixel.x * m_rows + curs.pixel.y];
+      for (int b = node * 32; b < node * 32 + 32; b++) {
+         char dir = m_dirs[b];
+         for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+            const PixelVec& vec = m_vecs[i];
+            for (PixelRef pix = vec.start(); pix.col(dir) <= vec.end().col(dir); pix.move(dir)) {
+               SearchMarks::Mark& mark = marks.mark(pix);
+               if (mark.m_misc != 0) {
+                  continue;
+               }
+               double d = dist(pix,curs.pixel);
+               if (mark.m_dist == -1.0 || curs.dist + d < mark.m_dist) {
+                  float last_dist = mark.m_dist;
+                  mark.m_dist = curs.dist + (float) d;
+                  // n.b. dmap v4.06r now sets angle in range 0 to 4 (1 = 90 degrees)
+                  mark.m_cumangle = curs_cumangle + (curs.lastpixel == NoPixel ? 0.0f : (float) (angle(pix,curs.pixel,curs.lastpixel) / (M_PI * 0.5)));
+                  if (mark.m_dist != last_dist) {
+                     heap.push_back(MetricTriple(mark.m_dist, pix, curs.pixel));
+                     std::push_heap(&heap[0], &heap[0] + heap.size(), std::greater<MetricTriple>());
+                  }
+               }
+            }
+         }
+      }
+   }
+}
+
+void PackedGraph::extractAngular(pqvector<AngularTriple>& pixels, PointMap *pointdata, const AngularTriple& curs) const
+{
+   if (curs.angle == 0.0f || pointdata->getPoint(curs.pixel).blocked() || pointdata->blockedAdjacent(curs.pixel)) { 
+      int node = m_node_refs[curs.pixel.x * m_rows + curs.pixel.y];
+      for (int b = node * 32; b < node * 32 + 32; b++) {
+         char dir = m_dirs[b];
+         for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+            const PixelVec& vec = m_vecs[i];
+            for (PixelRef pix = vec.start(); pix.col(dir) <= vec.end().col(dir); ) {
+               Point& pt = pointdata->getPoint(pix);
+               if (pt.m_misc == 0) {
+                  // n.b. dmap v4.06r now sets angle in range 0 to 4 (1 = 90 degrees)
+                  float ang = (curs.lastpixel == NoPixel) ? 0.0f : (float) (angle(pix,curs.pixel,curs.lastpixel) / (M_PI * 0.5));
+                  if (pt.m_cumangle == -1.0 || curs.angle + ang < pt.m_cumangle) {
+                     pt.m_cumangle = pointdata->getPoint(curs.pixel).m_cumangle + ang;
+                     pixels.add(AngularTriple(pt.m_cumangle, pix, curs.pixel));
+                  }
+               }
+               pix.move(dir);
+            }
+         }
+      }
+   }
+}
+
+// as the metric heap version above: the keys on the heap are kept unique
+
+void PackedGraph::extractAngular(pvector<AngularTriple>& heap, const PointMap *pointdata, const AngularTriple& curs, SearchMarks& marks) const
+{
+   if (curs.angle == 0.0f || pointdata->getPoint(curs.pixel).blocked() || pointdata->blockedAdjacent(curs.pixel)) { 
+      float curs_cumangle = marks.cumangle(curs.pixel);
+      int node = m_node_refs[curs.pixel.x * m_rows + curs.pixel.y];
+      for (int b = node * 32; b < node * 32 + 32; b++) {
+         char dir = m_dirs[b];
+         for (int i = m_bin_starts[b]; i < m_bin_starts[b+1]; i++) {
+            const PixelVec& vec = m_vecs[i];
+            for (PixelRef pix = vec.start(); pix.col(dir) <= vec.end().col(dir); pix.move(dir)) {
+               SearchMarks::Mark& mark = marks.mark(pix);
+               if (mark.m_misc != 0) {
+                  continue;
+               }
+               // n.b. dmap v4.06r now sets angle in range 0 to 4 (1 = 90 degrees)
+               float ang = (curs.lastpixel == NoPixel) ? 0.0f : (float) (angle(pix,curs.pixel,curs.lastpixel) / (M_PI * 0.5));
+               if (mark.m_cumangle == -1.0 || curs.angle + ang < mark.m_cumangle) {
+                  float last_cumangle = mark.m_cumangle;
+                  mark.m_cumangle = curs_cumangle + ang;
+                  if (mark.m_cumangle != last_cumangle) {
+                     heap.push_back(AngularTriple(mark.m_cumangle, pix, curs.pixel));
+                     std::push_heap(&heap[0], &heap[0] + heap.size(), std::greater<AngularTriple>());
+                  }
+               }
+            }
+         }
+      }
+   }
+}
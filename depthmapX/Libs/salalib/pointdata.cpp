@@ -19,8 +19,12 @@
 // Point data
 
 #include <math.h>
+#include <algorithm>
+#include <functional>
 #include <generic/paftl.h>
 #include <generic/comm.h>  // for communicator
+#include <generic/parallel.h>
+#include <generic/filesection.h>
 
 #include <sala/mgraph.h>
 #include <sala/spacepix.h>
@@ -37,13 +41,45 @@
 
 /////////////////////////////////////////////////////////////////////////////////
 
+const pqmap<int,Line> g_no_point_lines;
+
+PointExtra::~PointExtra()
+{
+   if (m_attributes) {
+      delete m_attributes;
+      m_attributes = NULL;
+   }
+}
+
 Point::~Point()
 {
    if (m_node) {
       delete m_node;
       m_node = NULL;
-      delete m_attributes;
-      m_attributes = NULL;
+   }
+   if (m_extra) {
+      delete m_extra;
+      m_extra = NULL;
+   }
+}
+
+void Point::clearLines()
+{
+   if (m_extra) {
+      m_extra->m_lines.clear();
+      // most points only ever have lines, so let the extra data go too if possible:
+      if (!m_extra->m_attributes && !m_extra->m_data_objects.size() && !m_extra->m_user_data) {
+         delete m_extra;
+         m_extra = NULL;
+      }
+   }
+}
+
+void Point::clearAttributes()
+{
+   if (m_extra && m_extra->m_attributes) {
+      delete m_extra->m_attributes;
+      m_extra->m_attributes = NULL;
    }
 }
 
@@ -57,8 +93,7 @@ ifstream& Point::read(ifstream& stream, int version, int attr_count)
    if (m_node) {
       delete m_node;
       m_node = NULL;
-      delete m_attributes;
-      m_attributes = NULL;
+      clearAttributes();
    }
    stream.read( (char *) &m_state, sizeof(m_state) );
    // block is the same size as m_noderef used to be for ease of replacement:
@@ -80,8 +115,8 @@ ifstream& Point::read(ifstream& stream, int version, int attr_count)
          m_node->read(stream, version);
          if (version < VERSION_ATTRIBUTES_TABLE) {
             // don't deal with this here, just get the attributes into memory
-            m_attributes = new AttrBody(-1,g_attr_header);
-            m_attributes->read( stream, attr_count );
+            extra().m_attributes = new AttrBody(-1,g_attr_header);
+            m_extra->m_attributes->read( stream, attr_count );
          }
       }
    }
@@ -90,7 +125,7 @@ ifstream& Point::read(ifstream& stream, int version, int attr_count)
    }
    if (version < VERSION_SHAPE_MAPS) {
       // old layer information
-      m_data_objects.read(stream);
+      extra().m_data_objects.read(stream);
    }
    if (version >= VERSION_BOUNDARYGRAPH && version < VERSION_NEWBOUNDARYGRAPH) {
       // dummy pvecint to hold old format boundary nodes
@@ -125,6 +160,32 @@ ofstream& Point::write(ofstream& stream, int version)
 
 /////////////////////////////////////////////////////////////////////////////////
 
+void PointGrid::create(int cols, int rows)
+{
+   destroy();
+   m_tile_cols = (cols + POINT_TILE_MASK) >> POINT_TILE_SHIFT;
+   m_tile_rows = (rows + POINT_TILE_MASK) >> POINT_TILE_SHIFT;
+   m_tiles = new Point *[m_tile_cols * m_tile_rows];
+   for (int i = 0; i < m_tile_cols * m_tile_rows; i++) {
+      m_tiles[i] = new Point [POINT_TILE_SIZE * POINT_TILE_SIZE];
+   }
+}
+
+void PointGrid::destroy()
+{
+   if (m_tiles) {
+      for (int i = 0; i < m_tile_cols * m_tile_rows; i++) {
+         delete [] m_tiles[i];
+      }
+      delete [] m_tiles;
+      m_tiles = NULL;
+   }
+   m_tile_cols = 0;
+   m_tile_rows = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 int PointMaps::addNewMap(const pstring& name)
 {
    pstring myname = name;
@@ -133,7 +194,7 @@ int PointMaps::addNewMap(const pstring& name)
    while (duplicate) {
       duplicate = false;
       for (size_t i = 0; i < size(); i++) {
-         if (at(i).getName() == myname) {
+         if (prefvec<PointMap>::at(i).getName() == myname) {
             duplicate = true;
             myname = pstringify(counter++,name+pstring(" %d"));
             break;
@@ -146,27 +207,97 @@ int PointMaps::addNewMap(const pstring& name)
    return size() - 1; 
 }
 
-bool PointMaps::read(ifstream& stream, int version)
+bool PointMaps::read(ifstream& stream, int version, const pstring& deferred_file)
 {
    stream.read((char *) &m_displayed_map, sizeof(m_displayed_map));
    int count;
    stream.read((char *) &count, sizeof(count));
+   m_deferred_file = deferred_file;
+   m_deferred_version = version;
    for (int i = 0; i < count; i++) {
+      if (version >= VERSION_MAP_DIRECTORY) {
+         // each map is listed by name (and from VERSION_MAP_SUMMARY whether it has been
+         // processed) and length before its data:
+         pstring name;
+         name.read(stream);
+         bool processed = false;
+         if (version >= VERSION_MAP_SUMMARY) {
+            stream.read((char *) &processed, sizeof(processed));
+         }
+         int64 length;
+         stream.read((char *) &length, sizeof(length));
+         streampos start = stream.tellg();
+         if (version >= VERSION_ALIGNED_MAPS) {
+            readAlignment(stream);
+         }
+         // (only left in the file if the directory holds all of its summary)
+         if (!deferred_file.empty() && i != m_displayed_map && version >= VERSION_MAP_SUMMARY) {
+            push_back(PointMap(name));
+            PointMap& map = prefvec<PointMap>::tail();
+            map.m_processed = processed;
+            map.m_deferred_offset = int64(streamoff(stream.tellg()));
+            map.m_deferred_length = length - int64(streamoff(stream.tellg() - start));
+            stream.seekg( start + streamoff(length) );
+            continue;
+         }
+      }
       push_back(PointMap());
-      tail().setSpacePixel( (SuperSpacePixel *) this );
-      tail().read( stream, version );
+      prefvec<PointMap>::tail().setSpacePixel( (SuperSpacePixel *) this );
+      prefvec<PointMap>::tail().read( stream, version );
+   }
+   return true;
+}
+
+bool PointMaps::loadMap(int i)
+{
+   PointMap& map = prefvec<PointMap>::at(i);
+   if (map.isLoaded()) {
+      return true;
+   }
+#ifdef _WIN32
+   ifstream stream( m_deferred_file.c_str(), ios::binary | ios::in );
+#else
+   ifstream stream( m_deferred_file.c_str(), ios::in );
+#endif
+   if (stream.fail()) {
+      return false;
+   }
+   stream.seekg( streamoff(map.m_deferred_offset) );
+   try {
+      map.setSpacePixel( m_spacepix );
+      map.read( stream, m_deferred_version );
    }
+   catch (pexception) {
+      return false;
+   }
+   if (stream.fail()) {
+      return false;
+   }
+   map.m_deferred_offset = -1;
    return true;
 }
 
+bool PointMaps::loadAllMaps()
+{
+   bool ok = true;
+   for (size_t i = 0; i < size(); i++) {
+      if (!loadMap(int(i))) {
+         ok = false;
+      }
+   }
+   return ok;
+}
+
 bool PointMaps::write(ofstream& stream, int version, bool displayedmaponly)
 {
+   m_copied_offsets.clear();
+   m_copied_offsets.set( -1, size() );
    if (!displayedmaponly) {
       stream.write((char *) &m_displayed_map, sizeof(m_displayed_map));
       int count = size();
       stream.write((char *) &count, sizeof(count));
       for (int i = 0; i < count; i++) {
-         at(i).write( stream, version );
+         writeMap( stream, version, i );
       }
    }
    else {
@@ -178,22 +309,74 @@ bool PointMaps::write(ofstream& stream, int version, bool displayedmaponly)
       dummy = 1;
       stream.write((char *) &dummy, sizeof(dummy));
       //
-      at(m_displayed_map).write(stream, version);
+      writeMap( stream, version, m_displayed_map );
    }
    return true;
 }
 
+void PointMaps::writeMap(ofstream& stream, int version, int i)
+{
+   PointMap& map = prefvec<PointMap>::at(i);
+   if (version >= VERSION_MAP_DIRECTORY) {
+      pstring name = map.getName();
+      name.write(stream);
+      if (version >= VERSION_MAP_SUMMARY) {
+         bool processed = map.isProcessed();
+         stream.write((char *) &processed, sizeof(processed));
+      }
+      streampos start = beginBlock(stream);
+      if (version >= VERSION_ALIGNED_MAPS) {
+         writeAlignment(stream);
+      }
+      if (!map.isLoaded() && version == m_deferred_version && version >= VERSION_ALIGNED_MAPS) {
+         // a map that has not been read in is unchanged, so it can be copied as it stands:
+         m_copied_offsets[i] = int64(streamoff(stream.tellp()));
+         if (!copyBlock( m_deferred_file, map.m_deferred_offset, map.m_deferred_length, stream )) {
+            stream.setstate( ios::failbit );
+         }
+      }
+      else {
+         if (!loadMap(i)) {
+            stream.setstate( ios::failbit );
+         }
+         map.write( stream, version );
+      }
+      endBlock(stream, start);
+   }
+   else {
+      if (!loadMap(i)) {
+         stream.setstate( ios::failbit );
+      }
+      map.write( stream, version );
+   }
+}
+
+void PointMaps::setDeferredFile(const pstring& deferred_file, int version)
+{
+   for (size_t i = 0; i < m_copied_offsets.size() && i < size(); i++) {
+      if (m_copied_offsets[i] != -1) {
+         prefvec<PointMap>::at(i).m_deferred_offset = m_copied_offsets[i];
+      }
+   }
+   m_copied_offsets.clear();
+   m_deferred_file = deferred_file;
+   m_deferred_version = version;
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 
 PointMap::PointMap(const pstring& name)
 {
    m_name = name;
 
-   m_points = NULL;
    m_cols = 0;
    m_rows = 0;
    m_point_count = 0;
 
+   m_packed_graph = NULL;
+   m_deferred_offset = -1;
+   m_deferred_length = 0;
+
    m_spacepix = NULL;
    m_spacing = 0.0;
 
@@ -220,7 +403,8 @@ PointMap::PointMap(const pstring& name)
 
 PointMap::~PointMap()
 {
-   if (m_points) {
+   clearPackedGraph();
+   if (m_points.allocated()) {
       // Trying to clear out the memory quicker -> predelete nodes and bins
       for (int j = 0; j < m_cols; j++) {
          for (int k = 0; k < m_rows; k++) {
@@ -230,11 +414,7 @@ PointMap::~PointMap()
             }
          }
       }
-      for (int i = 0; i < m_cols; i++) {
-         delete [] m_points[i];
-      }
-      delete [] m_points;
-      m_points = NULL;
+      m_points.destroy();
       m_cols = 0;
       m_rows = 0;
       m_point_count = 0;
@@ -250,12 +430,9 @@ PointMap& PointMap::operator = (const PointMap& pointdata)
 {
    if (this != &pointdata) {
 
-      if (m_points) {
-         for (int i = 0; i < m_cols; i++) {
-            delete [] m_points[i];
-         }
-         delete [] m_points;
-         m_points = NULL;
+      clearPackedGraph();
+      if (m_points.allocated()) {
+         m_points.destroy();
          m_cols = 0;
          m_rows = 0;         
       }
@@ -277,21 +454,21 @@ void PointMap::construct(const PointMap& pointdata)
    m_rows = pointdata.m_rows;
 
    if (m_cols) {
-      m_points = new Point *[m_cols];
+      m_points.create(m_cols, m_rows);
       for (int i = 0; i < m_cols; i++) {
-         m_points[i] = new Point [m_rows];
          for (int j = 0; j < m_rows; j++) {
             m_points[i][j] = pointdata.m_points[i][j];
          }
       }
    }
-   else {
-      m_points = NULL;
-
-   }
 
    m_point_count = pointdata.m_point_count;
 
+   // the packed graph is remade on demand
+   m_packed_graph = NULL;
+   m_deferred_offset = pointdata.m_deferred_offset;
+   m_deferred_length = pointdata.m_deferred_length;
+
    // You *must* set SpacePixel manually
    m_spacepix = NULL;
    m_spacing = pointdata.m_point_count;
@@ -347,34 +524,37 @@ bool PointMap::setGrid(double spacing, const Point2f& offset)
       return false;
    }
 
-   m_spacing = spacing;
    // note, the internal offset is the offset from the bottom left
-   double xoffset = fmod(m_spacepix->m_region.bottom_left.x + offset.x,m_spacing);
-   double yoffset = fmod(m_spacepix->m_region.bottom_left.y + offset.y,m_spacing);
-   if (xoffset < m_spacing / 2.0)
-      xoffset += m_spacing;
-   if (xoffset > m_spacing / 2.0)
-      xoffset -= m_spacing;
-   if (yoffset < m_spacing / 2.0)
-      yoffset += m_spacing;
-   if (yoffset > m_spacing / 2.0)
-      yoffset -= m_spacing;
+   double xoffset = fmod(m_spacepix->m_region.bottom_left.x + offset.x,spacing);
+   double yoffset = fmod(m_spacepix->m_region.bottom_left.y + offset.y,spacing);
+   if (xoffset < spacing / 2.0)
+      xoffset += spacing;
+   if (xoffset > spacing / 2.0)
+      xoffset -= spacing;
+   if (yoffset < spacing / 2.0)
+      yoffset += spacing;
+   if (yoffset > spacing / 2.0)
+      yoffset -= spacing;
+
+   // A grid at the required spacing (which must fit within the pixel references):
+   double cols = floor((xoffset + m_spacepix->m_region.width()) / spacing + 0.5) + 1;
+   double rows = floor((yoffset + m_spacepix->m_region.height()) / spacing + 0.5) + 1;
+   if (cols > PIXELREF_MAX || rows > PIXELREF_MAX) {
+      return false;
+   }
 
+   m_spacing = spacing;
    m_offset = Point2f(-xoffset, -yoffset);
 
-   if (m_points) {
-      for (int i = 0; i < m_cols; i++) {
-         delete [] m_points[i];
-      }
-      delete [] m_points;
-      m_points = NULL;
+   clearPackedGraph();
+   if (m_points.allocated()) {
+      m_points.destroy();
       m_point_count = 0;
    }
    m_undocounter = 0;  // <- reset the undo counter... sorry... once you've done this you can't undo
 
-   // A grid at the required spacing:
-   m_cols = (int) floor((xoffset + m_spacepix->m_region.width()) / m_spacing + 0.5) + 1;
-   m_rows = (int) floor((yoffset + m_spacepix->m_region.height()) / m_spacing + 0.5) + 1;
+   m_cols = (int) cols;
+   m_rows = (int) rows;
 
    m_bottom_left = Point2f(m_spacepix->m_region.bottom_left.x + m_offset.x,
                            m_spacepix->m_region.bottom_left.y + m_offset.y);
@@ -384,9 +564,8 @@ bool PointMap::setGrid(double spacing, const Point2f& offset)
       Point2f(m_bottom_left.x+double(m_cols-1)*m_spacing + m_spacing/2.0,
               m_bottom_left.y+double(m_rows-1)*m_spacing + m_spacing/2.0) );
 
-   m_points = new Point *[m_cols];
+   m_points.create(m_cols, m_rows);
    for (int j = 0; j < m_cols; j++) {
-      m_points[j] = new Point [m_rows];
       for (int k = 0; k < m_rows; k++) {
          m_points[j][k].m_location = depixelate(PixelRef(j,k));
       }
@@ -524,8 +703,7 @@ PixelRefList PointMap::getLayerPixels(int layer)
 
    for (int i = 0; i < m_cols; i++) {
       for (int j = 0; j < m_rows; j++) {
-         size_t obj = m_points[i][j].m_data_objects.searchindex(layer);
-         if (obj != paftl::npos) {
+         if (m_points[i][j].getDataObject(layer) != -1) {
             pixels.push_back( PixelRef(i,j) );
          }
       }
@@ -540,8 +718,7 @@ PixelRefList PointMap::getDataObjectPixels(int layer, int object)
 
    for (int i = 0; i < m_cols; i++) {
       for (int j = 0; j < m_rows; j++) {
-         size_t obj = m_points[i][j].m_data_objects.searchindex(layer);
-         if (paftl::npos != -1 && m_points[i][j].m_data_objects[obj] == object) {
+         if (m_points[i][j].getDataObject(layer) == object) {
             pixels.push_back( PixelRef(i,j) );
          }
       }
@@ -554,7 +731,7 @@ PixelRefList PointMap::getDataObjectPixels(int layer, int object)
 
 bool PointMap::fillLines()
 {
-   if (!m_spacepix || !m_initialised || !m_points) {
+   if (!m_spacepix || !m_initialised || !m_points.allocated()) {
       return false;
    }
    m_undocounter++;
@@ -594,7 +771,7 @@ void PointMap::fillLine(const Line& li)
 
 bool PointMap::blockLines()
 {
-   if (!m_spacepix || !m_initialised || !m_points) {
+   if (!m_spacepix || !m_initialised || !m_points.allocated()) {
       return false;
    }
    if (m_blockedlines) {
@@ -636,11 +813,15 @@ bool PointMap::blockLines()
          PixelRef curs = PixelRef( i, j );
          Point& pt = getPoint( curs );
          QtRegion viewport = regionate( curs, 1e-10 );
-         for (size_t k = pt.m_lines.size() - 1; k != paftl::npos; k--) {
-            if (!pt.m_lines.value(k).crop( viewport )) {
+         if (!pt.m_extra) {
+            continue;
+         }
+         pqmap<int,Line>& lines = pt.m_extra->m_lines;
+         for (size_t k = lines.size() - 1; k != paftl::npos; k--) {
+            if (!lines.value(k).crop( viewport )) {
                // the pixelation is fairly rough to make sure that no point is missed: this just
                // clears up if any point has been added in error:
-               pt.m_lines.remove_at(k);
+               lines.remove_at(k);
             }
          }
       }
@@ -658,7 +839,7 @@ void PointMap::blockLine(int key, const Line& li)
    // although it may catch extra points...
    for (size_t n = 0; n < pixels.size(); n++)
    {
-      getPoint(pixels[n]).m_lines.add(key,li);
+      getPoint(pixels[n]).addLine(key,li);
       getPoint(pixels[n]).setBlock(true);
    }
 }
@@ -669,7 +850,7 @@ void PointMap::unblockLines(bool clearblockedflag)
    for (int i = 0; i < m_cols; i++) {
       for (int j = 0; j < m_rows; j++) {
          PixelRef curs = PixelRef(i,j);
-         getPoint(curs).m_lines.clear();
+         getPoint(curs).clearLines();
          if (clearblockedflag) {
             getPoint(curs).setBlock(false);
          }
@@ -723,7 +904,7 @@ void PointMap::unblockLines(bool clearblockedflag)
 
 void PointMap::addLineDynamic(LineKey ref,const Line& line)
 {
-   if (!m_spacepix || !m_initialised || !m_points) {
+   if (!m_spacepix || !m_initialised || !m_points.allocated()) {
       return;
    }
 
@@ -765,7 +946,7 @@ void PointMap::addLineDynamic(LineKey ref,const Line& line)
 
 void PointMap::removeLineDynamic(LineKey ref, const Line& line)
 {
-   if (!m_spacepix || !m_initialised || !m_points) {
+   if (!m_spacepix || !m_initialised || !m_points.allocated()) {
       return;
    }
 
@@ -857,7 +1038,7 @@ bool PointMap::makePoints(const Point2f& seed, int fill_type, Communicator *comm
    if (!m_spacepix) {
       return false;
    }
-   if (!m_initialised || !m_points) {
+   if (!m_initialised || !m_points.allocated()) {
       return false;
    }
    if (comm) {
@@ -944,16 +1125,18 @@ int PointMap::expand( const PixelRef p1, const PixelRef p2, PixelRefList& list,
       return 2;
    }
    Line l(depixelate(p1),depixelate(p2));
-   for (size_t i = 0; i < getPoint(p1).m_lines.size(); i++)
+   const pqmap<int,Line>& lines1 = getPoint(p1).getLines();
+   for (size_t i = 0; i < lines1.size(); i++)
    {
-      if (intersect_region(l, getPoint(p1).m_lines[i], m_spacing * 1e-10) && intersect_line(l, getPoint(p1).m_lines[i], m_spacing * 1e-10)) {
+      if (intersect_region(l, lines1[i], m_spacing * 1e-10) && intersect_line(l, lines1[i], m_spacing * 1e-10)) {
          // 4 = blocked
          return 4;
       }
    }
-   for (size_t j = 0; j < getPoint(p2).m_lines.size(); j++)
+   const pqmap<int,Line>& lines2 = getPoint(p2).getLines();
+   for (size_t j = 0; j < lines2.size(); j++)
    {
-      if (intersect_region(l, getPoint(p2).m_lines[j], m_spacing * 1e-10) && intersect_line(l, getPoint(p2).m_lines[j], m_spacing * 1e-10)) {
+      if (intersect_region(l, lines2[j], m_spacing * 1e-10) && intersect_line(l, lines2[j], m_spacing * 1e-10)) {
          // 4 = blocked
          return 4;
       }
@@ -1555,12 +1738,9 @@ bool PointMap::read(ifstream& stream, int version )
    // NOTE: You MUST set m_spacepix manually!
    m_displayed_attribute = -1;
 
-   if (m_points) {
-      for (int i = 0; i < m_cols; i++) {
-         delete [] m_points[i];
-      }
-      delete [] m_points;
-      m_points = NULL;
+   clearPackedGraph();
+   if (m_points.allocated()) {
+      m_points.destroy();
    }
 
    stream.read( (char *) &m_spacing, sizeof(m_spacing) );
@@ -1603,36 +1783,41 @@ bool PointMap::read(ifstream& stream, int version )
       stream.read( (char *) &attr_count, sizeof(int) );
    }
 
-   m_points = new Point *[m_cols];
-   
-   for (int j = 0; j < m_cols; j++) {
-      m_points[j] = new Point [m_rows];
-      // ...and read...
-      if (version >= VERSION_LAYERS_INTROD) {
-         for (int k = 0; k < m_rows; k++) {
-            m_points[j][k].read(stream,version,attr_count);
+   if (version >= VERSION_ALIGNED_SECTIONS) {
+      readPointSections(stream);
+   }
+   else {
+      m_points.create(m_cols, m_rows);
+      for (int j = 0; j < m_cols; j++) {
+         // ...and read...
+         if (version >= VERSION_LAYERS_INTROD) {
+            for (int k = 0; k < m_rows; k++) {
+               m_points[j][k].read(stream,version,attr_count);
+            }
          }
-      }
-      else if (version >= VERSION_EXTRA_POINT_DATA_INTROD) {
-         // Hmm... more untidiness from a previous incarnation
-         OldPoint2 *oldpoints = new OldPoint2 [m_rows];
-         stream.read( (char *) oldpoints, sizeof(OldPoint2) * m_rows );
-         for (int k = 0; k < m_rows; k++) {
-            m_points[j][k].m_block = oldpoints[k].m_noderef;  // <- block is actually for something else!
-            m_points[j][k].m_state = oldpoints[k].m_state;
-            m_points[j][k].m_misc = oldpoints[k].m_misc;
+         else if (version >= VERSION_EXTRA_POINT_DATA_INTROD) {
+            // Hmm... more untidiness from a previous incarnation
+            OldPoint2 *oldpoints = new OldPoint2 [m_rows];
+            stream.read( (char *) oldpoints, sizeof(OldPoint2) * m_rows );
+            for (int k = 0; k < m_rows; k++) {
+               m_points[j][k].m_block = oldpoints[k].m_noderef;  // <- block is actually for something else!
+               m_points[j][k].m_state = oldpoints[k].m_state;
+               m_points[j][k].m_misc = oldpoints[k].m_misc;
+            }
          }
-      }
-      else {
-         // Hmm... more untidiness from a previous incarnation
-         OldPoint1 *oldpoints = new OldPoint1 [m_rows];
-         stream.read( (char *) oldpoints, sizeof(OldPoint1) * m_rows );
-         for (int k = 0; k < m_rows; k++) {
-            m_points[j][k].m_block= oldpoints[k].m_noderef;  // <- block is actually for something else!
-            m_points[j][k].m_state = oldpoints[k].m_state;
+         else {
+            // Hmm... more untidiness from a previous incarnation
+            OldPoint1 *oldpoints = new OldPoint1 [m_rows];
+            stream.read( (char *) oldpoints, sizeof(OldPoint1) * m_rows );
+            for (int k = 0; k < m_rows; k++) {
+               m_points[j][k].m_block= oldpoints[k].m_noderef;  // <- block is actually for something else!
+               m_points[j][k].m_state = oldpoints[k].m_state;
+            }
          }
       }
+   }
 
+   for (int j = 0; j < m_cols; j++) {
       for (int k = 0; k < m_rows; k++) {
          // Old style point node reffing and also unselects selected nodes which would otherwise be difficult
          if (version >= VERSION_QUICK_GRAPH_INTROD) {
@@ -1711,9 +1896,14 @@ bool PointMap::write( ofstream& stream, int version )
    stream.write( (char *) &m_displayed_attribute, sizeof(m_displayed_attribute) );
    m_attributes.write( stream, version );
    
-   for (int j = 0; j < m_cols; j++) {
-      for (int k = 0; k < m_rows; k++) {
-         m_points[j][k].write( stream, version );
+   if (version >= VERSION_ALIGNED_SECTIONS) {
+      writePointSections( stream );
+   }
+   else {
+      for (int j = 0; j < m_cols; j++) {
+         for (int k = 0; k < m_rows; k++) {
+            m_points[j][k].write( stream, version );
+         }
       }
    }
 
@@ -1723,6 +1913,143 @@ bool PointMap::write( ofstream& stream, int version )
    return false;
 }
 
+// Rather than each point and node being written in turn (with the bins run length
+// coded), the points go in a section per field in column order (only the fields held
+// in the file, the rest of the point is working space), and the graph is written
+// as the packed graph's arrays, so the whole lot is read back with a handful of block
+// reads.  The packed graph read is kept on as the map's packed graph, and the nodes
+// are remade from it
+
+void PointMap::readPointSections( ifstream& stream )
+{
+   // each field as a section of fixed width values, so the layout does not rest on
+   // how the compiler pads a structure:
+   pvector<double> locations;   // x then y for each point
+   pvecint states;
+   pvecint blocks;
+   pvecint miscs;
+   pvecint merges;
+   pvector<char> grid_connections;
+   readSection(stream, locations);
+   readSection(stream, states);
+   readSection(stream, blocks);
+   readSection(stream, miscs);
+   readSection(stream, merges);
+   readSection(stream, grid_connections);
+   int count = m_cols * m_rows;
+   if (int(locations.size()) != 2 * count || int(states.size()) != count || int(blocks.size()) != count ||
+       int(miscs.size()) != count || int(merges.size()) != count || int(grid_connections.size()) != count) {
+      throw pexception( pexception::FILE_ERROR );
+   }
+   PackedGraph *graph = new PackedGraph;
+   try {
+      graph->read(stream, m_cols, m_rows);
+   }
+   catch (pexception) {
+      delete graph;
+      throw;
+   }
+   m_packed_graph = graph;
+
+   // occlusion distances and bins are not in the packed graph, so have sections of their own:
+   pvecfloat occ_distances;
+   pvecint occ_starts;
+   pvector<PixelRef> occ_pixels;
+   readSection(stream, occ_distances);
+   readSection(stream, occ_starts);
+   readSection(stream, occ_pixels);
+   int bins = graph->nodeCount() * 32;
+   if (int(occ_distances.size()) != bins || int(occ_starts.size()) != bins + 1 || occ_starts.tail() != int(occ_pixels.size())) {
+      throw pexception( pexception::FILE_ERROR );
+   }
+
+   m_points.create(m_cols, m_rows);
+   for (int j = 0; j < m_cols; j++) {
+      for (int k = 0; k < m_rows; k++) {
+         int index = j * m_rows + k;
+         Point& p = m_points[j][k];
+         p.m_location = Point2f(locations[2 * index], locations[2 * index + 1]);
+         p.m_state = states[index];
+         p.m_block = blocks[index];
+         p.m_misc = miscs[index];
+         p.m_merge = PixelRef(merges[index]);
+         p.m_grid_connections = grid_connections[index];
+         int node = graph->nodeRef(PixelRef(j,k));
+         if (node != -1) {
+            p.m_node = new Node;
+            graph->unpackNode(node, *(p.m_node));
+            for (int b = 0; b < 32; b++) {
+               int bin = node * 32 + b;
+               p.m_node->bin(b).setOccDistance(occ_distances[bin]);
+               for (int i = occ_starts[bin]; i < occ_starts[bin+1]; i++) {
+                  p.m_node->m_occlusion_bins[b].push_back(occ_pixels[i]);
+               }
+            }
+         }
+      }
+   }
+}
+
+void PointMap::writePointSections( ofstream& stream )
+{
+   // as readPointSections, a section of fixed width values for each field
+   pvector<double> locations;
+   pvecint states;
+   pvecint blocks;
+   pvecint miscs;
+   pvecint merges;
+   pvector<char> grid_connections;
+   int count = m_cols * m_rows;
+   if (count > 0) {
+      locations.set(2 * count);
+      states.set(count);
+      blocks.set(count);
+      miscs.set(count);
+      merges.set(count);
+      grid_connections.set(count);
+   }
+   for (int j = 0; j < m_cols; j++) {
+      for (int k = 0; k < m_rows; k++) {
+         int index = j * m_rows + k;
+         const Point& p = m_points[j][k];
+         locations[2 * index] = p.m_location.x;
+         locations[2 * index + 1] = p.m_location.y;
+         states[index] = p.m_state;
+         blocks[index] = p.m_block;
+         miscs[index] = p.m_misc;
+         merges[index] = int(p.m_merge);
+         grid_connections[index] = p.m_grid_connections;
+      }
+   }
+   writeSection(stream, locations);
+   writeSection(stream, states);
+   writeSection(stream, blocks);
+   writeSection(stream, miscs);
+   writeSection(stream, merges);
+   writeSection(stream, grid_connections);
+
+   const PackedGraph& graph = getPackedGraph();
+   graph.write(stream);
+
+   pvecfloat occ_distances;
+   pvecint occ_starts;
+   pvector<PixelRef> occ_pixels;
+   occ_starts.push_back(0);
+   for (int n = 0; n < graph.nodeCount(); n++) {
+      Node *node = getPoint(graph.nodePixel(n)).m_node;
+      for (int b = 0; b < 32; b++) {
+         occ_distances.push_back(node->occdistance(b));
+         for (size_t i = 0; i < node->m_occlusion_bins[b].size(); i++) {
+            occ_pixels.push_back(node->m_occlusion_bins[b][i]);
+         }
+         occ_starts.push_back(int(occ_pixels.size()));
+      }
+   }
+   writeSection(stream, occ_distances);
+   writeSection(stream, occ_starts);
+   writeSection(stream, occ_pixels);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // A horrible piece of code: this is to convert a file from the old format
@@ -1737,7 +2064,7 @@ void PointMap::convertAttributes(int which_attributes)
       int connectivity_col = m_attributes.insertLockedColumn("Connectivity");
       for (int i = 0; i < m_cols; i++) {
          for (int j = 0; j < m_rows; j++) {
-            if (m_points[i][j].m_attributes) {
+            if (m_points[i][j].hasAttributes()) {
                // insert row...
                int row = m_attributes.insertRow(PixelRef(i,j));
                float val;
@@ -1753,7 +2080,7 @@ void PointMap::convertAttributes(int which_attributes)
       int controllability_col = m_attributes.insertColumn("Visual Controllability");
       for (int i = 0; i < m_cols; i++) {
          for (int j = 0; j < m_rows; j++) {
-            if (m_points[i][j].m_attributes) {
+            if (m_points[i][j].hasAttributes()) {
                int row = m_attributes.getRowid(PixelRef(i,j));
                float val;
                val = (float) m_points[i][j].getAttributes().getAttr(AttrHeader::CLUSTER);
@@ -1775,7 +2102,7 @@ void PointMap::convertAttributes(int which_attributes)
       int rel_entropy_col = m_attributes.insertColumn("Visual Relativised Entropy");
       for (int i = 0; i < m_cols; i++) {
          for (int j = 0; j < m_rows; j++) {
-            if (m_points[i][j].m_attributes) {
+            if (m_points[i][j].hasAttributes()) {
                int row = m_attributes.getRowid(PixelRef(i,j));
                float val;
                val = (float) m_points[i][j].getAttributes().getAttr(AttrHeader::ENTROPY);
@@ -1798,7 +2125,7 @@ void PointMap::convertAttributes(int which_attributes)
       int col = m_attributes.insertColumn("Visual Step Depth");
       for (int i = 0; i < m_cols; i++) {
          for (int j = 0; j < m_rows; j++) {
-            if (m_points[i][j].m_attributes) {
+            if (m_points[i][j].hasAttributes()) {
                int row = m_attributes.getRowid(PixelRef(i,j));
                float val;
                val = (float) m_points[i][j].getAttributes().getAttr(AttrHeader::POINT_DEPTH);
@@ -1814,7 +2141,7 @@ void PointMap::convertAttributes(int which_attributes)
       int count_col = m_attributes.insertColumn("Metric Node Count");
       for (int i = 0; i < m_cols; i++) {
          for (int j = 0; j < m_rows; j++) {
-            if (m_points[i][j].m_attributes) {
+            if (m_points[i][j].hasAttributes()) {
                int row = m_attributes.getRowid(PixelRef(i,j));
                double val, total = m_points[i][j].getAttributes().getAttr(AttrHeader::METRIC_GRAPH_SIZE);
                //
@@ -1832,10 +2159,7 @@ void PointMap::convertAttributes(int which_attributes)
    }
    for (int i = 0; i < m_cols; i++) {
       for (int j = 0; j < m_rows; j++) {
-         if (m_points[i][j].m_attributes) {
-            delete m_points[i][j].m_attributes;
-            m_points[i][j].m_attributes = NULL;
-         }
+         m_points[i][j].clearAttributes();
       }
    }
 }
@@ -2250,64 +2574,100 @@ bool PointMap::sparkGraph2( Communicator *comm, bool boundarygraph, double maxdi
    // pre-label --- allows faster node access later on
    int count = tagState( true, true );
 
-   // start the timer when you know the true count including fixed points
-   
-   // Quick mod - TV
-#if defined(_WIN32)   
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif   
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, count );
+   // The nodes and attribute rows are made up front, so that the sparks from
+   // each pixel can then be run independently.  The filled pixels are gathered
+   // into square tiles (pixels close to each other test against much the same
+   // lines), and the tiles are shared out between the threads.  The tiles are
+   // out of key order, so the rows are added together by insertRows.
+   const int tilesize = 16;
+   pvecint tilestarts;
+   pvector<PixelRef> pixels;
+   pvecint keys;
+   for (int ti = 0; ti < m_cols; ti += tilesize) {
+      for (int tj = 0; tj < m_rows; tj += tilesize) {
+         tilestarts.push_back( int(pixels.size()) );
+         for (int i = ti; i < __min(ti + tilesize, m_cols); i++) {
+            for (int j = tj; j < __min(tj + tilesize, m_rows); j++) {
+               if (m_points[i][j].getState() & Point::FILLED) {
+                  m_points[i][j].m_node = new Node;
+                  pixels.push_back( PixelRef(i,j) );
+                  keys.push_back( PixelRef(i,j) );
+               }
+            }
+         }
+      }
    }
+   tilestarts.push_back( int(pixels.size()) );
+   m_attributes.insertRows( keys );
+   int tilecount = int(tilestarts.size()) - 1;
 
-   count = 0;
+   // the attribute rows are looked up here, as the table's searches are not thread safe
+   pvecint rows;
+   for (size_t n = 0; n < pixels.size(); n++) {
+      rows.push_back( m_attributes.getRowid( pixels[n] ) );
+   }
 
-   for (int i = 0; i < m_cols; i++) {
+   // the point statistics go straight into the columns (each pixel has its own row)
+   AttributeColumnWriter connectivity( m_attributes, connectivity_col );
+   AttributeColumnWriter first_moment( m_attributes, m_attributes.getColumnIndex("Point First Moment") );
+   AttributeColumnWriter second_moment( m_attributes, m_attributes.getColumnIndex("Point Second Moment") );
 
-      for (int j = 0; j < m_rows; j++) {
+   // the nodes are about to be remade
+   clearPackedGraph();
 
-         PixelRef curs = PixelRef( i, j );
-   
-         if ( getPoint( curs ).getState() & Point::FILLED ) {
+   // start the timer when you know the true count including fixed points
+   ParallelComm pcomm( comm, count );
 
-            getPoint( curs ).m_node = new Node;
-            m_attributes.insertRow( curs );
+   #pragma omp parallel
+   {
+      // sieve scratch space, one set per thread
+      pvector<PixelRef> bins_b[32];
+      float far_bin_dists[32];
 
-            sparkPixel2(curs,1,maxdist); // make flag of 1 suggests make this node, don't set reciprocral process flags on those you can see
-                                         // maxdist controls how far to see out to
+      #pragma omp for schedule(dynamic)
+      for (int t = 0; t < tilecount; t++) {
+         if (pcomm.isCancelled()) {
+            continue;
+         }
+         for (int n = tilestarts[t]; n < tilestarts[t+1]; n++) {
+            int neighbourhood_size;
+            double total_dist, total_dist_sqr;
+            // make flag of 1 suggests make this node, don't set reciprocral process flags on those you can see
+            // maxdist controls how far to see out to
+            sparkPixel2(pixels[n],1,maxdist,bins_b,far_bin_dists,
+                        neighbourhood_size,total_dist,total_dist_sqr);
+            int row = rows[n];
+            connectivity.setValue( row, float(neighbourhood_size) );
+            first_moment.setValue( row, float(total_dist) );
+            second_moment.setValue( row, float(total_dist_sqr) );
+         }
+         pcomm.record( tilestarts[t+1] - tilestarts[t] );
+      }
+   }
 
-            count++;    // <- increment count
+   if (pcomm.isCancelled()) {
+      tagState( false, true );         // <- the state field has been used for tagging visited nodes... set back to a state variable
+      // (well, actually, no it hasn't!)
+      // Should clear all nodes and attributes here:
+      // Clear nodes
+      for (int ii = 0; ii < m_cols; ii++) {
+         for (int jj = 0; jj < m_rows; jj++) {
+            if (m_points[ii][jj].m_node) {
+               delete m_points[ii][jj].m_node;
+               m_points[ii][jj].m_node = NULL;
+            }
+         }
+      }
+      // Clear attributes
+      m_attributes.clear();
+      m_displayed_attribute = -2;
+      //
+      throw Communicator::CancelledException();
+   }
 
-            if (comm) {
-               if (qtimer( atime, 500 )) {
-                  if (comm->IsCancelled()) {
-                     tagState( false, true );         // <- the state field has been used for tagging visited nodes... set back to a state variable
-                     // (well, actually, no it hasn't!)
-                     // Should clear all nodes and attributes here:
-                     // Clear nodes
-                     for (int ii = 0; ii < m_cols; ii++) {
-                        for (int jj = 0; jj < m_rows; jj++) {
-                           if (m_points[ii][jj].m_node) {
-                              delete m_points[ii][jj].m_node;
-                              m_points[ii][jj].m_node = NULL;
-                           }
-                        }
-                     }
-                     // Clear attributes
-                     m_attributes.clear();
-                     m_displayed_attribute = -2;
-                     //
-                     throw Communicator::CancelledException();
-                  }
-                  comm->CommPostMessage( Communicator::CURRENT_RECORD, count );
-               }         
-            } // if (comm)
-         } // if ( getPoint( curs ).getState() & Point::FILLED )
-      } // rows
-   } // cols
+   connectivity.commit();
+   first_moment.commit();
+   second_moment.commit();
 
    tagState( false, true );  // <- the state field has been used for tagging visited nodes... set back to a state variable
 
@@ -2324,6 +2684,9 @@ bool PointMap::sparkGraph2( Communicator *comm, bool boundarygraph, double maxdi
       m_boundarygraph = true;
    }
 
+   // and packed ready for analysis
+   getPackedGraph();
+
    // override and reset:
    m_displayed_attribute = -2;
    setDisplayedAttribute(connectivity_col);
@@ -2336,6 +2699,12 @@ bool PointMap::sparkGraph2( Communicator *comm, bool boundarygraph, double maxdi
 
 bool PointMap::dynamicSparkGraph2()
 {
+   pvector<PixelRef> bins_b[32];
+   float far_bin_dists[32];
+   AttributeColumnWriter connectivity( m_attributes, m_attributes.getColumnIndex("Connectivity") );
+   AttributeColumnWriter first_moment( m_attributes, m_attributes.getColumnIndex("Point First Moment") );
+   AttributeColumnWriter second_moment( m_attributes, m_attributes.getColumnIndex("Point Second Moment") );
+
    for (int i = 0; i < m_cols; i++) {
 
       for (int j = 0; j < m_rows; j++) {
@@ -2344,12 +2713,26 @@ bool PointMap::dynamicSparkGraph2()
    
          if ( getPoint( curs ).getState() & Point::FILLED ) {
 
-            sparkPixel2(curs,1); // make flag of 1 suggests make this node, don't set reciprocral process flags on those you can see
+            int neighbourhood_size;
+            double total_dist, total_dist_sqr;
+            // make flag of 1 suggests make this node, don't set reciprocral process flags on those you can see
+            sparkPixel2(curs,1,-1.0,bins_b,far_bin_dists,neighbourhood_size,total_dist,total_dist_sqr);
+            int row = m_attributes.getRowid( curs );
+            connectivity.setValue( row, float(neighbourhood_size) );
+            first_moment.setValue( row, float(total_dist) );
+            second_moment.setValue( row, float(total_dist_sqr) );
 
          }
       }
    }
 
+   // the nodes have been remade
+   clearPackedGraph();
+
+   connectivity.commit();
+   first_moment.commit();
+   second_moment.commit();
+
    // and add grid connections
    // (this is easier than trying to work it out per pixel as we calculate visibility)
    addGridConnections();
@@ -2363,15 +2746,39 @@ bool PointMap::dynamicSparkGraph2()
 
 bool PointMap::sparkPixel2(PixelRef curs, int make, double maxdist)
 {
-   static pvector<PixelRef> bins_b[32];
-   static float far_bin_dists[32];
+   pvector<PixelRef> bins_b[32];
+   float far_bin_dists[32];
+   int neighbourhood_size;
+   double total_dist, total_dist_sqr;
+
+   sparkPixel2(curs, make, maxdist, bins_b, far_bin_dists, neighbourhood_size, total_dist, total_dist_sqr);
+
+   if (make & 1) {
+      // the node has been remade
+      clearPackedGraph();
+      int row = m_attributes.getRowid( curs );
+      m_attributes.setValue( row, "Connectivity", float(neighbourhood_size) );
+      m_attributes.setValue( row, "Point First Moment", float(total_dist) );
+      m_attributes.setValue( row, "Point Second Moment", float(total_dist_sqr) );
+   }
+
+   return true;
+}
+
+// The spark itself: the caller owns the bins and far bin distances, and the point
+// statistics are handed back rather than written to the attribute table.
+// With make & 1 only, nothing is written except curs's own node and process flag,
+// so sparkGraph2 can run many of these at once
+
+bool PointMap::sparkPixel2(PixelRef curs, int make, double maxdist, pvector<PixelRef> *bins_b, float *far_bin_dists,
+                           int& neighbourhood_size, double& total_dist, double& total_dist_sqr)
+{
    for (int i = 0; i < 32; i++) {
       far_bin_dists[i] = 0.0f;
    }
-   int neighbourhood_size = 0;
-   int max_depth = 0;
-   double total_dist = 0.0;
-   double total_dist_sqr = 0.0;
+   neighbourhood_size = 0;
+   total_dist = 0.0;
+   total_dist_sqr = 0.0;
 
    Point2f centre0 = depixelate(curs);
 
@@ -2424,10 +2831,11 @@ bool PointMap::sparkPixel2(PixelRef curs, int make, double maxdist)
          break;
       }
       pqmap<int,Line> lines0;
-      for (size_t m = 0; m < getPoint(curs).m_lines.size(); m++)
+      const pqmap<int,Line>& lines = getPoint(curs).getLines();
+      for (size_t m = 0; m < lines.size(); m++)
       {
-         int key = getPoint(curs).m_lines.key(m);
-         Line l = getPoint(curs).m_lines.value(m);
+         int key = lines.key(m);
+         Line l = lines.value(m);
          if (l.crop(viewport0)) {
             lines0.add(key,l);
          }
@@ -2474,16 +2882,10 @@ bool PointMap::sparkPixel2(PixelRef curs, int make, double maxdist)
 
    }  // <- for (int q = 0; q < 8; q++)
 
-   Point2f point = depixelate(curs);
-
    if (make & 1) {
       // The bins are cleared in the make function!
       Point& pt = getPoint( curs );
       pt.m_node->make(curs, bins_b, far_bin_dists, pt.m_processflag);   // note: make clears bins!
-      int row = m_attributes.getRowid( curs );
-      m_attributes.setValue( row, "Connectivity", float(neighbourhood_size) );
-      m_attributes.setValue( row, "Point First Moment", float(total_dist) );
-      m_attributes.setValue( row, "Point Second Moment", float(total_dist_sqr) );
    }
    else {
       // Clear bins by hand if not using them to make
@@ -2539,13 +2941,13 @@ bool PointMap::sieve2(sparkSieve2& sieve, pvector<PixelRef>& addlist, int q, int
                // don't repeat axes / diagonals
                if ((ind != 0 || q == 0 || q == 1 || q == 5 || q == 6) && (ind != depth || q < 4)) {
                   // block test as usual [tested 31.10.04 -- MUST use 1e-10 for Gassin at 10 grid spacing]
-                  if (!sieve.testblock(depixelate(here), getPoint(here).m_lines, m_spacing * 1e-10))  
+                  if (!sieve.testblock(depixelate(here), getPoint(here).getLines(), m_spacing * 1e-10))  
                   {
                      addlist.push_back(here);
                   }
                }
             }
-            sieve.block( getPoint(here).m_lines, q );
+            sieve.block( getPoint(here).getLines(), q );
          }
       }
    }
@@ -2556,6 +2958,32 @@ bool PointMap::sieve2(sparkSieve2& sieve, pvector<PixelRef>& addlist, int q, int
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+const PackedGraph& PointMap::getPackedGraph()
+{
+   if (!m_packed_graph) {
+      m_packed_graph = new PackedGraph;
+      m_packed_graph->init(m_cols, m_rows);
+      for (int i = 0; i < m_cols; i++) {
+         for (int j = 0; j < m_rows; j++) {
+            if (m_points[i][j].m_node) {
+               m_packed_graph->addNode(PixelRef(i,j), *(m_points[i][j].m_node));
+            }
+         }
+      }
+   }
+   return *m_packed_graph;
+}
+
+void PointMap::clearPackedGraph()
+{
+   if (m_packed_graph) {
+      delete m_packed_graph;
+      m_packed_graph = NULL;
+   }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 bool PointMap::binDisplay(Communicator *comm)
 {
    int bindisplay_col = m_attributes.insertColumn("Node Bins");
@@ -2601,85 +3029,122 @@ bool PointMap::analyseIsovist(Communicator *comm, MetaGraph& mgraph, bool simple
 
    comm->CommPostMessage( Communicator::CURRENT_STEP, 2 );
 
-   // Quick mod - TV
-#if defined(_WIN32)   
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif   
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, m_point_count );
-   }
-   int count = 0;
-
+   // the points to analyse, in the order their results go into the table
+   // (with their attribute rows, as the table's searches are not thread safe)
+   pvector<PixelRef> sources;
+   pvecint rows;
    for (int i = 0; i < m_cols; i++) {
       for (int j = 0; j < m_rows; j++) {
          PixelRef curs = PixelRef( i, j );
          if (getPoint( curs ).filled()) {
-            count++;
             if (getPoint( curs ).contextfilled() && !curs.iseven()) {
                continue;
             }
-            Isovist isovist;
-            mgraph.makeIsovist(depixelate(curs),isovist);
-            int row = m_attributes.getRowid(curs);
-
-            isovist.setData(m_attributes,row, simple_version);
-            Node& node = getPoint(curs).getNode();
-            pvector<PixelRef> *occ = node.m_occlusion_bins;
-            size_t k;
-            for (k = 0; k < 32; k++) {
-               occ[k].clear();
-               node.bin(k).setOccDistance(0.0f);
-            }
-            for (k = 0; k < isovist.getOcclusionPoints().size(); k++) {
-               const PointDist& pointdist = isovist.getOcclusionPoints().at(k);
-               int bin = whichbin(pointdist.m_point-depixelate(curs));
-               // only occlusion bins with a certain distance recorded (arbitrary scale note!)
-               if (pointdist.m_dist > 1.5) {
-                  PixelRef pix = pixelate(pointdist.m_point);
-                  if (pix != curs) {
-                     occ[bin].push_back(pix);
-                  }
-               }
-               node.bin(bin).setOccDistance(pointdist.m_dist);
-            }
+            sources.push_back(curs);
+            rows.push_back(m_attributes.getRowid(curs));
          }
-         if (comm) {
-            if (qtimer( atime, 500 )) {
-               if (comm->IsCancelled()) {
-                  throw Communicator::CancelledException();
+      }
+   }
+   int source_count = int(sources.size());
+
+   ParallelComm pcomm( comm, source_count );
+
+   pvector<IsovistData> data;
+   data.set( IsovistData(), source_count );
+
+   // The BSP tree is only read from here on, so each thread reuses its own isovist
+   // over its share of the points.  Every point has its own node, so the occlusion
+   // bins are filled in place; the table measures wait until all the points are done
+   #pragma omp parallel
+   {
+      Isovist isovist;
+
+      #pragma omp for schedule(dynamic)
+      for (int s = 0; s < source_count; s++) {
+
+         if (pcomm.isCancelled()) {
+            continue;
+         }
+
+         PixelRef curs = sources[s];
+         mgraph.makeIsovist(depixelate(curs),isovist);
+         isovist.getData(data[s]);
+
+         Node& node = getPoint(curs).getNode();
+         pvector<PixelRef> *occ = node.m_occlusion_bins;
+         size_t k;
+         for (k = 0; k < 32; k++) {
+            occ[k].clear();
+            node.bin(k).setOccDistance(0.0f);
+         }
+         for (k = 0; k < isovist.getOcclusionPoints().size(); k++) {
+            const PointDist& pointdist = isovist.getOcclusionPoints().at(k);
+            int bin = whichbin(pointdist.m_point-depixelate(curs));
+            // only occlusion bins with a certain distance recorded (arbitrary scale note!)
+            if (pointdist.m_dist > 1.5) {
+               PixelRef pix = pixelate(pointdist.m_point);
+               if (pix != curs) {
+                  occ[bin].push_back(pix);
                }
-               comm->CommPostMessage( Communicator::CURRENT_RECORD, count );
-            }         
+            }
+            node.bin(bin).setOccDistance(pointdist.m_dist);
          }
+
+         pcomm.record();
       }
    }
 
+   pcomm.throwIfCancelled();
+
+   Isovist::setData(m_attributes, rows, data, simple_version);
+
    return true;
 }
 
 // Graph analysis tools
 
-bool PointMap::analyseVisual(Communicator *comm, Options& options, bool simple_version)
+// entropy and relativised entropy of the depth distribution from a point
+// n.b., the distribution contains the root node itself in distribution[0]
+// -> chopped from entropy to avoid divide by zero if only one node
+
+static void visualEntropy(const pvecint& distribution, int total_depth, int total_nodes, double& entropy, double& rel_entropy)
 {
-   // Quick mod - TV
-#if defined(_WIN32)   
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif   
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, m_point_count );
+   double mean_depth = double(total_depth) / double(total_nodes - 1);
+   double factorial = 1.0;
+   entropy = 0.0;
+   rel_entropy = 0.0;
+   for (size_t k = 1; k < distribution.size(); k++) {
+      if (distribution[k] > 0) {
+         double prob = double(distribution[k]) / double(total_nodes - 1);
+         entropy -= prob * log2(prob);
+         // Formula from Turner 2001, "Depthmap"
+         factorial *= double(k + 1);
+         double q = (pow( mean_depth, double(k) ) / double(factorial)) * exp(-mean_depth);
+         rel_entropy += (float) prob * log2( prob / q );
+      }
    }
+}
 
+// index of the lowest set bit (bits must not be 0)
+
+static inline int lowestBit(uint64 bits)
+{
+#if defined(_MSC_VER)
+   unsigned long index;
+   _BitScanForward64(&index, bits);
+   return int(index);
+#else
+   return __builtin_ctzll(bits);
+#endif
+}
+
+bool PointMap::analyseVisual(Communicator *comm, Options& options, bool simple_version)
+{
    // dX simple version test // TV
 //#define _COMPILE_dX_SIMPLE_VERSION
 
 #ifndef _COMPILE_dX_SIMPLE_VERSION
-   int cluster_col, control_col, controllability_col;
+   int cluster_col = -1, control_col = -1, controllability_col = -1;
    if(!simple_version) {
        if (options.local) {
            cluster_col = m_attributes.insertColumn("Visual Clustering Coefficient");
@@ -2689,7 +3154,8 @@ bool PointMap::analyseVisual(Communicator *comm, Options& options, bool simple_v
    }
 #endif
 
-   int entropy_col, rel_entropy_col, integ_dv_col, integ_pv_col, integ_tk_col, depth_col, count_col;
+   // (columns not made are left at -1, which the writers below ignore)
+   int entropy_col = -1, rel_entropy_col = -1, integ_dv_col = -1, integ_pv_col = -1, integ_tk_col = -1, depth_col = -1, count_col = -1;
    if (options.global) {
       pstring radius_text;
       if (options.radius != -1) {
@@ -2724,191 +3190,354 @@ bool PointMap::analyseVisual(Communicator *comm, Options& options, bool simple_v
 #endif
    }
 
-   int count = 0;
-
+   // the points to analyse, in the order their results go into the table
+   pvector<PixelRef> sources;
    for (int i = 0; i < m_cols; i++) {
-
       for (int j = 0; j < m_rows; j++) {
-
          PixelRef curs = PixelRef( i, j );
-
          if ( getPoint( curs ).filled()) {
-
             if ((getPoint( curs ).contextfilled() && !curs.iseven()) ||
                 (options.gates_only && getPoint(curs).getDataObject(DataLayers::GATES) == -1)) {
-               count++;
                continue;
             }
+            sources.push_back(curs);
+         }
+      }
+   }
+   int source_count = int(sources.size());
 
-            if (options.global) {
+   ParallelComm pcomm( comm, source_count * ((options.global ? 1 : 0) + (options.local ? 1 : 0)) );
+
+   if (options.global) {
+
+      // Every point is the root of its own search, so the searches are shared out
+      // between the threads.  Each thread has its own seen register (in place of the
+      // points' m_misc and m_extent) and depth distribution, and the results are
+      // held per point until all the searches are done
+      pvecint total_depths;
+      pvecint total_nodes_counts;
+      pvecdouble entropies;
+      pvecdouble rel_entropies;
+      total_depths.set( 0, source_count );
+      total_nodes_counts.set( 0, source_count );
+      entropies.set( 0.0, source_count );
+      rel_entropies.set( 0.0, source_count );
+
+      const PackedGraph& graph = getPackedGraph();
+
+      if (m_merge_lines.size() == 0) {
+
+         // Without merged points, the searches from up to 256 points are run together:
+         // each node has a bit per root for the searches that have seen it, and for the
+         // ones that have just reached it, so a node is expanded once per level for the
+         // whole batch.  The depths come out the same as from a search per point
+         const int words = 4;
+         const int batch_size = words * 64;
+         int node_count = graph.nodeCount();
+         int batch_count = (source_count + batch_size - 1) / batch_size;
+
+         #pragma omp parallel
+         {
+            uint64 *seen = new uint64 [node_count * words];
+            uint64 *visit = new uint64 [node_count * words];
+            uint64 *next = new uint64 [node_count * words];
+            for (int i = 0; i < node_count * words; i++) {
+               seen[i] = visit[i] = next[i] = 0;
+            }
+            pvecint frontier;
+            pvecint touched;
+            pvecint reached;
+            pvecint *distributions = new pvecint [batch_size];
+
+            #pragma omp for schedule(dynamic)
+            for (int batch = 0; batch < batch_count; batch++) {
+
+               if (pcomm.isCancelled()) {
+                  continue;
+               }
+
+               int first = batch * batch_size;
+               int roots = __min(batch_size, source_count - first);
+
+               frontier.clear();
+               reached.clear();
+               for (int r = 0; r < roots; r++) {
+                  int node = graph.nodeRef(sources[first + r]);
+                  uint64 bit = uint64(1) << (r % 64);
+                  seen[node * words + r / 64] = bit;
+                  visit[node * words + r / 64] = bit;
+                  frontier.push_back(node);
+                  reached.push_back(node);
+                  distributions[r].clear();
+               }
 
-               for (int ii = 0; ii < m_cols; ii++) {
-                  for (int jj = 0; jj < m_rows; jj++) {
-                     m_points[ii][jj].m_misc = 0;
-                     m_points[ii][jj].m_extent = PixelRef(ii,jj);
+               int level = 0;
+               while (frontier.size()) {
+                  for (int r = 0; r < roots; r++) {
+                     distributions[r].push_back(0);
+                  }
+                  touched.clear();
+                  for (size_t n = 0; n < frontier.size(); n++) {
+                     int node = frontier[n];
+                     uint64 *bits = visit + node * words;
+                     PixelRef here = graph.nodePixel(node);
+                     Point& p = getPoint(here);
+                     if (p.filled()) {
+                        for (int w = 0; w < words; w++) {
+                           for (uint64 x = bits[w]; x; x &= x - 1) {
+                              int r = w * 64 + lowestBit(x);
+                              total_depths[first + r] += level;
+                              total_nodes_counts[first + r] += 1;
+                              distributions[r].tail() += 1;
+                           }
+                        }
+                        if ((int) options.radius == -1 || (level < (int) options.radius &&
+                            (!p.contextfilled() || here.iseven()))) {
+                           graph.spreadBits(node, bits, words, next, touched);
+                        }
+                     }
+                     for (int w = 0; w < words; w++) {
+                        bits[w] = 0;
+                     }
+                  }
+                  frontier.clear();
+                  for (size_t n = 0; n < touched.size(); n++) {
+                     int node = touched[n];
+                     uint64 any = 0;
+                     for (int i = node * words; i < node * words + words; i++) {
+                        uint64 bits = next[i] & ~seen[i];
+                        seen[i] |= bits;
+                        visit[i] = bits;
+                        next[i] = 0;
+                        any |= bits;
+                     }
+                     if (any) {
+                        frontier.push_back(node);
+                        reached.push_back(node);
+                     }
+                  }
+                  level++;
+               }
+
+               for (size_t n = 0; n < reached.size(); n++) {
+                  for (int w = 0; w < words; w++) {
+                     seen[reached[n] * words + w] = 0;
+                  }
+               }
+
+               for (int r = 0; r < roots; r++) {
+                  if (total_nodes_counts[first + r] > 1) {
+                     visualEntropy(distributions[r], total_depths[first + r], total_nodes_counts[first + r], entropies[first + r], rel_entropies[first + r]);
                   }
                }
 
+               pcomm.record(roots);
+            }
+
+            delete [] distributions;
+            delete [] next;
+            delete [] visit;
+            delete [] seen;
+         }
+      }
+      else {
+
+         #pragma omp parallel
+         {
+            SearchMarks marks;
+            marks.init( m_cols, m_rows );
+            pvecint distribution;
+            prefvec<PixelRefList> search_tree;
+
+            #pragma omp for schedule(dynamic)
+            for (int s = 0; s < source_count; s++) {
+
+               if (pcomm.isCancelled()) {
+                  continue;
+               }
+
+               marks.reset();
+               distribution.clear();
+               search_tree.clear();
+
                int total_depth = 0;
                int total_nodes = 0;
 
-               pvecint distribution;
-               prefvec<PixelRefList> search_tree;
                search_tree.push_back(PixelRefList());
-               search_tree.tail().push_back(curs);
+               search_tree.tail().push_back(sources[s]);
 
                int level = 0;
                while (search_tree[level].size()) {
                   search_tree.push_back(PixelRefList());
                   distribution.push_back(0);
                   for (size_t n = search_tree[level].size() - 1; n != paftl::npos; n--) {
-                     Point& p = getPoint(search_tree[level][n]);
-                     if (p.filled() && p.m_misc != ~0) {
+                     PixelRef here = search_tree[level][n];
+                     Point& p = getPoint(here);
+                     int& misc = marks.misc(here);
+                     if (p.filled() && misc != ~0) {
                         total_depth += level;
                         total_nodes += 1;
                         distribution.tail() += 1;
-                        if ((int) options.radius == -1 || level < (int) options.radius &&
-                            (!p.contextfilled() || search_tree[level][n].iseven())) {
-                           p.m_node->extractUnseen(search_tree[level+1],this,p.m_misc);
-                           p.m_misc = ~0;
+                        if ((int) options.radius == -1 || (level < (int) options.radius &&
+                            (!p.contextfilled() || here.iseven()))) {
+                           graph.extractUnseen(here,search_tree[level+1],marks);
+                           misc = ~0;
                            if (!p.m_merge.empty()) {
-                              Point& p2 = getPoint(p.m_merge);
-                              if (p2.m_misc != ~0) {
-                                 p2.m_node->extractUnseen(search_tree[level+1],this,p2.m_misc); // did say p.misc
-                                 p2.m_misc = ~0;
+                              int& misc2 = marks.misc(p.m_merge);
+                              if (misc2 != ~0) {
+                                 graph.extractUnseen(p.m_merge,search_tree[level+1],marks);
+                                 misc2 = ~0;
                               }
                            }
                         }
                         else {
-                           p.m_misc = ~0;
+                           misc = ~0;
                         }
                      }
                      search_tree[level].pop_back();
                   }
                   level++;
                }
-               int row = m_attributes.getRowid(curs);
-               // only set to single float precision after divide
-               // note -- total_nodes includes this one -- mean depth as per p.108 Social Logic of Space
+
+               total_depths[s] = total_depth;
+               total_nodes_counts[s] = total_nodes;
+
+               if (total_nodes > 1) {
+                  visualEntropy(distribution, total_depth, total_nodes, entropies[s], rel_entropies[s]);
+               }
+
+               pcomm.record();
+            }
+         }
+      }
+
+      pcomm.throwIfCancelled();
+
+      // the results are written a column at a time
+      AttributeColumnWriter count_writer( m_attributes, count_col );
+      AttributeColumnWriter depth_writer( m_attributes, depth_col );
+      AttributeColumnWriter integ_dv_writer( m_attributes, integ_dv_col );
+      AttributeColumnWriter integ_pv_writer( m_attributes, integ_pv_col );
+      AttributeColumnWriter integ_tk_writer( m_attributes, integ_tk_col );
+      AttributeColumnWriter entropy_writer( m_attributes, entropy_col );
+      AttributeColumnWriter rel_entropy_writer( m_attributes, rel_entropy_col );
+
+      for (int s = 0; s < source_count; s++) {
+         int total_depth = total_depths[s];
+         int total_nodes = total_nodes_counts[s];
+         int row = m_attributes.getRowid(sources[s]);
+         // only set to single float precision after divide
+         // note -- total_nodes includes this one -- mean depth as per p.108 Social Logic of Space
+         if(!simple_version) {
+              count_writer.setValue(row, float(total_nodes) ); // note: total nodes includes this one
+         }
+         // ERROR !!!!!!
+         if (total_nodes > 1) {
+            double mean_depth = double(total_depth) / double(total_nodes - 1);
+            if(!simple_version) {
+                  depth_writer.setValue(row, float(mean_depth) );
+            }
+            // total nodes > 2 to avoid divide by 0 (was > 3)
+            if (total_nodes > 2 && mean_depth > 1.0) {
+               double ra = 2.0 * (mean_depth - 1.0) / double(total_nodes - 2);
+               // d-value / p-values from Depthmap 4 manual, note: node_count includes this one
+               double rra_d = ra / dvalue(total_nodes);
+               double rra_p = ra / pvalue(total_nodes);
+               double integ_tk = teklinteg(total_nodes, total_depth);
+               integ_dv_writer.setValue(row, float(1.0/rra_d));
                if(!simple_version) {
-                    m_attributes.setValue(row, count_col, float(total_nodes) ); // note: total nodes includes this one
+                    integ_pv_writer.setValue(row, float(1.0/rra_p));
                }
-               // ERROR !!!!!!
-               if (total_nodes > 1) {
-                  double mean_depth = double(total_depth) / double(total_nodes - 1);
+               if (total_depth - total_nodes + 1 > 1) {
                   if(!simple_version) {
-                        m_attributes.setValue(row, depth_col, float(mean_depth) );
-                  }
-                  // total nodes > 2 to avoid divide by 0 (was > 3)
-                  if (total_nodes > 2 && mean_depth > 1.0) {
-                     double ra = 2.0 * (mean_depth - 1.0) / double(total_nodes - 2);
-                     // d-value / p-values from Depthmap 4 manual, note: node_count includes this one
-                     double rra_d = ra / dvalue(total_nodes);
-                     double rra_p = ra / pvalue(total_nodes);
-                     double integ_tk = teklinteg(total_nodes, total_depth);
-                     m_attributes.setValue(row,integ_dv_col,float(1.0/rra_d));
-                     if(!simple_version) {
-                          m_attributes.setValue(row,integ_pv_col,float(1.0/rra_p));
-                     }
-                     if (total_depth - total_nodes + 1 > 1) {
-                        if(!simple_version) {
-                            m_attributes.setValue(row,integ_tk_col,float(integ_tk));
-                        }
-                     }
-                     else {
-                        if(!simple_version) {
-                            m_attributes.setValue(row,integ_tk_col,-1.0f);
-                        }
-                     }
-                  }
-                  else {
-                     m_attributes.setValue(row,integ_dv_col,(float)-1);
-                     if(!simple_version) {
-                        m_attributes.setValue(row,integ_pv_col,(float)-1);
-                        m_attributes.setValue(row,integ_tk_col,(float)-1);
-                     }
-                  }
-                  double entropy = 0.0, rel_entropy = 0.0, factorial = 1.0;
-                  // n.b., this distribution contains the root node itself in distribution[0]
-                  // -> chopped from entropy to avoid divide by zero if only one node
-                  for (size_t k = 1; k < distribution.size(); k++) {
-                     if (distribution[k] > 0) {
-                        double prob = double(distribution[k]) / double(total_nodes - 1);
-                        entropy -= prob * log2(prob);
-                        // Formula from Turner 2001, "Depthmap"
-                        factorial *= double(k + 1);
-                        double q = (pow( mean_depth, double(k) ) / double(factorial)) * exp(-mean_depth);
-                        rel_entropy += (float) prob * log2( prob / q );
-                     }
-                  }
-                  if(!simple_version) {
-                    m_attributes.setValue(row, entropy_col, float(entropy) );
-                    m_attributes.setValue(row, rel_entropy_col, float(rel_entropy) );
+                      integ_tk_writer.setValue(row, float(integ_tk));
                   }
                }
                else {
                   if(!simple_version) {
-                    m_attributes.setValue(row, depth_col,(float)-1);
-                    m_attributes.setValue(row, entropy_col,(float)-1);
-                    m_attributes.setValue(row, rel_entropy_col,(float)-1);
+                      integ_tk_writer.setValue(row, -1.0f);
                   }
                }
             }
-            if (options.local) {
+            else {
+               integ_dv_writer.setValue(row, (float)-1);
+               if(!simple_version) {
+                  integ_pv_writer.setValue(row, (float)-1);
+                  integ_tk_writer.setValue(row, (float)-1);
+               }
+            }
+            if(!simple_version) {
+              entropy_writer.setValue(row, float(entropies[s]) );
+              rel_entropy_writer.setValue(row, float(rel_entropies[s]) );
+            }
+         }
+         else {
+            if(!simple_version) {
+              depth_writer.setValue(row, (float)-1);
+              entropy_writer.setValue(row, (float)-1);
+              rel_entropy_writer.setValue(row, (float)-1);
+            }
+         }
+      }
+
+      count_writer.commit();
+      depth_writer.commit();
+      integ_dv_writer.commit();
+      integ_pv_writer.commit();
+      integ_tk_writer.commit();
+      entropy_writer.commit();
+      rel_entropy_writer.commit();
+   }
 
-               int row = m_attributes.getRowid(curs);
+   if (options.local) {
 
-               // This is much easier to do with a straight forward list:
-               PixelRefList neighbourhood;
-               PixelRefList totalneighbourhood;
-               getPoint(curs).m_node->contents(neighbourhood);
+      for (int s = 0; s < source_count; s++) {
 
-               int cluster = 0;
-               float control = 0.0f;
+         PixelRef curs = sources[s];
+         int row = m_attributes.getRowid(curs);
 
-               for (size_t i = 0; i < neighbourhood.size(); i++) {
-                  int intersect_size = 0, retro_size = 0;
-                  Point& retpt = getPoint(neighbourhood[i]);
-                  if (retpt.filled() && retpt.m_node) {
-                     retpt.m_node->first();
-                     while (!retpt.m_node->is_tail()) {
-                        retro_size++;
-                        if (neighbourhood.searchindex(retpt.m_node->cursor()) != paftl::npos) {
-                           intersect_size++;
-                        }
-                        totalneighbourhood.add(retpt.m_node->cursor()); // <- note add does nothing if member already exists
-                        retpt.m_node->next();
-                     }
-                     control += 1.0f / float(retro_size);
-                     cluster += intersect_size;
+         // This is much easier to do with a straight forward list:
+         PixelRefList neighbourhood;
+         PixelRefList totalneighbourhood;
+         getPoint(curs).m_node->contents(neighbourhood);
+
+         int cluster = 0;
+         float control = 0.0f;
+
+         for (size_t i = 0; i < neighbourhood.size(); i++) {
+            int intersect_size = 0, retro_size = 0;
+            Point& retpt = getPoint(neighbourhood[i]);
+            if (retpt.filled() && retpt.m_node) {
+               retpt.m_node->first();
+               while (!retpt.m_node->is_tail()) {
+                  retro_size++;
+                  if (neighbourhood.searchindex(retpt.m_node->cursor()) != paftl::npos) {
+                     intersect_size++;
                   }
+                  totalneighbourhood.add(retpt.m_node->cursor()); // <- note add does nothing if member already exists
+                  retpt.m_node->next();
                }
-#ifndef _COMPILE_dX_SIMPLE_VERSION
-               if(!simple_version) {
-                   if (neighbourhood.size() > 1) {
-                       m_attributes.setValue(row, cluster_col, float(cluster / double(neighbourhood.size() * (neighbourhood.size() - 1.0))) );
-                       m_attributes.setValue(row, control_col, float(control) );
-                       m_attributes.setValue(row, controllability_col, float( double(neighbourhood.size()) / double(totalneighbourhood.size())) );
-                   }
-                   else {
-                       m_attributes.setValue(row, cluster_col, -1 );
-                       m_attributes.setValue(row, control_col, -1 );
-                       m_attributes.setValue(row, controllability_col, -1 );
-                   }
-               }
-#endif
+               control += 1.0f / float(retro_size);
+               cluster += intersect_size;
             }
-
-            count++;    // <- increment count
          }
-         if (comm) {
-            if (qtimer( atime, 500 )) {
-               if (comm->IsCancelled()) {
-                  throw Communicator::CancelledException();
-               }
-               comm->CommPostMessage( Communicator::CURRENT_RECORD, count );
-            }         
+#ifndef _COMPILE_dX_SIMPLE_VERSION
+         if(!simple_version) {
+             if (neighbourhood.size() > 1) {
+                 m_attributes.setValue(row, cluster_col, float(cluster / double(neighbourhood.size() * (neighbourhood.size() - 1.0))) );
+                 m_attributes.setValue(row, control_col, float(control) );
+                 m_attributes.setValue(row, controllability_col, float( double(neighbourhood.size()) / double(totalneighbourhood.size())) );
+             }
+             else {
+                 m_attributes.setValue(row, cluster_col, -1 );
+                 m_attributes.setValue(row, control_col, -1 );
+                 m_attributes.setValue(row, controllability_col, -1 );
+             }
          }
+#endif
+
+         pcomm.record();
+         pcomm.throwIfCancelled();
       }
    }
 
@@ -2984,17 +3613,6 @@ bool PointMap::analyseVisualPointDepth(Communicator *comm)
 
 bool PointMap::analyseMetric(Communicator *comm, Options& options)
 {
-   // Quick mod - TV
-#if defined(_WIN32)   
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif   
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, m_point_count );
-   }
-
    pstring radius_text;
    if (options.radius != -1.0) {
       if (options.radius > 100.0) {
@@ -3017,85 +3635,114 @@ bool PointMap::analyseMetric(Communicator *comm, Options& options)
    pstring count_col_text = pstring("Metric Node Count") + radius_text;
    int count_col = m_attributes.insertColumn(count_col_text.c_str());
 
-   int count = 0;
-
+   // the points to analyse, in the order their results go into the table
+   pvector<PixelRef> sources;
    for (int i = 0; i < m_cols; i++) {
-
       for (int j = 0; j < m_rows; j++) {
-
          PixelRef curs = PixelRef( i, j );
-
          if ( getPoint( curs ).filled() ) {
-
             if ( options.gates_only && getPoint(curs).getDataObject(DataLayers::GATES) == -1) {
-               count++;
                continue;
             }
+            sources.push_back(curs);
+         }
+      }
+   }
+   int source_count = int(sources.size());
 
-            for (int ii = 0; ii < m_cols; ii++) {
-               for (int jj = 0; jj < m_rows; jj++) {
-                  m_points[ii][jj].m_misc = 0;
-                  m_points[ii][jj].m_dist = -1.0f;
-                  m_points[ii][jj].m_cumangle = 0.0f;
-               }
-            }
+   // the attribute rows are looked up here, as the table's searches are not thread safe
+   pvecint rows;
+   for (int s = 0; s < source_count; s++) {
+      rows.push_back(m_attributes.getRowid(sources[s]));
+   }
 
-            float euclid_depth = 0.0f;
-            float total_depth = 0.0f;
-            float total_angle = 0.0f;
-            int total_nodes = 0;
+   ParallelComm pcomm( comm, source_count );
 
-            // note that m_misc is used in a different manner to analyseGraph / PointDepth
-            // here it marks the node as used in calculation only
+   // each point has its own row, so the threads write their results straight in
+   AttributeColumnWriter mspa_writer( m_attributes, mspa_col );
+   AttributeColumnWriter mspl_writer( m_attributes, mspl_col );
+   AttributeColumnWriter dist_writer( m_attributes, dist_col );
+   AttributeColumnWriter count_writer( m_attributes, count_col );
 
-            pqvector<MetricTriple> search_list;
-            search_list.add(MetricTriple(0.0f,curs,NoPixel));
-            int level = 0;
-            while (search_list.size()) {
-               MetricTriple here = search_list[0];
-               search_list.remove_at(0);
-               if (options.radius != -1.0 && (here.dist * m_spacing) > options.radius) {
-                  break;
-               }
-               Point& p = getPoint(here.pixel);
-               // nb, the filled check is necessary as diagonals seem to be stored with 'gaps' left in
-               if (p.filled() && p.m_misc != ~0) {
-                  p.m_node->extractMetric(search_list,this,here);
-                  p.m_misc = ~0;
-                  if (!p.m_merge.empty()) {
-                     Point& p2 = getPoint(p.m_merge);
-                     if (p2.m_misc != ~0) {
-                        p2.m_cumangle = p.m_cumangle;
-                        p2.m_node->extractMetric(search_list,this,MetricTriple(here.dist,p.m_merge,NoPixel));
-                        p2.m_misc = ~0;
-                     }
-                  }
-                  total_depth += float(here.dist * m_spacing);
-                  total_angle += p.m_cumangle;
-                  euclid_depth += float(m_spacing * dist(here.pixel,curs));
-                  total_nodes += 1;
-               }
-            }
+   const PackedGraph& graph = getPackedGraph();
 
-            int row = m_attributes.getRowid(curs);
-            m_attributes.setValue(row, mspa_col, float(double(total_angle) / double(total_nodes)) );
-            m_attributes.setValue(row, mspl_col, float(double(total_depth) / double(total_nodes)) );
-            m_attributes.setValue(row, dist_col, float(double(euclid_depth) / double(total_nodes)) );
-            m_attributes.setValue(row, count_col, float(total_nodes) );
+   // The searches from each point are shared out between the threads, each with
+   // its own search state (in place of the points' m_misc, m_dist and m_cumangle)
+   // and its own binary heap.  The heap pops in the order the pqvector did, so the
+   // totals are summed in the same order as ever
 
-            count++;    // <- increment count
+   #pragma omp parallel
+   {
+      SearchMarks marks;
+      marks.init( m_cols, m_rows );
+      pvector<MetricTriple> heap;
+
+      #pragma omp for schedule(dynamic)
+      for (int s = 0; s < source_count; s++) {
+
+         if (pcomm.isCancelled()) {
+            continue;
          }
-         if (comm) {
-            if (qtimer( atime, 500 )) {
-               if (comm->IsCancelled()) {
-                  throw Communicator::CancelledException();
+
+         PixelRef curs = sources[s];
+
+         marks.reset();
+         heap.clear();
+
+         float euclid_depth = 0.0f;
+         float total_depth = 0.0f;
+         float total_angle = 0.0f;
+         int total_nodes = 0;
+
+         // note that m_misc is used in a different manner to analyseGraph / PointDepth
+         // here it marks the node as used in calculation only
+
+         heap.push_back(MetricTriple(0.0f,curs,NoPixel));
+         while (heap.size()) {
+            std::pop_heap(&heap[0], &heap[0] + heap.size(), std::greater<MetricTriple>());
+            MetricTriple here = heap.tail();
+            heap.pop_back();
+            if (options.radius != -1.0 && (here.dist * m_spacing) > options.radius) {
+               break;
+            }
+            Point& p = getPoint(here.pixel);
+            // nb, the filled check is necessary as diagonals seem to be stored with 'gaps' left in
+            int& misc = marks.misc(here.pixel);
+            if (p.filled() && misc != ~0) {
+               graph.extractMetric(heap,this,here,marks);
+               misc = ~0;
+               if (!p.m_merge.empty()) {
+                  int& misc2 = marks.misc(p.m_merge);
+                  if (misc2 != ~0) {
+                     marks.cumangle(p.m_merge) = marks.cumangle(here.pixel);
+                     graph.extractMetric(heap,this,MetricTriple(here.dist,p.m_merge,NoPixel),marks);
+                     misc2 = ~0;
+                  }
                }
-               comm->CommPostMessage( Communicator::CURRENT_RECORD, count );
-            }         
+               total_depth += float(here.dist * m_spacing);
+               total_angle += marks.cumangle(here.pixel);
+               euclid_depth += float(m_spacing * dist(here.pixel,curs));
+               total_nodes += 1;
+            }
          }
+
+         int row = rows[s];
+         mspa_writer.setValue(row, float(double(total_angle) / double(total_nodes)) );
+         mspl_writer.setValue(row, float(double(total_depth) / double(total_nodes)) );
+         dist_writer.setValue(row, float(double(euclid_depth) / double(total_nodes)) );
+         count_writer.setValue(row, float(total_nodes) );
+
+         pcomm.record();
       }
    }
 
+   pcomm.throwIfCancelled();
+
+   mspa_writer.commit();
+   mspl_writer.commit();
+   dist_writer.commit();
+   count_writer.commit();
+
    m_displayed_attribute = -2;
    setDisplayedAttribute(mspl_col);
 
@@ -3177,17 +3824,6 @@ bool PointMap::analyseMetricPointDepth(Communicator *comm)
 
 bool PointMap::analyseAngular(Communicator *comm, Options& options)
 {
-   // Quick mod - TV
-#if defined(_WIN32)   
-   __time64_t atime = 0;
-#else
-   time_t atime = 0;
-#endif   
-   if (comm) {
-      qtimer( atime, 0 );
-      comm->CommPostMessage( Communicator::NUM_RECORDS, m_point_count );
-   }
-
    pstring radius_text;
    if (options.radius != -1.0) {
       if (m_region.width() > 100.0) {
@@ -3208,83 +3844,107 @@ bool PointMap::analyseAngular(Communicator *comm, Options& options)
    pstring count_col_text = pstring("Angular Node Count") + radius_text;
    int count_col = m_attributes.insertColumn(count_col_text.c_str());
 
-   int count = 0;
-
+   // the points to analyse, in the order their results go into the table
+   pvector<PixelRef> sources;
    for (int i = 0; i < m_cols; i++) {
-
       for (int j = 0; j < m_rows; j++) {
-
          PixelRef curs = PixelRef( i, j );
-
          if ( getPoint( curs ).filled() ) {
-
             if ( options.gates_only && getPoint(curs).getDataObject(DataLayers::GATES) == -1) {
-               count++;
                continue;
             }
+            sources.push_back(curs);
+         }
+      }
+   }
+   int source_count = int(sources.size());
 
-            for (int ii = 0; ii < m_cols; ii++) {
-               for (int jj = 0; jj < m_rows; jj++) {
-                  m_points[ii][jj].m_misc = 0;
-                  m_points[ii][jj].m_dist = 0.0f;
-                  m_points[ii][jj].m_cumangle = -1.0f;
-               }
-            }
+   // the attribute rows are looked up here, as the table's searches are not thread safe
+   pvecint rows;
+   for (int s = 0; s < source_count; s++) {
+      rows.push_back(m_attributes.getRowid(sources[s]));
+   }
 
-            float total_angle = 0.0f;
-            int total_nodes = 0;
+   ParallelComm pcomm( comm, source_count );
 
-            // note that m_misc is used in a different manner to analyseGraph / PointDepth
-            // here it marks the node as used in calculation only
+   AttributeColumnWriter mean_depth_writer( m_attributes, mean_depth_col );
+   AttributeColumnWriter total_depth_writer( m_attributes, total_depth_col );
+   AttributeColumnWriter count_writer( m_attributes, count_col );
 
-            pqvector<AngularTriple> search_list;
-            search_list.add(AngularTriple(0.0f,curs,NoPixel));
-            getPoint(curs).m_cumangle = 0.0f;
-            int level = 0;
-            while (search_list.size()) {
-               AngularTriple here = search_list[0];
-               search_list.remove_at(0);
-               if (options.radius != -1.0 && here.angle > options.radius) {
-                  break;
-               }
-               Point& p = getPoint(here.pixel);
-               // nb, the filled check is necessary as diagonals seem to be stored with 'gaps' left in
-               if (p.filled() && p.m_misc != ~0) {
-                  p.m_node->extractAngular(search_list,this,here);
-                  p.m_misc = ~0;
-                  if (!p.m_merge.empty()) {
-                     Point& p2 = getPoint(p.m_merge);
-                     if (p2.m_misc != ~0) {
-                        p2.m_cumangle = p.m_cumangle;
-                        p2.m_node->extractAngular(search_list,this,AngularTriple(here.angle,p.m_merge,NoPixel));
-                        p2.m_misc = ~0;
-                     }
-                  }
-                  total_angle += p.m_cumangle;
-                  total_nodes += 1;
-               }
-            }
+   const PackedGraph& graph = getPackedGraph();
 
-            int row = m_attributes.getRowid(curs);
-            if (total_nodes > 0) {
-               m_attributes.setValue(row, mean_depth_col, float(double(total_angle) / double(total_nodes)) );
-            }
-            m_attributes.setValue(row, total_depth_col, total_angle );
-            m_attributes.setValue(row, count_col, float(total_nodes) );
+   // As analyseMetric: each thread has its own search state (in place of the points'
+   // m_misc and m_cumangle) and binary heap, and writes its results straight into the table
 
-            count++;    // <- increment count
+   #pragma omp parallel
+   {
+      SearchMarks marks;
+      marks.init( m_cols, m_rows );
+      pvector<AngularTriple> heap;
+
+      #pragma omp for schedule(dynamic)
+      for (int s = 0; s < source_count; s++) {
+
+         if (pcomm.isCancelled()) {
+            continue;
          }
-         if (comm) {
-            if (qtimer( atime, 500 )) {
-               if (comm->IsCancelled()) {
-                  throw Communicator::CancelledException();
+
+         PixelRef curs = sources[s];
+
+         marks.reset(-1.0f);
+         heap.clear();
+
+         float total_angle = 0.0f;
+         int total_nodes = 0;
+
+         // note that m_misc is used in a different manner to analyseGraph / PointDepth
+         // here it marks the node as used in calculation only
+
+         heap.push_back(AngularTriple(0.0f,curs,NoPixel));
+         marks.cumangle(curs) = 0.0f;
+         while (heap.size()) {
+            std::pop_heap(&heap[0], &heap[0] + heap.size(), std::greater<AngularTriple>());
+            AngularTriple here = heap.tail();
+            heap.pop_back();
+            if (options.radius != -1.0 && here.angle > options.radius) {
+               break;
+            }
+            Point& p = getPoint(here.pixel);
+            // nb, the filled check is necessary as diagonals seem to be stored with 'gaps' left in
+            int& misc = marks.misc(here.pixel);
+            if (p.filled() && misc != ~0) {
+               graph.extractAngular(heap,this,here,marks);
+               misc = ~0;
+               if (!p.m_merge.empty()) {
+                  int& misc2 = marks.misc(p.m_merge);
+                  if (misc2 != ~0) {
+                     marks.cumangle(p.m_merge) = marks.cumangle(here.pixel);
+                     graph.extractAngular(heap,this,AngularTriple(here.angle,p.m_merge,NoPixel),marks);
+                     misc2 = ~0;
+                  }
                }
-               comm->CommPostMessage( Communicator::CURRENT_RECORD, count );
-            }         
+               total_angle += marks.cumangle(here.pixel);
+               total_nodes += 1;
+            }
+         }
+
+         int row = rows[s];
+         if (total_nodes > 0) {
+            mean_depth_writer.setValue(row, float(double(total_angle) / double(total_nodes)) );
          }
+         total_depth_writer.setValue(row, total_angle );
+         count_writer.setValue(row, float(total_nodes) );
+
+         pcomm.record();
       }
    }
 
+   pcomm.throwIfCancelled();
+
+   mean_depth_writer.commit();
+   total_depth_writer.commit();
+   count_writer.commit();
+
    m_displayed_attribute = -2;
    setDisplayedAttribute(mean_depth_col);
 
@@ -36,6 +36,9 @@
 #include <float.h>
 #include <time.h>
 
+#include <sstream>
+
+#include <generic/parallel.h>
 #include <sala/mgraph.h>
 #include <sala/ngraph.h>
 #include <sala/salaprogram.h>
@@ -131,10 +134,21 @@ SalaProgram::~SalaProgram()
 // use istrstream to make an istream from a string:
 // istrstream file(char *);
 
-bool SalaProgram::parse(istream& program)
+bool SalaProgram::parse(istream& stream)
 {
    m_var_stack.clear();
    m_error_stack.clear();
+   m_marked_rows.clear();
+
+   // the source is kept, so the program can be parsed again for each thread it runs on
+   pvector<char> text;
+   char ch;
+   while (stream.get(ch)) {
+      text.push_back(ch);
+   }
+   text.push_back('\0');
+   m_source = pstring(&(text[0]));
+   istringstream program(m_source.c_str());
 
    // this ensures wipe of any pre-existing variables in the global context:
    m_root_command = SalaCommand(this,NULL,-1,SalaCommand::SC_ROOT);
@@ -248,89 +262,200 @@ SalaObj SalaProgram::evaluate()
       // uninitialise all variables:
       m_var_stack[i].uninit();
    }
-   m_marked = false;
 
    // run the program
    SalaObj obj;
    bool ret = false, ifhandled = false;
    m_root_command.evaluate(obj,ret,ifhandled);
 
-   // clear marks if they've been used:
-   if (m_marked) {
+   // clear marks if they've been used (just on the rows that were marked, rather than the whole table):
+   if (m_marked_rows.size()) {
       AttributeTable *table = m_thisobj.getTable();
-      for (int i = 0; i < table->getRowCount(); i++) {
+      for (size_t i = 0; i < m_marked_rows.size(); i++) {
 	 // Quick mod - TV
 #if defined(_WIN32)	 
-         table->setMark(i,SalaObj());
+         table->setMark(m_marked_rows[i],SalaObj());
 #else
 	 SalaObj objTmp = SalaObj();
-         table->setMark(i,objTmp);
+         table->setMark(m_marked_rows[i],objTmp);
 #endif         
       }
-      m_marked = false;
+      m_marked_rows.clear();
    }
 
    return obj;
 }
 
-// this function is called by depthmapX to run a script to update a column
-// the operation is on a single node / row of the database combination
+// values which are not finite (e.g., after a divide by zero) go into the table as nulls
 
-bool SalaProgram::runupdate(int col, const pvecint& selset)
+static float salaValue(double val)
+{
+   float v = (float) val;
+   // Quick mod - TV
+#if defined(_WIN32)            
+   if (!_finite(v)) {
+#else
+   if (!finite(v)) {
+#endif            
+      v = -1.0f;
+   }
+   return v;
+}
+
+// the rowids to run on: the selection set if there is one, otherwise every row
+
+void SalaProgram::getRowids(const pvecint& selset, pvecint& rows)
 {
    AttributeTable *table = m_thisobj.getTable();
    bool pointmap = (m_thisobj.type & SalaObj::S_POINTMAP) ? true : false;
-   //
-   // note: reference, will change object directly, which is important for commands running the program
-   int& row = m_thisobj.data.graph.node;
-   m_col = col;
    if (selset.size()) {
       for (size_t i = 0; i < selset.size(); i++) {
-         row = selset[i];  // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
-         try {
-            SalaObj val = evaluate();
-            float v = (float) val.toDouble();   // note, toDouble will type check and throw if there's a problem
-            // Quick mod - TV
-#if defined(_WIN32)            
-            if (!_finite(v)) {
-#else
-            if (!finite(v)) {
-#endif            
-               v = -1.0f;
-            }
-            table->changeValue(pointmap ? table->getRowid(row) : row,m_col,v);
-         }
-         catch (SalaError e) {
-            // error
-            m_error_stack.push_back(e);
-            return false;
-         }
+         rows.push_back(pointmap ? table->getRowid(selset[i]) : selset[i]); // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
       }
    }
    else {
       for (int i = 0; i < table->getRowCount(); i++) {
-         row = pointmap ? table->getRowKey(i) : i; // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
-         try {
-            SalaObj val = evaluate();
-            float v = (float) val.toDouble();   // note, toDouble will type check and throw if there's a problem
-            // Quick mod - TV
-#if defined(_WIN32)            
-            if (!_finite(v)) {
-#else
-            if (!finite(v)) {
-#endif            
-               v = -1.0f;
+         rows.push_back(i);
+      }
+   }
+}
+
+// the program can be run on many rows at once as long as running it on one row cannot
+// change another: it must not set values or marks, or use rand (the sequence is shared),
+// and it must not read the column being updated (col), as other rows may not be done yet
+
+bool SalaProgram::isReentrant(int col)
+{
+   pstring colname;
+   if (col != -1) {
+      colname = m_thisobj.getTable()->getColumnName(col);
+   }
+   return m_root_command.isReentrant(colname);
+}
+
+// runs the program on each of the rows (by rowid), stopping at the first error:
+// the result is written to the column (if there is a writer), or recorded as true
+// or false (if there is a selected list), and the number of rows run is returned
+
+size_t SalaProgram::runrows(const pvecint& rows, AttributeColumnWriter *writer, pvector<bool> *selected)
+{
+   AttributeTable *table = m_thisobj.getTable();
+   bool pointmap = (m_thisobj.type & SalaObj::S_POINTMAP) ? true : false;
+   int count = (int) rows.size();
+   if (selected) {
+      selected->set(false, rows.size());
+   }
+
+   if (getThreadCount() > 1 && count > 1 && isReentrant(writer ? m_col : -1)) {
+      // Each thread parses its own copy of the program, so it has its own variables,
+      // context node and constants (string constants are reference counted, so cannot
+      // be shared).  The table is only read, through its cursor free column and row
+      // lookups.  The values are only written once all the rows are done, so that
+      // none are written past the first error, just as when run row by row
+      pvecfloat values;
+      if (writer) {
+         values.set(rows.size());
+      }
+      volatile int first_error = count;
+      SalaError error;
+
+      #pragma omp parallel
+      {
+         SalaProgram program(m_thisobj);
+         istringstream source(m_source.c_str());
+         program.parse(source);
+         program.m_col = m_col;
+         int& row = program.m_thisobj.data.graph.node;
+
+         #pragma omp for schedule(dynamic,64)
+         for (int i = 0; i < count; i++) {
+            if (i > first_error) {
+               continue;
+            }
+            row = pointmap ? table->getRowKey(rows[i]) : rows[i]; // *** NB! vga is keyed off pixelrefs *all* others use rowids directly ***
+            try {
+               SalaObj val = program.evaluate();
+               if (writer) {
+                  values[i] = salaValue(val.toDouble());   // note, toDouble will type check and throw if there's a problem
+               }
+               if (selected) {
+                  (*selected)[i] = val.toBool();   // note, toBool will type check and throw if there's a problem
+               }
+            }
+            catch (SalaError e) {
+               #pragma omp critical
+               {
+                  if (i < first_error) {
+                     first_error = i;
+                     error = e;
+                  }
+               }
             }
-            table->changeValue(i,m_col,v);
          }
-         catch (SalaError e) {
-            // error
-            m_error_stack.push_back(e);
-            return false;
+      }
+
+      if (writer) {
+         for (int i = 0; i < first_error; i++) {
+            writer->setValue(rows[i], values[i]);
          }
       }
+      if (first_error != count) {
+         m_error_stack.push_back(error);
+      }
+      return (size_t) first_error;
    }
-   return true;
+
+   // note: reference, will change object directly, which is important for commands running the program
+   int& row = m_thisobj.data.graph.node;
+   for (int i = 0; i < count; i++) {
+      row = pointmap ? table->getRowKey(rows[i]) : rows[i]; // *** NB! vga is keyed off pixelrefs *all* others use rowids directly ***
+      try {
+         SalaObj val = evaluate();
+         // n.b., written straight away, as later rows may read it
+         if (writer) {
+            writer->setValue(rows[i], salaValue(val.toDouble()));   // note, toDouble will type check and throw if there's a problem
+         }
+         if (selected) {
+            (*selected)[i] = val.toBool();   // note, toBool will type check and throw if there's a problem
+         }
+      }
+      catch (SalaError e) {
+         // error
+         m_error_stack.push_back(e);
+         return (size_t) i;
+      }
+   }
+   return rows.size();
+}
+
+// this function is called by depthmapX to run a script to update a column
+// the operation is on a single node / row of the database combination
+
+bool SalaProgram::runupdate(int col, const pvecint& selset)
+{
+   AttributeTable *table = m_thisobj.getTable();
+   m_col = col;
+   pvecint rows;
+   getRowids(selset, rows);
+   size_t done = rows.size();
+   // the column may already hold values (e.g., the update is run again), so they are changed:
+   AttributeColumnWriter writer(*table, col, true);
+   SalaCode code;
+   if (compile(code)) {
+      if (rows.size()) {
+         pvecdouble results;
+         results.set(rows.size());
+         code.evaluate(*table, &(rows[0]), (int) rows.size(), &(results[0]));
+         for (size_t i = 0; i < rows.size(); i++) {
+            writer.setValue(rows[i], salaValue(results[i]));
+         }
+      }
+   }
+   else {
+      done = runrows(rows, &writer, NULL);
+   }
+   writer.commit();
+   return done == rows.size();
 }
 
 // this function is called by depthmapX to run a script to select values
@@ -340,42 +465,52 @@ bool SalaProgram::runselect(pvecint& selsetout, const pvecint& selsetin)
 {
    AttributeTable *table = m_thisobj.getTable();
    bool pointmap = (m_thisobj.type & SalaObj::S_POINTMAP) ? true : false;
-   //
-   int& row = m_thisobj.data.graph.node;
-   if (selsetin.size()) {
-      for (size_t i = 0; i < selsetin.size(); i++) {
-         row = selsetin[i];  // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
-         try {
-            SalaObj val = evaluate();
-            bool v = val.toBool();   // note, toBool will type check and throw if there's a problem
-            if (v) {
-               selsetout.push_back(selsetin[i]);
-            }
-         }
-         catch (SalaError e) {
-            // error
-            m_error_stack.push_back(e);
-            return false;
+   pvecint rows;
+   getRowids(selsetin, rows);
+   size_t done = rows.size();
+   pvector<bool> selected;
+   SalaCode code;
+   if (compile(code)) {
+      if (rows.size()) {
+         pvecdouble results;
+         results.set(rows.size());
+         code.evaluate(*table, &(rows[0]), (int) rows.size(), &(results[0]));
+         selected.set(false, rows.size());
+         for (size_t i = 0; i < rows.size(); i++) {
+            selected[i] = (results[i] != 0.0);   // n.b., as toBool
          }
       }
    }
    else {
-      for (int i = 0; i < table->getRowCount(); i++) {
-         row = pointmap ? table->getRowKey(i) : i; // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
-         try {
-            SalaObj val = evaluate();
-            bool v = val.toBool();   // note, toBool will type check and throw if there's a problem
-            if (v) {
-               selsetout.push_back(row);
-            }
-         }
-         catch (SalaError e) {
-            // error
-            m_error_stack.push_back(e);
-            return false;
-         }
+      done = runrows(rows, NULL, &selected);
+   }
+   for (size_t i = 0; i < done; i++) {
+      if (selected[i]) {
+         selsetout.push_back(pointmap ? table->getRowKey(rows[i]) : rows[i]); // *** NB! selsets for vga store pixelrefs keys, *all* others use rowids directly ***
       }
    }
+   return done == rows.size();
+}
+
+// a program of a single expression may be compiled, to run over the whole table at once (see SalaCode)
+
+bool SalaProgram::compile(SalaCode& code)
+{
+   code.clear();
+   if (m_root_command.m_children.size() != 1) {
+      return false;
+   }
+   SalaCommand& command = m_root_command.m_children[0];
+   if ((command.m_command != SalaCommand::SC_EXPR && command.m_command != SalaCommand::SC_RETURN) || command.m_children.size() != 0) {
+      return false;
+   }
+   int pointer = (int) command.m_eval_stack.size() - 1;
+   int reg = command.compile(pointer, code);
+   // everything on the eval stack must be used, otherwise leave it to the interpreter
+   if (reg == -1 || pointer != -1) {
+      code.clear();
+      return false;
+   }
    return true;
 }
 
@@ -1152,7 +1287,7 @@ SalaObj SalaCommand::evaluate(int& pointer, SalaObj* &p_obj)
 	       {
 	    	    SalaObj tmp1 = evaluate(pointer,p_obj);
 	    	    SalaObj tmp2 = evaluate(pointer,p_obj);
-            	    data = tmp1 + tmp2;
+            	    data = tmp2 + tmp1;   // reverse order
                }
 #endif               
                break;
@@ -1164,7 +1299,7 @@ SalaObj SalaCommand::evaluate(int& pointer, SalaObj* &p_obj)
 	       {
 	    	    SalaObj tmp1 = evaluate(pointer,p_obj);
 	    	    SalaObj tmp2 = evaluate(pointer,p_obj);
-            	    data = tmp1 - tmp2;
+            	    data = tmp2 - tmp1;   // reverse order
                }
 #endif               
                break;
@@ -1573,7 +1708,7 @@ SalaObj SalaCommand::evaluate(int& pointer, SalaObj* &p_obj)
                   {
                      AttributeTable *table = obj.getTable();
                      table->setMark((obj.type == SalaObj::S_POINTMAPOBJ) ? table->getRowid(obj.data.graph.node) : obj.data.graph.node, param);
-                     m_program->m_marked = true;   // <- this tells the program to tidy up marks between executions
+                     m_program->m_marked_rows.push_back((obj.type == SalaObj::S_POINTMAPOBJ) ? table->getRowid(obj.data.graph.node) : obj.data.graph.node);   // <- this tells the program to tidy up marks between executions
                      data = SalaObj(); // returns none
                   }
                   break;
@@ -1620,6 +1755,127 @@ SalaObj SalaCommand::evaluate(int& pointer, SalaObj* &p_obj)
    return data;
 }
 
+// see SalaProgram::isReentrant: colname is the column being updated (if any)
+
+bool SalaCommand::isReentrant(const pstring& colname) const
+{
+   for (size_t i = 0; i < m_eval_stack.size(); i++) {
+      const SalaObj& data = m_eval_stack[i];
+      if (data.type != SalaObj::S_FUNCTION) {
+         continue;
+      }
+      switch (data.data.func) {
+      case SalaObj::S_FSETVALUE: case SalaObj::S_FMARK: case SalaObj::S_FSETMARK: case SalaObj::S_RAND:
+         return false;
+      case SalaObj::S_FVALUE:
+         // the column must be named directly, so that it is known not to be the one being updated
+         if (!colname.empty()) {
+            if (i == 0 || m_eval_stack[i-1].type != SalaObj::S_STRING || m_eval_stack[i-1].toStringRef() == colname) {
+               return false;
+            }
+         }
+         break;
+      default:
+         break;
+      }
+   }
+   for (size_t j = 0; j < m_children.size(); j++) {
+      if (!m_children[j].isReentrant(colname)) {
+         return false;
+      }
+   }
+   return true;
+}
+
+// compiles from the eval stack in the same order as evaluate, returning the register
+// holding the result, or -1 if it is something only the interpreter can run
+// (note, type errors are left to the interpreter too, so it can report them)
+
+int SalaCommand::compile(int& pointer, SalaCode& code)
+{
+   if (pointer < 0) {
+      return -1;
+   }
+   const SalaObj& data = m_eval_stack[pointer];
+   pointer--;
+   if (data.type == SalaObj::S_BOOL || data.type == SalaObj::S_INT || data.type == SalaObj::S_DOUBLE) {
+      return code.pushConstant(data);
+   }
+   else if (data.type != SalaObj::S_FUNCTION) {
+      return -1;
+   }
+   SalaObj::Func func = data.data.func;
+   switch (func) {
+   case SalaObj::S_PLUS:
+      return compile(pointer,code);   // just ignore it
+   case SalaObj::S_MINUS:
+      {
+         int a = compile(pointer,code);
+         if (a == -1 || !code.isNumber(a)) {
+            return -1;
+         }
+         return code.pushUnary(func,a);
+      }
+   case SalaObj::S_NOT:
+   case SalaObj::S_SQRT: case SalaObj::S_LOG: case SalaObj::S_LN:
+   case SalaObj::S_SIN: case SalaObj::S_COS: case SalaObj::S_TAN:
+   case SalaObj::S_ASIN: case SalaObj::S_ACOS: case SalaObj::S_ATAN:
+      {
+         int a = compile(pointer,code);
+         if (a == -1) {
+            return -1;
+         }
+         return code.pushUnary(func,a);
+      }
+   case SalaObj::S_ADD: case SalaObj::S_SUBTRACT: case SalaObj::S_MULTIPLY: case SalaObj::S_DIVIDE: case SalaObj::S_MODULO:
+   case SalaObj::S_POWER: case SalaObj::S_AND: case SalaObj::S_OR:
+   case SalaObj::S_EQ: case SalaObj::S_NEQ: case SalaObj::S_LT: case SalaObj::S_GT: case SalaObj::S_LEQ: case SalaObj::S_GEQ:
+      {
+         int b = compile(pointer,code);   // reverse order
+         int a = (b != -1) ? compile(pointer,code) : -1;
+         if (a == -1) {
+            return -1;
+         }
+         switch (func) {
+         case SalaObj::S_ADD: case SalaObj::S_SUBTRACT: case SalaObj::S_MULTIPLY: case SalaObj::S_DIVIDE: case SalaObj::S_MODULO:
+            if (!code.isNumber(a) || !code.isNumber(b)) {
+               return -1;
+            }
+            break;
+         case SalaObj::S_EQ: case SalaObj::S_NEQ: case SalaObj::S_LT: case SalaObj::S_GT: case SalaObj::S_LEQ: case SalaObj::S_GEQ:
+            // booleans compare with booleans, numbers with numbers
+            if (!(code.isNumber(a) && code.isNumber(b)) && !(code.isBool(a) && code.isBool(b))) {
+               return -1;
+            }
+            break;
+         default:
+            break;
+         }
+         return code.pushBinary(func,a,b);
+      }
+   case SalaObj::S_FVALUE:
+      {
+         // only value("column name") on this node, with the name given as a constant
+         if (pointer < 1 || m_eval_stack[pointer].type != SalaObj::S_STRING || m_eval_stack[pointer-1].type != SalaObj::S_THIS) {
+            return -1;
+         }
+         const pstring& str = m_eval_stack[pointer].toStringRef();
+         pointer -= 2;
+         int col = -1;
+         if (str != "Ref Number") {
+            col = m_program->m_thisobj.getTable()->getColumnIndex(str);
+            if (col == -1) {
+               return -1;
+            }
+         }
+         return code.pushValue(col);
+      }
+   default:
+      break;
+   }
+   return -1;
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 
 SalaObj SalaCommand::connections(SalaObj graphobj, SalaObj param)
@@ -1631,31 +1887,24 @@ SalaObj SalaCommand::connections(SalaObj graphobj, SalaObj param)
    SalaObj list;
    if ((graphobj.type & SalaObj::S_MAP) == SalaObj::S_POINTMAP) {
       // point map version
-      Node& node = graphobj.data.graph.map.point->getPoint(graphobj.data.graph.node).getNode();
+      // n.b., the node's own cursor is not used, as the program may be running on many threads
+      const Node& node = graphobj.data.graph.map.point->getPoint(graphobj.data.graph.node).getNode();
+      PixelRefList pixels;
       if (param.type == SalaObj::S_NONE) {
-         int count = node.count();
-         list = SalaObj( SalaObj::S_LIST, count);
-         node.first();
-         for (int i = 0; i < count; i++) {
-            graphobj.data.graph.node = node.cursor();
-            list.data.list.list->at(i) = graphobj;
-            node.next();
-         }
+         node.appendContents(pixels);
       }
       else {
          int b = param.toInt(); // note, will throw if it's not the right type
          if (b < 0 || b > 31) {
             throw SalaError("Bin must be in range 0 to 31");
          }
-         Bin& bin = node.bin(b);
-         int count = bin.count();
-         list = SalaObj( SalaObj::S_LIST, count);
-         bin.first();
-         for (int i = 0; i < count; i++) {
-            graphobj.data.graph.node = bin.cursor();
-            list.data.list.list->at(i) = graphobj;
-            bin.next();
-         }
+         node.bin(b).appendContents(pixels);
+      }
+      int count = (int) pixels.size();
+      list = SalaObj( SalaObj::S_LIST, count);
+      for (int i = 0; i < count; i++) {
+         graphobj.data.graph.node = pixels[i];
+         list.data.list.list->at(i) = graphobj;
       }
    }
    else {
@@ -1678,11 +1927,9 @@ SalaObj SalaCommand::connections(SalaObj graphobj, SalaObj param)
       }
       int count = connector.count(mode);
       list = SalaObj( SalaObj::S_LIST, count);
-      connector.first();
       for (int i = 0; i < count; i++) {
-         graphobj.data.graph.node = connector.cursor(mode);
+         graphobj.data.graph.node = connector.getConnection(i, mode);
          list.data.list.list->at(i) = graphobj;
-         connector.next();
       }
    }
    return list;
@@ -1690,6 +1937,269 @@ SalaObj SalaCommand::connections(SalaObj graphobj, SalaObj param)
 
 /////////////////////////////////////////////////////////////////////////////////
 
+int SalaCode::push(SalaObj::Func func, SalaObj::Type type, int a, int b)
+{
+   Instruction instruction;
+   instruction.func = func;
+   instruction.type = type;
+   instruction.a = a;
+   instruction.b = b;
+   instruction.col = -1;
+   instruction.value = 0.0;
+   m_code.push_back(instruction);
+   return (int) m_code.size() - 1;
+}
+
+int SalaCode::pushConstant(const SalaObj& obj)
+{
+   if (obj.type != SalaObj::S_BOOL && obj.type != SalaObj::S_INT && obj.type != SalaObj::S_DOUBLE) {
+      return -1;
+   }
+   int reg = push(SalaObj::S_FNULL, obj.type);
+   m_code[reg].value = obj.toDouble();
+   return reg;
+}
+
+SalaObj SalaCode::getConstant(int reg) const
+{
+   const Instruction& instruction = m_code[reg];
+   switch (instruction.type) {
+   case SalaObj::S_BOOL:
+      return SalaObj(instruction.value != 0.0);
+   case SalaObj::S_INT:
+      return SalaObj(int(instruction.value));
+   default:
+      break;
+   }
+   return SalaObj(instruction.value);
+}
+
+int SalaCode::pushValue(int col)
+{
+   // n.b., values are stored as floats, but calculated as doubles, as in the interpreter
+   int reg = push(SalaObj::S_FVALUE, SalaObj::S_DOUBLE);
+   m_code[reg].col = col;
+   return reg;
+}
+
+int SalaCode::pushUnary(SalaObj::Func func, int a)
+{
+   SalaObj::Type type = SalaObj::S_DOUBLE;
+   if (func == SalaObj::S_MINUS) {
+      type = m_code[a].type;
+   }
+   else if (func == SalaObj::S_NOT) {
+      type = SalaObj::S_BOOL;
+   }
+   if (m_code[a].func == SalaObj::S_FNULL) {
+      // constants are worked out now, using the same operations as the interpreter
+      SalaObj x = getConstant(a);
+      SalaObj result;
+      try {
+         switch (func) {
+         case SalaObj::S_MINUS: result = -x; break;
+         case SalaObj::S_NOT: result = !x.toBool(); break;
+         case SalaObj::S_SQRT: result = sqrt(x.toDouble()); break;
+         case SalaObj::S_LOG: result = log10(x.toDouble()); break;
+         case SalaObj::S_LN: result = ln(x.toDouble()); break;
+         case SalaObj::S_SIN: result = sin(x.toDouble()); break;
+         case SalaObj::S_COS: result = cos(x.toDouble()); break;
+         case SalaObj::S_TAN: result = tan(x.toDouble()); break;
+         case SalaObj::S_ASIN: result = asin(x.toDouble()); break;
+         case SalaObj::S_ACOS: result = acos(x.toDouble()); break;
+         case SalaObj::S_ATAN: result = atan(x.toDouble()); break;
+         default: return -1;
+         }
+      }
+      catch (SalaError) {
+         return -1;
+      }
+      m_code.pop_back();
+      return pushConstant(result);
+   }
+   return push(func, type, a);
+}
+
+int SalaCode::pushBinary(SalaObj::Func func, int a, int b)
+{
+   SalaObj::Type type = SalaObj::S_BOOL;  // comparisons and logical ops
+   switch (func) {
+   case SalaObj::S_ADD: case SalaObj::S_SUBTRACT: case SalaObj::S_MULTIPLY: case SalaObj::S_DIVIDE: case SalaObj::S_MODULO:
+      type = (m_code[a].type == SalaObj::S_INT && m_code[b].type == SalaObj::S_INT) ? SalaObj::S_INT : SalaObj::S_DOUBLE;
+      break;
+   case SalaObj::S_POWER:
+      type = SalaObj::S_DOUBLE;
+      break;
+   default:
+      break;
+   }
+   if (m_code[a].func == SalaObj::S_FNULL && m_code[b].func == SalaObj::S_FNULL) {
+      // constants are worked out now, using the same operations as the interpreter
+      SalaObj x = getConstant(a);
+      SalaObj y = getConstant(b);
+      SalaObj result;
+      try {
+         switch (func) {
+         case SalaObj::S_ADD: result = x + y; break;
+         case SalaObj::S_SUBTRACT: result = x - y; break;
+         case SalaObj::S_MULTIPLY: result = x * y; break;
+         case SalaObj::S_DIVIDE: result = x / y; break;
+         case SalaObj::S_MODULO:
+            if (type == SalaObj::S_INT && y.toInt() == 0) {
+               return -1;
+            }
+            result = x % y;
+            break;
+         case SalaObj::S_POWER: result = pow(x.toDouble(),y.toDouble()); break;
+         case SalaObj::S_AND: result = x.toBool() && y.toBool(); break;
+         case SalaObj::S_OR: result = x.toBool() || y.toBool(); break;
+         case SalaObj::S_EQ: result = (x == y); break;
+         case SalaObj::S_NEQ: result = (x != y); break;
+         case SalaObj::S_LT: result = (x < y); break;
+         case SalaObj::S_GT: result = (x > y); break;
+         case SalaObj::S_LEQ: result = (x <= y); break;
+         case SalaObj::S_GEQ: result = (x >= y); break;
+         default: return -1;
+         }
+      }
+      catch (SalaError) {
+         return -1;
+      }
+      m_code.pop_back();
+      m_code.pop_back();
+      return pushConstant(result);
+   }
+   return push(func, type, a, b);
+}
+
+// n.b., once compiled there is nothing that can go wrong: the types are all known,
+// and constant integer arithmetic has already been done, so everything else is in doubles
+
+void SalaCode::evaluate(const AttributeTable& table, const int *rows, int count, double *results) const
+{
+   if (m_code.size() == 0) {
+      return;
+   }
+   // the blocks are shared out between the threads, each with registers of its own
+   int blocks = (count + SALA_BLOCK_SIZE - 1) / SALA_BLOCK_SIZE;
+   #pragma omp parallel if (blocks > 1)
+   {
+      pvecdouble registers;
+      registers.set(m_code.size() * SALA_BLOCK_SIZE);
+
+      #pragma omp for schedule(static)
+      for (int b = 0; b < blocks; b++) {
+         int start = b * SALA_BLOCK_SIZE;
+         int n = (count - start < SALA_BLOCK_SIZE) ? count - start : SALA_BLOCK_SIZE;
+         const int *block = rows + start;
+         for (size_t k = 0; k < m_code.size(); k++) {
+            const Instruction& instruction = m_code[k];
+            double *r = &(registers[k * SALA_BLOCK_SIZE]);
+            const double *x = (instruction.a != -1) ? &(registers[instruction.a * SALA_BLOCK_SIZE]) : NULL;
+            const double *y = (instruction.b != -1) ? &(registers[instruction.b * SALA_BLOCK_SIZE]) : NULL;
+            int i;
+            switch (instruction.func) {
+            case SalaObj::S_FNULL:
+               for (i = 0; i < n; i++) r[i] = instruction.value;
+               break;
+            case SalaObj::S_FVALUE:
+               if (instruction.col == -1) {
+                  for (i = 0; i < n; i++) r[i] = (float) table.getRowKey(block[i]);
+               }
+               else {
+                  const float *values = table.getColumnValues(instruction.col);
+                  for (i = 0; i < n; i++) r[i] = values[block[i]];
+               }
+               break;
+            case SalaObj::S_ADD:
+               for (i = 0; i < n; i++) r[i] = x[i] + y[i];
+               break;
+            case SalaObj::S_SUBTRACT:
+               for (i = 0; i < n; i++) r[i] = x[i] - y[i];
+               break;
+            case SalaObj::S_MULTIPLY:
+               for (i = 0; i < n; i++) r[i] = x[i] * y[i];
+               break;
+            case SalaObj::S_DIVIDE:
+               for (i = 0; i < n; i++) r[i] = x[i] / y[i];
+               break;
+            case SalaObj::S_MODULO:
+               for (i = 0; i < n; i++) r[i] = fmod(x[i],y[i]);
+               break;
+            case SalaObj::S_POWER:
+               for (i = 0; i < n; i++) r[i] = pow(x[i],y[i]);
+               break;
+            case SalaObj::S_MINUS:
+               for (i = 0; i < n; i++) r[i] = -x[i];
+               break;
+            case SalaObj::S_AND:
+               for (i = 0; i < n; i++) r[i] = (x[i] != 0.0 && y[i] != 0.0) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_OR:
+               for (i = 0; i < n; i++) r[i] = (x[i] != 0.0 || y[i] != 0.0) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_NOT:
+               for (i = 0; i < n; i++) r[i] = (x[i] == 0.0) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_EQ:
+               for (i = 0; i < n; i++) r[i] = (x[i] == y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_NEQ:
+               for (i = 0; i < n; i++) r[i] = (x[i] != y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_LT:
+               for (i = 0; i < n; i++) r[i] = (x[i] < y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_GT:
+               for (i = 0; i < n; i++) r[i] = (x[i] > y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_LEQ:
+               for (i = 0; i < n; i++) r[i] = (x[i] <= y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_GEQ:
+               for (i = 0; i < n; i++) r[i] = (x[i] >= y[i]) ? 1.0 : 0.0;
+               break;
+            case SalaObj::S_SQRT:
+               for (i = 0; i < n; i++) r[i] = sqrt(x[i]);
+               break;
+            case SalaObj::S_LOG:
+               for (i = 0; i < n; i++) r[i] = log10(x[i]);
+               break;
+            case SalaObj::S_LN:
+               for (i = 0; i < n; i++) r[i] = ln(x[i]);
+               break;
+            case SalaObj::S_SIN:
+               for (i = 0; i < n; i++) r[i] = sin(x[i]);
+               break;
+            case SalaObj::S_COS:
+               for (i = 0; i < n; i++) r[i] = cos(x[i]);
+               break;
+            case SalaObj::S_TAN:
+               for (i = 0; i < n; i++) r[i] = tan(x[i]);
+               break;
+            case SalaObj::S_ASIN:
+               for (i = 0; i < n; i++) r[i] = asin(x[i]);
+               break;
+            case SalaObj::S_ACOS:
+               for (i = 0; i < n; i++) r[i] = acos(x[i]);
+               break;
+            case SalaObj::S_ATAN:
+               for (i = 0; i < n; i++) r[i] = atan(x[i]);
+               break;
+            default:
+               break;
+            }
+         }
+         const double *result = &(registers[(m_code.size() - 1) * SALA_BLOCK_SIZE]);
+         for (int i = 0; i < n; i++) {
+            results[start + i] = result[i];
+         }
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 AttributeTable *SalaObj::getTable()
 {
    if ((type & SalaObj::S_MAP) == SalaObj::S_POINTMAP) {
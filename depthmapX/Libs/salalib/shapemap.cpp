@@ -186,7 +186,12 @@ ShapeMap::ShapeMap(const pstring& name, int type) : m_attributes(name)
    m_bsp_tree = false;
    m_bsp_root = NULL;
    //
+   m_shape_tree_valid = false;
+   //
    m_mapinfodata = NULL;
+   //
+   m_deferred_offset = -1;
+   m_deferred_length = 0;
 }
 
 ShapeMap::~ShapeMap()
@@ -240,6 +245,8 @@ void ShapeMap::init(int size, const QtRegion &r)
    // calculate geom data:
    m_tolerance = __max(m_region.width(), m_region.height()) * TOLERANCE_A;
    //
+   m_shape_tree_valid = false;
+   //
    m_pixel_shapes = new pqvector<ShapeRef> *[m_cols];
    for (int i = 0; i < m_cols; i++) {
       m_pixel_shapes[i] = new pqvector<ShapeRef>[m_rows];
@@ -312,6 +319,9 @@ void ShapeMap::clearAll()
       m_display_shapes = NULL;
    }
 
+   m_shape_tree.clear();
+   m_shape_tree_valid = false;
+
    m_shapes.clear();
    m_objects.clear();
    m_undobuffer.clear();
@@ -1210,6 +1220,8 @@ void ShapeMap::undo()
 
 void ShapeMap::makePolyPixels(int polyref)
 {
+   // the tree is rebuilt from the bounding boxes set here when next needed:
+   m_shape_tree_valid = false;
    // first add into pixels, and ensure you have a bl, tr for the set (useful for testing later)
    SalaShape& poly = m_shapes.search(polyref);
    if (poly.isClosed()) {
@@ -1408,6 +1420,7 @@ void ShapeMap::removePolyPixels(int polyref)
    if (index == paftl::npos) {
       return;
    }
+   m_shape_tree_valid = false;
    SalaShape& poly = m_shapes[index];
    if (poly.isClosed()) {
       // easiest just to use scan lines to find internal pixels rather than trace a complex border:
@@ -1538,18 +1551,13 @@ int ShapeMap::pointInPoly(const Point2f& p) const
    if (!m_region.contains(p)) {
       return -1;
    }
-   pvecint testedshapes;
-   pvecint testnodes;
+   // (a single cell lists each shape only once, so there is nothing to de-duplicate)
    PixelRef pix = pixelate(p);
    pqvector<ShapeRef> &shapes = m_pixel_shapes[pix.x][pix.y];
    int drawlast = -1;
    int draworder = -1;
    for (size_t i = 0; i < shapes.size(); i++) {
       const ShapeRef& shape = shapes[i]; 
-      if (testedshapes.searchindex(shape.m_shape_ref) != paftl::npos) {
-         continue;
-      }
-      testedshapes.add(shape.m_shape_ref,paftl::ADD_HERE);
 
       int shapeindex = testPointInPoly(p,shape);
 
@@ -1582,15 +1590,10 @@ void ShapeMap::pointInPolyList(const Point2f& p, pvecint& shapeindexlist) const
    if (!m_region.contains(p)) {
       return ;
    }
-   pvecint testedshapes;
    PixelRef pix = pixelate(p);
    pqvector<ShapeRef> &shapes = m_pixel_shapes[pix.x][pix.y];
    for (size_t i = 0; i < shapes.size(); i++) {
       const ShapeRef& shape = shapes[i]; 
-      if (testedshapes.searchindex(shape.m_shape_ref) != paftl::npos) {
-         continue;
-      }
-      testedshapes.add(shape.m_shape_ref,paftl::ADD_HERE);
 
       int shapeindex = testPointInPoly(p,shape);
 
@@ -1616,6 +1619,9 @@ void ShapeMap::lineInPolyList(const Line& li_orig, pvecint& shapeindexlist, int
    pointInPolyList(li.end(),shapeindexlist);
 
    // only now pixelate and test for any other shapes:
+   // (the grid is used rather than the shape tree as the cells know which polygon sides pass through them;
+   // marked shapes are lines already tested or polygons already added)
+   m_shape_marks.reset();
    PixelRefList list = pixelateLine(li);
    for (size_t i = 0; i < list.size(); i++) {
       PixelRef pix = list[i];
@@ -1623,12 +1629,11 @@ void ShapeMap::lineInPolyList(const Line& li_orig, pvecint& shapeindexlist, int
          pqvector<ShapeRef>& shapes = m_pixel_shapes[pix.x][pix.y];
          for (size_t j = 0; j < shapes.size(); j++) {
             const ShapeRef& shape = shapes[j]; 
-            // slow to do this as it can repeat -- really need to use a linetest like structure to avoid retest of 
-            // polygon lines
-            if (shape.m_shape_ref != lineref && shape.m_tags & (ShapeRef::SHAPE_EDGE | ShapeRef::SHAPE_INTERNAL_EDGE | ShapeRef::SHAPE_OPEN)) {
+            if (shape.m_shape_ref != (unsigned int) lineref && shape.m_tags & (ShapeRef::SHAPE_EDGE | ShapeRef::SHAPE_INTERNAL_EDGE | ShapeRef::SHAPE_OPEN) && !m_shape_marks.marked(shape.m_shape_ref)) {
                const SalaShape& poly = m_shapes.search(shape.m_shape_ref);
                switch (poly.m_type & (SalaShape::SHAPE_LINE | SalaShape::SHAPE_POLY)) {
                case SalaShape::SHAPE_LINE:
+                  m_shape_marks.mark(shape.m_shape_ref);
                   if (intersect_region(li,poly.m_region)) {
                      // note: in this case m_region is stored as a line:
                      if (intersect_line(li,poly.m_region,tolerance)) {
@@ -1643,6 +1648,8 @@ void ShapeMap::lineInPolyList(const Line& li_orig, pvecint& shapeindexlist, int
                         if (intersect_region(li,lineb)) {
                            if (intersect_line(li,lineb,tolerance)) {
                               shapeindexlist.add(m_shapes.searchindex(shape.m_shape_ref));
+                              m_shape_marks.mark(shape.m_shape_ref);
+                              break;
                            }
                         }
                      }
@@ -1665,7 +1672,9 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
    }
    const SalaShape& poly = m_shapes[index];
    if (poly.isClosed()) { // <- it ought to be, you shouldn't be using this function if not!
-      pvecint testedlist;
+      // marks the shapes already added to the list
+      ShapeMarks& testedlist = m_shape_marks;
+      testedlist.reset();
       // easiest just to use scan lines to find internal pixels rather than trace a complex border:
       PixelRef minpix = pixelate(poly.m_region.bottom_left);
       PixelRef maxpix = pixelate(poly.m_region.top_right);
@@ -1680,7 +1689,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                for (size_t i = 0; i < shaperefs.size(); i++) {
                   ShapeRef& shaperef = shaperefs[i];
                   if (i != pos && ((shaperefs[pos].m_tags & ShapeRef::SHAPE_CENTRE) || (shaperef.m_tags & ShapeRef::SHAPE_CENTRE))) {
-                     if (testedlist.add(shaperef.m_shape_ref) != -1) {
+                     if (testedlist.mark(shaperef.m_shape_ref)) {
                         shapeindexlist.add(m_shapes.searchindex(shaperef.m_shape_ref));
                      }
                   }
@@ -1699,7 +1708,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                   // this has us in it, now looked through everything else:
                   for (size_t i = 0; i < shaperefs.size(); i++) {
                      ShapeRef& shaperefb = shaperefs[i];
-                     if (i != pos && testedlist.searchindex(shaperefb.m_shape_ref) == paftl::npos) {
+                     if (i != pos && !testedlist.marked(shaperefb.m_shape_ref)) {
                         size_t indexb = m_shapes.searchindex(shaperefb.m_shape_ref);
                         const SalaShape& polyb = m_shapes[indexb];
                         if (polyb.isPoint()) {
@@ -1709,7 +1718,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                         }
                         else if (polyb.isLine()) {
                            if (testPointInPoly(polyb.getLine().start(),shaperef) != -1 || testPointInPoly(polyb.getLine().end(),shaperef) != -1) {
-                              testedlist.add(shaperefb.m_shape_ref,paftl::ADD_HERE);
+                              testedlist.mark(shaperefb.m_shape_ref);
                               shapeindexlist.add((int)indexb);
                            }
                            else {
@@ -1717,7 +1726,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                                  Line line = Line(poly[shaperef.m_polyrefs[k]],poly[((shaperef.m_polyrefs[k]+1)%poly.size())]);
                                  if (intersect_region(line,polyb.getLine())) {
                                     if (intersect_line(line,polyb.getLine(),tolerance)) {
-                                       testedlist.add(shaperefb.m_shape_ref,paftl::ADD_HERE);
+                                       testedlist.mark(shaperefb.m_shape_ref);
                                        shapeindexlist.add((int)indexb);
                                        break;
                                     }
@@ -1727,7 +1736,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                         }
                         else if (polyb.isPolyLine()) {
                            if (testPointInPoly(polyb[shaperefb.m_polyrefs[0]],shaperef) != -1)  {
-                              testedlist.add(shaperefb.m_shape_ref,paftl::ADD_HERE);
+                              testedlist.mark(shaperefb.m_shape_ref);
                               shapeindexlist.add(indexb);
                            }
                            else {
@@ -1737,7 +1746,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                                     Line lineb = Line(polyb[shaperefb.m_polyrefs[kk]],polyb[((shaperefb.m_polyrefs[kk]+1)%polyb.size())]);
                                     if (intersect_region(line,lineb)) {
                                        if (intersect_line(line,lineb,tolerance)) {
-                                          if (testedlist.add(shaperefb.m_shape_ref) != -1) {
+                                          if (testedlist.mark(shaperefb.m_shape_ref)) {
                                              shapeindexlist.add(indexb);
                                              break;
                                           }
@@ -1754,7 +1763,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                            // pixel, not just part of the line associated with it...
                            if ((pixelate(polyb[shaperefb.m_polyrefs[0]]) == PixelRef(x,y) && testPointInPoly(polyb[shaperefb.m_polyrefs[0]],shaperef) != -1) ||
                                (pixelate(poly[shaperef.m_polyrefs[0]]) == PixelRef(x,y) && testPointInPoly(poly[shaperef.m_polyrefs[0]],shaperefb) != -1))  {
-                              testedlist.add(shaperefb.m_shape_ref,paftl::ADD_HERE);
+                              testedlist.mark(shaperefb.m_shape_ref);
                               shapeindexlist.add(indexb);
                            }
                            else {
@@ -1766,7 +1775,7 @@ void ShapeMap::polyInPolyList(int polyref, pvecint& shapeindexlist, double toler
                                     Line lineb = Line(polyb[shaperefb.m_polyrefs[kk]],polyb[((shaperefb.m_polyrefs[kk]+1)%polyb.size())]);
                                     if (intersect_region(line,lineb)) {
                                        if (intersect_line(line,lineb,tolerance)) {
-                                          testedlist.add(shaperefb.m_shape_ref,paftl::ADD_HERE);
+                                          testedlist.mark(shaperefb.m_shape_ref);
                                           shapeindexlist.add(indexb);
                                           breakit = true;
                                           break;
@@ -2328,45 +2337,38 @@ int ShapeMap::getLineConnections(int lineref, pvecint& connections, double toler
       return 0;
    }
    const Line& l = poly.getLine();
+   int self = (int)m_shapes.searchindex(lineref);
 
-   pvecint testedshapes;
-   
    // As of version 10, self-connections are *not* added
    // In the past:
    // <exclude> it's useful to have yourself in your connections list
    // (apparently! -- this needs checking, as most of the time it is then checked to exclude self again!) </exclude> 
    // <exclude> connections.add(m_shapes.searchindex(lineref)); </exclude>
 
-   testedshapes.add(lineref);
-
    int num_intersections = 0;
 
-   PixelRefList list = pixelateLine( l );
-
-   for (size_t i = 0; i < list.size(); i++) {
-      pqvector<ShapeRef>& shapes = m_pixel_shapes[ list[i].x ][ list[i].y ];
-      for (size_t j = 0; j < shapes.size(); j++) {
-         ShapeRef& shape = shapes[j];
-         if (testedshapes.searchindex(shape.m_shape_ref) != paftl::npos) {
-            continue;
-         }
-         testedshapes.add(shape.m_shape_ref,paftl::ADD_HERE);
-         if ((shape.m_tags & ShapeRef::SHAPE_OPEN) == ShapeRef::SHAPE_OPEN) {
-            try {
-               const Line& line = m_shapes.search(shape.m_shape_ref).getLine();
-               if ( intersect_region(line, l, line.length() * tolerance) ) {
-                  // n.b. originally this followed the logic that we must normalise intersect_line properly: tolerance * line length one * line length two
-                  // in fact, works better if it's just line.length() * tolerance...
-                  if ( intersect_line(line, l, line.length() * tolerance) ) {
-                     connections.add(m_shapes.searchindex(shape.m_shape_ref));
-                     num_intersections++;
-                  }
-               }
-            }
-            catch (pexception) {
-               // the lineref may have been deleted -- this is supposed to be tidied up
-               // just ignore...
-            }
+   // candidates come from the shape tree, each once: the region is widened by the largest
+   // tolerance used below, as no line can be longer than the map is wide plus high
+   QtRegion region = l;
+   double slack = (m_region.width() + m_region.height()) * tolerance;
+   region.bottom_left -= Point2f(slack,slack);
+   region.top_right += Point2f(slack,slack);
+   pvecint candidates;
+   getShapeTree().intersecting(region,candidates);
+
+   for (size_t i = 0; i < candidates.size(); i++) {
+      int index = candidates[i];
+      // only open shapes, as tagged in the pixel grid
+      if (index == self || !m_shapes[index].isOpen()) {
+         continue;
+      }
+      const Line& line = m_shapes[index].getLine();
+      if ( intersect_region(line, l, line.length() * tolerance) ) {
+         // n.b. originally this followed the logic that we must normalise intersect_line properly: tolerance * line length one * line length two
+         // in fact, works better if it's just line.length() * tolerance...
+         if ( intersect_line(line, l, line.length() * tolerance) ) {
+            connections.add(index);
+            num_intersections++;
          }
       }
    }
@@ -2582,6 +2584,14 @@ bool ShapeMap::selectionToLayer(const pstring& name)
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+MapSummary ShapeMap::getSummary() const
+{
+   MapSummary summary(m_name, m_map_type, m_editable);
+   summary.m_layers = m_attributes.getLayers();
+   summary.m_visible_layers = m_attributes.getVisibleLayers();
+   return summary;
+}
+
 bool ShapeMap::read( ifstream& stream, int version, bool drawinglayer )
 {
    // turn off selection / editable etc
@@ -3120,18 +3130,15 @@ void ShapeMap::makeViewportShapes( const QtRegion& viewport ) const
 
    m_current = -1;   // note: findNext expects first to be labelled -1
 
-   PixelRef bl = pixelate( viewport.bottom_left );
-   PixelRef tr = pixelate( viewport.top_right );
+   // the tree gives shape rows, which are also the attribute rows
+   pvecint rows;
+   getShapeTree().intersecting(viewport,rows);
 
-   for (int i = bl.x; i <= tr.x; i++) {
-      for (int j = bl.y; j <= tr.y; j++) {
-         for (size_t k = 0; k < m_pixel_shapes[i][j].size(); k++) {
-            // copy the index to the correct draworder position (draworder is formatted on display attribute)
-            int x = m_attributes.getRowid(m_pixel_shapes[i][j][k].m_shape_ref);
-            if (m_attributes.isVisible(x)) {
-               m_display_shapes[m_attributes.getDisplayPos(x)] = x;
-            }
-         }
+   for (size_t k = 0; k < rows.size(); k++) {
+      // copy the index to the correct draworder position (draworder is formatted on display attribute)
+      int x = rows[k];
+      if (m_attributes.isVisible(x)) {
+         m_display_shapes[m_attributes.getDisplayPos(x)] = x;
       }
    }
 
@@ -3563,7 +3570,7 @@ bool ShapeMap::makeBSPtree() const
       }
       m_bsp_root = new BSPNode();
 
-      m_bsp_root->make(NULL,0,partitionlines,NULL);
+      m_bsp_root->make(NULL,partitionlines);
       m_bsp_tree = true;
    }
 
@@ -3574,6 +3581,99 @@ bool ShapeMap::makeBSPtree() const
 
 /////////////////////////////////////////////////////////////////////////////////
 
+// the tree is built on first use: not thread safe, so build it before any parallel queries
+
+const ShapeTree& ShapeMap::getShapeTree() const
+{
+   // (the size check catches the shape list being emptied directly, as in the segment conversion)
+   if (!m_shape_tree_valid || m_shape_tree.size() != (int)m_shapes.size()) {
+      m_shape_tree.clear();
+      for (size_t i = 0; i < m_shapes.size(); i++) {
+         m_shape_tree.add(m_shapes[i].getBoundingBox());
+      }
+      m_shape_tree.build();
+      m_shape_tree_valid = true;
+   }
+   return m_shape_tree;
+}
+
+static int compareNodeX(const void *a, const void *b)
+{
+   double xa = ((const ShapeTree::Node *)a)->m_region.getCentre().x;
+   double xb = ((const ShapeTree::Node *)b)->m_region.getCentre().x;
+   return (xa < xb) ? -1 : (xa > xb) ? 1 : 0;
+}
+
+static int compareNodeY(const void *a, const void *b)
+{
+   double ya = ((const ShapeTree::Node *)a)->m_region.getCentre().y;
+   double yb = ((const ShapeTree::Node *)b)->m_region.getCentre().y;
+   return (ya < yb) ? -1 : (ya > yb) ? 1 : 0;
+}
+
+void ShapeTree::add(const QtRegion& region)
+{
+   Node leaf;
+   leaf.m_region = region;
+   leaf.m_first = m_leaves++;
+   leaf.m_count = 0;
+   m_nodes.push_back(leaf);
+}
+
+void ShapeTree::build()
+{
+   // each pass sorts a level into vertical slices by x, each slice by y, and
+   // then packs runs of FANOUT into the parents, until only the root is left
+   int begin = 0;
+   int end = (int)m_nodes.size();
+   while (end - begin > 1) {
+      int count = end - begin;
+      int parents = (count + FANOUT - 1) / FANOUT;
+      int slice = (int)ceil(sqrt((double)parents)) * FANOUT;
+      qsort(&(m_nodes[begin]),count,sizeof(Node),compareNodeX);
+      for (int i = begin; i < end; i += slice) {
+         qsort(&(m_nodes[i]),__min(slice,end - i),sizeof(Node),compareNodeY);
+      }
+      for (int j = begin; j < end; j += FANOUT) {
+         Node parent;
+         parent.m_first = j;
+         parent.m_count = __min((int)FANOUT,end - j);
+         parent.m_region = m_nodes[j].m_region;
+         for (int k = 1; k < parent.m_count; k++) {
+            parent.m_region = runion(parent.m_region,m_nodes[j + k].m_region);
+         }
+         m_nodes.push_back(parent);
+      }
+      begin = end;
+      end = (int)m_nodes.size();
+   }
+}
+
+void ShapeTree::intersecting(const QtRegion& region, pvecint& rows) const
+{
+   if (m_nodes.size() == 0 || !intersect_region(m_nodes.tail().m_region,region)) {
+      return;
+   }
+   // the root is the last node; the stack never holds more than FANOUT per level
+   int stack[FANOUT * 16];
+   int top = 0;
+   stack[top++] = (int)m_nodes.size() - 1;
+   while (top > 0) {
+      const Node& node = m_nodes[stack[--top]];
+      if (node.m_count == 0) {
+         rows.push_back(node.m_first);
+         continue;
+      }
+      for (int i = node.m_first; i < node.m_first + node.m_count; i++) {
+         if (intersect_region(m_nodes[i].m_region,region)) {
+            stack[top++] = i;
+         }
+      }
+   }
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 // SPECIALS BELOW
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
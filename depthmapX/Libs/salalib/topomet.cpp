@@ -21,13 +21,16 @@
 #include <time.h>
 #include <generic/paftl.h>
 #include <generic/comm.h>  // For communicator
+#include <generic/bucketqueue.h>
+#include <generic/brandes.h>
+#include <generic/parallel.h>
 
 #include <sala/mgraph.h> // purely for the version info --- as phased out should replace
 #include <sala/axialmap.h>
 
 #include "topomet.h"
 
-bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double radius, bool sel_only)
+bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double radius, bool sel_only, bool exact_choice)
 {
    bool retvar = true;
 
@@ -73,6 +76,8 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
    }
    pstring choicecol = prefix + pstring("Choice") + suffix;
    pstring wchoicecol = prefix + pstring("Choice [SLW]") + suffix;
+   pstring xchoicecol = prefix + pstring("Choice [Exact]") + suffix;
+   pstring wxchoicecol = prefix + pstring("Choice [Exact][SLW]") + suffix;
    pstring meandepthcol = prefix + pstring("Mean Depth") + suffix;
    pstring wmeandepthcol = prefix + pstring("Mean Depth [SLW]") + suffix;
    pstring totaldcol = prefix + pstring("Total Depth") + suffix;
@@ -82,6 +87,10 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
    if (!sel_only) {
       m_attributes.insertColumn(choicecol.c_str());
       m_attributes.insertColumn(wchoicecol.c_str());
+      if (exact_choice) {
+         m_attributes.insertColumn(xchoicecol.c_str());
+         m_attributes.insertColumn(wxchoicecol.c_str());
+      }
    }
    m_attributes.insertColumn(meandepthcol.c_str());
    m_attributes.insertColumn(wmeandepthcol.c_str());
@@ -92,6 +101,7 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
    unsigned int *seen = new unsigned int[getShapeCount()];
    TopoMetSegmentRef *audittrail = new TopoMetSegmentRef[getShapeCount()];
    TopoMetSegmentChoice *choicevals = new TopoMetSegmentChoice[getShapeCount()];
+   BucketQueue<int> list(maxbin);
    for (size_t cursor = 0; cursor < getShapeCount(); cursor++)
    {
       if (sel_only && !m_attributes.isSelected(cursor)) {
@@ -100,26 +110,14 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
       for (size_t i = 0; i < getShapeCount(); i++) {
          seen[i] = 0xffffffff;
       }
-      pvecint list[512]; // 512 bins!
-      int bin = 0;
-      list[bin].push_back(cursor);
+      list.clear();
+      list.push(0,cursor);
       double rootseglength = seglengths[cursor];
       audittrail[cursor] = TopoMetSegmentRef(cursor,Connector::SEG_CONN_ALL,rootseglength*0.5,-1);
-      int open = 1;
-      unsigned int segdepth = 0;
       double metdepth = 0.0, total = 0.0, wtotal = 0.0, wtotaldepth = 0.0, totalsegdepth = 0.0, totalmetdepth = 0.0;
-      while (open != 0) {
-         while (list[bin].size() == 0) {
-            bin++;
-            segdepth += 1;
-            if (bin == maxbin) {
-               bin = 0;
-            }
-         }
-         //
-         TopoMetSegmentRef& here = audittrail[list[bin].tail()];
-         list[bin].pop_back();
-         open--;
+      while (list.size() != 0) {
+         TopoMetSegmentRef& here = audittrail[list.pop()];
+         unsigned int segdepth = list.level();
          //
          if (here.done) {
             continue;
@@ -153,18 +151,16 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
                seen[connected_cursor] = segdepth;
                if (radius == -1 || here.dist + length < radius) {
                   // puts in a suitable bin ahead of us...
-                  open++;
-                  //
                   if (analysis_type == TOPOMET_METHOD_METRIC) {
                      // better to divide by 511 but have 512 bins...
-                     list[(bin + int(floor(0.5+511*length/maxseglength)))%512].push_back(connected_cursor);
+                     list.push(int(floor(0.5+511*length/maxseglength)),connected_cursor);
                   }
                   else {   // topological
                      if (axialrefs[here.ref] == axialref) {
-                        list[bin].push_back(connected_cursor);
+                        list.push(0,connected_cursor);
                      }
                      else {
-                        list[(bin+1)%2].push_back(connected_cursor);
+                        list.push(1,connected_cursor);
                         seen[connected_cursor] = segdepth + 1; // this is so if another node is connected directly to this one but is found later it is still handled -- note it can result in the connected cursor being added twice
                      }
                   }
@@ -227,6 +223,119 @@ bool ShapeGraph::analyseTopoMet(Communicator *comm, int analysis_type, double ra
    delete [] audittrail;
    delete [] choicevals;
 
+   if (!sel_only && exact_choice) {
+      // Exact choice counts every shortest route between each pair of segments (see
+      // brandes.h), with the same bins as costs as the search above.  As for choice,
+      // each pair is counted once, with the start and end segments included, but as
+      // the searches go from every segment, the routes both ways are counted and halved.
+      // n.b., a route is kept within the radius if its length to the middle of the root
+      // and the far end of the destination is no more than the radius
+      BrandesGraph graph;
+      for (size_t cursor = 0; cursor < getShapeCount(); cursor++) {
+         graph.addNode();
+         Connector& axline = m_connectors.at(cursor);
+         axline.first();
+         int connected_cursor = axline.cursor(Connector::SEG_CONN_ALL);
+         while (connected_cursor != -1) {
+            float length = seglengths[connected_cursor];
+            int cost;
+            if (analysis_type == TOPOMET_METHOD_METRIC) {
+               cost = int(floor(0.5+511*length/maxseglength));
+            }
+            else {
+               cost = (axialrefs[cursor] == axialrefs[connected_cursor]) ? 0 : 1;
+            }
+            graph.addEdge(connected_cursor, cost, length);
+            axline.next();
+            connected_cursor = axline.cursor(Connector::SEG_CONN_ALL);
+         }
+      }
+      int count = getShapeCount();
+
+      // each thread has its own totals, [count] choice then [count] weighted choice,
+      // added together in thread order
+      int thread_count = getThreadCount();
+      double **thread_exact = new double *[thread_count];
+      for (int t = 0; t < thread_count; t++) {
+         thread_exact[t] = NULL;
+      }
+
+      ParallelComm pcomm(comm, count);
+
+      #pragma omp parallel
+      {
+         BrandesSearch search(graph);
+         double *exact = new double [count * 2];
+         for (int j = 0; j < count * 2; j++) {
+            exact[j] = 0.0;
+         }
+         thread_exact[getThreadNum()] = exact;
+         double *pairweights = new double [count];
+
+         #pragma omp for schedule(static, 16)
+         for (int cursor = 0; cursor < count; cursor++) {
+
+            if (pcomm.isCancelled()) {
+               continue;
+            }
+
+            double rootseglength = seglengths[cursor];
+            double extent_limit = -1.0;
+            if (radius != -1.0) {
+               extent_limit = radius - rootseglength * 0.5;
+               if (extent_limit < 0.0) {
+                  extent_limit = 0.0;
+               }
+            }
+            search.start();
+            search.addRoot(cursor);
+            search.search(-1, extent_limit);
+
+            for (int n = 0; n < search.getReachedCount(); n++) {
+               int j = search.getReached(n);
+               pairweights[j] = rootseglength * seglengths[j];
+            }
+            search.accumulate(exact);
+            search.accumulate(exact + count, pairweights);
+            for (int n = 0; n < search.getReachedCount(); n++) {
+               int j = search.getReached(n);
+               if (j != cursor) {
+                  exact[cursor] += 1.0;
+                  exact[j] += 1.0;
+                  exact[count + cursor] += pairweights[j];
+                  exact[count + j] += pairweights[j];
+               }
+            }
+
+            pcomm.record();
+         }
+
+         delete [] pairweights;
+      }
+
+      if (!pcomm.isCancelled()) {
+         for (int cursor = 0; cursor < count; cursor++) {
+            double total_choice = 0.0, w_total_choice = 0.0;
+            for (int t = 0; t < thread_count; t++) {
+               if (thread_exact[t]) {
+                  total_choice += thread_exact[t][cursor];
+                  w_total_choice += thread_exact[t][count + cursor];
+               }
+            }
+            m_attributes.setValue(cursor,xchoicecol.c_str(),total_choice * 0.5);
+            m_attributes.setValue(cursor,wxchoicecol.c_str(),w_total_choice * 0.5);
+         }
+      }
+      for (int t = 0; t < thread_count; t++) {
+         if (thread_exact[t]) {
+            delete [] thread_exact[t];
+         }
+      }
+      delete [] thread_exact;
+
+      pcomm.throwIfCancelled();
+   }
+
    if (!sel_only) {
       setDisplayedAttribute(m_attributes.getColumnIndex(choicecol.c_str()));
    }
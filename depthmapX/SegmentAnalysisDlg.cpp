@@ -26,6 +26,7 @@ CSegmentAnalysisDlg::CSegmentAnalysisDlg(MetaGraph *graph, QWidget *parent)
 	m_tulip_bins = 0;
 	m_radius_type = -1;
 	m_choice = false;
+	m_exact_choice = false;
 	m_weighted = false;
 	m_attribute = -1;
 
@@ -43,6 +44,7 @@ CSegmentAnalysisDlg::CSegmentAnalysisDlg(MetaGraph *graph, QWidget *parent)
 				m_tulip_bins = mainWin->m_options.tulip_bins;
 			}
 			m_choice = mainWin->m_options.choice;
+			m_exact_choice = mainWin->m_options.exact_choice;
 			m_radius_type = mainWin->m_options.radius_type;
 			if ((int) mainWin->m_options.radius == -1) {
 				m_radius = QString("n");
@@ -70,6 +72,7 @@ void CSegmentAnalysisDlg::OnAnalysisType(bool value)
 	UpdateData(true);
 	c_tulip_bins->setEnabled(true);
 	c_choice->setEnabled(true);
+	c_exact_choice->setEnabled(true);
 	c_radius_type->setEnabled(true);
 	radioButton->setEnabled(true);
 	c_weighted->setEnabled(true);
@@ -81,6 +84,7 @@ void CSegmentAnalysisDlg::OnAnalysisTulip(bool value)
 	// actually, not tulip -- they're switched, this is on analyse angular!!
 	UpdateData(true);
 	m_choice = false;
+	m_exact_choice = false;
 	m_radius_type = 2;
 	m_analysis_type = 1;
 	m_weighted = false;
@@ -88,6 +92,7 @@ void CSegmentAnalysisDlg::OnAnalysisTulip(bool value)
 	UpdateData(false);
 	c_tulip_bins->setEnabled(false);
 	c_choice->setEnabled(false);
+	c_exact_choice->setEnabled(false);
 	c_radius_type->setEnabled(false);
 	radioButton->setEnabled(false);
 	c_weighted->setEnabled(false);
@@ -194,6 +199,7 @@ void CSegmentAnalysisDlg::OnOK()
 			}
 
 			mainWin->m_options.choice = m_choice;
+			mainWin->m_options.exact_choice = m_exact_choice;
 			mainWin->m_options.radius_type = m_radius_type;
 
 			if (m_analysis_type == 1) {
@@ -252,6 +258,10 @@ void CSegmentAnalysisDlg::UpdateData(bool value)
 			m_choice = true;
 		else
 			m_choice = false;
+		if (c_exact_choice->checkState())
+			m_exact_choice = true;
+		else
+			m_exact_choice = false;
 		if (c_weighted->checkState())
 			m_weighted = true;
 		else
@@ -293,6 +303,11 @@ void CSegmentAnalysisDlg::UpdateData(bool value)
 		else
 			c_choice->setCheckState(Qt::Unchecked);
 		
+		if (m_exact_choice)
+			c_exact_choice->setCheckState(Qt::Checked);
+		else
+			c_exact_choice->setCheckState(Qt::Unchecked);
+		
 		if (m_weighted)
 			c_weighted->setCheckState(Qt::Checked);
 		else
@@ -311,11 +326,13 @@ void CSegmentAnalysisDlg::showEvent(QShowEvent * event)
 
 	if (m_analysis_type == 1) {
 		m_choice = false;
+		m_exact_choice = false;
 		m_radius_type = 2;
 		m_weighted = false;
 		UpdateData(false);
 		c_tulip_bins->setEnabled(false);
 		c_choice->setEnabled(false);
+		c_exact_choice->setEnabled(false);
 		c_radius_type->setEnabled(false);
 		radioButton->setEnabled(false);
 		c_weighted->setEnabled(false);
@@ -324,6 +341,7 @@ void CSegmentAnalysisDlg::showEvent(QShowEvent * event)
 	else {
 		c_tulip_bins->setEnabled(true);
 		c_choice->setEnabled(true);
+		c_exact_choice->setEnabled(true);
 		c_radius_type->setEnabled(true);
 		radioButton->setEnabled(true);
 		c_weighted->setEnabled(true);
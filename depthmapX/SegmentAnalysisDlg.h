@@ -30,6 +30,7 @@ public:
 	int		m_tulip_bins;
 	int		m_radius_type;
 	bool	m_choice;
+	bool	m_exact_choice;
 	bool	m_weighted;
 	int		m_attribute;
 	void UpdateData(bool value);
@@ -22,6 +22,7 @@ CTopoMetDlg::CTopoMetDlg(QWidget *parent)
 	setupUi(this);
 	m_topological = 0;
 	m_selected_only = false;
+	m_exact_choice = false;
 	m_radius = tr("n");
 
 	UpdateData(false);
@@ -74,6 +75,10 @@ void CTopoMetDlg::UpdateData(bool value)
 			m_selected_only = true;
 		else
 			m_selected_only = false;
+		if (c_exact_choice->checkState())
+			m_exact_choice = true;
+		else
+			m_exact_choice = false;
 	}
 	else
 	{
@@ -93,6 +98,10 @@ void CTopoMetDlg::UpdateData(bool value)
 			checkBox->setCheckState(Qt::Checked);
 		else
 			checkBox->setCheckState(Qt::Unchecked);
+		if (m_exact_choice)
+			c_exact_choice->setCheckState(Qt::Checked);
+		else
+			c_exact_choice->setCheckState(Qt::Unchecked);
 	}
 }
 
@@ -24,6 +24,7 @@ public:
 	QString m_radius;
 	double m_dradius;
 	bool m_selected_only;
+	bool m_exact_choice;
 	void UpdateData(bool value);
 	void showEvent(QShowEvent * event);
 
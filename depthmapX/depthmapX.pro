@@ -45,6 +45,11 @@ HEADERS       = depthmapView.h \
     Libs/include/generic/p2dpoly.h \
     Libs/include/generic/dxfp.h \
     Libs/include/generic/comm.h \
+    Libs/include/generic/bucketqueue.h \
+    Libs/include/generic/filesection.h \
+    Libs/include/generic/lzblock.h \
+    Libs/include/generic/brandes.h \
+    Libs/include/generic/parallel.h \
     Libs/include/sala/vertex.h \
     Libs/include/sala/spacepix.h \
     Libs/include/sala/shapemap.h \
@@ -100,7 +105,9 @@ SOURCES       = depthmapView.cpp \
     AgentAnalysisDlg.cpp \
     AboutDlg.cpp \
 # genlib
+    Libs/genlib/brandes.cpp \
     Libs/genlib/dxfp.cpp \
+    Libs/genlib/lzblock.cpp \
     Libs/genlib/p2dpoly.cpp \
     Libs/genlib/pafmath.cpp \
     Libs/include/generic/xmlparse.cpp \
@@ -134,6 +141,11 @@ RESOURCES     = resource.qrc
 
 !win32:!macx:LIBS = -lGL -lGLU
 
+# the analyses are threaded with OpenMP (they still build and run serially without it)
+!win32:!macx:QMAKE_CXXFLAGS += -fopenmp
+!win32:!macx:QMAKE_LFLAGS += -fopenmp
+win32:QMAKE_CXXFLAGS += /openmp
+
 OTHER_FILES += \
     Libs/include/generic/lgpl.txt
 
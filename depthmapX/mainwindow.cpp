@@ -433,6 +433,15 @@ void MainWindow::OnToolsAgentRun()
     }
 }
 
+void MainWindow::OnEvoAgent()
+{
+    QGraphDoc* m_p = activeQDepthmapDoc();
+    if(m_p)
+    {
+        m_p->OnEvoAgent();
+    }
+}
+
 void MainWindow::OnToolsIsovistpath()
 {
     QGraphDoc* m_p = activeQDepthmapDoc();
@@ -1331,10 +1340,11 @@ void MainWindow::SetGraphTreeChecks()
             }
             else if (entry.m_subcat == -2) {
                 // the editable box
+                // (the map summaries are there without the maps being read in)
                 int editable = MetaGraph::NOT_EDITABLE;
                 switch (entry.m_type) {
                     case 0:
-                        if (graph->PointMaps::at(entry.m_cat).isProcessed()) {
+                        if (!graph->PointMaps::getMapSummary(entry.m_cat).m_editable) {
                             editable = MetaGraph::NOT_EDITABLE;
                         }
                         else {
@@ -1343,17 +1353,17 @@ void MainWindow::SetGraphTreeChecks()
                         break;
                     case 1:
                         {
-                            int type = graph->getShapeGraphs().getMap(entry.m_cat).getMapType();
-                            if (type == ShapeMap::SEGMENTMAP || type == ShapeMap::ALLLINEMAP) {
+                            MapSummary summary = graph->getShapeGraphs().getMapSummary(entry.m_cat);
+                            if (summary.m_type == ShapeMap::SEGMENTMAP || summary.m_type == ShapeMap::ALLLINEMAP) {
                                 editable = MetaGraph::NOT_EDITABLE;
                             }
                             else {
-                                editable = graph->getShapeGraphs().getMap(entry.m_cat).isEditable() ? MetaGraph::EDITABLE_ON : MetaGraph::EDITABLE_OFF;
+                                editable = summary.m_editable ? MetaGraph::EDITABLE_ON : MetaGraph::EDITABLE_OFF;
                             }
                         }
                         break;
                     case 2:
-                        editable = graph->getDataMaps().getMap(entry.m_cat).isEditable() ? MetaGraph::EDITABLE_ON : MetaGraph::EDITABLE_OFF;
+                        editable = graph->getDataMaps().getMapSummary(entry.m_cat).m_editable ? MetaGraph::EDITABLE_ON : MetaGraph::EDITABLE_OFF;
                         break;
                 }
                 switch (editable) {
@@ -1375,10 +1385,10 @@ void MainWindow::SetGraphTreeChecks()
                 // do not currently have layers supported
                 bool show = false;
                 if (entry.m_type == 1) {
-                    show = graph->getShapeGraphs().getMap(entry.m_cat).isLayerVisible(entry.m_subcat);
+                    show = graph->getShapeGraphs().getMapSummary(entry.m_cat).isLayerVisible(entry.m_subcat);
                 }
                 else if (entry.m_type == 2) {
-                    show = graph->getDataMaps().getMap(entry.m_cat).isLayerVisible(entry.m_subcat);
+                    show = graph->getDataMaps().getMapSummary(entry.m_cat).isLayerVisible(entry.m_subcat);
                 }
                 if (show) {
                       key->setCheckState(0, Qt::Checked);
@@ -1441,7 +1451,7 @@ void MainWindow::MakeGraphTree()
         }
         QTreeWidgetItem* hItem = m_treeroots[0]->child(0);
         for (size_t i = 0; i < m_treeDoc->m_meta_graph->PointMaps::size(); i++) {
-            QString name = QString(m_treeDoc->m_meta_graph->PointMaps::at(i).getName().c_str());
+            QString name = QString(m_treeDoc->m_meta_graph->PointMaps::getMapSummary(i).m_name.c_str());
             if (hItem == NULL) {
                 hItem = m_indexWidget->addNewFolder(name, m_treeroots[0]);
                 hItem->setCheckState(0, Qt::Unchecked);
@@ -1480,7 +1490,8 @@ void MainWindow::MakeGraphTree()
         }
         QTreeWidgetItem* hItem = m_treeroots[1]->child(0);
         for (size_t i = 0; i < m_treeDoc->m_meta_graph->getShapeGraphs().getMapCount(); i++) {
-            QString name = QString(m_treeDoc->m_meta_graph->getShapeGraphs().getMap(i).getName().c_str());
+            MapSummary summary = m_treeDoc->m_meta_graph->getShapeGraphs().getMapSummary(i);
+            QString name = QString(summary.m_name.c_str());
             if (hItem == NULL) {
                 hItem = m_indexWidget->addNewFolder(name, m_treeroots[1]);
                 hItem->setCheckState(0, Qt::Unchecked);
@@ -1495,9 +1506,8 @@ void MainWindow::MakeGraphTree()
             }
             else if (hItem->text(0) != name) hItem->setText(0, name);
             QTreeWidgetItem* hNewItem = hItem->child(0);
-            AttributeTable& table = m_treeDoc->m_meta_graph->getShapeGraphs().getMap(i).getAttributeTable();
-            for (int j = 0; j < table.getLayerCount(); j++) {
-                QString name = QString(table.getLayerName(j).c_str());
+            for (int j = 0; j < summary.getLayerCount(); j++) {
+                QString name = QString(summary.getLayerName(j).c_str());
                 if (hNewItem == NULL) {
                     hNewItem = m_indexWidget->addNewItem(name, 0);
                     ItemTreeEntry entry(1,(short)i,j);
@@ -1531,7 +1541,8 @@ void MainWindow::MakeGraphTree()
         }
         QTreeWidgetItem* hItem = m_treeroots[2]->child(0);
         for (size_t i = 0; i < m_treeDoc->m_meta_graph->getDataMaps().getMapCount(); i++) {
-            QString name = QString(m_treeDoc->m_meta_graph->getDataMaps().getMap(i).getName().c_str());
+            MapSummary summary = m_treeDoc->m_meta_graph->getDataMaps().getMapSummary(i);
+            QString name = QString(summary.m_name.c_str());
             if (hItem == NULL)
             {
                 hItem = m_indexWidget->addNewFolder(name, m_treeroots[2]);
@@ -1548,9 +1559,8 @@ void MainWindow::MakeGraphTree()
             else if (hItem->text(0) != name) hItem->setText(0, name);
 
             QTreeWidgetItem* hNewItem = hItem->child(0);
-            AttributeTable& table = m_treeDoc->m_meta_graph->getDataMaps().getMap(i).getAttributeTable();
-            for (int j = 0; j < table.getLayerCount(); j++) {
-                QString name = QString(table.getLayerName(j).c_str());
+            for (int j = 0; j < summary.getLayerCount(); j++) {
+                QString name = QString(summary.getLayerName(j).c_str());
                 if (hNewItem == NULL) {
                     hNewItem = m_indexWidget->addNewItem(name, 0);
                     hNewItem->setCheckState(0, Qt::Unchecked);
@@ -2263,12 +2273,20 @@ void MainWindow::updateAgentToolsSubMenu()
     if(!m_p)
     {
         runAgentAnalysisAct->setEnabled(0);
+        evolveAgentProgramsAct->setEnabled(0);
         loadAgentProgramAct->setEnabled(0);
         return;
     }
     if (m_p->m_meta_graph && m_p->m_meta_graph->viewingProcessedPoints() && !m_p->m_communicator)
+    {
         runAgentAnalysisAct->setEnabled(true);
-    else runAgentAnalysisAct->setEnabled(0);
+        evolveAgentProgramsAct->setEnabled(true);
+    }
+    else
+    {
+        runAgentAnalysisAct->setEnabled(0);
+        evolveAgentProgramsAct->setEnabled(0);
+    }
     if(current_view_type == VIEW_3D) loadAgentProgramAct->setEnabled(true);
     else loadAgentProgramAct->setEnabled(0);
 }
@@ -2890,6 +2908,10 @@ void MainWindow::createActions()
     runAgentAnalysisAct = new QAction(tr("&Run Agent Analysis"), this);
     connect(runAgentAnalysisAct, SIGNAL(triggered()), this, SLOT(OnToolsAgentRun()));
 
+    evolveAgentProgramsAct = new QAction(tr("&Evolve Agent Programs..."), this);
+    evolveAgentProgramsAct->setStatusTip(tr("Evolve agent programs against the agent analysis gate layer"));
+    connect(evolveAgentProgramsAct, SIGNAL(triggered()), this, SLOT(OnEvoAgent()));
+
     loadAgentProgramAct = new QAction(tr("&Load Agent Program"), this);
     connect(loadAgentProgramAct, SIGNAL(triggered()), this, SLOT(OnToolsAgentLoadProgram()));
 
@@ -3381,6 +3403,7 @@ void MainWindow::createMenus()
     visibilitySubMenu->addAction(convertDataMapLinesAct);
     agentToolsSubMenu = toolsMenu->addMenu(tr("&Agent Tools"));
     agentToolsSubMenu->addAction(runAgentAnalysisAct);
+    agentToolsSubMenu->addAction(evolveAgentProgramsAct);
     agentToolsSubMenu->addAction(loadAgentProgramAct);
 
     axialSubMenu = toolsMenu->addMenu(tr("A&xial / Convex / Pesh"));
@@ -192,6 +192,7 @@ private slots:
     void OnViewScatterplot();
     void OnToolsRun();
     void OnToolsAgentRun();
+    void OnEvoAgent();
 // MapView message
     void zoomModeTriggered();
     void FillModeTriggered();
@@ -386,6 +387,7 @@ private:
     QAction *angularStepAct;
     QAction *convertDataMapLinesAct;
     QAction *runAgentAnalysisAct;
+    QAction *evolveAgentProgramsAct;
     QAction *loadAgentProgramAct;
     QAction *runGraphAnaysisAct;
     QAction *stepDepthAct;
@@ -437,6 +437,13 @@ void RenderThread::run()
          }
          break;
 
+      case CMSCommunicator::AGENTEVOLUTION:
+         {
+            // the best program is saved as it goes, so nothing on the map changes
+            pDoc->m_meta_graph->runAgentEvolution( comm, comm->GetOption(0), (unsigned int) comm->GetOption(1), pstring(comm->GetString().toAscii()) );
+         }
+         break;
+
       case CMSCommunicator::BINDISPLAY:
          {
             // Set up for options metric point depth selection